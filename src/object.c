@@ -29,6 +29,7 @@
 
 #include <stdio.h>
 #include <limits.h>
+#include <ctype.h>
 #include <stdarg.h>
 #include <string.h>
 #include <stdbool.h>
@@ -37,6 +38,7 @@
 #include <murmurhash3.h>
 #include <libobjectconfig.h>
 #include <object.h>
+#include <object_private.h>
 
 typedef struct MutableString {
         size_t length;
@@ -61,24 +63,6 @@ while(0)
 } \
 while(0)
 
-#define RETURN_ON_NULL(o) do { \
-	if(o == NULL) { \
-		fprintf(get_debug_fp(), "%s():%s:%d caught a NULL pointer\n", __FILE__, \
-			__FUNCTION__, __LINE__); \
-		return NULL; \
-	} \
-} \
-while(0)
-
-#define BUG_ON_NULL(o) do { \
-	if(o == NULL) { \
-		fprintf(get_debug_fp(), "%s:%s:%d caught a NULL pointer!\n", __FILE__, \
-			__FUNCTION__, __LINE__); \
-		exit(EXIT_FAILURE); \
-	} \
-} \
-while(0)
-
 /*
  * Safe sanity checker
  */
@@ -101,12 +85,13 @@ static const char *const ObjectPrettyTypeLiteral[] = {
 	"object",
 	"function",
 	"pair",
-	"pointer"
+	"pointer",
+	"bytes"
 };
 
 static FILE* debug_fp = NULL;
 
-static FILE* get_debug_fp(void)
+FILE* get_debug_fp(void)
 {
 	if(!debug_fp) return stderr;
 	return debug_fp;
@@ -141,6 +126,21 @@ LIBOBJECT_API const char* libObjectVersion(void)
 	return LIB_OBJECT_VERSION;
 }
 
+/*
+ * compare two String instances by their bytes, a shorter String that is a
+ * prefix of a longer one orders first. Embedded NUL bytes are significant
+ */
+static int stringCompare(String* left, String* right)
+{
+	size_t n = left->length < right->length ? left->length : right->length;
+	int result = memcmp(left->value, right->value, n);
+	if(result != 0)
+		return result;
+	if(left->length == right->length)
+		return 0;
+	return left->length < right->length ? -1 : 1;
+}
+
 LIBOBJECT_API int objectValueTypeCompare(Object* left, Object* right)
 {
 	GUARDED_REQUIRE(left,  NULL, 0);
@@ -174,7 +174,10 @@ LIBOBJECT_API int objectValueIsLessThan(Object* left, Object* right)
 				return O_DVAL(left) < O_DVAL(right);
 			break;
 			case IS_STRING:
-				return strcmp(O_SVAL(left)->value, O_SVAL(right)->value) < 0;	
+				return stringCompare(O_SVAL(left), O_SVAL(right)) < 0;
+			break;
+			case IS_BYTES:
+				return stringCompare(O_BYVAL(left), O_BYVAL(right)) < 0;	
 			break;
 			default:
 				return 0;
@@ -208,7 +211,10 @@ LIBOBJECT_API int objectValueIsGreaterThan(Object* left, Object* right)
 				return O_DVAL(left) > O_DVAL(right);
 			break;
 			case IS_STRING:
-				return strcmp(O_SVAL(left)->value, O_SVAL(right)->value) > 0;	
+				return stringCompare(O_SVAL(left), O_SVAL(right)) > 0;
+			break;
+			case IS_BYTES:
+				return stringCompare(O_BYVAL(left), O_BYVAL(right)) > 0;	
 			break;
 			default:
 				return 0;
@@ -233,8 +239,8 @@ LIBOBJECT_API int objectValueCompare(Object* left, Object* right)
 				return 1;
 			break;
 			case IS_BOOL:
-			  return 0;
-      break;
+				return !O_BVAL(left) == !O_BVAL(right);
+			break;
 			case IS_LONG:
 				return O_LVAL(left) == O_LVAL(right);
 			break;
@@ -242,7 +248,10 @@ LIBOBJECT_API int objectValueCompare(Object* left, Object* right)
 				return O_DVAL(left) == O_DVAL(right);
 			break;
 			case IS_STRING:
-				return strcmp(O_SVAL(left)->value, O_SVAL(right)->value) == 0;	
+				return stringCompare(O_SVAL(left), O_SVAL(right)) == 0;
+			break;
+			case IS_BYTES:
+				return stringCompare(O_BYVAL(left), O_BYVAL(right)) == 0;	
 			break;
 			default:
 				return 0;
@@ -257,11 +266,14 @@ LIBOBJECT_API Object* newNumberFromCharArray(const char* text)
 {
 	GUARDED_REQUIRE(text, NULL, NULL);
 
-	double dval;
+	Object* number;
 
-	dval = strtod(text, NULL);
-	
-	return newDouble(dval);
+	/* like strtod(), skip leading space and read text without a number as 0 */
+	while(isspace((unsigned char)*text))
+		text++;
+	if(parseNumber(text, strlen(text), &number) == 0)
+		return newDouble(0.0);
+	return number;
 }
 
 LIBOBJECT_API char *objectToStringLength(Object *this, size_t *len)
@@ -294,18 +306,13 @@ LIBOBJECT_API char *objectToStringLength(Object *this, size_t *len)
 			buffer[length] = '\0';
 		}
 		break;
-		case IS_LONG: {
-			buffer = malloc(32);
-			BUG_ON_NULL(buffer);
-			snprintf(buffer, 32, "%ld", O_LVAL(this));
-			length = strlen(buffer);	
-		}
-		break;
+		case IS_LONG:
 		case IS_DOUBLE: {
-			buffer = malloc(32);
+			char number[OBJECT_SCALAR_BUFFER_SIZE];
+			length = objectFormatScalar(this, number);
+			buffer = malloc(length + 1);
 			BUG_ON_NULL(buffer);
-			snprintf(buffer, 32, "%.*G", DBL_DIG, O_DVAL(this));
-			length = strlen(buffer);
+			memcpy(buffer, number, length + 1);
 		}
 		break;
 		case IS_STRING: {
@@ -338,6 +345,15 @@ LIBOBJECT_API char *objectToStringLength(Object *this, size_t *len)
 			buffer[length] = '\0';
 		}
 		break;
+		case IS_BYTES: {
+			const char* bytes = "[object Bytes]";
+			length = sizeof("[object Bytes]") -1;
+			buffer = malloc(length + 1);
+			BUG_ON_NULL(buffer);
+			memcpy(buffer, bytes, length);
+			buffer[length] = '\0';
+		}
+		break;
 		case IS_OBJECT:
 		case IS_PAIR:
 		case IS_POINTER:
@@ -384,16 +400,13 @@ LIBOBJECT_API char* objectToString(Object* this)
 			buffer[length] = '\0';
 		}
 		break;
-		case IS_LONG: {
-			buffer = malloc(32);
-			BUG_ON_NULL(buffer);
-			snprintf(buffer, 32, "%ld", O_LVAL(this));	
-		}
-		break;
+		case IS_LONG:
 		case IS_DOUBLE: {
-			buffer = malloc(32);
+			char number[OBJECT_SCALAR_BUFFER_SIZE];
+			size_t length = objectFormatScalar(this, number);
+			buffer = malloc(length + 1);
 			BUG_ON_NULL(buffer);
-			snprintf(buffer, 32, "%.*G", DBL_DIG, O_DVAL(this));
+			memcpy(buffer, number, length + 1);
 		}
 		break;
 		case IS_STRING: {
@@ -425,6 +438,15 @@ LIBOBJECT_API char* objectToString(Object* this)
 			buffer[length] = '\0';
 		}
 		break;
+		case IS_BYTES: {
+			const char* bytes = "[object Bytes]";
+			size_t length = sizeof("[object Bytes]") -1;
+			buffer = malloc(length + 1);
+			BUG_ON_NULL(buffer);
+			memcpy(buffer, bytes, length);
+			buffer[length] = '\0';
+		}
+		break;
 		case IS_OBJECT:
 		case IS_PAIR:
 		case IS_POINTER:
@@ -453,14 +475,14 @@ LIBOBJECT_API uint32_t stringHash(const char* source, size_t length)
 	return hash;
 }
 
-static Object*	newObject(ObjectType);
 static Map*	newMapInstance(uint32_t);
 static String*	newStringInstance(const char*);
+static String*	newStringInstanceLength(const char*, size_t);
 static Array*	newArrayInstance(size_t);
 static int	arrayResize(Array*);
 static Object*	arrayRealGet(Array*, size_t);
 
-static Object* newObject(ObjectType type)
+Object* newObject(ObjectType type)
 {
 	Object* object = ALLOCATE(Object);
 	if(object == NULL) 
@@ -590,86 +612,307 @@ LIBOBJECT_API Object* newMap(uint32_t size)
 	return object;
 }
 
-LIBOBJECT_API Object* copyObject(Object* o)
+/*
+ * copyObject(), objectSafeDestroy() and objectFreeze() walk trees with a
+ * stack of frames instead of recursing, so nesting is only limited by
+ * memory. The first frames live on the C stack. A container with at least
+ * OBJECT_PARALLEL_CHILDREN children has them copied or destroyed on the
+ * pool of object_pool.c, a subtree to each call, when the pool has more
+ * than one thread
+ */
+#define OBJECT_WALK_FRAMES		32
+#define OBJECT_PARALLEL_CHILDREN	4096
+
+#define objectIsWalked(o) \
+	((O_TYPE(o) == IS_ARRAY || O_TYPE(o) == IS_MAP || O_TYPE(o) == IS_PAIR) && \
+	!(O_FLG(o) & OBJECT_FLAG_LAZY))
+
+#define objectIsWide(o) \
+	((O_TYPE(o) == IS_ARRAY && O_AVAL(o)->size >= OBJECT_PARALLEL_CHILDREN) || \
+	(O_TYPE(o) == IS_MAP && O_MVAL(o)->size >= OBJECT_PARALLEL_CHILDREN))
+
+/*
+ * make room for one more frame, moving off the C stack when the local
+ * frames run out. 0 when out of memory
+ */
+static int objectWalkGrow(void** stack, void* local, size_t* capacity, size_t depth, size_t size)
+{
+	void* grown;
+
+	if(depth < *capacity)
+		return 1;
+	if(*stack == local) {
+		grown = malloc(2 * *capacity * size);
+		if(grown != NULL)
+			memcpy(grown, local, depth * size);
+	} else {
+		grown = realloc(*stack, 2 * *capacity * size);
+	}
+	if(grown == NULL)
+		return 0;
+	*stack = grown;
+	*capacity *= 2;
+	return 1;
+}
+
+/*
+ * a copy of o without its children, which the walk fills in. A lazy
+ * container is copied whole, sharing the source text
+ */
+static Object* copyShell(Object* o)
 {
-	if(o == NULL) return NULL;
 	Object* ret;
+
+	if(O_FLG(o) & OBJECT_FLAG_LAZY)
+		return jsonLazyCopy(o);
 	switch(O_TYPE(o)) {
 		case IS_POINTER:
 			ret = newPointer(O_PTVAL(o));
-			O_MRKD(ret) = O_MRKD(o);
-			O_FLG(ret) = O_FLG(o);
 		break;
 		case IS_FUNCTION:
 			ret = newFunction(O_FVAL(o));
-			O_MRKD(ret) = O_MRKD(o);
-			O_FLG(ret) = O_FLG(o);
 		break;
 		case IS_PAIR:
-			ret = newPair(O_PVAL(o)->first, O_PVAL(o)->second);
-			O_MRKD(ret) = O_MRKD(o);
-			O_FLG(ret) = O_FLG(o);
+			ret = newObject(IS_PAIR);
+			if(ret != NULL && (O_PVAL(ret) = calloc(1, sizeof(Pair))) == NULL) {
+				free(ret);
+				ret = NULL;
+			}
 		break;
 		case IS_NULL:
 			ret = newNull();
-			O_MRKD(ret) = O_MRKD(o);
-			O_FLG(ret) = O_FLG(o);
 		break;
 		case IS_BOOL:
 			ret = newBool(O_BVAL(o));
-			O_MRKD(ret) = O_MRKD(o);
-			O_FLG(ret) = O_FLG(o);
 		break;
 		case IS_LONG: 
 			ret = newLong(O_LVAL(o));
-			O_MRKD(ret) = O_MRKD(o);
-			O_FLG(ret) = O_FLG(o);
 		break;
 		case IS_DOUBLE:
 			ret = newDouble(O_DVAL(o));
-			O_MRKD(ret) = O_MRKD(o);
-			O_FLG(ret) = O_FLG(o);
 		break;
 		case IS_STRING: {
 			String* str = O_SVAL(o);
-			ret = newString(str->value);
-			O_MRKD(ret) = O_MRKD(o);
-			O_FLG(ret) = O_FLG(o);
+			if(str->flags & STRING_FLAG_STATIC)
+				ret = newStringStatic(str->value, str->length);
+			else
+				ret = newStringFromSequence(str->value, str->length);
+			if(ret == NULL)
+				break;
+			O_SVAL(ret)->flags |= str->flags &
+				(STRING_FLAG_UTF8 | STRING_FLAG_COUNTED | STRING_FLAG_ASCII | STRING_FLAG_HASHED);
+			O_SVAL(ret)->codepoints = str->codepoints;
+			O_SVAL(ret)->hash = str->hash;
 		}
 		break;
-		case IS_ARRAY: {
-			size_t i;
+		case IS_BYTES:
+			ret = newBytes(O_BYVAL(o)->value, O_BYVAL(o)->length);
+		break;
+		case IS_ARRAY:
 			ret = newArray(O_AVAL(o)->capacity);
-			O_MRKD(ret) = O_MRKD(o);
-			O_FLG(ret) = O_FLG(o);
-			for(i = 0; i < O_AVAL(o)->size; i++) {
-				Object* value = arrayRealGet(O_AVAL(o), i);
-				arrayPush(ret, value);
-			}
-		}
 		break;
-		case IS_MAP: {
-			uint32_t i;
+		case IS_MAP:
 			ret = newMap(O_MVAL(o)->capacity);
-			O_MRKD(ret) = O_MRKD(o);
-			O_FLG(ret) = O_FLG(o);
-			for(i = 0; i < O_MVAL(o)->capacity; i++) {
-				Bucket* b = mapGetBucket(o, i);
-				while(b != NULL) {
-					Object* value = b->value;
-					mapInsert(ret, b->key->value, value);
-					b = b->next;
-				}
-			}
-		}
 		break;
 		default: 
 			return NULL;
 		break;
 	}
+	if(ret == NULL)
+		return NULL;
+	O_MRKD(ret) = O_MRKD(o);
+	O_FLG(ret) = O_FLG(o) & ~OBJECT_FLAG_FROZEN;
+	return ret;
+}
+
+/*
+ * append a bucket for key to the chain ending at *tail, its value left for
+ * the caller. NULL when out of memory
+ */
+static Bucket* copyBucket(Bucket*** tail, Bucket* key)
+{
+	Bucket* b = ALLOCATE(Bucket);
+
+	if(b == NULL)
+		return NULL;
+	if((b->key = newStringInstanceLength(key->key->value, key->key->length)) == NULL) {
+		free(b);
+		return NULL;
+	}
+	b->value = NULL;
+	b->__notUsed = 0;
+	b->hash = key->hash;
+	b->next = NULL;
+	**tail = b;
+	*tail = &b->next;
+	return b;
+}
+
+typedef struct CopyFrame {
+	Object*		src;
+	Object*		dst;
+	size_t		i;	/* next index, bucket or half of a pair */
+	Bucket*		b;	/* next bucket in the chain of bucket i - 1 */
+	Bucket**	tail;	/* where its copy goes */
+} CopyFrame;
+
+/*
+ * the next child of f->src and the slot in f->dst its copy goes in. 0
+ * once there are none left, -1 when out of memory
+ */
+static int copyNext(CopyFrame* f, Object** child, Object*** slot)
+{
+	Object* src = f->src;
+	Object* dst = f->dst;
+
+	switch(O_TYPE(src)) {
+		case IS_PAIR:
+			if(f->i == 2)
+				return 0;
+			*child = f->i == 0 ? O_PVAL(src)->first : O_PVAL(src)->second;
+			*slot = f->i == 0 ? &O_PVAL(dst)->first : &O_PVAL(dst)->second;
+			f->i++;
+		return 1;
+		case IS_ARRAY:
+			if(f->i == O_AVAL(src)->size)
+				return 0;
+			*child = O_AVAL(src)->table[f->i];
+			*slot = &O_AVAL(dst)->table[f->i];
+			/* a copy cut short is still a whole Array */
+			O_AVAL(dst)->size = O_AVAL(dst)->nextIndex = ++f->i;
+		return 1;
+		case IS_MAP: {
+			Bucket* b;
+			while(f->b == NULL) {
+				if(f->i == O_MVAL(src)->capacity)
+					return 0;
+				f->tail = &O_MVAL(dst)->buckets[f->i];
+				f->b = O_MVAL(src)->buckets[f->i++];
+			}
+			if((b = copyBucket(&f->tail, f->b)) == NULL)
+				return -1;
+			O_MVAL(dst)->size++;
+			*child = f->b->value;
+			*slot = &b->value;
+			f->b = f->b->next;
+		}
+		return 1;
+		default:
+		return 0;
+	}
+}
+
+static int copyChildren(Object*, Object*);
+
+static Object* objectWalkCopy(Object* root)
+{
+	CopyFrame local[OBJECT_WALK_FRAMES];
+	void* stack = local;
+	size_t depth = 0, capacity = OBJECT_WALK_FRAMES;
+	Object* ret = NULL;
+	Object** slot = &ret;
+	Object* o = root;
+	int more = 1;
+
+	while(more > 0) {
+		if(o != NULL) {
+			Object* copy = copyShell(o);
+			if((*slot = copy) == NULL) {
+				more = -1;
+				break;
+			}
+			if(objectIsWalked(o) && objectIsWide(o) && poolThreads() > 1) {
+				if(!copyChildren(o, copy)) {
+					more = -1;
+					break;
+				}
+			} else if(objectIsWalked(o)) {
+				if(!objectWalkGrow(&stack, local, &capacity, depth, sizeof(CopyFrame))) {
+					more = -1;
+					break;
+				}
+				CopyFrame* f = &((CopyFrame*)stack)[depth++];
+				memset(f, 0, sizeof(*f));
+				f->src = o;
+				f->dst = copy;
+			}
+		}
+		/* the next child, finishing containers on the way */
+		while(depth > 0 && (more = copyNext(&((CopyFrame*)stack)[depth - 1], &o, &slot)) == 0)
+			depth--;
+		if(depth == 0)
+			more = 0;
+	}
+	if(stack != local)
+		free(stack);
+	if(more < 0) {
+		fprintf(get_debug_fp(), "%s(): out of memory\n", __func__);
+		objectSafeDestroy(ret, NULL);
+		return NULL;
+	}
 	return ret;
 }
 
+typedef struct CopyJob {
+	Object*		src;
+	Object*		dst;
+	int		failed;
+} CopyJob;
+
+/*
+ * each range fills its own slots, or its own buckets' chains
+ */
+static void copyRange(void* context, size_t begin, size_t end)
+{
+	CopyJob* job = context;
+	size_t i;
+
+	for(i = begin; i < end; i++) {
+		if(O_TYPE(job->src) == IS_ARRAY) {
+			Object* value = O_AVAL(job->src)->table[i];
+			if(value != NULL &&
+				(O_AVAL(job->dst)->table[i] = objectWalkCopy(value)) == NULL)
+				__atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+		} else {
+			Bucket** tail = &O_MVAL(job->dst)->buckets[i];
+			Bucket* b;
+			Bucket* copy;
+			uint32_t size = 0;
+			for(b = O_MVAL(job->src)->buckets[i]; b != NULL; b = b->next) {
+				if((copy = copyBucket(&tail, b)) == NULL) {
+					__atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+					break;
+				}
+				size++;
+				if(b->value != NULL && (copy->value = objectWalkCopy(b->value)) == NULL) {
+					__atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+					break;
+				}
+			}
+			__atomic_add_fetch(&O_MVAL(job->dst)->size, size, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+static int copyChildren(Object* src, Object* dst)
+{
+	CopyJob job = { src, dst, 0 };
+
+	if(O_TYPE(src) == IS_ARRAY) {
+		poolParallel(copyRange, &job, O_AVAL(src)->size, 0);
+		O_AVAL(dst)->size = O_AVAL(dst)->nextIndex = O_AVAL(src)->size;
+	} else {
+		poolParallel(copyRange, &job, O_MVAL(src)->capacity, 0);
+	}
+	return !job.failed;
+}
+
+LIBOBJECT_API Object* copyObject(Object* o)
+{
+	if(o == NULL) return NULL;
+	return objectWalkCopy(o);
+}
+
 static int mapTryResize(Map* map)
 {
 	BUG_ON_NULL(map);
@@ -721,54 +964,51 @@ static int mapTryResize(Map* map)
 	return 1;
 }
 
-static void mapRealDelete(Map* map, String* key, uint32_t hash)
+/*
+ * remove the bucket holding key from its chain and return it, NULL if
+ * there is none
+ */
+static Bucket* mapUnlink(Map* map, const char* key, size_t length, uint32_t hash)
 {
-	uint32_t index = hash % map->capacity;
-	Bucket* b = map->buckets[index];
-	Bucket* head = map->buckets[index];
-	while(b != NULL) {
-		Bucket* next = b->next;
-		if((b->hash == hash) && 
-			(key->length == b->key->length) &&
-			((memcmp(b->key->value, key->value, b->key->length)) == 0))
-		{	
-			/* first node */
-			if(b == map->buckets[index]) { 
-				if(b->next == NULL) {
-					map->buckets[index] = NULL;
-					map->size = map->size-1;
-					free(b->key->value);
-					free(b->key);
-					objectSafeDestroy(b->value, NULL);
-					free(b);
-					return;
-				} else {
-					Bucket* bb = b->next;
-					map->size = map->size-1;
-					free(b->key->value);
-					free(b->key);
-					objectSafeDestroy(b->value, NULL);
-					free(b);
-					map->buckets[index] = bb;
-					return;
-				}
-			} else {
-				/* get the element before the current element */
-				while(head->next != NULL && head->next != b) {
-					head = head->next;
-				}
-				head->next = head->next->next;
-				map->buckets[index] = head;
-				map->size = map->size-1;
-				free(b->key->value);
-				free(b->key);
-				objectSafeDestroy(b->value, NULL);
-				free(b);
-				return;
-			}
+	Bucket** link = &map->buckets[hash % map->capacity];
+
+	for(; *link != NULL; link = &(*link)->next) {
+		Bucket* b = *link;
+		if(b->hash == hash && b->key->length == length &&
+			memcmp(b->key->value, key, length) == 0) {
+			*link = b->next;
+			map->size--;
+			return b;
 		}
-		b = next;
 	}
+	return NULL;
+}
+
+static void mapRealDelete(Map* map, String* key, uint32_t hash)
+{
+	Bucket* b = mapUnlink(map, key->value, key->length, hash);
+	if(b != NULL) {
+		stringInstanceFree(b->key);
+		objectSafeDestroy(b->value, NULL);
+		free(b);
+	}
+}
+
+Object* mapTakeHashed(Object* map, const char* key, size_t length, uint32_t hash)
+{
+	if(O_FLG(map) & OBJECT_FLAG_FROZEN)
+		return NULL;
+	if(!objectLoad(map))
+		return NULL;
+	Bucket* b = mapUnlink(O_MVAL(map), key, length, hash);
+	Object* value;
+
+	if(b == NULL)
+		return NULL;
+	value = b->value;
+	stringInstanceFree(b->key);
+	free(b);
+	return value;
 }
 
 LIBOBJECT_API void mapDelete(Object* object, const char* pkey)
@@ -779,12 +1019,17 @@ LIBOBJECT_API void mapDelete(Object* object, const char* pkey)
 		fprintf(get_debug_fp(), "%s(): Object passed must be an instance of Map\n", __func__);
 		return;
 	}
+	if(O_FLG(object) & OBJECT_FLAG_FROZEN) {
+		fprintf(get_debug_fp(), "%s(): Object is frozen\n", __func__);
+		return;
+	}
+	if(!objectLoad(object))
+		return;
 
 	String* key = newStringInstance(pkey);
 	uint32_t hash = stringHash(key->value, key->length);
 	mapRealDelete(O_MVAL(object), key, hash);
-	free(key->value);
-	free(key);
+	stringInstanceFree(key);
 }
 
 LIBOBJECT_API void object_print_stats(Object *o) {
@@ -800,6 +1045,12 @@ LIBOBJECT_API uint32_t mapInsertEx(Object* map, const char* key, Object* value)
 		fprintf(get_debug_fp(), "%s(): Object passed must be an instance of Map\n", __func__);
 		return 0;
 	}
+	if(O_FLG(map) & OBJECT_FLAG_FROZEN) {
+		fprintf(get_debug_fp(), "%s(): Object is frozen\n", __func__);
+		return 0;
+	}
+	if(!objectLoad(map))
+		return 0;
 	if(O_MVAL(map)->size >= O_MVAL(map)->capacity) {
 		int status;
 		if((status = mapTryResize(O_MVAL(map))) == 0) {
@@ -823,8 +1074,7 @@ LIBOBJECT_API uint32_t mapInsertEx(Object* map, const char* key, Object* value)
 
 			bucket->value = value_copy;		
 			/* not used if it exists already */
-			free(keyObject->value);
-			free(keyObject);
+			stringInstanceFree(keyObject);
 			return hash;
 		}
 		bucket = bucket->next;
@@ -851,6 +1101,12 @@ LIBOBJECT_API uint32_t mapInsert(Object* map, const char* key, Object* value)
 		fprintf(get_debug_fp(), "%s(): Object passed must be an instance of Map\n", __func__);
 		return 0;
 	}
+	if(O_FLG(map) & OBJECT_FLAG_FROZEN) {
+		fprintf(get_debug_fp(), "%s(): Object is frozen\n", __func__);
+		return 0;
+	}
+	if(!objectLoad(map))
+		return 0;
 	if(O_MVAL(map)->size >= O_MVAL(map)->capacity) {
 		int status;
 		if((status = mapTryResize(O_MVAL(map))) == 0) {
@@ -878,8 +1134,7 @@ LIBOBJECT_API uint32_t mapInsert(Object* map, const char* key, Object* value)
 			//objectSafeDestroy(oldValue, NULL);
 			bucket->value = value_copy;		
 			/* not used if it exists already */
-			free(keyObject->value);
-			free(keyObject);
+			stringInstanceFree(keyObject);
 			return hash;
 		}
 		bucket = bucket->next;
@@ -897,16 +1152,60 @@ LIBOBJECT_API uint32_t mapInsert(Object* map, const char* key, Object* value)
 	return hash;
 }
 
+int mapInsertString(Object* map, String* key, uint32_t hash, Object* value)
+{
+	BUG_ON_NULL(map);
+	if(O_FLG(map) & OBJECT_FLAG_FROZEN)
+		return 0;
+	if(!objectLoad(map))
+		return 0;
+	if(O_MVAL(map)->size >= O_MVAL(map)->capacity) {
+		if(!mapTryResize(O_MVAL(map))) {
+			fprintf(get_debug_fp(), "%s(): failed to resize table\n", __func__);
+			return 0;
+		}
+	}
+
+	uint32_t bucket_index = (hash % O_MVAL(map)->capacity);
+	Bucket* bucket = O_MVAL(map)->buckets[bucket_index];
+	while(bucket != NULL) {
+		if((bucket->hash == hash) &&
+			(key->length == bucket->key->length) &&
+			((memcmp(bucket->key->value, key->value, key->length)) == 0))
+		{
+			objectSafeDestroy(bucket->value, NULL);
+			bucket->value = value;
+			stringInstanceFree(key);
+			return 1;
+		}
+		bucket = bucket->next;
+	}
+
+	bucket = ALLOCATE(Bucket);
+	if(bucket == NULL)
+		return 0;
+	bucket->key = key;
+	bucket->value = value;
+	bucket->hash = hash;
+	bucket->next = O_MVAL(map)->buckets[bucket_index];
+	O_MVAL(map)->buckets[bucket_index] = bucket;
+	O_MVAL(map)->size++;
+
+	return 1;
+}
+
 LIBOBJECT_API uint32_t mapSize(Object* object)
 {
 	BUG_ON_NULL(object);
+	if(!objectLoad(object))
+		return 0;
 	return O_MVAL(object)->size;
 }
 
 LIBOBJECT_API uint32_t mapCapacity(Object* object)
 {
 	BUG_ON_NULL(object);
-	if(O_TYPE(object) != IS_MAP) {
+	if(O_TYPE(object) != IS_MAP || !objectLoad(object)) {
 		return 0;
 	}
 	return O_MVAL(object)->capacity;
@@ -915,6 +1214,8 @@ LIBOBJECT_API uint32_t mapCapacity(Object* object)
 LIBOBJECT_API Bucket* mapGetBucket(Object* object, uint32_t index)
 {
 	BUG_ON_NULL(object);
+	if(!objectLoad(object))
+		return NULL;
 	Map* map = O_MVAL(object);
 	
 	return index < map->capacity ? map->buckets[index] : NULL;
@@ -927,6 +1228,8 @@ LIBOBJECT_API Bucket* mapGetBucket(Object* object, uint32_t index)
 LIBOBJECT_API Object* mapSearch(Object* map, const char* key)
 {
 	BUG_ON_NULL(map);
+	if(!objectLoad(map))
+		return NULL;
 	size_t key_length = strlen(key);	
 	uint32_t hash = stringHash(key, key_length);
 	uint32_t bucket_index = (hash % O_MVAL(map)->capacity);
@@ -949,6 +1252,8 @@ LIBOBJECT_API Object* mapSearch(Object* map, const char* key)
 LIBOBJECT_API Object* mapSearchEx(Object* map, const char* key)
 {
 	BUG_ON_NULL(map);
+	if(!objectLoad(map))
+		return NULL;
 	size_t key_length = strlen(key);	
 	uint32_t hash = stringHash(key, key_length);
 	uint32_t bucket_index = (hash % O_MVAL(map)->capacity);
@@ -967,6 +1272,20 @@ LIBOBJECT_API Object* mapSearchEx(Object* map, const char* key)
 
 	return NULL;
 }
+Object* mapSearchHashed(Object* map, const char* key, size_t length, uint32_t hash)
+{
+	if(!objectLoad(map))
+		return NULL;
+	Bucket* bucket = O_MVAL(map)->buckets[hash % O_MVAL(map)->capacity];
+
+	for(; bucket != NULL; bucket = bucket->next) {
+		if(bucket->hash == hash && bucket->key->length == length &&
+			memcmp(bucket->key->value, key, length) == 0)
+			return bucket->value;
+	}
+	return NULL;
+}
+
 /*
  * @hash the hashed string value
  * this doesn't work if two keys hash to the same value
@@ -974,6 +1293,8 @@ LIBOBJECT_API Object* mapSearchEx(Object* map, const char* key)
 LIBOBJECT_API Object* mapGetValueByHash(Object* map, uint32_t hash)
 {
 	BUG_ON_NULL(map);	
+	if(!objectLoad(map))
+		return NULL;
 	uint32_t bucket_index = (hash % O_MVAL(map)->capacity);
 	Bucket* bucket = O_MVAL(map)->buckets[bucket_index];
 	
@@ -986,50 +1307,92 @@ LIBOBJECT_API Object* mapGetValueByHash(Object* map, uint32_t hash)
 
 	return NULL;
 }
-static String* newStringInstance(const char* source)
+static void stringInstanceInit(String* string, char* value, size_t length,
+	unsigned int flags, StringReleaseFunction release, void* context)
 {
-	BUG_ON_NULL(source);	
-	String* string = ALLOCATE(String);
-	BUG_ON_NULL(string);
-	size_t length = strlen(source);
 	string->length = length;
-	string->value = malloc(sizeof(char) * length + 1);
-	BUG_ON_NULL(string->value);
-	size_t i;
-	for(i = 0; i < length; i++) {
-		string->value[i] = source[i];
-	}
+	string->value = value;
+	string->flags = flags;
+	string->release = release;
+	string->context = context;
+	string->codepoints = 0;
+	string->index = NULL;
+	string->hash = 0;
+}
 
+/*
+ * allocate a String with room for length bytes and a NUL in the same
+ * block, value is left for the caller to fill in
+ */
+String* newStringInstanceBuffer(size_t length)
+{
+	if(length > SIZE_MAX - sizeof(String) - 1)
+		return NULL;
+	String* string = malloc(sizeof(String) + length + 1);
+	if(string == NULL)
+		return NULL;
+	stringInstanceInit(string, (char *)(string + 1), length, 0, NULL, NULL);
 	string->value[length] = '\0';
+
+	return string;
+}
+
+static String* newStringInstanceLength(const char* source, size_t length)
+{
+	BUG_ON_NULL(source);	
+	String* string = newStringInstanceBuffer(length);
+	BUG_ON_NULL(string);
+	memcpy(string->value, source, length);
 	
 	return string;
 }
 
+static String* newStringInstance(const char* source)
+{
+	BUG_ON_NULL(source);	
+	return newStringInstanceLength(source, strlen(source));
+}
+
+/*
+ * free a String and its bytes, honouring the storage flags: owned bytes are
+ * freed unless they share the String's block, external bytes are handed
+ * back to their release callback and static bytes are left alone
+ */
+void stringInstanceFree(String* string)
+{
+	if(string->flags & STRING_FLAG_EXTERNAL) {
+		if(string->release)
+			string->release(string->context, string->value, string->length);
+	} else if(!(string->flags & STRING_FLAG_STATIC) && string->value != (char *)(string + 1)) {
+		free(string->value);
+	}
+	free(string->index);
+	free(string);
+}
+
 LIBOBJECT_API Object* stringCat(Object *o1, Object *o2)
 {
 	String *s1 = O_SVAL(o1);
 	String *s2 = O_SVAL(o2);
 
-	size_t len = s1->length + s2->length + 1;
-
-	char *buffer = malloc(len);
-
-	if(!buffer)
-		return NULL;	
+	if(s1->length + s2->length < s1->length)
+		return NULL;
 
-	memcpy(buffer, s1->value, s1->length);
-	memcpy(buffer + s1->length, s2->value, s2->length);
+	Object *retval = newObject(IS_STRING);
 
-	buffer[len - 1] = '\0';
+	if(!retval)
+		return NULL;
 
-	Object *retval = newString(buffer);
+	String *string = newStringInstanceBuffer(s1->length + s2->length);
 
-	if(!retval) {
-		free(buffer);
-		return NULL;
+	if(!string) {
+		free(retval);
+		return NULL;	
 	}
-	
-	free(buffer);
+
+	memcpy(string->value, s1->value, s1->length);
+	memcpy(string->value + s1->length, s2->value, s2->length);
+	O_SVAL(retval) = string;
 
 	return retval;
 }
@@ -1058,55 +1421,438 @@ LIBOBJECT_API Object* newStringFromSequence(const char* value, size_t n)
 {	
 	BUG_ON_NULL(value);
 	Object* object = newObject(IS_STRING);
+	if(!object)
+		return NULL;
 	
-	String* string = ALLOCATE(String);
-	BUG_ON_NULL(string);
-	size_t length = n;
-	string->length = length;
-	string->value = malloc(sizeof(char) * length + 1);
-	BUG_ON_NULL(string->value);
+	O_SVAL(object) = newStringInstanceLength(value, n);
+	return object;
+}
+
+static Object* newStringReference(const char* value, size_t n, unsigned int flags,
+	StringReleaseFunction release, void* context)
+{
+	BUG_ON_NULL(value);
+	Object* object = newObject(IS_STRING);
+	if(!object)
+		return NULL;
 
-	size_t i = 0;
-	while(i < n) {
-		string->value[i] = *value;
-		value++;
-		i++;
+	String* string = ALLOCATE(String);
+	if(!string) {
+		free(object);
+		return NULL;
 	}
-	string->value[length] = '\0';
+
+	stringInstanceInit(string, (char *)value, n, flags, release, context);
+	O_SVAL(object) = string;
+
+	return object;
+}
+
+/*
+ * The bytes are borrowed until the String is destroyed, at which point
+ * release(context, value, n) is called. If the constructor fails release
+ * is not called and the caller keeps ownership
+ */
+LIBOBJECT_API Object* newStringExternal(const char* value, size_t n,
+	StringReleaseFunction release, void* context)
+{
+	return newStringReference(value, n, STRING_FLAG_EXTERNAL, release, context);
+}
+
+LIBOBJECT_API Object* newStringStatic(const char* value, size_t n)
+{
+	return newStringReference(value, n, STRING_FLAG_STATIC, NULL, NULL);
+}
+
+LIBOBJECT_API Object* newBytes(const void* value, size_t n)
+{
+	BUG_ON_NULL(value);
+	Object* object = newObject(IS_BYTES);
+	if(!object)
+		return NULL;
+
+	O_BYVAL(object) = newStringInstanceLength(value, n);
+	return object;
+}
+
+/*
+ * Bytes over caller memory, see newStringExternal()
+ */
+LIBOBJECT_API Object* newBytesExternal(const void* value, size_t n,
+	StringReleaseFunction release, void* context)
+{
+	Object* object = newStringReference(value, n, STRING_FLAG_EXTERNAL, release, context);
+	if(!object)
+		return NULL;
+
+	O_TYPE(object) = IS_BYTES;
+	return object;
+}
+
+/*
+ * wrap a malloc'd buffer of n bytes without copying it
+ */
+static Object* newObjectAdoptingBuffer(ObjectType type, char* buffer, size_t n)
+{
+	Object* object = newObject(type);
+	String* string = ALLOCATE(String);
+	if(!object || !string) {
+		free(object);
+		free(string);
+		free(buffer);
+		return NULL;
+	}
+	stringInstanceInit(string, buffer, n, 0, NULL, NULL);
 	O_SVAL(object) = string;
 	return object;
 }
 
+LIBOBJECT_API size_t bytesLength(Object* o)
+{
+	BUG_ON_NULL(o);
+	if(O_TYPE(o) != IS_BYTES)
+		return 0;
+	return O_BYVAL(o)->length;
+}
+
+LIBOBJECT_API Object* bytesToBase64(Object* o)
+{
+	BUG_ON_NULL(o);
+	if(O_TYPE(o) != IS_BYTES)
+		return NULL;
+
+	size_t n = base64EncodedLength(O_BYVAL(o)->length);
+	char* buffer = malloc(n + 1);
+	if(!buffer)
+		return NULL;
+	base64Encode(O_BYVAL(o)->value, O_BYVAL(o)->length, buffer);
+	buffer[n] = '\0';
+	return newObjectAdoptingBuffer(IS_STRING, buffer, n);
+}
+
+LIBOBJECT_API Object* bytesToHex(Object* o)
+{
+	BUG_ON_NULL(o);
+	if(O_TYPE(o) != IS_BYTES)
+		return NULL;
+	if(O_BYVAL(o)->length * 2 < O_BYVAL(o)->length)
+		return NULL;
+
+	size_t n = O_BYVAL(o)->length * 2;
+	char* buffer = malloc(n + 1);
+	if(!buffer)
+		return NULL;
+	hexEncode(O_BYVAL(o)->value, O_BYVAL(o)->length, buffer);
+	buffer[n] = '\0';
+	return newObjectAdoptingBuffer(IS_STRING, buffer, n);
+}
+
+/*
+ * return NULL if text is not valid base64
+ */
+LIBOBJECT_API Object* newBytesFromBase64(const char* text, size_t n)
+{
+	BUG_ON_NULL(text);
+	size_t length = 0;
+	char* buffer = malloc(base64DecodedLength(n) + 1);
+	if(!buffer)
+		return NULL;
+	if(!base64Decode(text, n, buffer, &length)) {
+		free(buffer);
+		return NULL;
+	}
+	buffer[length] = '\0';
+	return newObjectAdoptingBuffer(IS_BYTES, buffer, length);
+}
+
+/*
+ * return NULL if text is not valid hex
+ */
+LIBOBJECT_API Object* newBytesFromHex(const char* text, size_t n)
+{
+	BUG_ON_NULL(text);
+	size_t length = 0;
+	char* buffer = malloc(n / 2 + 1);
+	if(!buffer)
+		return NULL;
+	if(!hexDecode(text, n, buffer, &length)) {
+		free(buffer);
+		return NULL;
+	}
+	buffer[length] = '\0';
+	return newObjectAdoptingBuffer(IS_BYTES, buffer, length);
+}
+
 LIBOBJECT_API Object* newStringFromSubstr(Object* o, size_t pos, size_t len)
 {
 	BUG_ON_NULL(o);
 	if(O_TYPE(o) != IS_STRING) {
 		return NULL;
 	}
-	if(pos == O_SVAL(o)->length) {
+	if(pos >= O_SVAL(o)->length) {
 		return NULL;
 	}
-	Object* copy = copyObject(o);
-	BUG_ON_NULL(copy);
-	char* entire = O_SVAL(copy)->value;
-	size_t i;
-	char* subString = malloc(len + 1);
-	BUG_ON_NULL(subString);
-
-	for(i = 0; i < pos; i++)
-		entire++;	
-	for(i = 0; i < len; i++) {
-		subString[i] = *entire;
-		entire++;	
-	}		
-	subString[len] = '\0';
-	Object* ret = newString(subString);
-	BUG_ON_NULL(ret);
-	free(subString);
-	objectDestroy(copy);
+	if(len > O_SVAL(o)->length - pos) {
+		len = O_SVAL(o)->length - pos;
+	}
+	return newStringFromSequence(O_SVAL(o)->value + pos, len);
+}
+
+/*
+ * validation is opt in so trusted callers don't pay for it
+ */
+LIBOBJECT_API Object* newStringEx(const char* value, size_t n, unsigned int flags)
+{
+	BUG_ON_NULL(value);
+	if((flags & STRING_CHECK_UTF8) && !utf8Validate(value, n))
+		return NULL;
+
+	Object* object = newStringFromSequence(value, n);
+	if(object && (flags & STRING_CHECK_UTF8))
+		O_SVAL(object)->flags |= STRING_FLAG_UTF8;
+	return object;
+}
+
+LIBOBJECT_API Object* newStringUtf8Checked(const char* value, size_t n)
+{
+	return newStringEx(value, n, STRING_CHECK_UTF8);
+}
+
+LIBOBJECT_API int stringIsValidUtf8(Object* o)
+{
+	BUG_ON_NULL(o);
+	if(O_TYPE(o) != IS_STRING)
+		return 0;
+
+	String* string = O_SVAL(o);
+	if(!(string->flags & STRING_FLAG_UTF8) && utf8Validate(string->value, string->length))
+		string->flags |= STRING_FLAG_UTF8;
+	return (string->flags & STRING_FLAG_UTF8) != 0;
+}
+
+static size_t stringInstanceCodePoints(String* string)
+{
+	if(!(string->flags & STRING_FLAG_COUNTED)) {
+		string->codepoints = utf8CodePointCount(string->value, string->length);
+		string->flags |= STRING_FLAG_COUNTED;
+		if(string->codepoints == string->length)
+			string->flags |= STRING_FLAG_ASCII;
+	}
+	return string->codepoints;
+}
+
+/*
+ * byte offset of code point cp. Long strings get a sparse index so the
+ * scan is bounded by STRING_INDEX_STRIDE code points
+ */
+static size_t stringInstanceOffset(String* string, size_t cp)
+{
+	size_t total = stringInstanceCodePoints(string);
+	if(string->flags & STRING_FLAG_ASCII)
+		return cp;
+	if(string->length < STRING_INDEX_STRIDE * 4)
+		return utf8Advance(string->value, string->length, 0, cp);
+
+	if(string->index == NULL) {
+		size_t entries = total / STRING_INDEX_STRIDE + 1;
+		size_t* index = malloc(sizeof(size_t) * entries);
+		if(index == NULL)
+			return utf8Advance(string->value, string->length, 0, cp);
+		size_t i;
+		index[0] = utf8Advance(string->value, string->length, 0, 0);
+		for(i = 1; i < entries; i++) {
+			index[i] = utf8Advance(string->value, string->length, index[i - 1],
+				STRING_INDEX_STRIDE);
+		}
+		string->index = index;
+	}
+	return utf8Advance(string->value, string->length,
+		string->index[cp / STRING_INDEX_STRIDE], cp % STRING_INDEX_STRIDE);
+}
+
+/*
+ * number of code points, computed once and cached on the String
+ */
+LIBOBJECT_API size_t stringCodePointLength(Object* o)
+{
+	BUG_ON_NULL(o);
+	if(O_TYPE(o) != IS_STRING)
+		return 0;
+	return stringInstanceCodePoints(O_SVAL(o));
+}
+
+/*
+ * return at most count code points starting at code point start, or NULL
+ * if start is past the end of the String
+ */
+LIBOBJECT_API Object* stringCodePointSubstr(Object* o, size_t start, size_t count)
+{
+	BUG_ON_NULL(o);
+	if(O_TYPE(o) != IS_STRING)
+		return NULL;
+
+	String* string = O_SVAL(o);
+	size_t total = stringInstanceCodePoints(string);
+	if(start > total)
+		return NULL;
+	if(count > total - start)
+		count = total - start;
+
+	size_t begin = stringInstanceOffset(string, start);
+	size_t end;
+	if(string->flags & STRING_FLAG_ASCII)
+		end = begin + count;
+	else
+		end = utf8Advance(string->value, string->length, begin, count);
+
+	Object* ret = newStringFromSequence(string->value + begin, end - begin);
+	if(ret) {
+		O_SVAL(ret)->codepoints = count;
+		O_SVAL(ret)->flags |= STRING_FLAG_COUNTED | (string->flags & STRING_FLAG_UTF8);
+		if(end - begin == count)
+			O_SVAL(ret)->flags |= STRING_FLAG_ASCII;
+	}
 	return ret;
 }
 
+LIBOBJECT_API size_t stringIndexOf(Object* haystack, Object* needle)
+{
+	BUG_ON_NULL(haystack);
+	BUG_ON_NULL(needle);
+	if(O_TYPE(haystack) != IS_STRING || O_TYPE(needle) != IS_STRING)
+		return STRING_NPOS;
+	return byteSearch(O_SVAL(haystack)->value, O_SVAL(haystack)->length,
+		O_SVAL(needle)->value, O_SVAL(needle)->length);
+}
+
+LIBOBJECT_API size_t stringLastIndexOf(Object* haystack, Object* needle)
+{
+	BUG_ON_NULL(haystack);
+	BUG_ON_NULL(needle);
+	if(O_TYPE(haystack) != IS_STRING || O_TYPE(needle) != IS_STRING)
+		return STRING_NPOS;
+	return byteSearchLast(O_SVAL(haystack)->value, O_SVAL(haystack)->length,
+		O_SVAL(needle)->value, O_SVAL(needle)->length);
+}
+
+LIBOBJECT_API int stringContains(Object* haystack, Object* needle)
+{
+	return stringIndexOf(haystack, needle) != STRING_NPOS;
+}
+
+/*
+ * an empty needle never matches
+ */
+LIBOBJECT_API size_t stringCount(Object* haystack, Object* needle)
+{
+	BUG_ON_NULL(haystack);
+	BUG_ON_NULL(needle);
+	if(O_TYPE(haystack) != IS_STRING || O_TYPE(needle) != IS_STRING)
+		return 0;
+
+	String* h = O_SVAL(haystack);
+	String* n = O_SVAL(needle);
+	size_t count = 0;
+	size_t offset = 0;
+	if(n->length == 0)
+		return 0;
+	while(offset + n->length <= h->length) {
+		size_t pos = byteSearch(h->value + offset, h->length - offset, n->value, n->length);
+		if(pos == STRING_NPOS)
+			break;
+		count++;
+		offset += pos + n->length;
+	}
+	return count;
+}
+
+/*
+ * replace every non overlapping occurrence of needle, scanning the input
+ * once and writing the result straight into an exactly sized buffer. An
+ * empty needle returns a copy
+ */
+LIBOBJECT_API Object* stringReplaceAll(Object* o, Object* needle, Object* replacement)
+{
+	BUG_ON_NULL(o);
+	BUG_ON_NULL(needle);
+	BUG_ON_NULL(replacement);
+	if(O_TYPE(o) != IS_STRING || O_TYPE(needle) != IS_STRING ||
+		O_TYPE(replacement) != IS_STRING)
+		return NULL;
+
+	String* h = O_SVAL(o);
+	String* n = O_SVAL(needle);
+	String* r = O_SVAL(replacement);
+	if(n->length == 0)
+		return newStringFromSequence(h->value, h->length);
+
+	size_t inline_matches[32];
+	size_t* matches = inline_matches;
+	size_t capacity = sizeof(inline_matches) / sizeof(inline_matches[0]);
+	size_t count = 0;
+	size_t offset = 0;
+	while(offset + n->length <= h->length) {
+		size_t pos = byteSearch(h->value + offset, h->length - offset, n->value, n->length);
+		if(pos == STRING_NPOS)
+			break;
+		if(count == capacity) {
+			size_t* grown = malloc(sizeof(size_t) * capacity * 2);
+			if(!grown) {
+				if(matches != inline_matches)
+					free(matches);
+				return NULL;
+			}
+			memcpy(grown, matches, sizeof(size_t) * count);
+			if(matches != inline_matches)
+				free(matches);
+			matches = grown;
+			capacity *= 2;
+		}
+		matches[count++] = offset + pos;
+		offset += pos + n->length;
+	}
+
+	size_t length = h->length - count * n->length + count * r->length;
+	char* buffer = malloc(length + 1);
+	if(!buffer) {
+		if(matches != inline_matches)
+			free(matches);
+		return NULL;
+	}
+
+	size_t i;
+	size_t from = 0;
+	char* out = buffer;
+	for(i = 0; i < count; i++) {
+		memcpy(out, h->value + from, matches[i] - from);
+		out += matches[i] - from;
+		memcpy(out, r->value, r->length);
+		out += r->length;
+		from = matches[i] + n->length;
+	}
+	memcpy(out, h->value + from, h->length - from);
+	buffer[length] = '\0';
+
+	if(matches != inline_matches)
+		free(matches);
+	return newObjectAdoptingBuffer(IS_STRING, buffer, length);
+}
+
+LIBOBJECT_API Object* stringCaseFold(Object* o)
+{
+	BUG_ON_NULL(o);
+	if(O_TYPE(o) != IS_STRING)
+		return NULL;
+
+	String* string = O_SVAL(o);
+	char* buffer = malloc(string->length + 1);
+	if(!buffer)
+		return NULL;
+	size_t n = utf8CaseFold(string->value, string->length, buffer);
+	buffer[n] = '\0';
+	return newObjectAdoptingBuffer(IS_STRING, buffer, n);
+}
+
 
 LIBOBJECT_API Object* newFunction(void* ptr)
 {
@@ -1188,6 +1934,12 @@ LIBOBJECT_API size_t arrayPushEx(Object* object, Object* value)
 		fprintf(get_debug_fp(), "%s(): Object type is not an instance of Array, got %d\n", __func__, O_TYPE(object));
 		return 0;		
 	}
+	if(O_FLG(object) & OBJECT_FLAG_FROZEN) {
+		fprintf(get_debug_fp(), "%s(): Object is frozen\n", __func__);
+		return 0;
+	}
+	if(!objectLoad(object))
+		return 0;
 	size_t retval = O_AVAL(object)->nextIndex;
 	if(O_AVAL(object)->capacity == O_AVAL(object)->size) {
 		if(!arrayResize(O_AVAL(object))) {
@@ -1202,6 +1954,43 @@ LIBOBJECT_API size_t arrayPushEx(Object* object, Object* value)
 	return retval;
 }
 
+int arrayInsertAt(Object* object, size_t index, Object* value)
+{
+	if(O_FLG(object) & OBJECT_FLAG_FROZEN)
+		return 0;
+	if(!objectLoad(object))
+		return 0;
+	Array* array = O_AVAL(object);
+
+	if(index > array->size)
+		return 0;
+	if(array->size == array->capacity && !arrayResize(array))
+		return 0;
+	memmove(array->table + index + 1, array->table + index,
+		(array->size - index) * sizeof(Object*));
+	array->table[index] = value;
+	array->nextIndex = ++array->size;
+	return 1;
+}
+
+Object* arrayTakeAt(Object* object, size_t index)
+{
+	if(O_FLG(object) & OBJECT_FLAG_FROZEN)
+		return NULL;
+	if(!objectLoad(object))
+		return NULL;
+	Array* array = O_AVAL(object);
+	Object* value;
+
+	if(index >= array->size)
+		return NULL;
+	value = array->table[index];
+	memmove(array->table + index, array->table + index + 1,
+		(array->size - index - 1) * sizeof(Object*));
+	array->nextIndex = --array->size;
+	return value;
+}
+
 LIBOBJECT_API size_t arrayPush(Object* object, Object* value)
 {
 	BUG_ON_NULL(object);
@@ -1210,6 +1999,12 @@ LIBOBJECT_API size_t arrayPush(Object* object, Object* value)
 		fprintf(get_debug_fp(), "%s(): Object type is not an instance of Array, got %d\n", __func__, O_TYPE(object));
 		return 0;		
 	}
+	if(O_FLG(object) & OBJECT_FLAG_FROZEN) {
+		fprintf(get_debug_fp(), "%s(): Object is frozen\n", __func__);
+		return 0;
+	}
+	if(!objectLoad(object))
+		return 0;
 
 	Object* value_copy = copyObject(value);
 	if(value_copy == NULL) {
@@ -1249,6 +2044,8 @@ LIBOBJECT_API Object* arrayGet(Object* object, size_t index)
 		fprintf(get_debug_fp(), "%s(): Object type is not an instance of Array, got %d\n", __func__, O_TYPE(object));
 		return NULL;		
 	}
+	if(!objectLoad(object))
+		return NULL;
 
 	return copyObject(arrayRealGet(O_AVAL(object), index));
 }
@@ -1261,6 +2058,8 @@ LIBOBJECT_API Object* arrayGetEx(Object* object, size_t index)
 		fprintf(get_debug_fp(), "%s(): Object type is not an instance of Array, got %d\n", __func__, O_TYPE(object));
 		return NULL;		
 	}
+	if(!objectLoad(object))
+		return NULL;
 
 	return arrayRealGet(O_AVAL(object), index);
 }
@@ -1273,6 +2072,8 @@ LIBOBJECT_API size_t arraySize(Object* object)
 		fprintf(get_debug_fp(), "%s(): Object type is not an instance of Array, got %d\n", __func__, O_TYPE(object));
 		return 0;		
 	}
+	if(!objectLoad(object))
+		return 0;
 	
 	return O_AVAL(object)->size;
 }
@@ -1289,13 +2090,16 @@ LIBOBJECT_API void objectEcho(Object* object)
 			fprintf(stdout, "%s", O_BVAL(object) ? "true" : "false");
 		break;
 		case IS_LONG:
-			fprintf(stdout, "%ld", O_LVAL(object));
-		break;
-		case IS_DOUBLE:
-			fprintf(stdout, "%.2f", O_DVAL(object));
+		case IS_DOUBLE: {
+			char number[OBJECT_SCALAR_BUFFER_SIZE];
+			fwrite(number, 1, objectFormatScalar(object, number), stdout);
+		}
 		break;
 		case IS_STRING:
-			fprintf(stdout, "%s", O_SVAL(object)->value);
+			fprintf(stdout, "%.*s", (int)O_SVAL(object)->length, O_SVAL(object)->value);
+		break;
+		case IS_BYTES:
+			fprintf(stdout, "[Object Bytes]");
 		break;
 		case IS_ARRAY:
 			fprintf(stdout, "[Object Array]");
@@ -1330,7 +2134,10 @@ LIBOBJECT_API void objectDump(Object* object, Object* last, size_t indent)
 {
 	BUG_ON_NULL(object);
 	size_t i;
+	char number[OBJECT_SCALAR_BUFFER_SIZE];
 	
+	if(!objectLoad(object))
+		return;
 	switch(O_TYPE(object)) {
 		case IS_POINTER:
 			fprintf(stdout, "%s", O_PRETTY_TYPE(IS_POINTER));
@@ -1356,14 +2163,14 @@ LIBOBJECT_API void objectDump(Object* object, Object* last, size_t indent)
 		case IS_LONG:
 			fprintf(stdout, "%s", O_PRETTY_TYPE(IS_LONG));
 			fprintf(stdout, "(");
-			fprintf(stdout, "%ld", O_LVAL(object));
+			fwrite(number, 1, objectFormatScalar(object, number), stdout);
 			fprintf(stdout, ")");
 			fprintf(stdout, "\n");
 		break; 
 		case IS_DOUBLE:
 			fprintf(stdout, "%s", O_PRETTY_TYPE(IS_DOUBLE));
 			fprintf(stdout, "(");
-			fprintf(stdout, "%.2f", O_DVAL(object));
+			fwrite(number, 1, objectFormatScalar(object, number), stdout);
 			fprintf(stdout, ")");
 			fprintf(stdout, "\n");
 		break; 
@@ -1373,10 +2180,17 @@ LIBOBJECT_API void objectDump(Object* object, Object* last, size_t indent)
 			fprintf(stdout, "%zu", O_SVAL(object)->length);
 			fprintf(stdout, ")");
 			fprintf(stdout, " ");
-			fprintf(stdout, "\"%s\"", O_SVAL(object)->value);
+			fprintf(stdout, "\"%.*s\"", (int)O_SVAL(object)->length, O_SVAL(object)->value);
 			fprintf(stdout, "\n");
 
 		break;
+		case IS_BYTES:
+			fprintf(stdout, "%s", O_PRETTY_TYPE(IS_BYTES));
+			fprintf(stdout, "(");
+			fprintf(stdout, "%zu", O_BYVAL(object)->length);
+			fprintf(stdout, ")");
+			fprintf(stdout, "\n");
+		break;
 		case IS_ARRAY:
 			fprintf(stdout, "%s", O_PRETTY_TYPE(IS_ARRAY));
 			fprintf(stdout, "(");
@@ -1455,6 +2269,8 @@ LIBOBJECT_API void objectDumpEx(Object* object, Object* last, size_t indent)
 	BUG_ON_NULL(object);
 	size_t i;
 	
+	if(!objectLoad(object))
+		return;
 	switch(O_TYPE(object)) {
 		case IS_POINTER:
 			fprintf(stdout, "%s", O_PRETTY_TYPE(IS_POINTER));
@@ -1501,6 +2317,15 @@ LIBOBJECT_API void objectDumpEx(Object* object, Object* last, size_t indent)
 			fprintf(stdout, "\n");
 
 		break;
+		case IS_BYTES:
+			fprintf(stdout, "%s", O_PRETTY_TYPE(IS_BYTES));
+			fprintf(stdout, "(");
+			fprintf(stdout, "%zu", O_BYVAL(object)->length);
+			fprintf(stdout, ")");
+			fprintf(stdout, " ");
+			fprintf(stdout, "%p", (void *)O_BYVAL(object)->value);
+			fprintf(stdout, "\n");
+		break;
 		case IS_ARRAY:
 			fprintf(stdout, "%s => %p", O_PRETTY_TYPE(IS_ARRAY), (void *)object);
 			fprintf(stdout, "(");
@@ -1570,69 +2395,368 @@ LIBOBJECT_API void objectDumpEx(Object* object, Object* last, size_t indent)
 	}
 }
 
-LIBOBJECT_API void objectSafeDestroy(Object* current, Object* last)
+LIBOBJECT_API Object* objectRetain(Object* o)
+{
+	BUG_ON_NULL(o);
+	if(O_FLG(o) & OBJECT_FLAG_FROZEN)
+		__atomic_add_fetch(&O_REFCNT(o), 1, __ATOMIC_RELAXED);
+	else
+		O_REFCNT(o)++;
+	return o;
+}
+
+/*
+ * fill in what a reader of a String would otherwise compute and cache on
+ * first use
+ */
+static void stringInstanceFreeze(Object* o)
 {
-	if(current == NULL) {
+	String* string = O_SVAL(o);
+
+	if(O_TYPE(o) != IS_STRING)
 		return;
-	}
-	switch(O_TYPE(current)) {
-		case IS_LONG:
-		case IS_DOUBLE:
-		case IS_BOOL:
-		case IS_NULL:
-		case IS_FUNCTION:
-		case IS_POINTER:
-			free(current);
-		break;
+	stringIsValidUtf8(o);
+	stringInstanceCodePoints(string);
+	if(string->length > 0)
+		stringInstanceOffset(string, 0);
+}
+
+typedef struct FreezeFrame {
+	Object*		o;
+	size_t		i;	/* next index, bucket or half of a pair */
+	Bucket*		b;	/* next bucket in the chain of bucket i - 1 */
+} FreezeFrame;
+
+/*
+ * the next child of f->o, caching the hash of its key on the filling
+ * pass. 0 once there are none left
+ */
+static int freezeNext(FreezeFrame* f, Object** child, int fill)
+{
+	Object* o = f->o;
+
+	switch(O_TYPE(o)) {
 		case IS_PAIR:
-			objectSafeDestroy(O_PVAL(current)->first, NULL);
-			objectSafeDestroy(O_PVAL(current)->second, NULL);
-			free(current);
-		break;
-		case IS_STRING:
-			free(O_SVAL(current)->value);
-			free(O_SVAL(current));
-			free(current);
-		break;
-		case IS_ARRAY: {
-			size_t i;
-			for(i = 0; i < arraySize(current); i++) {
-				if(current == last) {
-					return;
-				} else {
-					Object* value = arrayRealGet(O_AVAL(current), i);
-					objectSafeDestroy(value, current);
+			if(f->i == 2)
+				return 0;
+			*child = f->i++ == 0 ? O_PVAL(o)->first : O_PVAL(o)->second;
+		return 1;
+		case IS_ARRAY:
+			if(f->i == O_AVAL(o)->size)
+				return 0;
+			*child = O_AVAL(o)->table[f->i++];
+		return 1;
+		case IS_MAP:
+			while(f->b == NULL) {
+				if(f->i == O_MVAL(o)->capacity)
+					return 0;
+				f->b = O_MVAL(o)->buckets[f->i++];
+			}
+			if(fill)
+				stringInstanceHash(f->b->key);
+			*child = f->b->value;
+			f->b = f->b->next;
+		return 1;
+		default:
+		return 0;
+	}
+}
+
+/*
+ * one pass over what is not frozen yet under root. The filling pass loads
+ * lazy values and fills in every cache a reader would otherwise write, and
+ * is the only one that can fail. The other sets OBJECT_FLAG_FROZEN in the
+ * frames the filling pass grew, never going deeper than it did
+ */
+static int objectWalkFreeze(Object* root, void** stack, void* local, size_t* capacity, int fill)
+{
+	size_t depth = 0;
+	Object* o = root;
+
+	for(;;) {
+		if(o != NULL && !(O_FLG(o) & OBJECT_FLAG_FROZEN)) {
+			if(!fill) {
+				O_FLG(o) |= OBJECT_FLAG_FROZEN;
+			} else if(!objectLoad(o)) {
+				fprintf(get_debug_fp(), "%s(): failed to load a lazy value\n", __func__);
+				return 0;
+			} else if(O_TYPE(o) == IS_STRING || O_TYPE(o) == IS_BYTES) {
+				stringInstanceFreeze(o);
+				stringInstanceHash(O_SVAL(o));
+			}
+			if(objectIsWalked(o)) {
+				if(!objectWalkGrow(stack, local, capacity, depth, sizeof(FreezeFrame))) {
+					fprintf(get_debug_fp(), "%s(): out of memory\n", __func__);
+					return 0;
 				}
+				FreezeFrame* f = &((FreezeFrame*)*stack)[depth++];
+				f->o = o;
+				f->i = 0;
+				f->b = NULL;
 			}
-			free(O_AVAL(current)->table);
-			free(O_AVAL(current));
-			free(current);
 		}
-		break;
+		/* the next child, finishing containers on the way */
+		while(depth > 0 && !freezeNext(&((FreezeFrame*)*stack)[depth - 1], &o, fill))
+			depth--;
+		if(depth == 0)
+			return 1;
+	}
+}
+
+LIBOBJECT_API Object* objectFreeze(Object* o)
+{
+	FreezeFrame local[OBJECT_WALK_FRAMES];
+	void* stack = local;
+	size_t capacity = OBJECT_WALK_FRAMES;
+	int filled;
+
+	BUG_ON_NULL(o);
+
+	/* nothing is frozen unless everything can be */
+	if((filled = objectWalkFreeze(o, &stack, local, &capacity, 1)))
+		objectWalkFreeze(o, &stack, local, &capacity, 0);
+	if(stack != local)
+		free(stack);
+	return filled ? o : NULL;
+}
+
+LIBOBJECT_API int objectIsFrozen(Object* o)
+{
+	BUG_ON_NULL(o);
+	return (O_FLG(o) & OBJECT_FLAG_FROZEN) != 0;
+}
+
+/*
+ * heap owned by o itself, not counting its children or malloc overhead
+ */
+size_t objectFootprint(Object* o)
+{
+	size_t size = sizeof(Object);
+
+	/* the parser's record is the document's, not this node's */
+	if(O_FLG(o) & OBJECT_FLAG_LAZY)
+		return size;
+	switch(O_TYPE(o)) {
+		case IS_STRING:
+		case IS_BYTES:
+			size += sizeof(String);
+			if(!(O_SVAL(o)->flags & (STRING_FLAG_EXTERNAL | STRING_FLAG_STATIC)))
+				size += O_SVAL(o)->length + 1;
+			break;
+		case IS_ARRAY:
+			size += sizeof(Array) + O_AVAL(o)->capacity * sizeof(Object*);
+			break;
 		case IS_MAP: {
+			Map* map = O_MVAL(o);
 			uint32_t i;
-			for(i = 0; i < mapCapacity(current); i++) {
-				Bucket* b = mapGetBucket(current, i);
-				while(b != NULL) {
-					Bucket* bn = b->next;
-					String* key = b->key;
-					free(key->value);
-					free(key);
-					objectSafeDestroy(b->value, current);
-					free(b);
-					b = bn;
-				}
+			Bucket* b;
+			size += sizeof(Map) + map->capacity * sizeof(Bucket*);
+			for(i = 0; i < map->capacity; i++) {
+				for(b = map->buckets[i]; b != NULL; b = b->next)
+					size += sizeof(Bucket) + sizeof(String) + b->key->length + 1;
 			}
-			free(O_MVAL(current)->buckets);
-			free(O_MVAL(current));
-			free(current);
 		}
 		break;
+		case IS_PAIR:
+			size += sizeof(Pair);
+			break;
 		default:
-			fprintf(get_debug_fp(), "%s(): invalid object\n", __func__);
-			return;
+			break;
+	}
+	return size;
+}
+
+/*
+ * drop a reference to o, 1 when it was the last. A walk running on the
+ * pool drops every count atomically, since a shared subtree can be
+ * reached from more than one thread
+ */
+static int objectRelease(Object* o, int atomic)
+{
+	if(atomic || (O_FLG(o) & OBJECT_FLAG_FROZEN))
+		return __atomic_sub_fetch(&O_REFCNT(o), 1, __ATOMIC_ACQ_REL) == 0;
+	if(O_REFCNT(o) > 1) {
+		O_REFCNT(o)--;
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * free o once its children are gone
+ */
+static void objectFreeShell(Object* o)
+{
+	switch(O_TYPE(o)) {
+		case IS_PAIR:
+			free(O_PVAL(o));
+		break;
+		case IS_STRING:
+			stringInstanceFree(O_SVAL(o));
+		break;
+		case IS_BYTES:
+			stringInstanceFree(O_BYVAL(o));
 		break;
+		case IS_ARRAY:
+			free(O_AVAL(o)->table);
+			free(O_AVAL(o));
+		break;
+		case IS_MAP:
+			free(O_MVAL(o)->buckets);
+			free(O_MVAL(o));
+		break;
+		default:
+		break;
+	}
+	free(o);
+}
+
+typedef struct DestroyFrame {
+	Object*		o;
+	size_t		i;	/* next index, bucket or half of a pair */
+	Bucket*		b;	/* next bucket in the chain of bucket i - 1 */
+} DestroyFrame;
+
+/*
+ * take the next child out of f->o, freeing the bucket that held it. 0
+ * once there are none left
+ */
+static int destroyNext(DestroyFrame* f, Object** child)
+{
+	Object* o = f->o;
+
+	switch(O_TYPE(o)) {
+		case IS_PAIR:
+			if(f->i == 2)
+				return 0;
+			*child = f->i++ == 0 ? O_PVAL(o)->first : O_PVAL(o)->second;
+		return 1;
+		case IS_ARRAY:
+			if(f->i == O_AVAL(o)->size)
+				return 0;
+			*child = O_AVAL(o)->table[f->i++];
+		return 1;
+		case IS_MAP: {
+			Bucket* b;
+			while(f->b == NULL) {
+				if(f->i == O_MVAL(o)->capacity)
+					return 0;
+				f->b = O_MVAL(o)->buckets[f->i++];
+			}
+			b = f->b;
+			f->b = b->next;
+			*child = b->value;
+			stringInstanceFree(b->key);
+			free(b);
+		}
+		return 1;
+		default:
+		return 0;
+	}
+}
+
+static void destroyChildren(Object*, size_t*);
+
+/*
+ * a container is never destroyed as its own child. freed, when not NULL,
+ * gains the objectFootprint() of everything freed
+ */
+static void objectWalkDestroy(Object* root, Object* last, int atomic, size_t* freed)
+{
+	DestroyFrame local[OBJECT_WALK_FRAMES];
+	void* stack = local;
+	size_t depth = 0, capacity = OBJECT_WALK_FRAMES;
+	Object* o = root;
+	Object* parent = last;
+
+	for(;;) {
+		if(o != NULL && o != parent && objectRelease(o, atomic)) {
+			if(freed != NULL)
+				*freed += objectFootprint(o);
+			if(O_FLG(o) & OBJECT_FLAG_LAZY) {
+				jsonLazyFree(o);
+				free(o);
+			} else if(!objectIsWalked(o)) {
+				objectFreeShell(o);
+			} else if(objectIsWide(o) && poolThreads() > 1) {
+				destroyChildren(o, freed);
+				objectFreeShell(o);
+			} else if(objectWalkGrow(&stack, local, &capacity, depth, sizeof(DestroyFrame))) {
+				DestroyFrame* f = &((DestroyFrame*)stack)[depth++];
+				f->o = o;
+				f->i = 0;
+				f->b = NULL;
+			} else {
+				/* out of memory: the children get a walk of their own */
+				DestroyFrame f = { o, 0, NULL };
+				Object* child;
+				while(destroyNext(&f, &child))
+					objectWalkDestroy(child, o, atomic, freed);
+				objectFreeShell(o);
+			}
+		}
+		/* the next child, freeing containers on the way */
+		while(depth > 0 && !destroyNext(&((DestroyFrame*)stack)[depth - 1], &o))
+			objectFreeShell(((DestroyFrame*)stack)[--depth].o);
+		if(depth == 0)
+			break;
+		parent = ((DestroyFrame*)stack)[depth - 1].o;
+	}
+	if(stack != local)
+		free(stack);
+}
+
+typedef struct DestroyJob {
+	Object*		o;
+	size_t*		freed;
+} DestroyJob;
+
+static void destroyRange(void* context, size_t begin, size_t end)
+{
+	DestroyJob* job = context;
+	Object* o = job->o;
+	size_t i, freed = 0;
+	size_t* count = job->freed != NULL ? &freed : NULL;
+
+	for(i = begin; i < end; i++) {
+		if(O_TYPE(o) == IS_ARRAY) {
+			objectWalkDestroy(O_AVAL(o)->table[i], o, 1, count);
+		} else {
+			Bucket* b = O_MVAL(o)->buckets[i];
+			while(b != NULL) {
+				Bucket* next = b->next;
+				stringInstanceFree(b->key);
+				objectWalkDestroy(b->value, o, 1, count);
+				free(b);
+				b = next;
+			}
+		}
 	}
+	if(count != NULL)
+		__atomic_add_fetch(job->freed, freed, __ATOMIC_RELAXED);
+}
+
+static void destroyChildren(Object* o, size_t* freed)
+{
+	DestroyJob job = { o, freed };
+
+	if(O_TYPE(o) == IS_ARRAY)
+		poolParallel(destroyRange, &job, O_AVAL(o)->size, 0);
+	else
+		poolParallel(destroyRange, &job, O_MVAL(o)->capacity, 0);
+}
+
+LIBOBJECT_API void objectSafeDestroy(Object* current, Object* last)
+{
+	objectWalkDestroy(current, last, 0, NULL);
+}
+
+size_t objectDestroyCounted(Object* o)
+{
+	size_t freed = 0;
+
+	objectWalkDestroy(o, NULL, 0, &freed);
+	return freed;
 }
 static MutableString* newMutableString()
 {
@@ -1673,38 +2797,6 @@ static void mutableStringAppend(MutableString* ms, const char value)
         ms->value[current_position] = '\0';
 }
 
-static void mutableStringAppendString(MutableString* ss, const char* str)
-{
-        size_t part_length = strlen(str);
-        size_t i;
-        size_t current_position;
-        size_t new_length;
-
-        if (part_length == 0) {
-                return;
-        }
-
-        new_length = part_length + ss->length;
-        current_position = ss->length;
-
-        if (new_length >= ss->capacity) {
-                while (new_length >= ss->capacity) {
-                        ss->capacity *= 2;
-                        if ((ss->value = realloc(ss->value, ss->capacity)) == NULL) {
-                                return;
-                        }
-                }
-        }
-
-        for (i = 0; i < part_length; i++) {
-                ss->value[current_position++] = str[i];
-        }
-
-        ss->length = new_length;
-        ss->value[current_position] = '\0';
-
-}
-
 static void mutableStringReset(MutableString* ms)
 {
         ms->length = 0;
@@ -1753,142 +2845,3 @@ LIBOBJECT_API Object* stringSplit(const char* source, char sep)
         
 	return array;
 }
-
-#define JSON_INDENT_LOOP(ms, x) do { \
-        int i; \
-        for(i = 0; i < x; i++) { \
-                mutableStringAppendString(ms, "  "); \
-        } \
-} while(0)
-
-static void object_to_json(MutableString* out, Object* o, int pretty, int indents, int* error)
-{
-	BUG_ON_NULL(out);
-	BUG_ON_NULL(o);
-	switch(O_TYPE(o)) {
-		case IS_MAP: {
-			uint32_t map_size = mapSize(o);
-			uint32_t i = 1;
-			mutableStringAppend(out, '{');
-			if(pretty)
-				mutableStringAppend(out, '\n');
-
-			Object* key; Object* value;
-			MAP_FOREACH_KEY_VALUE(o, key, value) {
-				char* skey = objectToString(key);
-				if(pretty) {
-					JSON_INDENT_LOOP(out, indents + 1);
-				}
-				mutableStringAppend(out, '"');
-				mutableStringAppendString(out, skey);
-				objectDestroy(key);
-				free(skey);
-				mutableStringAppend(out, '"');
-				mutableStringAppend(out, ':');
-				if(pretty)
-					mutableStringAppend(out, ' ');
-				object_to_json(out, value, pretty, indents + 1, error);
-				objectDestroy(value);
-				if(i != map_size)
-					mutableStringAppend(out, ',');
-				if(pretty)
-					mutableStringAppend(out, '\n');
-				i++;
-			} MAP_FOREACH_END();
-
-			if(pretty) {
-				JSON_INDENT_LOOP(out, indents);
-			}
-			mutableStringAppend(out, '}');
-		}
-		break;
-		case IS_STRING:
-			mutableStringAppend(out, '"');
-			mutableStringAppendString(out, O_SVAL(o)->value);
-			mutableStringAppend(out, '"');
-		break;
-		case IS_LONG: {
-			char* value = objectToString(o);
-			mutableStringAppendString(out, value);
-			free(value);	
-		}
-		break;
-		case IS_BOOL: {
-			char* value = objectToString(o);
-			mutableStringAppendString(out, value);
-			free(value);
-		}
-		break;
-		case IS_NULL: {
-			char* value = objectToString(o);
-			mutableStringAppendString(out, value);
-			free(value);
-		}
-		break;
-		case IS_DOUBLE: {
-			char* value = objectToString(o);
-			mutableStringAppendString(out, value);
-			free(value);
-		}
-		break;
-		case IS_ARRAY: {
-			mutableStringAppend(out, '[');
-			if(pretty)
-				mutableStringAppend(out, '\n');
-
-			size_t ar_size = arraySize(o);
-			size_t i;
-			Object* value;
-			ARRAY_ENUMERATE(o, i, value) {
-				if(pretty) {
-					JSON_INDENT_LOOP(out, indents + 1);
-				}
-				object_to_json(out, value, pretty, indents + 1, error);
-				objectDestroy(value);
-				if(i != ar_size - 1)
-					mutableStringAppend(out, ',');
-				if(pretty)
-					mutableStringAppend(out, '\n');
-			} ARRAY_ENUMERATE_END();
-			if(pretty) {
-				JSON_INDENT_LOOP(out, indents);
-			}
-			mutableStringAppend(out, ']');
-		}
-		break;
-		default:
-			*error = 1;
-		break;
-	}
-}
-
-LIBOBJECT_API char* objectToJson(Object* o, int pretty, size_t* length)
-{
-	BUG_ON_NULL(o);
-	MutableString* out = newMutableString();
-	if(!out) {
-		*length = 0;
-		return NULL;
-	}
-	int status = 0;
-	object_to_json(out, o, pretty, 0, &status);	
-	if(status) {
-		*length = 0;
-		mutableStringFree(out);
-		return NULL;
-	}	
-	char* buffer = malloc(out->length + 1);
-	if(!buffer) {
-		*length = 0;
-		mutableStringFree(out);
-		return NULL;
-	}	
-
-	memcpy(buffer, out->value, out->length);
-	buffer[out->length] = '\0';
-	*length = out->length;	
-	mutableStringFree(out);
-	return buffer;
-}
-
-
@@ -50,12 +50,52 @@ typedef enum ObjectType {
 	IS_OBJECT,
 	IS_FUNCTION,
 	IS_PAIR,
-	IS_POINTER
+	IS_POINTER,
+	IS_BYTES
 } ObjectType;
 
+/*
+ * Called when a String created by newStringExternal() is destroyed. The
+ * callback receives the context, pointer and length given to the constructor
+ */
+typedef void (*StringReleaseFunction)(void* context, const char* value, size_t length);
+
+/*
+ * String storage flags. An owned String holds a NUL terminated copy of its
+ * bytes, EXTERNAL and STATIC strings point at caller memory which is not
+ * required to be NUL terminated, so always use length to read value
+ */
+#define STRING_FLAG_EXTERNAL	0x1
+#define STRING_FLAG_STATIC	0x2
+/*
+ * cached facts about the bytes, filled in on first use
+ */
+#define STRING_FLAG_UTF8	0x4	/* validated as UTF-8 */
+#define STRING_FLAG_COUNTED	0x8	/* codepoints is valid */
+#define STRING_FLAG_ASCII	0x10	/* every code point is one byte */
+#define STRING_FLAG_HASHED	0x20	/* hash is valid */
+
+/*
+ * constructor flags for newStringEx()
+ */
+#define STRING_CHECK_UTF8	0x100	/* fail unless the bytes are valid UTF-8 */
+
+/*
+ * number of code points between two entries of String.index
+ */
+#define STRING_INDEX_STRIDE	64
+
 typedef struct String {
 	size_t		length;
 	char*		value;
+	unsigned int	flags;
+	StringReleaseFunction release;
+	void*		context;
+	size_t		codepoints;
+	/* byte offset of every STRING_INDEX_STRIDE'th code point, built lazily */
+	size_t*		index;
+	/* 64 bit hash of the bytes, for objectHash() */
+	uint64_t	hash;
 } String;
 
 typedef struct Array {
@@ -100,6 +140,7 @@ struct Object {
 		void*		functionValue;
 		Pair*	  pairValue;
 		void*   pointerValue;
+		String* bytesValue;
 	} value;	
 };
 
@@ -117,6 +158,11 @@ struct Object {
 #define O_FVAL(o) (o)->value.functionValue
 #define O_PVAL(o) (o)->value.pairValue
 #define O_PTVAL(o) (o)->value.pointerValue
+/*
+ * Bytes share the String layout and storage flags. They are length
+ * delimited and may contain NULs, so always use length to read value
+ */
+#define O_BYVAL(o) (o)->value.bytesValue
 
 extern LIBOBJECT_API char        *objectTypeStr(Object *);
 extern LIBOBJECT_API int         setDebuggingOutFile(FILE*);
@@ -127,7 +173,46 @@ extern LIBOBJECT_API int         objectValueTypeCompare(Object*, Object*);
 extern LIBOBJECT_API int         objectValueCompare(Object*, Object*);
 extern LIBOBJECT_API int         objectValueIsLessThan(Object *, Object *);
 extern LIBOBJECT_API int         objectValueIsGreaterThan(Object *, Object *);
+/*
+ * a hash of the whole tree, equal for trees objectDeepEquals() accepts. Map
+ * entries are combined without regard to order. String and Bytes hashes
+ * are cached, so they must not be changed in place afterwards
+ */
+extern LIBOBJECT_API uint64_t    objectHash(Object*);
+/*
+ * compare two trees by value: same types, arrays in order, maps by key
+ */
+extern LIBOBJECT_API int         objectDeepEquals(Object*, Object*);
+/*
+ * <0, 0 or >0 as the first tree sorts before, with or after the second, in
+ * one total order over every type. See object_compare.c for the order
+ */
+extern LIBOBJECT_API int         objectCompare(Object*, Object*);
 extern LIBOBJECT_API Object*     newNumberFromCharArray(const char*);
+/*
+ * size of the buffer objectFormatScalar(), formatLong() and formatDouble()
+ * write to, including the NUL
+ */
+#define OBJECT_SCALAR_BUFFER_SIZE 32
+
+/*
+ * format a Null, Bool, Long or Double without allocating and return the
+ * length, 0 for other types. Doubles use the shortest text that reads back
+ * to the same value. objectToJson() adds ".0" to integral ones, so they are
+ * read back as Doubles
+ */
+extern LIBOBJECT_API size_t      objectFormatScalar(Object*, char*);
+extern LIBOBJECT_API size_t      formatLong(long, char*);
+extern LIBOBJECT_API size_t      formatDouble(double, char*);
+/*
+ * parse the number at the start of s[0..n), which need not be NUL
+ * terminated, and return the bytes consumed, 0 if there is none. Accepts
+ * [+-] digits [. digits] [e [+-] digits], infinity and nan, whatever the
+ * locale. parseNumber() stores a Long when the text is an integer that
+ * fits, a Double otherwise
+ */
+extern LIBOBJECT_API size_t      parseNumber(const char*, size_t, Object**);
+extern LIBOBJECT_API size_t      parseDouble(const char*, size_t, double*);
 extern LIBOBJECT_API Object*     newPointer(void *);
 extern LIBOBJECT_API Object*     newPair(Object*, Object*);
 extern LIBOBJECT_API Object*     newNull(void);
@@ -153,7 +238,74 @@ extern LIBOBJECT_API void        mapDelete(Object*, const char*);
 extern LIBOBJECT_API Object*     stringCat(Object *, Object *);
 extern LIBOBJECT_API Object*     newString(const char*);
 extern LIBOBJECT_API Object*     newStringFromSequence(const char*, size_t);
+/*
+ * create a String that points at caller memory without copying it. release
+ * is called with context when the String is destroyed and may be NULL
+ */
+extern LIBOBJECT_API Object*     newStringExternal(const char*, size_t, StringReleaseFunction, void*);
+/*
+ * create a String over memory that outlives every Object, e.g. a literal
+ */
+extern LIBOBJECT_API Object*     newStringStatic(const char*, size_t);
 extern LIBOBJECT_API Object*     newStringFromSubstr(Object*, size_t, size_t);
+/*
+ * copy n bytes into a new String, flags is a mask of STRING_CHECK_*.
+ * return NULL if a requested check fails
+ */
+extern LIBOBJECT_API Object*     newStringEx(const char*, size_t, unsigned int);
+extern LIBOBJECT_API Object*     newStringUtf8Checked(const char*, size_t);
+extern LIBOBJECT_API int         stringIsValidUtf8(Object*);
+extern LIBOBJECT_API size_t      stringCodePointLength(Object*);
+/*
+ * substring by code point position and count rather than bytes
+ */
+extern LIBOBJECT_API Object*     stringCodePointSubstr(Object*, size_t, size_t);
+extern LIBOBJECT_API Object*     stringCaseFold(Object*);
+extern LIBOBJECT_API int         utf8Validate(const char*, size_t);
+extern LIBOBJECT_API size_t      utf8CodePointCount(const char*, size_t);
+extern LIBOBJECT_API size_t      utf8Advance(const char*, size_t, size_t, size_t);
+extern LIBOBJECT_API size_t      utf8CaseFold(const char*, size_t, char*);
+
+/*
+ * returned by the search functions when there is no match
+ */
+#define STRING_NPOS ((size_t)-1)
+
+extern LIBOBJECT_API size_t      stringIndexOf(Object*, Object*);
+extern LIBOBJECT_API size_t      stringLastIndexOf(Object*, Object*);
+extern LIBOBJECT_API int         stringContains(Object*, Object*);
+/*
+ * number of non overlapping occurrences
+ */
+extern LIBOBJECT_API size_t      stringCount(Object*, Object*);
+extern LIBOBJECT_API Object*     stringReplaceAll(Object*, Object*, Object*);
+extern LIBOBJECT_API size_t      byteSearch(const char*, size_t, const char*, size_t);
+extern LIBOBJECT_API size_t      byteSearchLast(const char*, size_t, const char*, size_t);
+
+/*
+ * multi pattern search, see stringMatcherNew(). The callback gets each match
+ * and returns 0 to stop the scan
+ */
+typedef struct StringMatcher StringMatcher;
+typedef int (*StringMatchFunction)(void* context, size_t pattern, size_t offset);
+
+extern LIBOBJECT_API StringMatcher* stringMatcherNew(Object*);
+extern LIBOBJECT_API size_t      stringMatcherScan(StringMatcher*, Object*, StringMatchFunction, void*);
+extern LIBOBJECT_API size_t      stringMatcherScanBytes(StringMatcher*, const char*, size_t, StringMatchFunction, void*);
+extern LIBOBJECT_API void        stringMatcherFree(StringMatcher*);
+extern LIBOBJECT_API Object*     newBytes(const void*, size_t);
+extern LIBOBJECT_API Object*     newBytesExternal(const void*, size_t, StringReleaseFunction, void*);
+extern LIBOBJECT_API size_t      bytesLength(Object*);
+extern LIBOBJECT_API Object*     bytesToBase64(Object*);
+extern LIBOBJECT_API Object*     bytesToHex(Object*);
+extern LIBOBJECT_API Object*     newBytesFromBase64(const char*, size_t);
+extern LIBOBJECT_API Object*     newBytesFromHex(const char*, size_t);
+extern LIBOBJECT_API size_t      base64EncodedLength(size_t);
+extern LIBOBJECT_API size_t      base64DecodedLength(size_t);
+extern LIBOBJECT_API size_t      base64Encode(const void*, size_t, char*);
+extern LIBOBJECT_API int         base64Decode(const char*, size_t, void*, size_t*);
+extern LIBOBJECT_API size_t      hexEncode(const void*, size_t, char*);
+extern LIBOBJECT_API int         hexDecode(const char*, size_t, void*, size_t*);
 extern LIBOBJECT_API Object*     newFunction(void*);
 extern LIBOBJECT_API Object*     newArray(size_t);
 extern LIBOBJECT_API size_t      arrayPushEx(Object*, Object*);
@@ -161,15 +313,434 @@ extern LIBOBJECT_API Object*     arrayGetEx(Object* object, size_t);
 extern LIBOBJECT_API size_t      arrayPush(Object*, Object*);
 extern LIBOBJECT_API Object*     arrayGet(Object* object, size_t);
 extern LIBOBJECT_API size_t      arraySize(Object*);
+/*
+ * sort an Array in place by objectCompare()
+ */
+extern LIBOBJECT_API void        arraySort(Object*);
+/*
+ * the first index of a sorted Array whose element is not less than key by
+ * objectCompare(), arraySize() if there is none. Check the element there
+ * to search, or insert key there to keep the Array sorted
+ */
+extern LIBOBJECT_API size_t      arrayLowerBound(Object*, Object*);
 
 extern LIBOBJECT_API uint32_t    stringHash(const char* source, size_t length);
 extern LIBOBJECT_API Object*     stringSplit(const char*, char);
 extern LIBOBJECT_API void        objectEcho(Object*);
 extern LIBOBJECT_API void        objectDump(Object*, Object*, size_t);
 extern LIBOBJECT_API void        objectDumpEx(Object*, Object*, size_t);
+/*
+ * objects start with one reference. objectRetain() adds another and
+ * objectDestroy() drops one, freeing the object with the last. A shared
+ * object may sit in several trees, so copy it before editing it
+ */
+extern LIBOBJECT_API Object*     objectRetain(Object*);
 extern LIBOBJECT_API void        objectSafeDestroy(Object*, Object*);
 extern LIBOBJECT_API Object*     copyObject(Object*);
-extern LIBOBJECT_API char*       objectToJson(Object*, int pretty, size_t* length);
+/*
+ * make o and everything under it immutable, returning o, or NULL if a
+ * lazily parsed part of it could not be loaded or memory ran out, leaving
+ * the tree as mutable as it was. A frozen tree may be read,
+ * retained and destroyed from any number of threads at once; mapInsert(),
+ * arrayPush(), mapDelete() and the other mutators refuse it. Freeze a tree
+ * before handing it to other threads. copyObject() of it is not frozen
+ */
+extern LIBOBJECT_API Object*     objectFreeze(Object*);
+extern LIBOBJECT_API int         objectIsFrozen(Object*);
+
+/*
+ * objectToJson() and JSON writer flags
+ */
+#define OBJECT_JSON_PRETTY	0x1	/* one member per line, two space indent */
+#define OBJECT_JSON_ASCII	0x2	/* \u escape everything above U+007F */
+
+/*
+ * receives the serialized text in pieces, return 0 to stop the writer
+ */
+typedef int (*ObjectJsonWriteFunction)(void* context, const char* data, size_t length);
+
+extern LIBOBJECT_API char*       objectToJson(Object*, int flags, size_t* length);
+/*
+ * exact length of the objectToJson() text, not counting the NUL. 0 if the
+ * tree holds a value JSON cannot represent
+ */
+extern LIBOBJECT_API size_t      objectJsonLength(Object*, int);
+/*
+ * like snprintf(): write at most size bytes including the NUL and return
+ * the length of the whole document, 0 on error
+ */
+extern LIBOBJECT_API size_t      objectToJsonBuffer(Object*, int, char*, size_t);
+/*
+ * stream to a FILE*, a file descriptor or a callback without building the
+ * document in memory. Return 1 on success, 0 on error
+ */
+extern LIBOBJECT_API int         objectToJsonFile(Object*, int, FILE*);
+extern LIBOBJECT_API int         objectToJsonFd(Object*, int, int);
+extern LIBOBJECT_API int         objectToJsonCallback(Object*, int, ObjectJsonWriteFunction, void*);
+
+/*
+ * where and why objectFromJson() failed. offset is in bytes from the start
+ * of the input, line and column count from 1 and column is in bytes
+ */
+typedef struct ObjectJsonError {
+	size_t		offset;
+	size_t		line;
+	size_t		column;
+	const char*	message;
+} ObjectJsonError;
+
+/*
+ * objectFromJson() flags
+ */
+#define OBJECT_JSON_NO_UTF8_CHECK	0x100	/* trust that strings are UTF-8 */
+#define OBJECT_JSON_MULTIPLE		0x200	/* ObjectJsonReader: a sequence of documents, e.g. NDJSON */
+/*
+ * check the whole text but only build each Array and Map when it is first
+ * read, keeping a copy of the text until the last one is destroyed. A
+ * container never read is written out by objectToJson() as its source
+ * text minus white space. Reading a lazy tree changes it, so threads
+ * must not share one without a lock
+ */
+#define OBJECT_JSON_LAZY		0x400
+
+/*
+ * deepest nesting of arrays and maps objectFromJson() accepts
+ */
+#define OBJECT_JSON_MAX_DEPTH	1024
+
+/*
+ * parse len bytes of RFC 8259 JSON. Integers that fit in a long become
+ * Long, other numbers Double. Duplicate keys keep the last value. Return
+ * NULL on error and fill in err if it is not NULL
+ */
+extern LIBOBJECT_API Object*     objectFromJson(const char*, size_t, unsigned int, ObjectJsonError*);
+
+/*
+ * Hash-consing. objectCanonicalize() takes ownership of a tree and returns
+ * it with every subtree equal to one the table has seen replaced by that
+ * shared instance, so repeated substructures are stored once. The result
+ * may itself be shared: treat canonical trees as read-only, copyObject()
+ * before editing, and destroy them as usual. Functions and Pointers are
+ * never shared. Trees stay valid after the table is freed
+ */
+typedef struct ObjectCanonTable ObjectCanonTable;
+
+typedef struct ObjectCanonStats {
+	size_t		objects;	/* distinct subtrees in the table */
+	size_t		lookups;	/* nodes passed through it */
+	size_t		shared;		/* nodes replaced by an existing instance */
+	size_t		bytes_saved;	/* heap those replacements freed */
+} ObjectCanonStats;
+
+extern LIBOBJECT_API ObjectCanonTable* objectCanonTableNew(void);
+extern LIBOBJECT_API void        objectCanonTableFree(ObjectCanonTable*);
+extern LIBOBJECT_API void        objectCanonTableStats(ObjectCanonTable*, ObjectCanonStats*);
+extern LIBOBJECT_API Object*     objectCanonicalize(Object*, ObjectCanonTable*);
+/*
+ * objectFromJson() interning each value through the table as it is built,
+ * so duplicates are freed straight away. OBJECT_JSON_LAZY is ignored
+ */
+extern LIBOBJECT_API Object*     objectFromJsonCanonical(const char*, size_t, unsigned int,
+	ObjectCanonTable*, ObjectJsonError*);
+
+/*
+ * Pull parser for JSON that arrives in pieces. Feed it chunks and call
+ * jsonReaderNext() until it asks for more. A chunk is read in place and
+ * must stay valid until then; only a token cut by the end of a chunk is
+ * copied, so memory use depends on the longest string and the nesting,
+ * not on the size of the document.
+ */
+typedef struct ObjectJsonReader ObjectJsonReader;
+
+typedef enum ObjectJsonEvent {
+	OBJECT_JSON_NEED_MORE,		/* feed the next chunk, or finish */
+	OBJECT_JSON_START_MAP,
+	OBJECT_JSON_END_MAP,
+	OBJECT_JSON_START_ARRAY,
+	OBJECT_JSON_END_ARRAY,
+	OBJECT_JSON_KEY,
+	OBJECT_JSON_VALUE,		/* a string, number, bool or null */
+	OBJECT_JSON_END,		/* input finished after a complete document */
+	OBJECT_JSON_ERROR
+} ObjectJsonEvent;
+
+extern LIBOBJECT_API ObjectJsonReader* newJsonReader(unsigned int);
+extern LIBOBJECT_API void        jsonReaderFree(ObjectJsonReader*);
+/*
+ * hand over the next chunk, only once the previous one is used up. Returns 0
+ * if it is not
+ */
+extern LIBOBJECT_API int         jsonReaderFeed(ObjectJsonReader*, const char*, size_t);
+/*
+ * no more chunks will follow
+ */
+extern LIBOBJECT_API void        jsonReaderFinish(ObjectJsonReader*);
+extern LIBOBJECT_API ObjectJsonEvent jsonReaderNext(ObjectJsonReader*);
+/*
+ * the unescaped text of the current key or string value, not NUL
+ * terminated and valid until the next call on the reader, otherwise NULL
+ */
+extern LIBOBJECT_API const char* jsonReaderString(ObjectJsonReader*, size_t*);
+/*
+ * after a VALUE, START_MAP, START_ARRAY or KEY event, build that value or
+ * the one following the key into *out, subtree and all. Returns
+ * OBJECT_JSON_VALUE when done, OBJECT_JSON_NEED_MORE to be called again
+ * after feeding, or OBJECT_JSON_ERROR
+ */
+extern LIBOBJECT_API ObjectJsonEvent jsonReaderValue(ObjectJsonReader*, Object**);
+/*
+ * the same, but pass over the value without allocating. Skipped containers
+ * are only checked for balanced brackets
+ */
+extern LIBOBJECT_API ObjectJsonEvent jsonReaderSkip(ObjectJsonReader*);
+/*
+ * number of maps and arrays open around the current position
+ */
+extern LIBOBJECT_API size_t      jsonReaderDepth(ObjectJsonReader*);
+/*
+ * fill err and return 1 once the reader has failed
+ */
+extern LIBOBJECT_API int         jsonReaderError(ObjectJsonReader*, ObjectJsonError*);
+
+/*
+ * Newline delimited JSON, one document per line. Lines are parsed on
+ * worker threads, one per CPU, but records reach the callback in input
+ * order on the calling thread. The callback owns the record and returns 0
+ * to stop early. Blank lines are skipped
+ */
+typedef int (*ObjectNdjsonFunction)(void* context, Object* record, size_t index);
+
+/*
+ * return 1 once the input is read or the callback stopped, 0 on error with
+ * err filled in. err->line and err->offset count from the start of the
+ * input, and records before the bad line have been delivered
+ */
+extern LIBOBJECT_API int         ndjsonReadBuffer(const char*, size_t, unsigned int, ObjectNdjsonFunction, void*, ObjectJsonError*);
+extern LIBOBJECT_API int         ndjsonReadFile(FILE*, unsigned int, ObjectNdjsonFunction, void*, ObjectJsonError*);
+/*
+ * every record in one Array, or NULL on error
+ */
+extern LIBOBJECT_API Object*     newArrayFromNdjson(const char*, size_t, unsigned int, ObjectJsonError*);
+/*
+ * write each element of an Array on its own line. Lines are formatted on
+ * worker threads and written in order. OBJECT_JSON_PRETTY is ignored.
+ * Return 1 on success, 0 on error
+ */
+extern LIBOBJECT_API int         ndjsonWrite(Object*, int, ObjectJsonWriteFunction, void*);
+extern LIBOBJECT_API int         ndjsonWriteFile(Object*, int, FILE*);
+
+/*
+ * MessagePack. Null, Bool, Long, Double, String, Bytes as bin, Array, Map
+ * and Pair as a two element array can be encoded, Functions and Pointers
+ * cannot. objectMsgpackLength() is the exact encoded size, 0 if the tree
+ * cannot be encoded
+ */
+extern LIBOBJECT_API size_t      objectMsgpackLength(Object*);
+/*
+ * the encoding in a malloc'd buffer, NULL on error
+ */
+extern LIBOBJECT_API char*       objectToMsgpack(Object*, size_t*);
+/*
+ * like snprintf(): write at most size bytes and return the length of the
+ * whole encoding, 0 on error. The buffer holds it only if it fit
+ */
+extern LIBOBJECT_API size_t      objectToMsgpackBuffer(Object*, char*, size_t);
+
+/*
+ * deepest nesting of arrays and maps objectFromMsgpack() accepts
+ */
+#define OBJECT_MSGPACK_MAX_DEPTH	1024
+
+/*
+ * decode one value. With consumed NULL it must fill the input, otherwise
+ * the bytes used are stored there so values can be read back to back.
+ * Integers past LONG_MAX become Double and float 32 widens to Double. Map
+ * keys must be strings and extension types are rejected. NULL on error
+ */
+extern LIBOBJECT_API Object*     objectFromMsgpack(const char*, size_t, size_t*);
+
+/*
+ * Snapshots. objectSnapshotWrite() stores a tree at the current position of
+ * a seekable fd in a form objectSnapshotOpen() maps read-only and reads in
+ * place, with no parse step. Processes opening the same file share its pages.
+ * Functions and Pointers cannot be stored. Replace a snapshot by renaming a
+ * new file over it, readers of a mapped file that shrinks get SIGBUS.
+ * Return 1 on success, 0 on error
+ */
+typedef struct ObjectSnapshot ObjectSnapshot;
+/*
+ * a value inside a snapshot, 0 when there is none
+ */
+typedef uint64_t ObjectSnapshotRef;
+
+extern LIBOBJECT_API int         objectSnapshotWrite(Object*, int);
+/*
+ * NULL unless the file was written by objectSnapshotWrite() on a machine of
+ * the same byte order
+ */
+extern LIBOBJECT_API ObjectSnapshot* objectSnapshotOpen(const char*);
+extern LIBOBJECT_API void        objectSnapshotClose(ObjectSnapshot*);
+extern LIBOBJECT_API ObjectSnapshotRef snapshotRoot(ObjectSnapshot*);
+/*
+ * the ObjectType of ref, -1 if ref is 0
+ */
+extern LIBOBJECT_API int         snapshotType(ObjectSnapshot*, ObjectSnapshotRef);
+extern LIBOBJECT_API long        snapshotLong(ObjectSnapshot*, ObjectSnapshotRef);
+extern LIBOBJECT_API double      snapshotDouble(ObjectSnapshot*, ObjectSnapshotRef);
+/*
+ * the bytes of a String or Bytes inside the mapping, NUL terminated and
+ * valid until objectSnapshotClose()
+ */
+extern LIBOBJECT_API const char* snapshotString(ObjectSnapshot*, ObjectSnapshotRef, size_t*);
+/*
+ * elements of an Array or Map, 2 for a Pair
+ */
+extern LIBOBJECT_API size_t      snapshotSize(ObjectSnapshot*, ObjectSnapshotRef);
+extern LIBOBJECT_API ObjectSnapshotRef snapshotArrayGet(ObjectSnapshot*, ObjectSnapshotRef, size_t);
+/*
+ * hashed lookup in the mapped table, 0 if the key is absent
+ */
+extern LIBOBJECT_API ObjectSnapshotRef snapshotMapSearch(ObjectSnapshot*, ObjectSnapshotRef, const char*, size_t);
+/*
+ * the index'th key and value of a Map, for iteration
+ */
+extern LIBOBJECT_API const char* snapshotMapKey(ObjectSnapshot*, ObjectSnapshotRef, size_t, size_t*);
+extern LIBOBJECT_API ObjectSnapshotRef snapshotMapValue(ObjectSnapshot*, ObjectSnapshotRef, size_t);
+/*
+ * copy ref and everything under it into an ordinary tree
+ */
+extern LIBOBJECT_API Object*     snapshotToObject(ObjectSnapshot*, ObjectSnapshotRef);
+
+/*
+ * JSONPath queries, compiled once and run against any number of trees:
+ * $, .name, ['name'], [n], [start:end:step], .*, [*] and .. for any depth.
+ * NULL on a syntax error
+ */
+typedef struct ObjectPath ObjectPath;
+
+extern LIBOBJECT_API ObjectPath* objectPathCompile(const char*);
+extern LIBOBJECT_API void        objectPathFree(ObjectPath*);
+/*
+ * the first match, or NULL. Allocates nothing, the result belongs to the tree
+ */
+extern LIBOBJECT_API Object*     objectPathGet(ObjectPath*, Object*);
+/*
+ * stores up to max matches, owned by the tree, and returns how many there
+ * are in all, like snprintf()
+ */
+extern LIBOBJECT_API size_t      objectPathEval(ObjectPath*, Object*, Object**, size_t);
+
+/*
+ * JSON Patch (RFC 6902) and JSON Merge Patch (RFC 7396). objectDiff()
+ * returns a new Array of add, remove and replace operations that turns
+ * from into to, NULL on error. The apply functions edit *document in
+ * place, replacing it when the root changes, and return 1 on success.
+ * objectApplyPatch() stops at the first operation that fails, leaving
+ * the ones before it applied, so patch a copy to apply all or nothing.
+ * A frozen document, or a frozen Map reached by a merge patch, is patched
+ * as a copy that takes its place, leaving the original to its other holders
+ */
+extern LIBOBJECT_API Object*     objectDiff(Object*, Object*);
+extern LIBOBJECT_API int         objectApplyPatch(Object**, Object*);
+extern LIBOBJECT_API int         objectMergePatch(Object**, Object*);
+
+/*
+ * A cell holds a root that writers replace while readers keep using it.
+ * cellAcquire() returns the current root without locking, valid until the
+ * thread's matching cellRelease(); sections may nest, across cells too.
+ * objectRetain() a root to keep it longer. cellPublish() freezes root,
+ * takes ownership of it and makes it current, returning 1, or 0 with root
+ * still the caller's. Publishing the current root again does nothing and
+ * takes no reference. An old root is destroyed once every read section
+ * that could see it has ended; cellSynchronize() waits for that, so do not
+ * call it from inside a read section. newObjectCell() takes ownership of
+ * its first root and cellFree() needs every reader to be done
+ */
+typedef struct ObjectCell ObjectCell;
+
+extern LIBOBJECT_API ObjectCell* newObjectCell(Object*);
+extern LIBOBJECT_API void        cellFree(ObjectCell*);
+extern LIBOBJECT_API Object*     cellAcquire(ObjectCell*);
+extern LIBOBJECT_API void        cellRelease(ObjectCell*);
+extern LIBOBJECT_API int         cellPublish(ObjectCell*, Object*);
+extern LIBOBJECT_API void        cellSynchronize(ObjectCell*);
+
+/*
+ * A Map that any number of threads may use at once. Searches take no
+ * locks, writers lock one of several stripes, and growing the table is
+ * shared out between the writers. concurrentMapInsert() freezes value and
+ * takes ownership of it, replacing any value under key, and returns 0 with
+ * value still the caller's on failure. concurrentMapSearch() returns a new
+ * reference to the value, which the caller destroys, or NULL.
+ * concurrentMapToMap() copies the members into a Map sharing their values;
+ * with writers running it sees each member as of some moment during the
+ * call. concurrentMapFree() needs every other thread to be done
+ */
+typedef struct ObjectConcurrentMap ObjectConcurrentMap;
+
+extern LIBOBJECT_API ObjectConcurrentMap* newConcurrentMap(uint32_t);
+extern LIBOBJECT_API void        concurrentMapFree(ObjectConcurrentMap*);
+extern LIBOBJECT_API int         concurrentMapInsert(ObjectConcurrentMap*, const char*, Object*);
+extern LIBOBJECT_API Object*     concurrentMapSearch(ObjectConcurrentMap*, const char*);
+extern LIBOBJECT_API int         concurrentMapDelete(ObjectConcurrentMap*, const char*);
+extern LIBOBJECT_API uint32_t    concurrentMapSize(ObjectConcurrentMap*);
+extern LIBOBJECT_API Object*     concurrentMapToMap(ObjectConcurrentMap*);
+
+/*
+ * Loops over an Array or a Map on a pool of threads, one per CPU, that
+ * steal work from each other. An Array is split by index and a Map by
+ * bucket into ranges of about grain elements or buckets, 0 picking a size
+ * from the length. Elements are borrowed, and each is handed to exactly
+ * one call; key is NULL for an Array and index is a bucket for a Map. The
+ * container must not change until the loop returns, and callbacks may
+ * start loops of their own
+ */
+typedef void (*ObjectParallelFunction)(void* context, size_t index, const char* key, Object* value);
+
+extern LIBOBJECT_API int         objectParallelForEach(Object*, ObjectParallelFunction, void*, size_t);
+
+/*
+ * arrayMap() fills a new Array with what fn returns for each element, the
+ * new Array owning it, and fails if fn returns NULL. arrayFilter() returns
+ * a new Array sharing the elements fn returned nonzero for, in order.
+ * arrayReduce() combines the elements with fn, which must be associative:
+ * runs of elements are folded from the left in parallel and the results
+ * are then folded in order. fn returns a new Object from two borrowed
+ * ones. It returns NULL for an empty Array or when fn returns NULL, and a
+ * new reference to the element of an Array of one
+ */
+typedef Object* (*ObjectArrayMapFunction)(void* context, size_t index, Object* value);
+typedef int (*ObjectArrayFilterFunction)(void* context, size_t index, Object* value);
+typedef Object* (*ObjectArrayReduceFunction)(void* context, Object* left, Object* right);
+
+extern LIBOBJECT_API Object*     arrayMap(Object*, ObjectArrayMapFunction, void*, size_t);
+extern LIBOBJECT_API Object*     arrayFilter(Object*, ObjectArrayFilterFunction, void*, size_t);
+extern LIBOBJECT_API Object*     arrayReduce(Object*, ObjectArrayReduceFunction, void*, size_t);
+
+/*
+ * objectDestroyAsync() drops a reference like objectDestroy() but leaves
+ * destroying a tree to a background thread and returns at once. Small
+ * trees are destroyed in place, and so is any tree that would take the
+ * bytes waiting past objectDestroyAsyncLimit(), 64 MB to start with. A
+ * limit of 0 makes objectDestroyAsync() always destroy in place, and
+ * those trees are not counted as overflowed. Bytes waiting are estimated from a
+ * sample of each tree, bytes reclaimed are counted as they are freed. A
+ * tree sharing unfrozen subtrees with trees still in use must be destroyed
+ * in place. objectDestroyAsyncDrain() waits until nothing is waiting, e.g.
+ * before exit
+ */
+typedef struct ObjectAsyncStats {
+	size_t		queued;		/* trees waiting or being destroyed */
+	size_t		pending_bytes;	/* estimated size of those */
+	size_t		reclaimed;	/* trees the background thread destroyed */
+	size_t		reclaimed_bytes;	/* heap it freed doing so */
+	size_t		overflowed;	/* trees destroyed in place over the limit */
+} ObjectAsyncStats;
+
+extern LIBOBJECT_API void        objectDestroyAsync(Object*);
+extern LIBOBJECT_API void        objectDestroyAsyncLimit(size_t);
+extern LIBOBJECT_API void        objectDestroyAsyncStats(ObjectAsyncStats*);
+extern LIBOBJECT_API void        objectDestroyAsyncDrain(void);
 extern LIBOBJECT_API void        object_print_stats(Object *);
 
 #define objectDestroy(o) objectSafeDestroy(o, NULL)
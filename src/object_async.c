@@ -0,0 +1,304 @@
+/*
+ *  Copyright (c) 2015 Ryan McCullagh <me@ryanmccullagh.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Destroying trees off the calling thread.
+ *
+ * objectDestroyAsync() appends a tree to a queue that one reclaimer
+ * thread, started on first use, empties. Callers append with a single
+ * atomic exchange on the tail of an intrusive list, so none of them ever
+ * waits for another, and the reclaimer is the only one taking from the
+ * head. The lock is only for putting the reclaimer to sleep on an empty
+ * queue and waking it. Each tree is charged to a pending byte count at an
+ * estimate from a sample of its nodes, and a caller that would take the
+ * count past the limit destroys its tree itself. A limit of 0 destroys
+ * every tree in place without counting it as an overflow.
+ *
+ * Where there is SCHED_BATCH the reclaimer runs under it, so waking it
+ * does not preempt the caller that just handed it a tree.
+ */
+
+/* for SCHED_BATCH */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "object.h"
+#include "object_private.h"
+
+#define ASYNC_SAMPLE		256	/* nodes an estimate looks at, roughly */
+#define ASYNC_SPREAD		16	/* children of one container it looks at */
+#define ASYNC_INLINE_BYTES	1024	/* cheaper to free than to queue */
+#define ASYNC_DEFAULT_LIMIT	((size_t)64 << 20)
+
+typedef struct AsyncNode {
+	struct AsyncNode*	next;
+	Object*			o;
+	size_t			estimate;
+} AsyncNode;
+
+static struct {
+	AsyncNode*	head;		/* the reclaimer's end */
+	AsyncNode*	tail;		/* the callers' end */
+	AsyncNode	stub;		/* keeps the list from ever being empty */
+	pthread_mutex_t	lock;
+	pthread_cond_t	wake;
+	pthread_cond_t	drained;
+	int		sleeping;
+	int		running;
+	size_t		limit;
+	size_t		queued;
+	size_t		pending_bytes;
+	size_t		reclaimed;
+	size_t		reclaimed_bytes;
+	size_t		overflowed;
+} async = {
+	.head = &async.stub,
+	.tail = &async.stub,
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.wake = PTHREAD_COND_INITIALIZER,
+	.drained = PTHREAD_COND_INITIALIZER,
+	.limit = ASYNC_DEFAULT_LIMIT,
+};
+
+static pthread_once_t async_once = PTHREAD_ONCE_INIT;
+
+static void async_push(AsyncNode* n)
+{
+	AsyncNode* prev;
+
+	n->next = NULL;
+	prev = __atomic_exchange_n(&async.tail, n, __ATOMIC_ACQ_REL);
+	/* until this store the reclaimer sees the list end at prev */
+	__atomic_store_n(&prev->next, n, __ATOMIC_RELEASE);
+}
+
+/*
+ * the oldest node, NULL when there is none or a caller is halfway through
+ * appending it
+ */
+static AsyncNode* async_pop(void)
+{
+	AsyncNode* head = async.head;
+	AsyncNode* next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+
+	if(head == &async.stub) {
+		if(next == NULL)
+			return NULL;
+		async.head = head = next;
+		next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+	}
+	if(next != NULL) {
+		async.head = next;
+		return head;
+	}
+	if(__atomic_load_n(&async.tail, __ATOMIC_ACQUIRE) != head)
+		return NULL;
+	/* head is the last node: put the stub behind it to take it */
+	async_push(&async.stub);
+	next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+	if(next == NULL)
+		return NULL;
+	async.head = next;
+	return head;
+}
+
+static void* async_reclaimer(void* arg)
+{
+	AsyncNode* n;
+	size_t freed;
+	(void)arg;
+
+#ifdef SCHED_BATCH
+	{
+		struct sched_param param = { 0 };
+		pthread_setschedparam(pthread_self(), SCHED_BATCH, &param);
+	}
+#endif
+	for(;;) {
+		if((n = async_pop()) == NULL) {
+			/* counted before it is appended, so one is on its way */
+			if(__atomic_load_n(&async.queued, __ATOMIC_SEQ_CST) != 0) {
+				sched_yield();
+				continue;
+			}
+			pthread_mutex_lock(&async.lock);
+			__atomic_store_n(&async.sleeping, 1, __ATOMIC_SEQ_CST);
+			while(__atomic_load_n(&async.queued, __ATOMIC_SEQ_CST) == 0)
+				pthread_cond_wait(&async.wake, &async.lock);
+			__atomic_store_n(&async.sleeping, 0, __ATOMIC_RELAXED);
+			pthread_mutex_unlock(&async.lock);
+			continue;
+		}
+		freed = objectDestroyCounted(n->o);
+		__atomic_sub_fetch(&async.pending_bytes, n->estimate, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&async.reclaimed_bytes, freed, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&async.reclaimed, 1, __ATOMIC_RELAXED);
+		free(n);
+		if(__atomic_sub_fetch(&async.queued, 1, __ATOMIC_SEQ_CST) == 0) {
+			pthread_mutex_lock(&async.lock);
+			pthread_cond_broadcast(&async.drained);
+			pthread_mutex_unlock(&async.lock);
+		}
+	}
+	return NULL;
+}
+
+static void async_start(void)
+{
+	pthread_t thread;
+
+	if(pthread_create(&thread, NULL, async_reclaimer, NULL) != 0) {
+		fprintf(get_debug_fp(), "%s(): no reclaimer thread, destroying in place\n", __func__);
+		return;
+	}
+	pthread_detach(thread);
+	async.running = 1;
+}
+
+/*
+ * objectFootprint() of the tree under o, from about budget nodes. An Array
+ * or Map is assumed to hold more children like the few evenly spaced ones
+ * looked at, and with the budget spent one child still stands in for all
+ * of them, so depth is always seen
+ */
+static size_t async_estimate(Object* o, size_t budget)
+{
+	size_t shell, sum = 0, seen = 0, n, want, share, j;
+
+	if(o == NULL)
+		return 0;
+	if((O_FLG(o) & OBJECT_FLAG_LAZY) ||
+		(O_TYPE(o) != IS_ARRAY && O_TYPE(o) != IS_MAP && O_TYPE(o) != IS_PAIR))
+		return objectFootprint(o);
+
+	switch(O_TYPE(o)) {
+		case IS_ARRAY:
+			shell = sizeof(Object) + sizeof(Array) + O_AVAL(o)->capacity * sizeof(Object*);
+			n = O_AVAL(o)->size;
+		break;
+		case IS_MAP:
+			shell = sizeof(Object) + sizeof(Map) + O_MVAL(o)->capacity * sizeof(Bucket*);
+			n = O_MVAL(o)->size;
+		break;
+		default:
+			shell = sizeof(Object) + sizeof(Pair);
+			n = 2;
+		break;
+	}
+	if(n == 0)
+		return shell;
+	want = n < ASYNC_SPREAD ? n : ASYNC_SPREAD;
+	if(want > budget)
+		want = budget > 0 ? budget : 1;
+	share = budget > want ? (budget - want) / want : 0;
+
+	if(O_TYPE(o) == IS_PAIR) {
+		sum = async_estimate(O_PVAL(o)->first, share) + async_estimate(O_PVAL(o)->second, share);
+		seen = 2;
+	} else if(O_TYPE(o) == IS_ARRAY) {
+		for(j = 0; j < want; j++, seen++)
+			sum += async_estimate(O_AVAL(o)->table[j * n / want], share);
+	} else {
+		Map* map = O_MVAL(o);
+		size_t capacity = map->capacity;
+		/* whole chains of evenly spaced buckets */
+		if(want > capacity)
+			want = capacity;
+		for(j = 0; j < want; j++) {
+			Bucket* b;
+			for(b = map->buckets[j * capacity / want]; b != NULL; b = b->next, seen++)
+				sum += sizeof(Bucket) + sizeof(String) + b->key->length + 1 +
+					async_estimate(b->value, share);
+		}
+		if(seen == 0)
+			return shell + n * (sizeof(Bucket) + sizeof(String) + sizeof(Object));
+	}
+	return shell + sum / seen * n;
+}
+
+LIBOBJECT_API void objectDestroyAsync(Object* o)
+{
+	AsyncNode* n;
+	size_t estimate;
+
+	if(o == NULL)
+		return;
+	/* a reference that is not the last is dropped here and now */
+	if(O_FLG(o) & OBJECT_FLAG_FROZEN) {
+		if(__atomic_sub_fetch(&O_REFCNT(o), 1, __ATOMIC_ACQ_REL) != 0)
+			return;
+		__atomic_store_n(&O_REFCNT(o), 1, __ATOMIC_RELAXED);
+	} else if(O_REFCNT(o) > 1) {
+		O_REFCNT(o)--;
+		return;
+	}
+
+	pthread_once(&async_once, async_start);
+	/* a limit of 0 turns queueing off, it does not overflow */
+	if(!async.running || __atomic_load_n(&async.limit, __ATOMIC_RELAXED) == 0 ||
+		(estimate = async_estimate(o, ASYNC_SAMPLE)) < ASYNC_INLINE_BYTES) {
+		objectDestroy(o);
+		return;
+	}
+	if(__atomic_add_fetch(&async.pending_bytes, estimate, __ATOMIC_RELAXED) >
+		__atomic_load_n(&async.limit, __ATOMIC_RELAXED) ||
+		(n = malloc(sizeof(AsyncNode))) == NULL) {
+		__atomic_sub_fetch(&async.pending_bytes, estimate, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&async.overflowed, 1, __ATOMIC_RELAXED);
+		objectDestroy(o);
+		return;
+	}
+	n->o = o;
+	n->estimate = estimate;
+	__atomic_add_fetch(&async.queued, 1, __ATOMIC_SEQ_CST);
+	async_push(n);
+	/* the reclaimer sets sleeping before it looks at queued for the last time */
+	if(__atomic_load_n(&async.sleeping, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&async.lock);
+		pthread_cond_signal(&async.wake);
+		pthread_mutex_unlock(&async.lock);
+	}
+}
+
+LIBOBJECT_API void objectDestroyAsyncLimit(size_t bytes)
+{
+	__atomic_store_n(&async.limit, bytes, __ATOMIC_RELAXED);
+}
+
+LIBOBJECT_API void objectDestroyAsyncStats(ObjectAsyncStats* stats)
+{
+	BUG_ON_NULL(stats);
+
+	stats->queued = __atomic_load_n(&async.queued, __ATOMIC_RELAXED);
+	stats->pending_bytes = __atomic_load_n(&async.pending_bytes, __ATOMIC_RELAXED);
+	stats->reclaimed = __atomic_load_n(&async.reclaimed, __ATOMIC_RELAXED);
+	stats->reclaimed_bytes = __atomic_load_n(&async.reclaimed_bytes, __ATOMIC_RELAXED);
+	stats->overflowed = __atomic_load_n(&async.overflowed, __ATOMIC_RELAXED);
+}
+
+LIBOBJECT_API void objectDestroyAsyncDrain(void)
+{
+	pthread_mutex_lock(&async.lock);
+	while(__atomic_load_n(&async.queued, __ATOMIC_SEQ_CST) != 0)
+		pthread_cond_wait(&async.drained, &async.lock);
+	pthread_mutex_unlock(&async.lock);
+}
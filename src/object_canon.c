@@ -0,0 +1,276 @@
+/*
+ *  Copyright (c) 2015 Ryan McCullagh <me@ryanmccullagh.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Hash-consing. A table holds one instance of every distinct subtree it
+ * has seen, and trees passed through it are rebuilt bottom up so that
+ * equal subtrees become the same Object, shared by reference count.
+ *
+ * Children are interned before their parent, so two containers are equal
+ * exactly when their children are the same pointers: interning a node
+ * never looks deeper than one level. Scalars are matched exactly, a
+ * Double by its bits, so -0.0 and 0.0 stay apart. Functions and Pointers
+ * are never shared.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "object.h"
+#include "object_private.h"
+
+#define CANON_INITIAL_CAPACITY 1024
+
+typedef struct CanonEntry {
+	uint64_t	hash;
+	Object*		object;
+} CanonEntry;
+
+struct ObjectCanonTable {
+	CanonEntry*	entries;
+	size_t		capacity;	/* a power of two */
+	ObjectCanonStats stats;
+};
+
+static uint64_t canon_mix(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+static uint64_t canon_combine(uint64_t seed, uint64_t value)
+{
+	return canon_mix(seed * 0x9e3779b97f4a7c15ULL + value);
+}
+
+/*
+ * hash a node whose children are already interned, by their addresses
+ */
+static uint64_t canon_hash(Object* o)
+{
+	uint64_t hash = canon_mix(O_TYPE(o) + 1);
+
+	switch(O_TYPE(o)) {
+		case IS_ARRAY: {
+			Array* array = O_AVAL(o);
+			size_t i;
+			for(i = 0; i < array->size; i++)
+				hash = canon_combine(hash, (uintptr_t)array->table[i]);
+			return canon_combine(hash, array->size);
+		}
+		case IS_MAP: {
+			Map* map = O_MVAL(o);
+			uint64_t sum = 0;
+			uint32_t i, left;
+			Bucket* b;
+			for(i = 0, left = map->size; i < map->capacity && left; i++) {
+				for(b = map->buckets[i]; b != NULL; b = b->next, left--)
+					sum += canon_combine(b->hash, (uintptr_t)b->value);
+			}
+			return canon_combine(canon_combine(hash, sum), map->size);
+		}
+		case IS_PAIR:
+			hash = canon_combine(hash, (uintptr_t)O_PVAL(o)->first);
+			return canon_combine(hash, (uintptr_t)O_PVAL(o)->second);
+		default:
+			return objectHash(o);
+	}
+}
+
+static int canon_equal(Object* a, Object* b)
+{
+	if(a == b)
+		return 1;
+	if(O_TYPE(a) != O_TYPE(b))
+		return 0;
+
+	switch(O_TYPE(a)) {
+		case IS_NULL:
+			return 1;
+		case IS_BOOL:
+			return !O_BVAL(a) == !O_BVAL(b);
+		case IS_LONG:
+			return O_LVAL(a) == O_LVAL(b);
+		case IS_DOUBLE:
+			return memcmp(&O_DVAL(a), &O_DVAL(b), sizeof(double)) == 0;
+		case IS_STRING:
+		case IS_BYTES:
+			return O_SVAL(a)->length == O_SVAL(b)->length &&
+				memcmp(O_SVAL(a)->value, O_SVAL(b)->value, O_SVAL(a)->length) == 0;
+		case IS_ARRAY:
+			return O_AVAL(a)->size == O_AVAL(b)->size && (O_AVAL(a)->size == 0 ||
+				memcmp(O_AVAL(a)->table, O_AVAL(b)->table, O_AVAL(a)->size * sizeof(Object*)) == 0);
+		case IS_MAP: {
+			Map* map = O_MVAL(a);
+			uint32_t i, left;
+			Bucket* k;
+			if(map->size != O_MVAL(b)->size)
+				return 0;
+			for(i = 0, left = map->size; i < map->capacity && left; i++) {
+				for(k = map->buckets[i]; k != NULL; k = k->next, left--) {
+					if(mapSearchHashed(b, k->key->value, k->key->length, k->hash) != k->value)
+						return 0;
+				}
+			}
+			return 1;
+		}
+		case IS_PAIR:
+			return O_PVAL(a)->first == O_PVAL(b)->first && O_PVAL(a)->second == O_PVAL(b)->second;
+		default:
+			return 0;
+	}
+}
+
+static int canon_grow(ObjectCanonTable* table)
+{
+	size_t capacity = table->capacity * 2;
+	CanonEntry* entries = calloc(capacity, sizeof(CanonEntry));
+	size_t i, k;
+
+	if(entries == NULL)
+		return 0;
+	for(i = 0; i < table->capacity; i++) {
+		if(table->entries[i].object == NULL)
+			continue;
+		for(k = table->entries[i].hash & (capacity - 1); entries[k].object != NULL;
+			k = (k + 1) & (capacity - 1))
+			;
+		entries[k] = table->entries[i];
+	}
+	free(table->entries);
+	table->entries = entries;
+	table->capacity = capacity;
+	return 1;
+}
+
+Object* canonIntern(ObjectCanonTable* table, Object* o)
+{
+	uint64_t hash;
+	size_t k;
+
+	if(O_TYPE(o) == IS_FUNCTION || O_TYPE(o) == IS_POINTER || O_TYPE(o) == IS_OBJECT ||
+		(O_FLG(o) & OBJECT_FLAG_LAZY))
+		return o;
+
+	table->stats.lookups++;
+	hash = canon_hash(o);
+	for(k = hash & (table->capacity - 1); table->entries[k].object != NULL;
+		k = (k + 1) & (table->capacity - 1)) {
+		Object* found = table->entries[k].object;
+		if(table->entries[k].hash != hash || !canon_equal(found, o))
+			continue;
+		if(found != o) {
+			table->stats.shared++;
+			if(O_REFCNT(o) == 1)
+				table->stats.bytes_saved += objectFootprint(o);
+			objectDestroy(o);
+			objectRetain(found);
+		}
+		return found;
+	}
+
+	/* kept at most half full, and left out of the table if it cannot grow */
+	if((table->stats.objects + 1) * 2 > table->capacity) {
+		if(!canon_grow(table))
+			return o;
+		for(k = hash & (table->capacity - 1); table->entries[k].object != NULL;
+			k = (k + 1) & (table->capacity - 1))
+			;
+	}
+	table->entries[k].hash = hash;
+	table->entries[k].object = objectRetain(o);
+	table->stats.objects++;
+	return o;
+}
+
+LIBOBJECT_API ObjectCanonTable* objectCanonTableNew(void)
+{
+	ObjectCanonTable* table = calloc(1, sizeof(ObjectCanonTable));
+
+	if(table == NULL)
+		return NULL;
+	table->capacity = CANON_INITIAL_CAPACITY;
+	table->entries = calloc(table->capacity, sizeof(CanonEntry));
+	if(table->entries == NULL) {
+		free(table);
+		return NULL;
+	}
+	return table;
+}
+
+LIBOBJECT_API void objectCanonTableFree(ObjectCanonTable* table)
+{
+	size_t i;
+
+	if(table == NULL)
+		return;
+	for(i = 0; i < table->capacity; i++)
+		objectDestroy(table->entries[i].object);
+	free(table->entries);
+	free(table);
+}
+
+LIBOBJECT_API void objectCanonTableStats(ObjectCanonTable* table, ObjectCanonStats* stats)
+{
+	BUG_ON_NULL(table);
+	BUG_ON_NULL(stats);
+	*stats = table->stats;
+}
+
+LIBOBJECT_API Object* objectCanonicalize(Object* o, ObjectCanonTable* table)
+{
+	BUG_ON_NULL(o);
+	BUG_ON_NULL(table);
+
+	/* the children of a frozen node stay as they are */
+	if(O_FLG(o) & OBJECT_FLAG_FROZEN)
+		return canonIntern(table, o);
+	if(!objectLoad(o))
+		return o;
+	switch(O_TYPE(o)) {
+		case IS_ARRAY: {
+			Array* array = O_AVAL(o);
+			size_t i;
+			for(i = 0; i < array->size; i++)
+				array->table[i] = objectCanonicalize(array->table[i], table);
+		}
+		break;
+		case IS_MAP: {
+			Map* map = O_MVAL(o);
+			uint32_t i, left;
+			Bucket* b;
+			for(i = 0, left = map->size; i < map->capacity && left; i++) {
+				for(b = map->buckets[i]; b != NULL; b = b->next, left--)
+					b->value = objectCanonicalize(b->value, table);
+			}
+		}
+		break;
+		case IS_PAIR:
+			O_PVAL(o)->first = objectCanonicalize(O_PVAL(o)->first, table);
+			O_PVAL(o)->second = objectCanonicalize(O_PVAL(o)->second, table);
+			break;
+		default:
+			break;
+	}
+	return canonIntern(table, o);
+}
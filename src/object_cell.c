@@ -0,0 +1,131 @@
+/*
+ *  Copyright (c) 2015 Ryan McCullagh <me@ryanmccullagh.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Cells: a root that readers use without locks while writers replace it,
+ * in the manner of RCU.
+ *
+ * Readers are epoch readers, see object_epoch.c. A writer swaps the root
+ * and retires the old one, which is dropped through objectDestroy() once
+ * no reader that could have seen it is still reading: a reader that
+ * retained it keeps it. Roots are frozen, so any number of readers can
+ * walk them at once.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "object.h"
+#include "object_private.h"
+
+struct ObjectCell {
+	Object*		root;
+	pthread_mutex_t	lock;		/* serializes writers */
+	EpochRetired*	retired;
+};
+
+static void cell_destroy(void* root)
+{
+	objectDestroy((Object*)root);
+}
+
+LIBOBJECT_API ObjectCell* newObjectCell(Object* root)
+{
+	BUG_ON_NULL(root);
+	ObjectCell* cell = malloc(sizeof(ObjectCell));
+
+	if(cell == NULL)
+		return NULL;
+	if(objectFreeze(root) == NULL) {
+		free(cell);
+		return NULL;
+	}
+	cell->root = root;
+	cell->retired = NULL;
+	pthread_mutex_init(&cell->lock, NULL);
+	return cell;
+}
+
+LIBOBJECT_API void cellFree(ObjectCell* cell)
+{
+	if(cell == NULL)
+		return;
+	epochReclaimAll(&cell->retired);
+	objectDestroy(cell->root);
+	pthread_mutex_destroy(&cell->lock);
+	free(cell);
+}
+
+LIBOBJECT_API Object* cellAcquire(ObjectCell* cell)
+{
+	BUG_ON_NULL(cell);
+
+	if(!epochEnter()) {
+		fprintf(get_debug_fp(), "%s(): out of memory\n", __func__);
+		return NULL;
+	}
+	return __atomic_load_n(&cell->root, __ATOMIC_ACQUIRE);
+}
+
+LIBOBJECT_API void cellRelease(ObjectCell* cell)
+{
+	BUG_ON_NULL(cell);
+
+	if(!epochExit())
+		fprintf(get_debug_fp(), "%s(): not in a read section\n", __func__);
+}
+
+LIBOBJECT_API int cellPublish(ObjectCell* cell, Object* root)
+{
+	BUG_ON_NULL(cell);
+	BUG_ON_NULL(root);
+	Object* old;
+
+	if(objectFreeze(root) == NULL) {
+		fprintf(get_debug_fp(), "%s(): out of memory\n", __func__);
+		return 0;
+	}
+	pthread_mutex_lock(&cell->lock);
+	/* retiring the current root would free it under its readers */
+	if(__atomic_load_n(&cell->root, __ATOMIC_RELAXED) == root) {
+		pthread_mutex_unlock(&cell->lock);
+		return 1;
+	}
+	old = __atomic_exchange_n(&cell->root, root, __ATOMIC_SEQ_CST);
+	epochRetire(&cell->retired, cell_destroy, old);
+	epochReclaim(&cell->retired);
+	pthread_mutex_unlock(&cell->lock);
+	return 1;
+}
+
+LIBOBJECT_API void cellSynchronize(ObjectCell* cell)
+{
+	BUG_ON_NULL(cell);
+
+	for(;;) {
+		size_t left;
+		pthread_mutex_lock(&cell->lock);
+		left = epochReclaim(&cell->retired);
+		pthread_mutex_unlock(&cell->lock);
+		if(left == 0)
+			return;
+		sched_yield();
+	}
+}
@@ -0,0 +1,372 @@
+/*
+ *  Copyright (c) 2015 Ryan McCullagh <me@ryanmccullagh.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Base64 (RFC 4648, standard alphabet) and hex codecs used by the Bytes
+ * type. Every routine works on (pointer, length) pairs and never writes a
+ * NUL terminator, the caller sizes the output with the *Length helpers.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "object.h"
+#include "object_simd.h"
+
+static const char base64_alphabet[] =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static const char hex_alphabet[] = "0123456789abcdef";
+
+/* 0xff marks a byte that is not part of the alphabet */
+static const unsigned char base64_reverse[256] = {
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,   62, 0xff, 0xff, 0xff,   63,
+	  52,   53,   54,   55,   56,   57,   58,   59,   60,   61, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff,    0,    1,    2,    3,    4,    5,    6,    7,    8,    9,   10,   11,   12,   13,   14,
+	  15,   16,   17,   18,   19,   20,   21,   22,   23,   24,   25, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff,   26,   27,   28,   29,   30,   31,   32,   33,   34,   35,   36,   37,   38,   39,   40,
+	  41,   42,   43,   44,   45,   46,   47,   48,   49,   50,   51, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+};
+
+static int hex_value(unsigned char c)
+{
+	if(c >= '0' && c <= '9')
+		return c - '0';
+	c |= 0x20;
+	if(c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return -1;
+}
+
+LIBOBJECT_API size_t base64EncodedLength(size_t n)
+{
+	return ((n + 2) / 3) * 4;
+}
+
+/*
+ * an upper bound, padding is only known once the input has been decoded
+ */
+LIBOBJECT_API size_t base64DecodedLength(size_t n)
+{
+	return ((n + 3) / 4) * 3;
+}
+
+static size_t base64_encode_scalar(const unsigned char* in, size_t n, char* out)
+{
+	char* start = out;
+	size_t i = 0;
+
+	for(; i + 3 <= n; i += 3) {
+		uint32_t w = ((uint32_t)in[i] << 16) | ((uint32_t)in[i + 1] << 8) | in[i + 2];
+		out[0] = base64_alphabet[(w >> 18) & 0x3f];
+		out[1] = base64_alphabet[(w >> 12) & 0x3f];
+		out[2] = base64_alphabet[(w >> 6) & 0x3f];
+		out[3] = base64_alphabet[w & 0x3f];
+		out += 4;
+	}
+	if(n - i == 1) {
+		uint32_t w = (uint32_t)in[i] << 16;
+		out[0] = base64_alphabet[(w >> 18) & 0x3f];
+		out[1] = base64_alphabet[(w >> 12) & 0x3f];
+		out[2] = '=';
+		out[3] = '=';
+		out += 4;
+	} else if(n - i == 2) {
+		uint32_t w = ((uint32_t)in[i] << 16) | ((uint32_t)in[i + 1] << 8);
+		out[0] = base64_alphabet[(w >> 18) & 0x3f];
+		out[1] = base64_alphabet[(w >> 12) & 0x3f];
+		out[2] = base64_alphabet[(w >> 6) & 0x3f];
+		out[3] = '=';
+		out += 4;
+	}
+	return (size_t)(out - start);
+}
+
+/*
+ * decode whole quanta, stopping at the first byte outside the alphabet.
+ * return the number of input bytes consumed
+ */
+static size_t base64_decode_quanta(const unsigned char* in, size_t n, unsigned char* out, size_t* written)
+{
+	size_t i = 0;
+	size_t o = 0;
+
+	for(; i + 4 <= n; i += 4) {
+		uint32_t a = base64_reverse[in[i]];
+		uint32_t b = base64_reverse[in[i + 1]];
+		uint32_t c = base64_reverse[in[i + 2]];
+		uint32_t d = base64_reverse[in[i + 3]];
+		if((a | b | c | d) & 0x80)
+			break;
+		uint32_t w = (a << 18) | (b << 12) | (c << 6) | d;
+		out[o] = (unsigned char)(w >> 16);
+		out[o + 1] = (unsigned char)(w >> 8);
+		out[o + 2] = (unsigned char)w;
+		o += 3;
+	}
+	*written = o;
+	return i;
+}
+
+#ifdef OBJECT_SIMD_X86
+/*
+ * Vectorized base64 after Wojciech Mula and Daniel Lemire: 12 input bytes
+ * are spread into 16 six bit indices with a shuffle and two multiplies,
+ * then translated to ASCII with a 16 entry offset table
+ */
+OBJECT_TARGET("ssse3")
+static size_t base64_encode_ssse3(const unsigned char* in, size_t n, char* out)
+{
+	const __m128i spread = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+	const __m128i shift_lut = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52,
+		'0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		'+' - 62, '/' - 63, 'A', 0, 0);
+	size_t i = 0;
+	char* start = out;
+
+	/* 16 bytes are loaded but only 12 consumed */
+	for(; i + 16 <= n; i += 12) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+		v = _mm_shuffle_epi8(v, spread);
+		__m128i t0 = _mm_and_si128(v, _mm_set1_epi32(0x0fc0fc00));
+		__m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+		__m128i t2 = _mm_and_si128(v, _mm_set1_epi32(0x003f03f0));
+		__m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+		__m128i indices = _mm_or_si128(t1, t3);
+
+		__m128i result = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+		__m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+		result = _mm_or_si128(result, _mm_and_si128(less, _mm_set1_epi8(13)));
+		result = _mm_add_epi8(_mm_shuffle_epi8(shift_lut, result), indices);
+		_mm_storeu_si128((__m128i *)out, result);
+		out += 16;
+	}
+	out += base64_encode_scalar(in + i, n - i, out);
+	return (size_t)(out - start);
+}
+
+OBJECT_TARGET("ssse3")
+static size_t base64_decode_ssse3(const unsigned char* in, size_t n, unsigned char* out, size_t* written)
+{
+	const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+		0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+	const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+		0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+	const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+		0, 0, 0, 0, 0, 0, 0, 0);
+	const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+	const __m128i nibble = _mm_set1_epi8(0x0f);
+	size_t i = 0;
+	size_t o = 0;
+
+	/* 16 bytes are stored but only 12 are kept, so leave room in the output */
+	for(; i + 24 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+		__m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(v, 4), nibble);
+		__m128i lo_nibbles = _mm_and_si128(v, nibble);
+		__m128i lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+		__m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+		if(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())) != 0xffff)
+			break;
+		__m128i eq_2f = _mm_cmpeq_epi8(v, _mm_set1_epi8(0x2f));
+		__m128i roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(eq_2f, hi_nibbles));
+		v = _mm_add_epi8(v, roll);
+
+		__m128i merged = _mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140));
+		merged = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+		merged = _mm_shuffle_epi8(merged, pack);
+		_mm_storeu_si128((__m128i *)(out + o), merged);
+		o += 12;
+	}
+	size_t tail_written;
+	i += base64_decode_quanta(in + i, n - i, out + o, &tail_written);
+	*written = o + tail_written;
+	return i;
+}
+#endif
+
+/*
+ * encode n bytes from in into out, which must hold base64EncodedLength(n)
+ * bytes. return the number of characters written
+ */
+LIBOBJECT_API size_t base64Encode(const void* in, size_t n, char* out)
+{
+#ifdef OBJECT_SIMD_X86
+	if(n >= 16 && object_cpu_has_ssse3())
+		return base64_encode_ssse3(in, n, out);
+#endif
+	return base64_encode_scalar(in, n, out);
+}
+
+/*
+ * decode n characters from in into out, which must hold
+ * base64DecodedLength(n) bytes. Padding is optional, whitespace is not
+ * accepted. return 1 on success and store the decoded length, 0 if the
+ * input is not valid base64
+ */
+LIBOBJECT_API int base64Decode(const char* in, size_t n, void* out, size_t* length)
+{
+	const unsigned char* src = (const unsigned char *)in;
+	unsigned char* dst = out;
+	size_t written = 0;
+	size_t i;
+
+	size_t pad = 0;
+	if(n >= 1 && src[n - 1] == '=')
+		pad++;
+	if(n >= 2 && src[n - 2] == '=')
+		pad++;
+	if(pad && n % 4 != 0)
+		return 0;
+	n -= pad;
+	if(n % 4 == 1)
+		return 0;
+
+#ifdef OBJECT_SIMD_X86
+	if(n >= 24 && object_cpu_has_ssse3())
+		i = base64_decode_ssse3(src, n, dst, &written);
+	else
+#endif
+	i = base64_decode_quanta(src, n, dst, &written);
+
+	size_t rest = n - i;
+	if(rest >= 4)
+		return 0;
+	if(rest > 0) {
+		uint32_t w = 0;
+		size_t k;
+		for(k = 0; k < rest; k++) {
+			uint32_t d = base64_reverse[src[i + k]];
+			if(d & 0x80)
+				return 0;
+			w |= d << (18 - 6 * k);
+		}
+		dst[written++] = (unsigned char)(w >> 16);
+		if(rest == 3)
+			dst[written++] = (unsigned char)(w >> 8);
+	}
+	*length = written;
+	return 1;
+}
+
+static void hex_encode_scalar(const unsigned char* in, size_t n, char* out)
+{
+	size_t i;
+	for(i = 0; i < n; i++) {
+		out[2 * i] = hex_alphabet[in[i] >> 4];
+		out[2 * i + 1] = hex_alphabet[in[i] & 0x0f];
+	}
+}
+
+/*
+ * encode n bytes as lower case hex into out, which must hold 2 * n bytes.
+ * return the number of characters written
+ */
+LIBOBJECT_API size_t hexEncode(const void* in, size_t n, char* out)
+{
+	const unsigned char* src = in;
+	size_t i = 0;
+#ifdef OBJECT_SIMD_X86
+	const __m128i nibble = _mm_set1_epi8(0x0f);
+	const __m128i nine = _mm_set1_epi8(9);
+	const __m128i ascii_zero = _mm_set1_epi8('0');
+	const __m128i letter_offset = _mm_set1_epi8('a' - '0' - 10);
+
+	for(; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), nibble);
+		__m128i lo = _mm_and_si128(v, nibble);
+		hi = _mm_add_epi8(_mm_add_epi8(hi, ascii_zero),
+			_mm_and_si128(_mm_cmpgt_epi8(hi, nine), letter_offset));
+		lo = _mm_add_epi8(_mm_add_epi8(lo, ascii_zero),
+			_mm_and_si128(_mm_cmpgt_epi8(lo, nine), letter_offset));
+		_mm_storeu_si128((__m128i *)(out + 2 * i), _mm_unpacklo_epi8(hi, lo));
+		_mm_storeu_si128((__m128i *)(out + 2 * i + 16), _mm_unpackhi_epi8(hi, lo));
+	}
+#endif
+	hex_encode_scalar(src + i, n - i, out + 2 * i);
+	return 2 * n;
+}
+
+#ifdef OBJECT_SIMD_X86
+/*
+ * turn 16 hex characters into nibble values, set *valid to 0 if any
+ * character is outside [0-9a-fA-F]
+ */
+static inline __m128i hex_nibbles_sse2(__m128i v, int* valid)
+{
+	__m128i digit = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+	__m128i is_digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+		_mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+	__m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+	__m128i letter = _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10));
+	__m128i is_letter = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+		_mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+	if(_mm_movemask_epi8(_mm_or_si128(is_digit, is_letter)) != 0xffff)
+		*valid = 0;
+	return _mm_or_si128(_mm_and_si128(is_digit, digit), _mm_and_si128(is_letter, letter));
+}
+#endif
+
+/*
+ * decode n hex characters (either case) into out, which must hold n / 2
+ * bytes. return 1 on success and store the decoded length, 0 if the input
+ * has an odd length or a character that is not a hex digit
+ */
+LIBOBJECT_API int hexDecode(const char* in, size_t n, void* out, size_t* length)
+{
+	const unsigned char* src = (const unsigned char *)in;
+	unsigned char* dst = out;
+	size_t i = 0;
+
+	if(n % 2 != 0)
+		return 0;
+#ifdef OBJECT_SIMD_X86
+	const __m128i low_byte = _mm_set1_epi16(0x00ff);
+	for(; i + 32 <= n; i += 32) {
+		int valid = 1;
+		__m128i a = hex_nibbles_sse2(_mm_loadu_si128((const __m128i *)(src + i)), &valid);
+		__m128i b = hex_nibbles_sse2(_mm_loadu_si128((const __m128i *)(src + i + 16)), &valid);
+		if(!valid)
+			return 0;
+		/* each 16 bit lane holds (high nibble, low nibble) in memory order */
+		a = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(a, low_byte), 4), _mm_srli_epi16(a, 8));
+		b = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(b, low_byte), 4), _mm_srli_epi16(b, 8));
+		_mm_storeu_si128((__m128i *)(dst + i / 2), _mm_packus_epi16(a, b));
+	}
+#endif
+	for(; i < n; i += 2) {
+		int hi = hex_value(src[i]);
+		int lo = hex_value(src[i + 1]);
+		if(hi < 0 || lo < 0)
+			return 0;
+		dst[i / 2] = (unsigned char)((hi << 4) | lo);
+	}
+	*length = n / 2;
+	return 1;
+}
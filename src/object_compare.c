@@ -0,0 +1,444 @@
+/*
+ *  Copyright (c) 2015 Ryan McCullagh <me@ryanmccullagh.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Structural hashing, equality and ordering of whole trees.
+ *
+ * Two trees are equal when they have the same shape and the same scalars:
+ * types must match (1 and 1.0 differ), arrays compare in order, maps by
+ * key whatever their insertion order or capacity, and Pointers and
+ * Functions by address. Equal trees hash the same, so map entries are
+ * combined with a sum rather than in bucket order.
+ *
+ * objectCompare() orders any two trees, first by kind:
+ *
+ *   Null < Bool < numbers < String < Bytes < Array < Map < Pair
+ *	< Object < Function < Pointer
+ *
+ * Longs and Doubles compare by exact numeric value, a Long first when the
+ * values are equal, and NaN after every other number. Strings and Bytes
+ * compare their bytes, a prefix first. Arrays compare element by element,
+ * Maps as their entries sorted by key. Trees that compare equal are the
+ * ones objectDeepEquals() accepts, except that NaN equals itself here.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+
+#include "object.h"
+#include "object_private.h"
+#include "murmurhash3.h"
+
+#define HASH_GOLDEN 0x9e3779b97f4a7c15ULL
+
+/*
+ * MurmurHash3's 64 bit finalizer
+ */
+static uint64_t hash_mix(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+static uint64_t hash_combine(uint64_t seed, uint64_t value)
+{
+	return hash_mix(seed * HASH_GOLDEN + value);
+}
+
+/*
+ * the hash of a String's bytes, computed once
+ */
+uint64_t stringInstanceHash(String* string)
+{
+	const char* p = string->value;
+	size_t left = string->length;
+	uint64_t out[2];
+	uint64_t hash = 0;
+
+	if(string->flags & STRING_FLAG_HASHED)
+		return string->hash;
+	do {
+		int n = left > INT_MAX ? INT_MAX : (int)left;
+		MurmurHash3_x64_128(p, n, (uint32_t)hash, out);
+		hash ^= out[0];
+		p += n;
+		left -= n;
+	} while(left > 0);
+	string->hash = hash;
+	string->flags |= STRING_FLAG_HASHED;
+	return hash;
+}
+
+/*
+ * a hash that is already known without walking o, 0 if there is none
+ */
+static int object_known_hash(Object* o, uint64_t* hash)
+{
+	if((O_TYPE(o) == IS_STRING || O_TYPE(o) == IS_BYTES) &&
+		(O_SVAL(o)->flags & STRING_FLAG_HASHED)) {
+		*hash = hash_combine(O_TYPE(o), O_SVAL(o)->hash);
+		return 1;
+	}
+	return 0;
+}
+
+LIBOBJECT_API uint64_t objectHash(Object* o)
+{
+	BUG_ON_NULL(o);
+	uint64_t hash = hash_mix(O_TYPE(o) + 1);
+
+	if(!objectLoad(o))
+		return hash;
+
+	switch(O_TYPE(o)) {
+		case IS_NULL:
+			break;
+		case IS_BOOL:
+			hash = hash_combine(hash, O_BVAL(o) != 0);
+			break;
+		case IS_LONG:
+			hash = hash_combine(hash, (uint64_t)O_LVAL(o));
+			break;
+		case IS_DOUBLE: {
+			/* 0.0 == -0.0, so they must hash alike */
+			double d = O_DVAL(o) == 0.0 ? 0.0 : O_DVAL(o);
+			uint64_t bits;
+			memcpy(&bits, &d, sizeof(bits));
+			hash = hash_combine(hash, bits);
+		}
+		break;
+		case IS_STRING:
+		case IS_BYTES:
+			hash = hash_combine(O_TYPE(o), stringInstanceHash(O_SVAL(o)));
+			break;
+		case IS_ARRAY: {
+			Array* array = O_AVAL(o);
+			size_t i;
+			for(i = 0; i < array->size; i++)
+				hash = hash_combine(hash, objectHash(array->table[i]));
+			hash = hash_combine(hash, array->size);
+		}
+		break;
+		case IS_MAP: {
+			Map* map = O_MVAL(o);
+			uint64_t sum = 0;
+			uint32_t i, left;
+			Bucket* b;
+			for(i = 0, left = map->size; i < map->capacity && left; i++) {
+				for(b = map->buckets[i]; b != NULL; b = b->next, left--)
+					sum += hash_mix(hash_combine(stringInstanceHash(b->key), objectHash(b->value)));
+			}
+			hash = hash_combine(hash_combine(hash, sum), map->size);
+		}
+		break;
+		case IS_PAIR:
+			hash = hash_combine(hash, objectHash(O_PVAL(o)->first));
+			hash = hash_combine(hash, objectHash(O_PVAL(o)->second));
+			break;
+		default:
+			hash = hash_combine(hash, (uintptr_t)O_PTVAL(o));
+			break;
+	}
+	return hash;
+}
+
+LIBOBJECT_API int objectDeepEquals(Object* left, Object* right)
+{
+	BUG_ON_NULL(left);
+	BUG_ON_NULL(right);
+	uint64_t h1, h2;
+
+	if(left == right)
+		return 1;
+	if(O_TYPE(left) != O_TYPE(right))
+		return 0;
+	if(object_known_hash(left, &h1) && object_known_hash(right, &h2) && h1 != h2)
+		return 0;
+	if(!objectLoad(left) || !objectLoad(right))
+		return 0;
+
+	switch(O_TYPE(left)) {
+		case IS_NULL:
+			return 1;
+		case IS_BOOL:
+			return !O_BVAL(left) == !O_BVAL(right);
+		case IS_LONG:
+			return O_LVAL(left) == O_LVAL(right);
+		case IS_DOUBLE:
+			return O_DVAL(left) == O_DVAL(right);
+		case IS_STRING:
+		case IS_BYTES:
+			return O_SVAL(left)->length == O_SVAL(right)->length &&
+				memcmp(O_SVAL(left)->value, O_SVAL(right)->value, O_SVAL(left)->length) == 0;
+		case IS_ARRAY: {
+			Array* a = O_AVAL(left);
+			Array* b = O_AVAL(right);
+			size_t i;
+			if(a->size != b->size)
+				return 0;
+			for(i = 0; i < a->size; i++) {
+				if(!objectDeepEquals(a->table[i], b->table[i]))
+					return 0;
+			}
+			return 1;
+		}
+		case IS_MAP: {
+			Map* map = O_MVAL(left);
+			uint32_t i, n;
+			Bucket* b;
+			if(map->size != O_MVAL(right)->size)
+				return 0;
+			for(i = 0, n = map->size; i < map->capacity && n; i++) {
+				for(b = map->buckets[i]; b != NULL; b = b->next, n--) {
+					Object* value = mapSearchHashed(right, b->key->value, b->key->length, b->hash);
+					if(value == NULL || !objectDeepEquals(b->value, value))
+						return 0;
+				}
+			}
+			return 1;
+		}
+		case IS_PAIR:
+			return objectDeepEquals(O_PVAL(left)->first, O_PVAL(right)->first) &&
+				objectDeepEquals(O_PVAL(left)->second, O_PVAL(right)->second);
+		default:
+			return O_PTVAL(left) == O_PTVAL(right);
+	}
+}
+
+static int compare_rank(ObjectType type)
+{
+	switch(type) {
+		case IS_NULL:		return 0;
+		case IS_BOOL:		return 1;
+		case IS_LONG:
+		case IS_DOUBLE:		return 2;
+		case IS_STRING:		return 3;
+		case IS_BYTES:		return 4;
+		case IS_ARRAY:		return 5;
+		case IS_MAP:		return 6;
+		case IS_PAIR:		return 7;
+		case IS_OBJECT:		return 8;
+		case IS_FUNCTION:	return 9;
+		default:		return 10;
+	}
+}
+
+#define COMPARE(a, b) ((a) < (b) ? -1 : (a) > (b))
+
+static int compare_bytes(String* a, String* b)
+{
+	size_t n = a->length < b->length ? a->length : b->length;
+	int result = memcmp(a->value, b->value, n);
+
+	if(result != 0)
+		return result < 0 ? -1 : 1;
+	return COMPARE(a->length, b->length);
+}
+
+/*
+ * x != x only for NaN, which sorts after every other number
+ */
+static int compare_double(double a, double b)
+{
+	if(a != a)
+		return b != b ? 0 : 1;
+	if(b != b)
+		return -1;
+	return COMPARE(a, b);
+}
+
+/*
+ * l against d without rounding l to a double
+ */
+static int compare_long_double(long l, double d)
+{
+	long t;
+	double fraction;
+
+	if(d != d || d >= -(double)LONG_MIN)
+		return -1;
+	if(d < (double)LONG_MIN)
+		return 1;
+	t = (long)d;
+	if(l != t)
+		return COMPARE(l, t);
+	fraction = d - (double)t;
+	return fraction > 0 ? -1 : fraction < 0;
+}
+
+static int compare_number(Object* a, Object* b)
+{
+	int result;
+
+	if(O_TYPE(a) == IS_LONG && O_TYPE(b) == IS_LONG)
+		return COMPARE(O_LVAL(a), O_LVAL(b));
+	if(O_TYPE(a) == IS_DOUBLE && O_TYPE(b) == IS_DOUBLE)
+		return compare_double(O_DVAL(a), O_DVAL(b));
+	if(O_TYPE(a) == IS_LONG)
+		result = compare_long_double(O_LVAL(a), O_DVAL(b));
+	else
+		result = -compare_long_double(O_LVAL(b), O_DVAL(a));
+	return result != 0 ? result : O_TYPE(a) == IS_LONG ? -1 : 1;
+}
+
+static int compare_bucket(const void* a, const void* b)
+{
+	return compare_bytes((*(Bucket* const*)a)->key, (*(Bucket* const*)b)->key);
+}
+
+/*
+ * the entries of a Map sorted by key, in stack when there are few
+ */
+static Bucket** compare_entries(Map* map, Bucket** stack, size_t n)
+{
+	Bucket** entries = map->size <= n ? stack : malloc(map->size * sizeof(Bucket*));
+	uint32_t i, k;
+	Bucket* b;
+
+	if(entries == NULL)
+		return NULL;
+	for(i = 0, k = 0; i < map->capacity && k < map->size; i++) {
+		for(b = map->buckets[i]; b != NULL; b = b->next)
+			entries[k++] = b;
+	}
+	qsort(entries, map->size, sizeof(Bucket*), compare_bucket);
+	return entries;
+}
+
+static int compare_map(Map* a, Map* b)
+{
+	Bucket* stack_a[16];
+	Bucket* stack_b[16];
+	Bucket** x = compare_entries(a, stack_a, 16);
+	Bucket** y = compare_entries(b, stack_b, 16);
+	uint32_t i, n = a->size < b->size ? a->size : b->size;
+	int result = 0;
+
+	if(x == NULL || y == NULL) {
+		fprintf(get_debug_fp(), "%s(): out of memory, comparing sizes only\n", __func__);
+	} else {
+		for(i = 0; i < n && result == 0; i++) {
+			result = compare_bytes(x[i]->key, y[i]->key);
+			if(result == 0)
+				result = objectCompare(x[i]->value, y[i]->value);
+		}
+	}
+	if(result == 0)
+		result = COMPARE(a->size, b->size);
+	if(x != stack_a)
+		free(x);
+	if(y != stack_b)
+		free(y);
+	return result;
+}
+
+LIBOBJECT_API int objectCompare(Object* left, Object* right)
+{
+	BUG_ON_NULL(left);
+	BUG_ON_NULL(right);
+	int result;
+
+	if(left == right)
+		return 0;
+	result = COMPARE(compare_rank(O_TYPE(left)), compare_rank(O_TYPE(right)));
+	if(result != 0)
+		return result;
+	if(!objectLoad(left) || !objectLoad(right))
+		return 0;
+
+	switch(O_TYPE(left)) {
+		case IS_NULL:
+			return 0;
+		case IS_BOOL:
+			return COMPARE(O_BVAL(left) != 0, O_BVAL(right) != 0);
+		case IS_LONG:
+		case IS_DOUBLE:
+			return compare_number(left, right);
+		case IS_STRING:
+		case IS_BYTES:
+			return compare_bytes(O_SVAL(left), O_SVAL(right));
+		case IS_ARRAY: {
+			Array* a = O_AVAL(left);
+			Array* b = O_AVAL(right);
+			size_t i, n = a->size < b->size ? a->size : b->size;
+			for(i = 0; i < n; i++) {
+				if((result = objectCompare(a->table[i], b->table[i])) != 0)
+					return result;
+			}
+			return COMPARE(a->size, b->size);
+		}
+		case IS_MAP:
+			return compare_map(O_MVAL(left), O_MVAL(right));
+		case IS_PAIR:
+			result = objectCompare(O_PVAL(left)->first, O_PVAL(right)->first);
+			return result != 0 ? result : objectCompare(O_PVAL(left)->second, O_PVAL(right)->second);
+		default:
+			return COMPARE((uintptr_t)O_PTVAL(left), (uintptr_t)O_PTVAL(right));
+	}
+}
+
+static int compare_element(const void* a, const void* b)
+{
+	return objectCompare(*(Object* const*)a, *(Object* const*)b);
+}
+
+LIBOBJECT_API void arraySort(Object* array)
+{
+	BUG_ON_NULL(array);
+
+	if(O_TYPE(array) != IS_ARRAY) {
+		fprintf(get_debug_fp(), "%s(): Object type is not an instance of Array, got %d\n", __func__, O_TYPE(array));
+		return;
+	}
+	if(O_FLG(array) & OBJECT_FLAG_FROZEN) {
+		fprintf(get_debug_fp(), "%s(): Object is frozen\n", __func__);
+		return;
+	}
+	if(!objectLoad(array) || O_AVAL(array)->size < 2)
+		return;
+	qsort(O_AVAL(array)->table, O_AVAL(array)->size, sizeof(Object*), compare_element);
+}
+
+LIBOBJECT_API size_t arrayLowerBound(Object* array, Object* key)
+{
+	BUG_ON_NULL(array);
+	BUG_ON_NULL(key);
+	size_t low = 0, high;
+
+	if(O_TYPE(array) != IS_ARRAY) {
+		fprintf(get_debug_fp(), "%s(): Object type is not an instance of Array, got %d\n", __func__, O_TYPE(array));
+		return 0;
+	}
+	if(!objectLoad(array))
+		return 0;
+	high = O_AVAL(array)->size;
+	while(low < high) {
+		size_t middle = low + (high - low) / 2;
+		if(objectCompare(O_AVAL(array)->table[middle], key) < 0)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return low;
+}
@@ -0,0 +1,434 @@
+/*
+ *  Copyright (c) 2015 Ryan McCullagh <me@ryanmccullagh.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A hash map for many threads. Readers take no locks: they walk the
+ * chains as epoch readers (see object_epoch.c) and writers only ever
+ * publish fully built nodes, so a reader sees each node either before or
+ * after a change. Writers lock one of CMAP_STRIPES stripes, chosen by the
+ * low bits of the hash. The table size is a power of two of at least
+ * CMAP_STRIPES, so a stripe owns the same buckets in every table and the
+ * buckets of different stripes never share a chain.
+ *
+ * Growing is done a stripe at a time. The resizing thread links the new
+ * table from the old one and copies each stripe's nodes across under that
+ * stripe's lock, then marks the stripe moved; readers and writers of a
+ * moved stripe follow the link. A writer that finds its stripe not moved
+ * yet moves it itself, so writers help the resize instead of waiting for
+ * it, and no lock is ever held on more than one stripe. The old nodes are
+ * left intact for readers still walking them, and retired with the old
+ * table.
+ *
+ * Values are frozen on the way in, since any number of threads may read
+ * them, and searches hand out a reference of their own.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "object.h"
+#include "object_private.h"
+
+#define CMAP_STRIPES		64	/* a power of two */
+#define CMAP_CACHE_LINE		64
+#define CMAP_LOAD		2	/* average chain length that triggers a resize */
+#define CMAP_RECLAIM		64	/* retired nodes a stripe collects before reclaiming */
+
+typedef struct CMapNode {
+	uint32_t	hash;
+	String*		key;
+	Object*		value;
+	struct CMapNode* next;
+} CMapNode;
+
+typedef struct CMapTable {
+	CMapNode**	buckets;
+	size_t		capacity;	/* a power of two, at least CMAP_STRIPES */
+	struct CMapTable* next;		/* the table a resize is moving to */
+	unsigned char	moved[CMAP_STRIPES];	/* stripes already in next */
+} CMapTable;
+
+#define CMAP_STRIPE_FIELDS (sizeof(pthread_mutex_t) + 2 * sizeof(size_t) + sizeof(void*))
+
+typedef struct CMapStripe {
+	pthread_mutex_t	lock;
+	size_t		size;
+	size_t		nretired;
+	EpochRetired*	retired;	/* nodes and values unlinked from it */
+	char		pad[CMAP_CACHE_LINE - CMAP_STRIPE_FIELDS % CMAP_CACHE_LINE];
+} CMapStripe;
+
+struct ObjectConcurrentMap {
+	CMapTable*	table;
+	pthread_mutex_t	resize_lock;
+	EpochRetired*	retired_tables;	/* resize_lock held */
+	CMapStripe	stripes[CMAP_STRIPES];
+};
+
+static CMapTable* cmap_table_new(size_t capacity)
+{
+	CMapTable* t = calloc(1, sizeof(CMapTable));
+
+	if(t == NULL)
+		return NULL;
+	t->capacity = capacity;
+	t->buckets = calloc(capacity, sizeof(CMapNode*));
+	if(t->buckets == NULL) {
+		free(t);
+		return NULL;
+	}
+	return t;
+}
+
+/*
+ * a table retired by a resize: its nodes were copied, so the keys and
+ * values belong to the new table
+ */
+static void cmap_table_release(void* arg)
+{
+	CMapTable* t = arg;
+	size_t i;
+
+	for(i = 0; i < t->capacity; i++) {
+		CMapNode* n = t->buckets[i];
+		while(n != NULL) {
+			CMapNode* next = n->next;
+			free(n);
+			n = next;
+		}
+	}
+	free(t->buckets);
+	free(t);
+}
+
+static void cmap_node_release(void* arg)
+{
+	CMapNode* n = arg;
+	stringInstanceFree(n->key);
+	objectDestroy(n->value);
+	free(n);
+}
+
+static void cmap_value_release(void* value)
+{
+	objectDestroy((Object*)value);
+}
+
+/*
+ * the table holding stripe s for a reader
+ */
+static CMapTable* cmap_read_table(ObjectConcurrentMap* map, size_t s)
+{
+	CMapTable* t = __atomic_load_n(&map->table, __ATOMIC_ACQUIRE);
+	CMapTable* next;
+
+	while((next = __atomic_load_n(&t->next, __ATOMIC_ACQUIRE)) != NULL &&
+		__atomic_load_n(&t->moved[s], __ATOMIC_ACQUIRE))
+		t = next;
+	return t;
+}
+
+/*
+ * copy the nodes of stripe s into the table being resized to, the
+ * stripe's lock held. Readers find them there once moved[s] is set
+ */
+static void cmap_move_stripe(CMapTable* from, CMapTable* to, size_t s)
+{
+	size_t i;
+
+	for(i = s; i < from->capacity; i += CMAP_STRIPES) {
+		CMapNode* n;
+		for(n = from->buckets[i]; n != NULL; n = n->next) {
+			CMapNode* copy = malloc(sizeof(CMapNode));
+			CMapNode** head = &to->buckets[n->hash & (to->capacity - 1)];
+			BUG_ON_NULL(copy);
+			*copy = *n;
+			copy->next = *head;
+			*head = copy;
+		}
+	}
+	__atomic_store_n(&from->moved[s], 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * the table a writer holding stripe s changes, helping a resize along
+ */
+static CMapTable* cmap_write_table(ObjectConcurrentMap* map, size_t s)
+{
+	CMapTable* t = __atomic_load_n(&map->table, __ATOMIC_ACQUIRE);
+	CMapTable* next;
+
+	while((next = __atomic_load_n(&t->next, __ATOMIC_ACQUIRE)) != NULL) {
+		if(!t->moved[s])
+			cmap_move_stripe(t, next, s);
+		t = next;
+	}
+	return t;
+}
+
+static void cmap_resize(ObjectConcurrentMap* map, CMapTable* seen)
+{
+	CMapTable* t;
+	CMapTable* bigger;
+	size_t s;
+
+	/* one resize at a time, and only of the table that was too full */
+	if(pthread_mutex_trylock(&map->resize_lock) != 0)
+		return;
+	t = __atomic_load_n(&map->table, __ATOMIC_ACQUIRE);
+	if(t != seen || (bigger = cmap_table_new(t->capacity * 2)) == NULL) {
+		pthread_mutex_unlock(&map->resize_lock);
+		return;
+	}
+	__atomic_store_n(&t->next, bigger, __ATOMIC_RELEASE);
+	for(s = 0; s < CMAP_STRIPES; s++) {
+		pthread_mutex_lock(&map->stripes[s].lock);
+		if(!t->moved[s])
+			cmap_move_stripe(t, bigger, s);
+		pthread_mutex_unlock(&map->stripes[s].lock);
+	}
+	__atomic_store_n(&map->table, bigger, __ATOMIC_RELEASE);
+	epochRetire(&map->retired_tables, cmap_table_release, t);
+	epochReclaim(&map->retired_tables);
+	pthread_mutex_unlock(&map->resize_lock);
+}
+
+/*
+ * release what a stripe retired once enough has piled up, its lock held
+ */
+static void cmap_retire(ObjectConcurrentMap* map, CMapStripe* stripe,
+	void (*release)(void*), void* pointer)
+{
+	epochRetire(&stripe->retired, release, pointer);
+	if(++stripe->nretired < CMAP_RECLAIM)
+		return;
+	stripe->nretired = epochReclaim(&stripe->retired);
+	if(pthread_mutex_trylock(&map->resize_lock) == 0) {
+		epochReclaim(&map->retired_tables);
+		pthread_mutex_unlock(&map->resize_lock);
+	}
+}
+
+LIBOBJECT_API ObjectConcurrentMap* newConcurrentMap(uint32_t size)
+{
+	ObjectConcurrentMap* map = malloc(sizeof(ObjectConcurrentMap));
+	size_t capacity = CMAP_STRIPES;
+	size_t s;
+
+	if(map == NULL)
+		return NULL;
+	while(capacity < size)
+		capacity *= 2;
+	if((map->table = cmap_table_new(capacity)) == NULL) {
+		free(map);
+		return NULL;
+	}
+	map->retired_tables = NULL;
+	pthread_mutex_init(&map->resize_lock, NULL);
+	for(s = 0; s < CMAP_STRIPES; s++) {
+		pthread_mutex_init(&map->stripes[s].lock, NULL);
+		map->stripes[s].size = 0;
+		map->stripes[s].nretired = 0;
+		map->stripes[s].retired = NULL;
+	}
+	return map;
+}
+
+LIBOBJECT_API void concurrentMapFree(ObjectConcurrentMap* map)
+{
+	CMapTable* t;
+	size_t s, i;
+
+	if(map == NULL)
+		return;
+	for(s = 0; s < CMAP_STRIPES; s++) {
+		epochReclaimAll(&map->stripes[s].retired);
+		pthread_mutex_destroy(&map->stripes[s].lock);
+	}
+	epochReclaimAll(&map->retired_tables);
+	t = map->table;
+	for(i = 0; i < t->capacity; i++) {
+		CMapNode* n = t->buckets[i];
+		while(n != NULL) {
+			CMapNode* next = n->next;
+			cmap_node_release(n);
+			n = next;
+		}
+	}
+	free(t->buckets);
+	free(t);
+	pthread_mutex_destroy(&map->resize_lock);
+	free(map);
+}
+
+LIBOBJECT_API int concurrentMapInsert(ObjectConcurrentMap* map, const char* key, Object* value)
+{
+	BUG_ON_NULL(map);
+	BUG_ON_NULL(key);
+	BUG_ON_NULL(value);
+	size_t length = strlen(key);
+	uint32_t hash = stringHash(key, length);
+	CMapStripe* stripe = &map->stripes[hash & (CMAP_STRIPES - 1)];
+	CMapTable* t;
+	CMapNode** head;
+	CMapNode* n;
+	int grow;
+
+	if(objectFreeze(value) == NULL) {
+		fprintf(get_debug_fp(), "%s(): out of memory\n", __func__);
+		return 0;
+	}
+	/*
+	 * a resize may retire the table, so writers read it as epoch readers
+	 * too, taking the lock first so that no reader ever waits on one
+	 */
+	pthread_mutex_lock(&stripe->lock);
+	if(!epochEnter()) {
+		pthread_mutex_unlock(&stripe->lock);
+		fprintf(get_debug_fp(), "%s(): out of memory\n", __func__);
+		return 0;
+	}
+	t = cmap_write_table(map, hash & (CMAP_STRIPES - 1));
+	head = &t->buckets[hash & (t->capacity - 1)];
+	for(n = *head; n != NULL; n = n->next) {
+		if(n->hash == hash && n->key->length == length && memcmp(n->key->value, key, length) == 0) {
+			Object* old = n->value;
+			__atomic_store_n(&n->value, value, __ATOMIC_RELEASE);
+			epochExit();
+			cmap_retire(map, stripe, cmap_value_release, old);
+			pthread_mutex_unlock(&stripe->lock);
+			return 1;
+		}
+	}
+
+	if((n = malloc(sizeof(CMapNode))) == NULL || (n->key = newStringInstanceBuffer(length)) == NULL) {
+		epochExit();
+		pthread_mutex_unlock(&stripe->lock);
+		free(n);
+		fprintf(get_debug_fp(), "%s(): out of memory\n", __func__);
+		return 0;
+	}
+	memcpy(n->key->value, key, length);
+	n->hash = hash;
+	n->value = value;
+	n->next = *head;
+	__atomic_store_n(head, n, __ATOMIC_RELEASE);
+	__atomic_store_n(&stripe->size, stripe->size + 1, __ATOMIC_RELAXED);
+	grow = stripe->size > CMAP_LOAD * (t->capacity / CMAP_STRIPES);
+	epochExit();
+	pthread_mutex_unlock(&stripe->lock);
+
+	/* t is only compared, never read, once the section ends */
+	if(grow)
+		cmap_resize(map, t);
+	return 1;
+}
+
+LIBOBJECT_API Object* concurrentMapSearch(ObjectConcurrentMap* map, const char* key)
+{
+	BUG_ON_NULL(map);
+	BUG_ON_NULL(key);
+	size_t length = strlen(key);
+	uint32_t hash = stringHash(key, length);
+	CMapTable* t;
+	CMapNode* n;
+	Object* value = NULL;
+
+	if(!epochEnter()) {
+		fprintf(get_debug_fp(), "%s(): out of memory\n", __func__);
+		return NULL;
+	}
+	t = cmap_read_table(map, hash & (CMAP_STRIPES - 1));
+	n = __atomic_load_n(&t->buckets[hash & (t->capacity - 1)], __ATOMIC_ACQUIRE);
+	for(; n != NULL; n = __atomic_load_n(&n->next, __ATOMIC_ACQUIRE)) {
+		if(n->hash == hash && n->key->length == length && memcmp(n->key->value, key, length) == 0) {
+			value = objectRetain(__atomic_load_n(&n->value, __ATOMIC_ACQUIRE));
+			break;
+		}
+	}
+	epochExit();
+	return value;
+}
+
+LIBOBJECT_API int concurrentMapDelete(ObjectConcurrentMap* map, const char* key)
+{
+	BUG_ON_NULL(map);
+	BUG_ON_NULL(key);
+	size_t length = strlen(key);
+	uint32_t hash = stringHash(key, length);
+	CMapStripe* stripe = &map->stripes[hash & (CMAP_STRIPES - 1)];
+	CMapTable* t;
+	CMapNode** link;
+
+	pthread_mutex_lock(&stripe->lock);
+	if(!epochEnter()) {
+		pthread_mutex_unlock(&stripe->lock);
+		fprintf(get_debug_fp(), "%s(): out of memory\n", __func__);
+		return 0;
+	}
+	t = cmap_write_table(map, hash & (CMAP_STRIPES - 1));
+	for(link = &t->buckets[hash & (t->capacity - 1)]; *link != NULL; link = &(*link)->next) {
+		CMapNode* n = *link;
+		if(n->hash == hash && n->key->length == length && memcmp(n->key->value, key, length) == 0) {
+			__atomic_store_n(link, n->next, __ATOMIC_RELEASE);
+			__atomic_store_n(&stripe->size, stripe->size - 1, __ATOMIC_RELAXED);
+			epochExit();
+			cmap_retire(map, stripe, cmap_node_release, n);
+			pthread_mutex_unlock(&stripe->lock);
+			return 1;
+		}
+	}
+	epochExit();
+	pthread_mutex_unlock(&stripe->lock);
+	return 0;
+}
+
+LIBOBJECT_API uint32_t concurrentMapSize(ObjectConcurrentMap* map)
+{
+	BUG_ON_NULL(map);
+	size_t s, size = 0;
+
+	for(s = 0; s < CMAP_STRIPES; s++)
+		size += __atomic_load_n(&map->stripes[s].size, __ATOMIC_RELAXED);
+	return (uint32_t)size;
+}
+
+LIBOBJECT_API Object* concurrentMapToMap(ObjectConcurrentMap* map)
+{
+	BUG_ON_NULL(map);
+	Object* ret = newMap(concurrentMapSize(map) + 1);
+	size_t s, i;
+
+	if(ret == NULL || !epochEnter()) {
+		fprintf(get_debug_fp(), "%s(): out of memory\n", __func__);
+		objectDestroy(ret);
+		return NULL;
+	}
+	for(s = 0; s < CMAP_STRIPES; s++) {
+		CMapTable* t = cmap_read_table(map, s);
+		for(i = s; i < t->capacity; i += CMAP_STRIPES) {
+			CMapNode* n = __atomic_load_n(&t->buckets[i], __ATOMIC_ACQUIRE);
+			for(; n != NULL; n = __atomic_load_n(&n->next, __ATOMIC_ACQUIRE))
+				mapInsertEx(ret, n->key->value, objectRetain(__atomic_load_n(&n->value, __ATOMIC_ACQUIRE)));
+		}
+	}
+	epochExit();
+	return ret;
+}
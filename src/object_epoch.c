@@ -0,0 +1,211 @@
+/*
+ *  Copyright (c) 2015 Ryan McCullagh <me@ryanmccullagh.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Epoch based reclamation, shared by ObjectCell and ObjectConcurrentMap.
+ *
+ * Every thread that reads lock-free owns an EpochReader, on a cache line
+ * of its own, in one process wide list. Entering a read section copies
+ * the global epoch into the reader and leaving it stores 0, so readers
+ * only ever write their own line. A writer that unlinks something retires
+ * it stamped with the current epoch. A reader that could still reach it
+ * entered at that epoch or before, so it is released once every reader in
+ * a section has entered at a later one; reclaiming bumps the epoch so that
+ * new readers do.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "object.h"
+#include "object_private.h"
+
+#define EPOCH_CACHE_LINE	64
+
+typedef struct EpochReader {
+	uint64_t	epoch;		/* at entry to the read section, 0 outside */
+	unsigned int	nesting;
+	int		in_use;		/* owned by a live thread */
+	struct EpochReader* next;
+} EpochReader;
+
+static uint64_t epoch_global = 1;
+static EpochReader* epoch_readers = NULL;
+static pthread_mutex_t epoch_readers_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t epoch_reader_key;
+static pthread_once_t epoch_reader_once = PTHREAD_ONCE_INIT;
+
+/*
+ * a thread's reader goes back to the list for the next new thread
+ */
+static void epoch_reader_release(void* arg)
+{
+	EpochReader* r = arg;
+	__atomic_store_n(&r->epoch, 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&r->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void epoch_reader_init(void)
+{
+	pthread_key_create(&epoch_reader_key, epoch_reader_release);
+}
+
+static EpochReader* epoch_reader(void)
+{
+	EpochReader* r;
+	void* line;
+
+	pthread_once(&epoch_reader_once, epoch_reader_init);
+	if((r = pthread_getspecific(epoch_reader_key)) != NULL)
+		return r;
+
+	/* reuse one left by a thread that exited, or add one */
+	for(r = __atomic_load_n(&epoch_readers, __ATOMIC_ACQUIRE); r != NULL; r = r->next) {
+		int free_slot = 0;
+		if(__atomic_compare_exchange_n(&r->in_use, &free_slot, 1, 0,
+			__ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+			break;
+	}
+	if(r == NULL) {
+		if(posix_memalign(&line, EPOCH_CACHE_LINE, EPOCH_CACHE_LINE > sizeof(EpochReader) ?
+			EPOCH_CACHE_LINE : sizeof(EpochReader)) != 0)
+			return NULL;
+		r = line;
+		r->epoch = 0;
+		r->nesting = 0;
+		r->in_use = 1;
+		pthread_mutex_lock(&epoch_readers_lock);
+		r->next = epoch_readers;
+		__atomic_store_n(&epoch_readers, r, __ATOMIC_RELEASE);
+		pthread_mutex_unlock(&epoch_readers_lock);
+	}
+	pthread_setspecific(epoch_reader_key, r);
+	return r;
+}
+
+int epochEnter(void)
+{
+	EpochReader* r = epoch_reader();
+
+	if(r == NULL)
+		return 0;
+	if(r->nesting++ == 0) {
+		__atomic_store_n(&r->epoch, __atomic_load_n(&epoch_global, __ATOMIC_RELAXED),
+			__ATOMIC_RELAXED);
+		/* the epoch is visible before anything shared is read */
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	}
+	return 1;
+}
+
+int epochExit(void)
+{
+	EpochReader* r;
+
+	pthread_once(&epoch_reader_once, epoch_reader_init);
+	r = pthread_getspecific(epoch_reader_key);
+	if(r == NULL || r->nesting == 0)
+		return 0;
+	if(--r->nesting == 0)
+		__atomic_store_n(&r->epoch, 0, __ATOMIC_RELEASE);
+	return 1;
+}
+
+/*
+ * the oldest epoch a reader is still in, UINT64_MAX when none is
+ */
+static uint64_t epoch_oldest_reader(void)
+{
+	uint64_t oldest = UINT64_MAX;
+	EpochReader* r;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	for(r = __atomic_load_n(&epoch_readers, __ATOMIC_ACQUIRE); r != NULL; r = r->next) {
+		uint64_t epoch = __atomic_load_n(&r->epoch, __ATOMIC_ACQUIRE);
+		if(epoch != 0 && epoch < oldest)
+			oldest = epoch;
+	}
+	return oldest;
+}
+
+/*
+ * wait until no reader is in a section entered at epoch or before. The
+ * caller must not be in a read section itself
+ */
+static void epoch_wait(uint64_t epoch)
+{
+	__atomic_add_fetch(&epoch_global, 1, __ATOMIC_SEQ_CST);
+	while(epoch_oldest_reader() <= epoch)
+		sched_yield();
+}
+
+void epochRetire(EpochRetired** list, void (*release)(void*), void* pointer)
+{
+	EpochRetired* old = malloc(sizeof(EpochRetired));
+	uint64_t epoch;
+
+	/* after the caller unlinked pointer */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	epoch = __atomic_load_n(&epoch_global, __ATOMIC_SEQ_CST);
+	if(old == NULL) {
+		epoch_wait(epoch);
+		release(pointer);
+		return;
+	}
+	old->release = release;
+	old->pointer = pointer;
+	old->epoch = epoch;
+	old->next = *list;
+	*list = old;
+}
+
+size_t epochReclaim(EpochRetired** list)
+{
+	uint64_t oldest;
+	size_t left = 0;
+
+	if(*list == NULL)
+		return 0;
+	__atomic_add_fetch(&epoch_global, 1, __ATOMIC_SEQ_CST);
+	oldest = epoch_oldest_reader();
+	while(*list != NULL) {
+		EpochRetired* old = *list;
+		if(old->epoch < oldest) {
+			*list = old->next;
+			old->release(old->pointer);
+			free(old);
+		} else {
+			list = &old->next;
+			left++;
+		}
+	}
+	return left;
+}
+
+void epochReclaimAll(EpochRetired** list)
+{
+	EpochRetired* old;
+
+	while((old = *list) != NULL) {
+		*list = old->next;
+		old->release(old->pointer);
+		free(old);
+	}
+}
@@ -0,0 +1,2602 @@
+/*
+ *  Copyright (c) 2015 Ryan McCullagh <me@ryanmccullagh.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * JSON reader and writer.
+ *
+ * The reader works in two stages. Stage one classifies the input 64 bytes at a time and
+ * records the offset of every structural character outside strings, of
+ * every opening quote and of the first byte of every other scalar. Stage
+ * two walks that index with an explicit stack, so nesting never recurses,
+ * and builds the tree bottom up: an Array or Map is only created once its
+ * closing bracket is seen, at its final size.
+ */
+
+#include <stdio.h>
+#include <float.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "object.h"
+#include "object_private.h"
+#include "object_simd.h"
+
+#define JSON_QUOTE	0x1
+#define JSON_BACKSLASH	0x2
+#define JSON_OP		0x4	/* { } [ ] : , */
+#define JSON_SPACE	0x8
+
+static const unsigned char json_class[256] = {
+	['"'] = JSON_QUOTE,
+	['\\'] = JSON_BACKSLASH,
+	['{'] = JSON_OP, ['}'] = JSON_OP, ['['] = JSON_OP, [']'] = JSON_OP,
+	[':'] = JSON_OP, [','] = JSON_OP,
+	[' '] = JSON_SPACE, ['\t'] = JSON_SPACE, ['\n'] = JSON_SPACE, ['\r'] = JSON_SPACE
+};
+
+typedef struct JsonBlock {
+	uint64_t quote;
+	uint64_t backslash;
+	uint64_t op;
+	uint64_t space;
+} JsonBlock;
+
+typedef struct JsonKey {
+	String*		key;
+	uint32_t	hash;
+} JsonKey;
+
+typedef struct JsonFrame {
+	size_t		values;	/* values stack height when the container opened */
+	size_t		keys;
+	int		is_map;
+} JsonFrame;
+
+typedef struct JsonParser {
+	const unsigned char* buf;
+	size_t		len;
+	unsigned int	flags;
+	size_t*		index;
+	size_t		count;
+	size_t		index_capacity;
+	Object**	values;
+	size_t		nvalues;
+	size_t		values_capacity;
+	JsonKey*	keys;
+	size_t		nkeys;
+	size_t		keys_capacity;
+	JsonFrame*	frames;
+	size_t		depth;
+	size_t		frames_capacity;
+	size_t		error_offset;
+	const char*	error;
+	ObjectCanonTable* canon;	/* intern every value built, if set */
+} JsonParser;
+
+static inline int json_ctz64(uint64_t x)
+{
+#ifdef __GNUC__
+	return __builtin_ctzll(x);
+#else
+	int n = 0;
+	while(!(x & 1)) {
+		x >>= 1;
+		n++;
+	}
+	return n;
+#endif
+}
+
+/*
+ * return table with room for need elements, or NULL leaving table intact
+ */
+static void* json_reserve(void* table, size_t* capacity, size_t need, size_t size)
+{
+	if(need <= *capacity)
+		return table;
+
+	size_t n = *capacity ? *capacity : 16;
+	while(n < need)
+		n *= 2;
+
+	void* t = realloc(table, n * size);
+	if(t != NULL)
+		*capacity = n;
+	return t;
+}
+
+static void* json_fail(JsonParser* jp, size_t offset, const char* message)
+{
+	if(jp->error == NULL) {
+		jp->error = message;
+		jp->error_offset = offset;
+	}
+	return NULL;
+}
+
+#ifdef OBJECT_SIMD_X86
+static void json_classify(const unsigned char* p, JsonBlock* b)
+{
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i lbrace = _mm_set1_epi8('{');
+	const __m128i rbrace = _mm_set1_epi8('}');
+	const __m128i colon = _mm_set1_epi8(':');
+	const __m128i comma = _mm_set1_epi8(',');
+	const __m128i space = _mm_set1_epi8(' ');
+	const __m128i tab = _mm_set1_epi8('\t');
+	const __m128i nl = _mm_set1_epi8('\n');
+	const __m128i cr = _mm_set1_epi8('\r');
+	const __m128i lower = _mm_set1_epi8(0x20);
+	int k;
+
+	memset(b, 0, sizeof(*b));
+	for(k = 0; k < 4; k++) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(p + 16 * k));
+		/* [ and ] differ from { and } only in bit 5 */
+		__m128i folded = _mm_or_si128(x, lower);
+		__m128i op = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(folded, lbrace), _mm_cmpeq_epi8(folded, rbrace)),
+			_mm_or_si128(_mm_cmpeq_epi8(x, colon), _mm_cmpeq_epi8(x, comma)));
+		__m128i ws = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(x, space), _mm_cmpeq_epi8(x, tab)),
+			_mm_or_si128(_mm_cmpeq_epi8(x, nl), _mm_cmpeq_epi8(x, cr)));
+		int shift = 16 * k;
+
+		b->quote |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x, quote)) << shift;
+		b->backslash |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x, backslash)) << shift;
+		b->op |= (uint64_t)(uint32_t)_mm_movemask_epi8(op) << shift;
+		b->space |= (uint64_t)(uint32_t)_mm_movemask_epi8(ws) << shift;
+	}
+}
+#else
+static void json_classify(const unsigned char* p, JsonBlock* b)
+{
+	int k;
+
+	memset(b, 0, sizeof(*b));
+	for(k = 0; k < 64; k++) {
+		uint64_t bit = (uint64_t)1 << k;
+		unsigned char c = json_class[p[k]];
+		if(c & JSON_QUOTE)
+			b->quote |= bit;
+		if(c & JSON_BACKSLASH)
+			b->backslash |= bit;
+		if(c & JSON_OP)
+			b->op |= bit;
+		if(c & JSON_SPACE)
+			b->space |= bit;
+	}
+}
+#endif
+
+/*
+ * bytes preceded by an odd run of backslashes. Runs starting on an even
+ * bit and on an odd bit are separated with one addition each, the carry
+ * out of which tells the next block whether its first byte is escaped
+ */
+static uint64_t json_escaped(uint64_t backslash, uint64_t* carry)
+{
+	const uint64_t even = 0x5555555555555555ULL;
+	uint64_t follows, odd_starts, even_starts, sum, invert;
+
+	backslash &= ~*carry;
+	follows = (backslash << 1) | *carry;
+	odd_starts = backslash & ~even & ~follows;
+	sum = odd_starts + backslash;
+	*carry = sum < odd_starts;
+	even_starts = sum;
+	invert = even_starts << 1;
+
+	return (even ^ invert) & follows;
+}
+
+/*
+ * bit i is set when an odd number of bits at or below i are set in x
+ */
+static inline uint64_t json_prefix_xor(uint64_t x)
+{
+	x ^= x << 1;
+	x ^= x << 2;
+	x ^= x << 4;
+	x ^= x << 8;
+	x ^= x << 16;
+	x ^= x << 32;
+	return x;
+}
+
+static int json_grow_index(JsonParser* jp, size_t need)
+{
+	size_t* index = json_reserve(jp->index, &jp->index_capacity, need, sizeof(size_t));
+	if(index == NULL)
+		return 0;
+	jp->index = index;
+	return 1;
+}
+
+static int json_index(JsonParser* jp)
+{
+	const unsigned char* buf = jp->buf;
+	size_t len = jp->len;
+	uint64_t escape_carry = 0, string_carry = 0, scalar_carry = 0;
+	unsigned char tail[64];
+	size_t base;
+
+	jp->count = 0;
+	if(!json_grow_index(jp, len / 8 + 64))
+		return 0;
+
+	for(base = 0; base < len; base += 64) {
+		JsonBlock b;
+		uint64_t escaped, quote, in_string, scalar, nonquote, follows, s;
+
+		if(len - base >= 64) {
+			json_classify(buf + base, &b);
+		} else {
+			memset(tail, ' ', sizeof(tail));
+			memcpy(tail, buf + base, len - base);
+			json_classify(tail, &b);
+		}
+
+		escaped = json_escaped(b.backslash, &escape_carry);
+		quote = b.quote & ~escaped;
+		/* from an opening quote up to but excluding its closing quote */
+		in_string = json_prefix_xor(quote) ^ string_carry;
+		string_carry = (uint64_t)0 - (in_string >> 63);
+
+		/* a scalar starts where a run of non space, non operator bytes does */
+		scalar = ~(b.op | b.space);
+		nonquote = scalar & ~quote;
+		follows = (nonquote << 1) | scalar_carry;
+		scalar_carry = nonquote >> 63;
+
+		s = (b.op | (scalar & ~follows)) & ~(in_string ^ quote);
+
+		if(!json_grow_index(jp, jp->count + 64))
+			return 0;
+		while(s) {
+			jp->index[jp->count++] = base + json_ctz64(s);
+			s &= s - 1;
+		}
+	}
+
+	return 1;
+}
+
+/*
+ * offset of the first byte in s[0..n) that a JSON string cannot carry
+ * verbatim: a quote, a backslash, a control character and, when ascii is
+ * set, any byte of a multi-byte sequence. n if there is none. The reader
+ * uses it to find the end of a clean run, the writer to find the next byte
+ * to escape.
+ */
+static inline size_t json_scan_scalar(const unsigned char* s, size_t i, size_t n, int ascii)
+{
+	for(; i < n; i++) {
+		if(s[i] == '"' || s[i] == '\\' || s[i] < 0x20 || (ascii && s[i] >= 0x80))
+			return i;
+	}
+	return n;
+}
+
+#ifdef OBJECT_SIMD_X86
+/*
+ * sets *at and returns 1 on a hit, otherwise leaves *at at the unscanned
+ * tail
+ */
+OBJECT_TARGET("avx2")
+static int json_scan_avx2(const unsigned char* s, size_t n, int ascii, size_t* at)
+{
+	const __m256i quote = _mm256_set1_epi8('"');
+	const __m256i backslash = _mm256_set1_epi8('\\');
+	const __m256i control = _mm256_set1_epi8(0x1f);
+	const __m256i high = ascii ? _mm256_set1_epi8((char)0x80) : _mm256_setzero_si256();
+	size_t i = 0;
+
+	for(; i + 32 <= n; i += 32) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)(s + i));
+		__m256i m = _mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpeq_epi8(x, quote), _mm256_cmpeq_epi8(x, backslash)),
+			_mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(x, control), x),
+				_mm256_and_si256(x, high)));
+		uint32_t mask = (uint32_t)_mm256_movemask_epi8(m);
+		if(mask) {
+			*at = i + object_ctz32(mask);
+			return 1;
+		}
+	}
+	*at = i;
+	return 0;
+}
+#endif
+
+static size_t json_scan(const unsigned char* s, size_t n, int ascii)
+{
+	size_t i = 0;
+
+#ifdef OBJECT_SIMD_X86
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i control = _mm_set1_epi8(0x1f);
+	const __m128i high = ascii ? _mm_set1_epi8((char)0x80) : _mm_setzero_si128();
+
+	if(n >= 64 && object_cpu_has_avx2() && json_scan_avx2(s, n, ascii, &i))
+		return i;
+	for(; i + 16 <= n; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(s + i));
+		__m128i m = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(x, quote), _mm_cmpeq_epi8(x, backslash)),
+			_mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(x, control), x),
+				_mm_and_si128(x, high)));
+		int mask = _mm_movemask_epi8(m);
+		if(mask)
+			return i + object_ctz32((uint32_t)mask);
+	}
+#endif
+	return json_scan_scalar(s, i, n, ascii);
+}
+
+static int json_hex4(const unsigned char* p, uint32_t* out)
+{
+	uint32_t v = 0;
+	int k;
+
+	for(k = 0; k < 4; k++) {
+		unsigned char c = p[k];
+		v <<= 4;
+		if(c >= '0' && c <= '9')
+			v |= c - '0';
+		else if((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+			v |= (c | 0x20) - 'a' + 10;
+		else
+			return 0;
+	}
+	*out = v;
+	return 1;
+}
+
+static size_t json_utf8_encode(uint32_t cp, char* out)
+{
+	if(cp < 0x80) {
+		out[0] = (char)cp;
+		return 1;
+	}
+	if(cp < 0x800) {
+		out[0] = (char)(0xc0 | (cp >> 6));
+		out[1] = (char)(0x80 | (cp & 0x3f));
+		return 2;
+	}
+	if(cp < 0x10000) {
+		out[0] = (char)(0xe0 | (cp >> 12));
+		out[1] = (char)(0x80 | ((cp >> 6) & 0x3f));
+		out[2] = (char)(0x80 | (cp & 0x3f));
+		return 3;
+	}
+	out[0] = (char)(0xf0 | (cp >> 18));
+	out[1] = (char)(0x80 | ((cp >> 12) & 0x3f));
+	out[2] = (char)(0x80 | ((cp >> 6) & 0x3f));
+	out[3] = (char)(0x80 | (cp & 0x3f));
+	return 4;
+}
+
+/*
+ * decode the string that starts after its opening quote at src into out,
+ * which has room for end - src bytes, and stop at the closing quote. Text
+ * only ever shrinks when unescaped. Returns NULL or an error message with
+ * *at set to where it applies
+ */
+static const char* json_unescape(const unsigned char* src, const unsigned char* end,
+	unsigned int flags, char* out, size_t* length, const unsigned char** at)
+{
+	char* start = out;
+	size_t k = json_scan(src, end - src, 0);
+
+	*at = src - 1;
+	for(;;) {
+		if(!(flags & OBJECT_JSON_NO_UTF8_CHECK) && !utf8Validate((const char *)src, k))
+			return "invalid UTF-8 in string";
+		memcpy(out, src, k);
+		out += k;
+		src += k;
+
+		if(src == end)
+			return "unterminated string";
+		if(*src == '"')
+			break;
+		if(*src < 0x20) {
+			*at = src;
+			return "control character in string";
+		}
+
+		/* backslash */
+		*at = src;
+		if(end - src < 2)
+			return "unterminated string";
+		switch(src[1]) {
+			case '"': *out++ = '"'; break;
+			case '\\': *out++ = '\\'; break;
+			case '/': *out++ = '/'; break;
+			case 'b': *out++ = '\b'; break;
+			case 'f': *out++ = '\f'; break;
+			case 'n': *out++ = '\n'; break;
+			case 'r': *out++ = '\r'; break;
+			case 't': *out++ = '\t'; break;
+			case 'u': {
+				uint32_t cp, low;
+				if(end - src < 6 || !json_hex4(src + 2, &cp))
+					return "invalid \\u escape";
+				if(cp >= 0xd800 && cp < 0xdc00) {
+					if(end - src < 12 || src[6] != '\\' || src[7] != 'u' ||
+						!json_hex4(src + 8, &low) || low < 0xdc00 || low > 0xdfff)
+						return "unpaired surrogate in \\u escape";
+					cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+					src += 6;
+				} else if(cp >= 0xdc00 && cp <= 0xdfff) {
+					return "unpaired surrogate in \\u escape";
+				}
+				out += json_utf8_encode(cp, out);
+				src += 4;
+			}
+			break;
+			default:
+				return "invalid escape";
+		}
+		src += 2;
+		k = json_scan(src, end - src, 0);
+	}
+
+	*length = out - start;
+	return NULL;
+}
+
+/*
+ * decode the string whose opening quote is index entry i. The closing
+ * quote lies before the next index entry, which bounds the storage needed
+ */
+static String* json_string(JsonParser* jp, size_t i)
+{
+	size_t start = jp->index[i] + 1;
+	size_t bound = i + 1 < jp->count ? jp->index[i + 1] : jp->len;
+	const unsigned char* src = jp->buf + start;
+	const unsigned char* end = jp->buf + bound;
+	size_t k = json_scan(src, end - src, 0);
+	const unsigned char* at;
+	const char* message;
+	String* string;
+
+	if(src + k < end && src[k] == '"') {
+		if(!(jp->flags & OBJECT_JSON_NO_UTF8_CHECK) && !utf8Validate((const char *)src, k))
+			return json_fail(jp, start - 1, "invalid UTF-8 in string");
+		string = newStringInstanceBuffer(k);
+		if(string == NULL)
+			return json_fail(jp, start - 1, "out of memory");
+		memcpy(string->value, src, k);
+		return string;
+	}
+
+	string = newStringInstanceBuffer(bound - start);
+	if(string == NULL)
+		return json_fail(jp, start - 1, "out of memory");
+	message = json_unescape(src, end, jp->flags, string->value, &string->length, &at);
+	if(message != NULL) {
+		stringInstanceFree(string);
+		return json_fail(jp, at - jp->buf, message);
+	}
+
+	string->value[string->length] = '\0';
+	/* give back what the escapes freed when it is worth a call */
+	if(bound - start - string->length > 64) {
+		String* shrunk = realloc(string, sizeof(String) + string->length + 1);
+		if(shrunk != NULL) {
+			string = shrunk;
+			string->value = (char *)(string + 1);
+		}
+	}
+	return string;
+}
+
+/*
+ * length of the number at p under the JSON grammar, which is stricter than
+ * what parseNumber() accepts, or 0. *exponent is set when it has one
+ */
+static size_t json_number_length(const unsigned char* p, const unsigned char* end, int* exponent)
+{
+	const unsigned char* start = p;
+
+	if(p < end && *p == '-')
+		p++;
+	if(p == end || *p < '0' || *p > '9')
+		return 0;
+	if(*p == '0') {
+		p++;
+	} else {
+		while(p < end && *p >= '0' && *p <= '9')
+			p++;
+	}
+	if(p < end && *p == '.') {
+		p++;
+		if(p == end || *p < '0' || *p > '9')
+			return 0;
+		while(p < end && *p >= '0' && *p <= '9')
+			p++;
+	}
+	if(p < end && (*p == 'e' || *p == 'E')) {
+		*exponent = 1;
+		p++;
+		if(p < end && (*p == '+' || *p == '-'))
+			p++;
+		if(p == end || *p < '0' || *p > '9')
+			return 0;
+		while(p < end && *p >= '0' && *p <= '9')
+			p++;
+	}
+	return p - start;
+}
+
+/*
+ * length of the literal or number at p, or 0 with *message set. *exponent
+ * is set for a number with an exponent
+ */
+static size_t json_scalar_length(const unsigned char* p, size_t left, const char** message,
+	int* exponent)
+{
+	size_t n;
+
+	switch(*p) {
+		case 't':
+			if(left < 4 || memcmp(p, "true", 4) != 0)
+				break;
+			return 4;
+		case 'f':
+			if(left < 5 || memcmp(p, "false", 5) != 0)
+				break;
+			return 5;
+		case 'n':
+			if(left < 4 || memcmp(p, "null", 4) != 0)
+				break;
+			return 4;
+		case '-': case '0': case '1': case '2': case '3': case '4':
+		case '5': case '6': case '7': case '8': case '9':
+			n = json_number_length(p, p + left, exponent);
+			if(n == 0)
+				*message = "invalid number";
+			return n;
+		default:
+			*message = "expected a value";
+			return 0;
+	}
+	*message = "invalid literal";
+	return 0;
+}
+
+/*
+ * the Object for n bytes that json_scalar_length() accepted
+ */
+static Object* json_scalar_value(const unsigned char* p, size_t n)
+{
+	Object* number;
+
+	switch(*p) {
+		case 't':
+			return newBool(1);
+		case 'f':
+			return newBool(0);
+		case 'n':
+			return newNull();
+		default:
+			parseNumber((const char *)p, n, &number);
+			return number;
+	}
+}
+
+/*
+ * length of the scalar at index entry i, 0 after json_fail(). *exponent is
+ * set as by json_scalar_length()
+ */
+static size_t json_scalar_token(JsonParser* jp, size_t i, int* exponent)
+{
+	size_t offset = jp->index[i];
+	const unsigned char* p = jp->buf + offset;
+	size_t left = jp->len - offset;
+	const char* message;
+	size_t consumed = json_scalar_length(p, left, &message, exponent);
+
+	if(consumed == 0) {
+		json_fail(jp, offset, message);
+		return 0;
+	}
+
+	/* the token must end where the scalar run does */
+	if(consumed < left && !(json_class[p[consumed]] & (JSON_OP | JSON_SPACE))) {
+		json_fail(jp, offset + consumed, "unexpected character after value");
+		return 0;
+	}
+	return consumed;
+}
+
+static Object* json_scalar(JsonParser* jp, size_t i)
+{
+	int exponent;
+	size_t consumed = json_scalar_token(jp, i, &exponent);
+	Object* value;
+
+	if(consumed == 0)
+		return NULL;
+	value = json_scalar_value(jp->buf + jp->index[i], consumed);
+	if(value == NULL)
+		return json_fail(jp, jp->index[i], "out of memory");
+	return value;
+}
+
+static Object* json_string_value(JsonParser* jp, size_t i)
+{
+	String* string = json_string(jp, i);
+	Object* value;
+
+	if(string == NULL)
+		return NULL;
+	value = newObject(IS_STRING);
+	if(value == NULL) {
+		stringInstanceFree(string);
+		return json_fail(jp, jp->index[i], "out of memory");
+	}
+	if(!(jp->flags & OBJECT_JSON_NO_UTF8_CHECK))
+		string->flags |= STRING_FLAG_UTF8;
+	O_SVAL(value) = string;
+	return value;
+}
+
+static int json_push_value(JsonParser* jp, Object* value)
+{
+	Object** values = json_reserve(jp->values, &jp->values_capacity, jp->nvalues + 1, sizeof(Object*));
+	if(values == NULL) {
+		objectSafeDestroy(value, NULL);
+		return 0;
+	}
+	jp->values = values;
+	jp->values[jp->nvalues++] = value;
+	return 1;
+}
+
+static int json_open(JsonParser* jp, size_t offset, int is_map)
+{
+	if(jp->depth == OBJECT_JSON_MAX_DEPTH) {
+		json_fail(jp, offset, "nesting too deep");
+		return 0;
+	}
+	JsonFrame* frames = json_reserve(jp->frames, &jp->frames_capacity, jp->depth + 1, sizeof(JsonFrame));
+	if(frames == NULL) {
+		json_fail(jp, offset, "out of memory");
+		return 0;
+	}
+	jp->frames = frames;
+	JsonFrame* frame = &jp->frames[jp->depth++];
+	frame->values = jp->nvalues;
+	frame->keys = jp->nkeys;
+	frame->is_map = is_map;
+	return 1;
+}
+
+/*
+ * pop the innermost container's children off the stacks into a new
+ * Array or Map
+ */
+static Object* json_close(JsonParser* jp, size_t offset)
+{
+	JsonFrame* frame = &jp->frames[jp->depth - 1];
+	size_t n = jp->nvalues - frame->values;
+	size_t k;
+	Object* container;
+
+	if(frame->is_map) {
+		size_t capacity = n + n / 2 + 1;
+		if(capacity > UINT32_MAX)
+			return json_fail(jp, offset, "too many keys");
+		container = newMap((uint32_t)capacity);
+		if(container == NULL)
+			return json_fail(jp, offset, "out of memory");
+		/* presized, so inserting only allocates buckets */
+		for(k = 0; k < n; k++) {
+			JsonKey* key = &jp->keys[frame->keys + k];
+			if(!mapInsertString(container, key->key, key->hash, jp->values[frame->values + k]))
+				break;
+		}
+		if(k < n) {
+			/* the stacks still own everything from k on */
+			objectSafeDestroy(container, NULL);
+			memmove(jp->keys + frame->keys, jp->keys + frame->keys + k, (n - k) * sizeof(JsonKey));
+			memmove(jp->values + frame->values, jp->values + frame->values + k, (n - k) * sizeof(Object*));
+			jp->nkeys -= k;
+			jp->nvalues -= k;
+			return json_fail(jp, offset, "out of memory");
+		}
+		jp->nkeys = frame->keys;
+	} else {
+		container = newArray(n ? n : 1);
+		if(container == NULL)
+			return json_fail(jp, offset, "out of memory");
+		if(n)
+			memcpy(O_AVAL(container)->table, jp->values + frame->values, n * sizeof(Object*));
+		O_AVAL(container)->size = n;
+		O_AVAL(container)->nextIndex = n;
+	}
+
+	jp->nvalues = frame->values;
+	jp->depth--;
+	return container;
+}
+
+static int json_key(JsonParser* jp, size_t i)
+{
+	String* key = json_string(jp, i);
+	if(key == NULL)
+		return 0;
+
+	JsonKey* keys = json_reserve(jp->keys, &jp->keys_capacity, jp->nkeys + 1, sizeof(JsonKey));
+	if(keys == NULL) {
+		stringInstanceFree(key);
+		json_fail(jp, jp->index[i], "out of memory");
+		return 0;
+	}
+	jp->keys = keys;
+	jp->keys[jp->nkeys].key = key;
+	jp->keys[jp->nkeys].hash = stringHash(key->value, key->length);
+	jp->nkeys++;
+	return 1;
+}
+
+static Object* json_build(JsonParser* jp)
+{
+	const unsigned char* buf = jp->buf;
+	size_t count = jp->count;
+	size_t i = 0;
+	Object* value;
+
+	if(count == 0)
+		return json_fail(jp, jp->len, "empty document");
+
+value:
+	if(i >= count)
+		return json_fail(jp, jp->len, "unexpected end of input");
+	switch(buf[jp->index[i]]) {
+		case '{':
+			if(!json_open(jp, jp->index[i], 1))
+				return NULL;
+			i++;
+			if(i < count && buf[jp->index[i]] == '}')
+				goto close;
+			goto key;
+		case '[':
+			if(!json_open(jp, jp->index[i], 0))
+				return NULL;
+			i++;
+			if(i < count && buf[jp->index[i]] == ']')
+				goto close;
+			goto value;
+		case '"':
+			value = json_string_value(jp, i);
+			if(value == NULL)
+				return NULL;
+		break;
+		default:
+			value = json_scalar(jp, i);
+			if(value == NULL)
+				return NULL;
+		break;
+	}
+	i++;
+
+push:
+	if(jp->canon != NULL)
+		value = canonIntern(jp->canon, value);
+	if(!json_push_value(jp, value))
+		return json_fail(jp, jp->index[i - 1], "out of memory");
+
+	/* after a value */
+	if(jp->depth == 0) {
+		if(i != count)
+			return json_fail(jp, jp->index[i], "unexpected data after the document");
+		jp->nvalues = 0;
+		return jp->values[0];
+	}
+	if(i >= count)
+		return json_fail(jp, jp->len, "unexpected end of input");
+	if(jp->frames[jp->depth - 1].is_map) {
+		switch(buf[jp->index[i]]) {
+			case ',':
+				i++;
+				goto key;
+			case '}':
+				goto close;
+			default:
+				return json_fail(jp, jp->index[i], "expected ',' or '}'");
+		}
+	} else {
+		switch(buf[jp->index[i]]) {
+			case ',':
+				i++;
+				goto value;
+			case ']':
+				goto close;
+			default:
+				return json_fail(jp, jp->index[i], "expected ',' or ']'");
+		}
+	}
+
+key:
+	if(i >= count)
+		return json_fail(jp, jp->len, "unexpected end of input");
+	if(buf[jp->index[i]] != '"')
+		return json_fail(jp, jp->index[i], "expected a string key");
+	if(!json_key(jp, i))
+		return NULL;
+	i++;
+	if(i >= count)
+		return json_fail(jp, jp->len, "unexpected end of input");
+	if(buf[jp->index[i]] != ':')
+		return json_fail(jp, jp->index[i], "expected ':'");
+	i++;
+	goto value;
+
+close:
+	value = json_close(jp, jp->index[i]);
+	if(value == NULL)
+		return NULL;
+	i++;
+	goto push;
+}
+
+static Object* json_lazy_build(JsonParser* jp);
+
+static void json_error(JsonParser* jp, ObjectJsonError* err)
+{
+	const unsigned char* p = jp->buf;
+	const unsigned char* end = jp->buf + jp->error_offset;
+	const unsigned char* nl;
+	size_t line = 1;
+	const unsigned char* line_start = p;
+
+	while(p < end && (nl = memchr(p, '\n', end - p)) != NULL) {
+		line++;
+		p = nl + 1;
+		line_start = p;
+	}
+	err->offset = jp->error_offset;
+	err->line = line;
+	err->column = jp->error_offset - (line_start - jp->buf) + 1;
+	err->message = jp->error;
+}
+
+static Object* json_parse(const char* text, size_t length, unsigned int flags,
+	ObjectCanonTable* canon, ObjectJsonError* err)
+{
+	JsonParser jp;
+	Object* root = NULL;
+	size_t k;
+
+	memset(&jp, 0, sizeof(jp));
+	jp.buf = (const unsigned char *)text;
+	jp.len = length;
+	jp.flags = flags;
+	jp.canon = canon;
+
+	if(text == NULL && length != 0) {
+		json_fail(&jp, 0, "NULL input");
+	} else if(!json_index(&jp)) {
+		json_fail(&jp, 0, "out of memory");
+	} else if(flags & OBJECT_JSON_LAZY) {
+		root = json_lazy_build(&jp);
+	} else {
+		root = json_build(&jp);
+	}
+
+	if(root == NULL) {
+		for(k = 0; k < jp.nvalues; k++)
+			objectSafeDestroy(jp.values[k], NULL);
+		for(k = 0; k < jp.nkeys; k++)
+			stringInstanceFree(jp.keys[k].key);
+		if(err)
+			json_error(&jp, err);
+	}
+
+	free(jp.index);
+	free(jp.values);
+	free(jp.keys);
+	free(jp.frames);
+
+	return root;
+}
+
+LIBOBJECT_API Object* objectFromJson(const char* text, size_t length, unsigned int flags,
+	ObjectJsonError* err)
+{
+	return json_parse(text, length, flags, NULL, err);
+}
+
+LIBOBJECT_API Object* objectFromJsonCanonical(const char* text, size_t length, unsigned int flags,
+	ObjectCanonTable* table, ObjectJsonError* err)
+{
+	BUG_ON_NULL(table);
+	return json_parse(text, length, flags & ~OBJECT_JSON_LAZY, table, err);
+}
+
+/*
+ * Lazy documents. With OBJECT_JSON_LAZY the text is checked exactly as for
+ * a full parse, but all that is kept is a copy of it, its structural index
+ * and the index entry of each bracket's partner. Every Array and Map starts
+ * out as a JsonLazy pointing at its opening bracket and builds its children
+ * the first time it is used; nested containers among them are lazy in turn.
+ * Containers nobody looks at cost their index entries, and are written back
+ * out by copying their text.
+ */
+
+typedef struct JsonDocument {
+	JsonParser	jp;		/* buf, len, flags, index and count */
+	size_t*		close;		/* entry of the matching bracket, for openers */
+	int		compact;	/* no white space between tokens */
+	int		overflow;	/* a number too big for a double */
+	unsigned int	refs;		/* JsonLazy nodes using it */
+} JsonDocument;
+
+typedef struct JsonLazy {
+	JsonDocument*	doc;
+	size_t		open;		/* index entry of the opening bracket */
+} JsonLazy;
+
+static void json_document_retain(JsonDocument* doc)
+{
+#ifdef __GNUC__
+	__atomic_add_fetch(&doc->refs, 1, __ATOMIC_RELAXED);
+#else
+	doc->refs++;
+#endif
+}
+
+static void json_document_release(JsonDocument* doc)
+{
+#ifdef __GNUC__
+	if(__atomic_sub_fetch(&doc->refs, 1, __ATOMIC_ACQ_REL) != 0)
+		return;
+#else
+	if(--doc->refs != 0)
+		return;
+#endif
+	free(doc->jp.index);
+	free(doc->close);
+	free(doc);
+}
+
+/*
+ * check the string at index entry i without keeping it. Escaped strings
+ * are decoded into scratch to find their errors
+ */
+static int json_check_string(JsonParser* jp, size_t i, char** scratch, size_t* capacity)
+{
+	size_t start = jp->index[i] + 1;
+	size_t bound = i + 1 < jp->count ? jp->index[i + 1] : jp->len;
+	const unsigned char* src = jp->buf + start;
+	size_t k = json_scan(src, bound - start, 0);
+	const unsigned char* at;
+	const char* message;
+	size_t length;
+	char* out;
+
+	if(k < bound - start && src[k] == '"') {
+		if(!(jp->flags & OBJECT_JSON_NO_UTF8_CHECK) && !utf8Validate((const char *)src, k)) {
+			json_fail(jp, start - 1, "invalid UTF-8 in string");
+			return 0;
+		}
+		return 1;
+	}
+
+	out = json_reserve(*scratch, capacity, bound - start + 1, 1);
+	if(out == NULL) {
+		json_fail(jp, start - 1, "out of memory");
+		return 0;
+	}
+	*scratch = out;
+	message = json_unescape(src, jp->buf + bound, jp->flags, out, &length, &at);
+	if(message != NULL) {
+		json_fail(jp, at - jp->buf, message);
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * whether the n byte number at p parses to an infinite double, which a
+ * loaded document writes as null
+ */
+static int json_number_overflows(const unsigned char* p, size_t n)
+{
+	Object* number;
+	int overflows;
+
+	parseNumber((const char *)p, n, &number);
+	overflows = number != NULL && O_TYPE(number) == IS_DOUBLE && O_DVAL(number) - O_DVAL(number) != 0;
+	objectDestroy(number);
+	return overflows;
+}
+
+/*
+ * walk the grammar of json_build() without building anything. Each
+ * opening bracket's close entry links to the enclosing one while it is
+ * open, and to its partner once that is found. overflow is set when a
+ * number is out of double range
+ */
+static int json_check(JsonParser* jp, size_t* close, int* compact, int* overflow)
+{
+	const unsigned char* buf = jp->buf;
+	size_t* index = jp->index;
+	size_t count = jp->count;
+	size_t i = 0, top = SIZE_MAX, depth = 0, capacity = 0;
+	char* scratch = NULL;
+	int ok = 0;
+
+	for(i = 1, *compact = 1; i < count && *compact; i++)
+		*compact = !(json_class[buf[index[i] - 1]] & JSON_SPACE);
+	*overflow = 0;
+	i = 0;
+
+value:
+	if(i >= count) {
+		json_fail(jp, jp->len, "unexpected end of input");
+		goto done;
+	}
+	switch(buf[index[i]]) {
+		case '{':
+		case '[':
+			if(depth == OBJECT_JSON_MAX_DEPTH) {
+				json_fail(jp, index[i], "nesting too deep");
+				goto done;
+			}
+			close[i] = top;
+			top = i++;
+			depth++;
+			if(i < count && buf[index[i]] == (buf[index[top]] == '{' ? '}' : ']'))
+				goto close;
+			if(buf[index[top]] == '{')
+				goto key;
+			goto value;
+		case '"':
+			if(!json_check_string(jp, i, &scratch, &capacity))
+				goto done;
+		break;
+		default: {
+			int exponent = 0;
+			size_t n = json_scalar_token(jp, i, &exponent);
+			if(n == 0)
+				goto done;
+			/* only these can be too big, and there are few of them */
+			if((exponent || n > DBL_MAX_10_EXP) && !*overflow)
+				*overflow = json_number_overflows(buf + index[i], n);
+		}
+		break;
+	}
+	i++;
+
+next:
+	if(depth == 0) {
+		if(i != count)
+			json_fail(jp, index[i], "unexpected data after the document");
+		ok = i == count;
+		goto done;
+	}
+	if(i >= count) {
+		json_fail(jp, jp->len, "unexpected end of input");
+		goto done;
+	}
+	if(buf[index[top]] == '{') {
+		switch(buf[index[i]]) {
+			case ',':
+				i++;
+				goto key;
+			case '}':
+				goto close;
+			default:
+				json_fail(jp, index[i], "expected ',' or '}'");
+				goto done;
+		}
+	} else {
+		switch(buf[index[i]]) {
+			case ',':
+				i++;
+				goto value;
+			case ']':
+				goto close;
+			default:
+				json_fail(jp, index[i], "expected ',' or ']'");
+				goto done;
+		}
+	}
+
+key:
+	if(i >= count) {
+		json_fail(jp, jp->len, "unexpected end of input");
+		goto done;
+	}
+	if(buf[index[i]] != '"') {
+		json_fail(jp, index[i], "expected a string key");
+		goto done;
+	}
+	if(!json_check_string(jp, i, &scratch, &capacity))
+		goto done;
+	i++;
+	if(i >= count) {
+		json_fail(jp, jp->len, "unexpected end of input");
+		goto done;
+	}
+	if(buf[index[i]] != ':') {
+		json_fail(jp, index[i], "expected ':'");
+		goto done;
+	}
+	i++;
+	goto value;
+
+close: {
+		size_t parent = close[top];
+		close[top] = i++;
+		top = parent;
+		depth--;
+	}
+	goto next;
+
+done:
+	free(scratch);
+	return ok;
+}
+
+static Object* json_lazy_new(JsonDocument* doc, size_t open)
+{
+	Object* o = newObject(doc->jp.buf[doc->jp.index[open]] == '{' ? IS_MAP : IS_ARRAY);
+	JsonLazy* lazy = malloc(sizeof(JsonLazy));
+
+	if(o == NULL || lazy == NULL) {
+		free(o);
+		free(lazy);
+		return NULL;
+	}
+	lazy->doc = doc;
+	lazy->open = open;
+	json_document_retain(doc);
+	O_PTVAL(o) = lazy;
+	O_FLG(o) |= OBJECT_FLAG_LAZY;
+	return o;
+}
+
+static Object* json_lazy_build(JsonParser* jp)
+{
+	JsonDocument* doc;
+	size_t* close;
+	size_t* index;
+	int compact, overflow;
+	Object* root;
+
+	if(jp->count == 0)
+		return json_fail(jp, jp->len, "empty document");
+	close = malloc(jp->count * sizeof(size_t));
+	if(close == NULL)
+		return json_fail(jp, 0, "out of memory");
+	if(!json_check(jp, close, &compact, &overflow)) {
+		free(close);
+		return NULL;
+	}
+	/* nothing to defer in a lone scalar */
+	if(jp->buf[jp->index[0]] != '{' && jp->buf[jp->index[0]] != '[') {
+		free(close);
+		return json_build(jp);
+	}
+
+	doc = malloc(sizeof(JsonDocument) + jp->len);
+	if(doc == NULL) {
+		free(close);
+		return json_fail(jp, 0, "out of memory");
+	}
+	memcpy(doc + 1, jp->buf, jp->len);
+	index = realloc(jp->index, jp->count * sizeof(size_t));
+	doc->jp = *jp;
+	doc->jp.buf = (const unsigned char *)(doc + 1);
+	doc->jp.index = index ? index : jp->index;
+	doc->jp.index_capacity = jp->count;
+	doc->close = close;
+	doc->compact = compact;
+	doc->overflow = overflow;
+	doc->refs = 1;
+	jp->index = NULL;
+
+	root = json_lazy_new(doc, 0);
+	json_document_release(doc);
+	if(root == NULL)
+		return json_fail(jp, 0, "out of memory");
+	return root;
+}
+
+/*
+ * entry after the value that starts at entry k
+ */
+static inline size_t json_lazy_skip(JsonDocument* doc, size_t k)
+{
+	unsigned char c = doc->jp.buf[doc->jp.index[k]];
+	return (c == '{' || c == '[' ? doc->close[k] : k) + 1;
+}
+
+static Object* json_lazy_value(JsonDocument* doc, JsonParser* jp, size_t k)
+{
+	switch(jp->buf[jp->index[k]]) {
+		case '{':
+		case '[':
+			return json_lazy_new(doc, k);
+		case '"':
+			return json_string_value(jp, k);
+		default:
+			return json_scalar(jp, k);
+	}
+}
+
+int jsonLazyLoad(Object* o)
+{
+	JsonLazy* lazy = O_PTVAL(o);
+	JsonDocument* doc = lazy->doc;
+	/* a private copy, so loads in different threads do not share error state */
+	JsonParser jp = doc->jp;
+	size_t end = doc->close[lazy->open];
+	size_t k, n = 0;
+	Object* container;
+
+	for(k = lazy->open + 1; k < end; n++) {
+		if(O_TYPE(o) == IS_MAP)
+			k += 2;
+		k = json_lazy_skip(doc, k) + 1;
+	}
+
+	if(O_TYPE(o) == IS_MAP) {
+		if(n + n / 2 + 1 > UINT32_MAX)
+			return 0;
+		container = newMap((uint32_t)(n + n / 2 + 1));
+		if(container == NULL)
+			return 0;
+		for(k = lazy->open + 1; k < end; k = json_lazy_skip(doc, k) + 1) {
+			String* key = json_string(&jp, k);
+			Object* value = key ? json_lazy_value(doc, &jp, k + 2) : NULL;
+			if(value == NULL || !mapInsertString(container, key, stringHash(key->value, key->length), value)) {
+				if(key != NULL)
+					stringInstanceFree(key);
+				if(value != NULL)
+					objectSafeDestroy(value, NULL);
+				objectSafeDestroy(container, NULL);
+				return 0;
+			}
+			k += 2;
+		}
+	} else {
+		container = newArray(n ? n : 1);
+		if(container == NULL)
+			return 0;
+		for(k = lazy->open + 1; k < end; k = json_lazy_skip(doc, k) + 1) {
+			Object* value = json_lazy_value(doc, &jp, k);
+			if(value == NULL) {
+				objectSafeDestroy(container, NULL);
+				return 0;
+			}
+			O_AVAL(container)->table[O_AVAL(container)->size++] = value;
+		}
+		O_AVAL(container)->nextIndex = O_AVAL(container)->size;
+	}
+
+	/* move the built container into o */
+	o->value = container->value;
+	O_FLG(o) &= ~OBJECT_FLAG_LAZY;
+	free(container);
+	free(lazy);
+	json_document_release(doc);
+	return 1;
+}
+
+Object* jsonLazyCopy(Object* o)
+{
+	JsonLazy* lazy = O_PTVAL(o);
+	return json_lazy_new(lazy->doc, lazy->open);
+}
+
+void jsonLazyFree(Object* o)
+{
+	JsonLazy* lazy = O_PTVAL(o);
+	json_document_release(lazy->doc);
+	free(lazy);
+}
+
+/*
+ * The pull reader walks the same grammar one token at a time. Tokens are
+ * read where they lie in the caller's chunk; one that runs past its end is
+ * copied into partial and completed from the following chunks before
+ * anything else happens. Values only become Objects when asked for, using
+ * the stacks of a JsonParser, and skipping counts brackets without
+ * decoding anything.
+ */
+
+enum {
+	JSON_READ_VALUE,		/* a value must follow */
+	JSON_READ_FIRST_VALUE,		/* a value or ] */
+	JSON_READ_FIRST_KEY,		/* a key or } */
+	JSON_READ_KEY,
+	JSON_READ_COLON,
+	JSON_READ_NEXT,			/* , or the closing bracket */
+	JSON_READ_DONE,
+	JSON_READ_FAILED
+};
+
+enum {
+	JSON_OP_NONE,
+	JSON_OP_VALUE,			/* inside jsonReaderValue() */
+	JSON_OP_SKIP			/* inside jsonReaderSkip() */
+};
+
+struct ObjectJsonReader {
+	unsigned int	flags;
+	int		state;
+	ObjectJsonEvent	event;		/* the current event, NEED_MORE for none */
+
+	const unsigned char* chunk;
+	size_t		length;
+	size_t		pos;
+	size_t		base;		/* stream offset of chunk[0] */
+	int		finished;
+
+	/* a token cut by the end of a chunk */
+	unsigned char*	partial;
+	size_t		partial_length;
+	size_t		partial_capacity;
+	size_t		partial_offset;
+	int		partial_active;
+	int		partial_escape;	/* it ends in a backslash */
+
+	/* the current token, and the unescaped text of a string */
+	const unsigned char* token;
+	size_t		token_length;
+	size_t		token_offset;
+	const char*	text;
+	size_t		text_length;
+	char*		scratch;
+	size_t		scratch_capacity;
+
+	/* one byte per open container, 1 for a map */
+	unsigned char*	stack;
+	size_t		depth;
+	size_t		stack_capacity;
+
+	int		op;
+	size_t		op_depth;	/* depth at which the value is complete */
+	JsonParser	builder;
+
+	int		skip_pop;	/* the skipped container is on the stack */
+	int		skip_string;
+	int		skip_escape;
+	int		skip_scalar;
+	size_t		skip_depth;
+
+	size_t		line;
+	size_t		line_start;
+	const char*	error;
+	size_t		error_offset;
+	size_t		error_line;
+	size_t		error_column;
+};
+
+static ObjectJsonEvent json_reader_fail(ObjectJsonReader* r, size_t offset, const char* message)
+{
+	if(r->error == NULL) {
+		r->error = message;
+		r->error_offset = offset;
+		r->error_line = r->line;
+		r->error_column = offset >= r->line_start ? offset - r->line_start + 1 : 1;
+	}
+	r->state = JSON_READ_FAILED;
+	return OBJECT_JSON_ERROR;
+}
+
+static inline size_t json_reader_offset(ObjectJsonReader* r)
+{
+	return r->base + r->pos;
+}
+
+static inline void json_reader_after_value(ObjectJsonReader* r)
+{
+	r->state = r->depth ? JSON_READ_NEXT : JSON_READ_DONE;
+}
+
+/*
+ * the closing quote of a string whose body continues at p, or NULL.
+ * *escape carries a backslash at the end over to the next call
+ */
+static const unsigned char* json_string_end(const unsigned char* p, const unsigned char* end, int* escape)
+{
+	if(*escape && p < end) {
+		p++;
+		*escape = 0;
+	}
+	while(p < end) {
+		p += json_scan(p, end - p, 0);
+		if(p == end)
+			break;
+		if(*p == '"')
+			return p;
+		if(*p == '\\') {
+			if(p + 1 == end) {
+				*escape = 1;
+				return NULL;
+			}
+			p += 2;
+		} else {
+			/* a control character, reported when the string is decoded */
+			p++;
+		}
+	}
+	return NULL;
+}
+
+static inline const unsigned char* json_scalar_end(const unsigned char* p, const unsigned char* end)
+{
+	while(p < end && !(json_class[*p] & (JSON_OP | JSON_SPACE)))
+		p++;
+	return p;
+}
+
+static int json_reader_append(ObjectJsonReader* r, const unsigned char* p, size_t n)
+{
+	unsigned char* partial = json_reserve(r->partial, &r->partial_capacity, r->partial_length + n, 1);
+	if(partial == NULL)
+		return 0;
+	r->partial = partial;
+	memcpy(r->partial + r->partial_length, p, n);
+	r->partial_length += n;
+	return 1;
+}
+
+/*
+ * check the complete token t, a string with its quotes or a scalar, and
+ * report it
+ */
+static ObjectJsonEvent json_reader_token(ObjectJsonReader* r, const unsigned char* t, size_t n,
+	size_t offset)
+{
+	r->token = t;
+	r->token_length = n;
+	r->token_offset = offset;
+
+	if(*t == '"') {
+		const unsigned char* body = t + 1;
+		size_t length = n - 2;
+
+		if(json_scan(body, length, 0) == length) {
+			/* nothing to unescape, point into the token */
+			if(!(r->flags & OBJECT_JSON_NO_UTF8_CHECK) && !utf8Validate((const char *)body, length))
+				return json_reader_fail(r, offset, "invalid UTF-8 in string");
+			r->text = (const char *)body;
+			r->text_length = length;
+		} else {
+			const unsigned char* at;
+			const char* message;
+			char* scratch = json_reserve(r->scratch, &r->scratch_capacity, length + 1, 1);
+			if(scratch == NULL)
+				return json_reader_fail(r, offset, "out of memory");
+			r->scratch = scratch;
+			message = json_unescape(body, t + n, r->flags, scratch, &r->text_length, &at);
+			if(message != NULL)
+				return json_reader_fail(r, offset + (at - t), message);
+			r->text = scratch;
+		}
+		if(r->state == JSON_READ_FIRST_KEY || r->state == JSON_READ_KEY) {
+			r->state = JSON_READ_COLON;
+			return OBJECT_JSON_KEY;
+		}
+	} else {
+		const char* message;
+		int exponent;
+		size_t consumed = json_scalar_length(t, n, &message, &exponent);
+		if(consumed == 0)
+			return json_reader_fail(r, offset, message);
+		if(consumed != n)
+			return json_reader_fail(r, offset + consumed, "unexpected character after value");
+	}
+
+	json_reader_after_value(r);
+	return OBJECT_JSON_VALUE;
+}
+
+/*
+ * the input ended inside the string t. Report the first problem in it, as
+ * objectFromJson() would
+ */
+static ObjectJsonEvent json_reader_unterminated(ObjectJsonReader* r, const unsigned char* t, size_t n,
+	size_t offset)
+{
+	const unsigned char* at;
+	const char* message;
+	char* scratch = json_reserve(r->scratch, &r->scratch_capacity, n, 1);
+
+	if(scratch == NULL)
+		return json_reader_fail(r, offset, "out of memory");
+	r->scratch = scratch;
+	message = json_unescape(t + 1, t + n, r->flags, scratch, &r->text_length, &at);
+	return json_reader_fail(r, offset + (at - t), message ? message : "unterminated string");
+}
+
+/*
+ * read the string or scalar starting at the current position, keeping
+ * what the chunk holds of it when it is cut short
+ */
+static ObjectJsonEvent json_reader_lex(ObjectJsonReader* r)
+{
+	const unsigned char* t = r->chunk + r->pos;
+	const unsigned char* end = r->chunk + r->length;
+	const unsigned char* stop;
+	size_t offset = json_reader_offset(r);
+	int escape = 0;
+
+	if(*t == '"') {
+		stop = json_string_end(t + 1, end, &escape);
+		if(stop != NULL) {
+			r->pos = stop + 1 - r->chunk;
+			return json_reader_token(r, t, stop + 1 - t, offset);
+		}
+	} else {
+		stop = json_scalar_end(t, end);
+		if(stop == t)
+			return json_reader_fail(r, offset, "expected a value");
+		if(stop < end || r->finished) {
+			r->pos = stop - r->chunk;
+			return json_reader_token(r, t, stop - t, offset);
+		}
+	}
+
+	if(r->finished)
+		return json_reader_unterminated(r, t, end - t, offset);
+	r->partial_length = 0;
+	if(!json_reader_append(r, t, end - t))
+		return json_reader_fail(r, offset, "out of memory");
+	r->partial_offset = offset;
+	r->partial_escape = escape;
+	r->partial_active = 1;
+	r->pos = r->length;
+	return OBJECT_JSON_NEED_MORE;
+}
+
+/*
+ * continue the token in partial with the new chunk
+ */
+static ObjectJsonEvent json_reader_resume(ObjectJsonReader* r)
+{
+	const unsigned char* p = r->chunk + r->pos;
+	const unsigned char* end = r->chunk + r->length;
+	const unsigned char* stop;
+	int done;
+
+	if(r->partial[0] == '"') {
+		stop = json_string_end(p, end, &r->partial_escape);
+		done = stop != NULL;
+		stop = done ? stop + 1 : end;
+	} else {
+		stop = json_scalar_end(p, end);
+		done = stop < end || r->finished;
+	}
+
+	if(!json_reader_append(r, p, stop - p))
+		return json_reader_fail(r, r->partial_offset, "out of memory");
+	r->pos = stop - r->chunk;
+	if(!done) {
+		if(r->finished)
+			return json_reader_unterminated(r, r->partial, r->partial_length, r->partial_offset);
+		return OBJECT_JSON_NEED_MORE;
+	}
+	r->partial_active = 0;
+	return json_reader_token(r, r->partial, r->partial_length, r->partial_offset);
+}
+
+static ObjectJsonEvent json_reader_open(ObjectJsonReader* r, int is_map)
+{
+	size_t offset = json_reader_offset(r);
+
+	if(r->depth == OBJECT_JSON_MAX_DEPTH)
+		return json_reader_fail(r, offset, "nesting too deep");
+	unsigned char* stack = json_reserve(r->stack, &r->stack_capacity, r->depth + 1, 1);
+	if(stack == NULL)
+		return json_reader_fail(r, offset, "out of memory");
+	r->stack = stack;
+	r->stack[r->depth++] = is_map;
+	r->token_offset = offset;
+	r->pos++;
+	r->state = is_map ? JSON_READ_FIRST_KEY : JSON_READ_FIRST_VALUE;
+	return is_map ? OBJECT_JSON_START_MAP : OBJECT_JSON_START_ARRAY;
+}
+
+static ObjectJsonEvent json_reader_close(ObjectJsonReader* r, unsigned char c)
+{
+	int is_map = r->stack[r->depth - 1];
+
+	if(c != (is_map ? '}' : ']'))
+		return json_reader_fail(r, json_reader_offset(r),
+			is_map ? "expected ',' or '}'" : "expected ',' or ']'");
+	r->token_offset = json_reader_offset(r);
+	r->pos++;
+	r->depth--;
+	json_reader_after_value(r);
+	return is_map ? OBJECT_JSON_END_MAP : OBJECT_JSON_END_ARRAY;
+}
+
+static ObjectJsonEvent json_reader_event(ObjectJsonReader* r)
+{
+	const unsigned char* chunk = r->chunk;
+	unsigned char c;
+
+	r->text = NULL;
+	if(r->state == JSON_READ_FAILED)
+		return OBJECT_JSON_ERROR;
+	if(r->partial_active)
+		return json_reader_resume(r);
+
+	for(;;) {
+		/* whitespace, counting lines for error positions */
+		while(r->pos < r->length && (json_class[chunk[r->pos]] & JSON_SPACE)) {
+			if(chunk[r->pos] == '\n') {
+				r->line++;
+				r->line_start = r->base + r->pos + 1;
+			}
+			r->pos++;
+		}
+		if(r->pos == r->length) {
+			if(!r->finished)
+				return OBJECT_JSON_NEED_MORE;
+			if(r->state == JSON_READ_DONE)
+				return OBJECT_JSON_END;
+			if(r->state == JSON_READ_VALUE && r->depth == 0) {
+				if(r->flags & OBJECT_JSON_MULTIPLE)
+					return OBJECT_JSON_END;
+				return json_reader_fail(r, json_reader_offset(r), "empty document");
+			}
+			return json_reader_fail(r, json_reader_offset(r), "unexpected end of input");
+		}
+
+		c = chunk[r->pos];
+		switch(r->state) {
+			case JSON_READ_DONE:
+				if(!(r->flags & OBJECT_JSON_MULTIPLE))
+					return json_reader_fail(r, json_reader_offset(r), "unexpected data after the document");
+				r->state = JSON_READ_VALUE;
+				continue;
+			case JSON_READ_COLON:
+				if(c != ':')
+					return json_reader_fail(r, json_reader_offset(r), "expected ':'");
+				r->pos++;
+				r->state = JSON_READ_VALUE;
+				continue;
+			case JSON_READ_NEXT:
+				if(c != ',')
+					return json_reader_close(r, c);
+				r->pos++;
+				r->state = r->stack[r->depth - 1] ? JSON_READ_KEY : JSON_READ_VALUE;
+				continue;
+			case JSON_READ_FIRST_KEY:
+				if(c == '}')
+					return json_reader_close(r, c);
+				/* fall through */
+			case JSON_READ_KEY:
+				if(c != '"')
+					return json_reader_fail(r, json_reader_offset(r), "expected a string key");
+				return json_reader_lex(r);
+			case JSON_READ_FIRST_VALUE:
+				if(c == ']')
+					return json_reader_close(r, c);
+				/* fall through */
+			default:
+				if(c == '{' || c == '[')
+					return json_reader_open(r, c == '{');
+				return json_reader_lex(r);
+		}
+	}
+}
+
+/*
+ * the Object for the current VALUE event
+ */
+static Object* json_reader_scalar(ObjectJsonReader* r)
+{
+	if(r->text != NULL) {
+		String* string = newStringInstanceBuffer(r->text_length);
+		Object* value = string ? newObject(IS_STRING) : NULL;
+		if(value == NULL) {
+			if(string != NULL)
+				stringInstanceFree(string);
+			return NULL;
+		}
+		memcpy(string->value, r->text, r->text_length);
+		if(!(r->flags & OBJECT_JSON_NO_UTF8_CHECK))
+			string->flags |= STRING_FLAG_UTF8;
+		O_SVAL(value) = string;
+		return value;
+	}
+	return json_scalar_value(r->token, r->token_length);
+}
+
+static int json_reader_push_key(ObjectJsonReader* r)
+{
+	JsonParser* b = &r->builder;
+	String* key = newStringInstanceBuffer(r->text_length);
+	JsonKey* keys = key ? json_reserve(b->keys, &b->keys_capacity, b->nkeys + 1, sizeof(JsonKey)) : NULL;
+
+	if(keys == NULL) {
+		if(key != NULL)
+			stringInstanceFree(key);
+		json_fail(b, r->token_offset, "out of memory");
+		return 0;
+	}
+	memcpy(key->value, r->text, r->text_length);
+	b->keys = keys;
+	b->keys[b->nkeys].key = key;
+	b->keys[b->nkeys].hash = stringHash(key->value, key->length);
+	b->nkeys++;
+	return 1;
+}
+
+/*
+ * drop whatever a failed jsonReaderValue() left on the builder's stacks
+ */
+static void json_reader_clear(ObjectJsonReader* r)
+{
+	JsonParser* b = &r->builder;
+	size_t k;
+
+	for(k = 0; k < b->nvalues; k++)
+		objectSafeDestroy(b->values[k], NULL);
+	for(k = 0; k < b->nkeys; k++)
+		stringInstanceFree(b->keys[k].key);
+	b->nvalues = 0;
+	b->nkeys = 0;
+	b->depth = 0;
+	b->error = NULL;
+}
+
+/*
+ * pass over a value by counting brackets outside strings
+ */
+static ObjectJsonEvent json_reader_skip(ObjectJsonReader* r)
+{
+	const unsigned char* chunk = r->chunk;
+	const unsigned char* stop;
+	size_t i = r->pos;
+	size_t n = r->length;
+	unsigned char c;
+
+	if(r->state == JSON_READ_FAILED)
+		return OBJECT_JSON_ERROR;
+
+	while(i < n) {
+		c = chunk[i];
+		if(r->skip_string) {
+			stop = json_string_end(chunk + i, chunk + n, &r->skip_escape);
+			if(stop == NULL) {
+				i = n;
+				break;
+			}
+			i = stop + 1 - chunk;
+			r->skip_string = 0;
+			if(r->skip_depth == 0)
+				goto done;
+			continue;
+		}
+		if(r->skip_scalar) {
+			if(json_class[c] & (JSON_OP | JSON_SPACE))
+				goto done;
+			i++;
+			continue;
+		}
+		if(c == '\n') {
+			r->line++;
+			r->line_start = r->base + i + 1;
+		}
+		if(r->state == JSON_READ_COLON) {
+			/* after a key */
+			if(c == ':')
+				r->state = JSON_READ_VALUE;
+			else if(!(json_class[c] & JSON_SPACE))
+				return json_reader_fail(r, r->base + i, "expected ':'");
+			i++;
+			continue;
+		}
+		switch(c) {
+			case '"':
+				r->skip_string = 1;
+				break;
+			case '{': case '[':
+				r->skip_depth++;
+				break;
+			case '}': case ']':
+				if(r->skip_depth == 0)
+					return json_reader_fail(r, r->base + i, "expected a value");
+				if(--r->skip_depth == 0) {
+					i++;
+					goto done;
+				}
+				break;
+			case ',': case ':':
+				if(r->skip_depth == 0)
+					return json_reader_fail(r, r->base + i, "expected a value");
+				break;
+			default:
+				if(r->skip_depth == 0 && !(json_class[c] & JSON_SPACE))
+					r->skip_scalar = 1;
+				break;
+		}
+		i++;
+	}
+
+	r->pos = i;
+	if(!r->finished)
+		return OBJECT_JSON_NEED_MORE;
+	if(!r->skip_scalar)
+		return json_reader_fail(r, json_reader_offset(r), "unexpected end of input");
+
+done:
+	r->pos = i;
+	r->skip_scalar = 0;
+	if(r->skip_pop)
+		r->depth--;
+	json_reader_after_value(r);
+	return OBJECT_JSON_VALUE;
+}
+
+LIBOBJECT_API ObjectJsonReader* newJsonReader(unsigned int flags)
+{
+	ObjectJsonReader* r = calloc(1, sizeof(ObjectJsonReader));
+	if(r == NULL) {
+		fprintf(get_debug_fp(), "%s(): out of memory\n", __func__);
+		return NULL;
+	}
+	r->flags = flags;
+	r->builder.flags = flags;
+	r->chunk = (const unsigned char *)"";
+	r->state = JSON_READ_VALUE;
+	r->event = OBJECT_JSON_NEED_MORE;
+	r->line = 1;
+	return r;
+}
+
+LIBOBJECT_API void jsonReaderFree(ObjectJsonReader* r)
+{
+	if(r == NULL)
+		return;
+	json_reader_clear(r);
+	free(r->builder.values);
+	free(r->builder.keys);
+	free(r->builder.frames);
+	free(r->partial);
+	free(r->scratch);
+	free(r->stack);
+	free(r);
+}
+
+LIBOBJECT_API int jsonReaderFeed(ObjectJsonReader* r, const char* chunk, size_t length)
+{
+	BUG_ON_NULL(r);
+	if(chunk == NULL && length != 0) {
+		fprintf(get_debug_fp(), "%s(): NULL chunk\n", __func__);
+		return 0;
+	}
+	if(r->finished || r->pos < r->length) {
+		fprintf(get_debug_fp(), "%s(): the previous chunk is not used up\n", __func__);
+		return 0;
+	}
+	r->base += r->length;
+	r->chunk = length ? (const unsigned char *)chunk : (const unsigned char *)"";
+	r->length = length;
+	r->pos = 0;
+	return 1;
+}
+
+LIBOBJECT_API void jsonReaderFinish(ObjectJsonReader* r)
+{
+	BUG_ON_NULL(r);
+	r->finished = 1;
+}
+
+LIBOBJECT_API ObjectJsonEvent jsonReaderNext(ObjectJsonReader* r)
+{
+	BUG_ON_NULL(r);
+	ObjectJsonEvent event;
+	Object* value;
+
+	/* finish an interrupted jsonReaderValue() or jsonReaderSkip() first */
+	if(r->op == JSON_OP_SKIP && (event = jsonReaderSkip(r)) != OBJECT_JSON_VALUE)
+		return event;
+	if(r->op == JSON_OP_VALUE) {
+		if((event = jsonReaderValue(r, &value)) != OBJECT_JSON_VALUE)
+			return event;
+		objectSafeDestroy(value, NULL);
+	}
+
+	r->event = json_reader_event(r);
+	return r->event;
+}
+
+LIBOBJECT_API const char* jsonReaderString(ObjectJsonReader* r, size_t* length)
+{
+	BUG_ON_NULL(r);
+	if(r->text != NULL && length != NULL)
+		*length = r->text_length;
+	return r->text;
+}
+
+LIBOBJECT_API ObjectJsonEvent jsonReaderValue(ObjectJsonReader* r, Object** out)
+{
+	BUG_ON_NULL(r);
+	BUG_ON_NULL(out);
+	JsonParser* b = &r->builder;
+	ObjectJsonEvent event;
+	Object* value;
+
+	*out = NULL;
+	if(r->op == JSON_OP_SKIP)
+		return json_reader_fail(r, json_reader_offset(r), "a value is being skipped");
+	if(r->op == JSON_OP_NONE) {
+		switch(r->event) {
+			case OBJECT_JSON_VALUE:
+				value = json_reader_scalar(r);
+				if(value == NULL)
+					return json_reader_fail(r, r->token_offset, "out of memory");
+				r->event = OBJECT_JSON_NEED_MORE;
+				*out = value;
+				return OBJECT_JSON_VALUE;
+			case OBJECT_JSON_START_MAP:
+			case OBJECT_JSON_START_ARRAY:
+				if(!json_open(b, r->token_offset, r->event == OBJECT_JSON_START_MAP))
+					goto failed;
+				r->op_depth = r->depth - 1;
+				break;
+			case OBJECT_JSON_KEY:
+				r->op_depth = r->depth;
+				break;
+			default:
+				return json_reader_fail(r, json_reader_offset(r), "no value to read");
+		}
+		r->op = JSON_OP_VALUE;
+	}
+
+	for(;;) {
+		event = json_reader_event(r);
+		switch(event) {
+			case OBJECT_JSON_NEED_MORE:
+				return event;
+			case OBJECT_JSON_START_MAP:
+			case OBJECT_JSON_START_ARRAY:
+				if(!json_open(b, r->token_offset, event == OBJECT_JSON_START_MAP))
+					goto failed;
+				continue;
+			case OBJECT_JSON_KEY:
+				if(!json_reader_push_key(r))
+					goto failed;
+				continue;
+			case OBJECT_JSON_VALUE:
+				value = json_reader_scalar(r);
+				if(value == NULL) {
+					json_fail(b, r->token_offset, "out of memory");
+					goto failed;
+				}
+				break;
+			case OBJECT_JSON_END_MAP:
+			case OBJECT_JSON_END_ARRAY:
+				value = json_close(b, r->token_offset);
+				if(value == NULL)
+					goto failed;
+				break;
+			default:
+				goto failed;
+		}
+		if(r->depth == r->op_depth) {
+			r->op = JSON_OP_NONE;
+			r->event = OBJECT_JSON_NEED_MORE;
+			*out = value;
+			return OBJECT_JSON_VALUE;
+		}
+		if(!json_push_value(b, value)) {
+			json_fail(b, r->token_offset, "out of memory");
+			goto failed;
+		}
+	}
+
+failed:
+	if(b->error != NULL)
+		json_reader_fail(r, b->error_offset, b->error);
+	json_reader_clear(r);
+	r->op = JSON_OP_NONE;
+	return OBJECT_JSON_ERROR;
+}
+
+LIBOBJECT_API ObjectJsonEvent jsonReaderSkip(ObjectJsonReader* r)
+{
+	BUG_ON_NULL(r);
+	ObjectJsonEvent event;
+
+	if(r->op == JSON_OP_VALUE)
+		return json_reader_fail(r, json_reader_offset(r), "a value is being read");
+	if(r->op == JSON_OP_NONE) {
+		switch(r->event) {
+			case OBJECT_JSON_VALUE:
+				r->event = OBJECT_JSON_NEED_MORE;
+				return OBJECT_JSON_VALUE;
+			case OBJECT_JSON_START_MAP:
+			case OBJECT_JSON_START_ARRAY:
+				r->skip_pop = 1;
+				r->skip_depth = 1;
+				break;
+			case OBJECT_JSON_KEY:
+				r->skip_pop = 0;
+				r->skip_depth = 0;
+				break;
+			default:
+				return json_reader_fail(r, json_reader_offset(r), "no value to skip");
+		}
+		r->skip_string = 0;
+		r->skip_escape = 0;
+		r->skip_scalar = 0;
+		r->text = NULL;
+		r->op = JSON_OP_SKIP;
+	}
+
+	event = json_reader_skip(r);
+	if(event != OBJECT_JSON_NEED_MORE) {
+		r->op = JSON_OP_NONE;
+		r->event = OBJECT_JSON_NEED_MORE;
+	}
+	return event;
+}
+
+LIBOBJECT_API size_t jsonReaderDepth(ObjectJsonReader* r)
+{
+	BUG_ON_NULL(r);
+	return r->depth;
+}
+
+LIBOBJECT_API int jsonReaderError(ObjectJsonReader* r, ObjectJsonError* err)
+{
+	BUG_ON_NULL(r);
+	if(r->error == NULL)
+		return 0;
+	if(err != NULL) {
+		err->offset = r->error_offset;
+		err->line = r->error_line;
+		err->column = r->error_column;
+		err->message = r->error;
+	}
+	return 1;
+}
+
+/*
+ * The writer formats into a buffer and hands full buffers to a sink
+ * through drain(), walking the tree in place. Streaming sinks reuse one
+ * stack chunk, objectToJson() grows its buffer in place and
+ * objectToJsonBuffer() formats straight into the caller's memory.
+ */
+
+#define JSON_CHUNK 4096
+
+typedef struct JsonWriter JsonWriter;
+
+struct JsonWriter {
+	char*		pos;
+	char*		end;
+	char*		base;
+	size_t		drained;	/* bytes handed on before base */
+	int		(*drain)(JsonWriter*);
+	int		flags;
+	int		failed;
+	FILE*		fp;
+	int		fd;
+	ObjectJsonWriteFunction write;
+	void*		context;
+	char		chunk[JSON_CHUNK];
+};
+
+static void json_writer_init(JsonWriter* w, int flags, int (*drain)(JsonWriter*))
+{
+	w->base = w->pos = w->chunk;
+	w->end = w->chunk + JSON_CHUNK;
+	w->drained = 0;
+	w->drain = drain;
+	w->flags = flags;
+	w->failed = 0;
+}
+
+static inline size_t json_written(JsonWriter* w)
+{
+	return w->drained + (w->pos - w->base);
+}
+
+/*
+ * a drain that discards, used to measure
+ */
+static int json_drain_count(JsonWriter* w)
+{
+	w->drained += w->pos - w->base;
+	w->pos = w->base;
+	return 1;
+}
+
+static int json_drain_file(JsonWriter* w)
+{
+	size_t n = w->pos - w->base;
+	if(fwrite(w->base, 1, n, w->fp) != n)
+		return 0;
+	w->drained += n;
+	w->pos = w->base;
+	return 1;
+}
+
+static int json_drain_fd(JsonWriter* w)
+{
+	const char* p = w->base;
+	while(p < w->pos) {
+		ssize_t n = write(w->fd, p, w->pos - p);
+		if(n < 0) {
+			if(errno == EINTR)
+				continue;
+			return 0;
+		}
+		p += n;
+	}
+	w->drained += w->pos - w->base;
+	w->pos = w->base;
+	return 1;
+}
+
+static int json_drain_callback(JsonWriter* w)
+{
+	size_t n = w->pos - w->base;
+	if(n && !w->write(w->context, w->base, n))
+		return 0;
+	w->drained += n;
+	w->pos = w->base;
+	return 1;
+}
+
+/*
+ * the caller's buffer is full: keep counting in the chunk
+ */
+static int json_drain_buffer(JsonWriter* w)
+{
+	w->drained += w->pos - w->base;
+	w->base = w->pos = w->chunk;
+	w->end = w->chunk + JSON_CHUNK;
+	w->drain = json_drain_count;
+	return 1;
+}
+
+static int json_drain_grow(JsonWriter* w)
+{
+	size_t used = w->pos - w->base;
+	size_t capacity = (w->end - w->base) * 2;
+	char* base;
+
+	if(capacity < used)
+		return 0;
+	if(w->base == w->chunk) {
+		base = malloc(capacity);
+		if(base != NULL)
+			memcpy(base, w->chunk, used);
+	} else {
+		base = realloc(w->base, capacity);
+	}
+	if(base == NULL)
+		return 0;
+
+	w->base = base;
+	w->pos = base + used;
+	w->end = base + capacity;
+	return 1;
+}
+
+static void json_put(JsonWriter* w, const char* s, size_t n)
+{
+	while(n > (size_t)(w->end - w->pos)) {
+		size_t room = w->end - w->pos;
+		memcpy(w->pos, s, room);
+		w->pos += room;
+		s += room;
+		n -= room;
+		if(w->failed || !w->drain(w)) {
+			w->failed = 1;
+			w->pos = w->base;
+			return;
+		}
+	}
+	memcpy(w->pos, s, n);
+	w->pos += n;
+}
+
+static inline void json_putc(JsonWriter* w, char c)
+{
+	if(w->pos == w->end && (w->failed || !w->drain(w))) {
+		w->failed = 1;
+		w->pos = w->base;
+		return;
+	}
+	*w->pos++ = c;
+}
+
+static void json_indent(JsonWriter* w, size_t depth)
+{
+	static const char spaces[] = "                                ";
+	size_t n = depth * 2;
+	while(n > sizeof(spaces) - 1) {
+		json_put(w, spaces, sizeof(spaces) - 1);
+		n -= sizeof(spaces) - 1;
+	}
+	json_put(w, spaces, n);
+}
+
+static void json_write_bytes(JsonWriter* w, String* bytes)
+{
+	/* whole base64 quanta, so pieces concatenate */
+	char encoded[JSON_CHUNK];
+	const size_t step = JSON_CHUNK / 4 * 3;
+	size_t i;
+
+	json_putc(w, '"');
+	for(i = 0; i < bytes->length && !w->failed; i += step) {
+		size_t n = bytes->length - i < step ? bytes->length - i : step;
+		json_put(w, encoded, base64Encode(bytes->value + i, n, encoded));
+	}
+	json_putc(w, '"');
+}
+
+/*
+ * the code point of the well formed UTF-8 sequence at s, or U+FFFD with
+ * a width of one for a byte that does not start one
+ */
+static uint32_t json_utf8_decode(const unsigned char* s, size_t n, size_t* width)
+{
+	uint32_t cp, min;
+	size_t k, len;
+
+	*width = 1;
+	if(s[0] >= 0xc2 && s[0] <= 0xdf) {
+		len = 2, min = 0x80, cp = s[0] & 0x1f;
+	} else if(s[0] >= 0xe0 && s[0] <= 0xef) {
+		len = 3, min = 0x800, cp = s[0] & 0x0f;
+	} else if(s[0] >= 0xf0 && s[0] <= 0xf4) {
+		len = 4, min = 0x10000, cp = s[0] & 0x07;
+	} else {
+		return 0xfffd;
+	}
+	if(len > n)
+		return 0xfffd;
+	for(k = 1; k < len; k++) {
+		if((s[k] & 0xc0) != 0x80)
+			return 0xfffd;
+		cp = (cp << 6) | (s[k] & 0x3f);
+	}
+	if(cp < min || cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff))
+		return 0xfffd;
+	*width = len;
+	return cp;
+}
+
+static void json_put_u16(JsonWriter* w, uint32_t unit)
+{
+	static const char hex[] = "0123456789abcdef";
+	char escape[6] = { '\\', 'u', hex[unit >> 12], hex[(unit >> 8) & 0xf],
+		hex[(unit >> 4) & 0xf], hex[unit & 0xf] };
+	json_put(w, escape, sizeof(escape));
+}
+
+/*
+ * RFC 8259 string: runs that need no escaping are copied in one json_put(),
+ * so clean strings cost a scan and a memcpy. Control characters use the
+ * short escapes where JSON has one. With OBJECT_JSON_ASCII everything
+ * above U+007F is written as \u escapes, astral code points as surrogate
+ * pairs, and bytes that are not valid UTF-8 as U+FFFD.
+ */
+static void json_write_string(JsonWriter* w, const char* value, size_t length)
+{
+	const unsigned char* s = (const unsigned char*)value;
+	const unsigned char* end = s + length;
+	int ascii = w->flags & OBJECT_JSON_ASCII;
+
+	json_putc(w, '"');
+	while(s < end && !w->failed) {
+		size_t k = json_scan(s, end - s, ascii);
+
+		json_put(w, (const char*)s, k);
+		s += k;
+		if(s == end)
+			break;
+
+		if(*s >= 0x80) {
+			uint32_t cp = json_utf8_decode(s, end - s, &k);
+			if(cp >= 0x10000) {
+				cp -= 0x10000;
+				json_put_u16(w, 0xd800 | (cp >> 10));
+				cp = 0xdc00 | (cp & 0x3ff);
+			}
+			json_put_u16(w, cp);
+			s += k;
+			continue;
+		}
+
+		switch(*s) {
+			case '"':  json_put(w, "\\\"", 2); break;
+			case '\\': json_put(w, "\\\\", 2); break;
+			case '\b': json_put(w, "\\b", 2); break;
+			case '\f': json_put(w, "\\f", 2); break;
+			case '\n': json_put(w, "\\n", 2); break;
+			case '\r': json_put(w, "\\r", 2); break;
+			case '\t': json_put(w, "\\t", 2); break;
+			default:   json_put_u16(w, *s); break;
+		}
+		s++;
+	}
+	json_putc(w, '"');
+}
+
+/*
+ * copy an untouched container from its source, dropping the white space
+ * between tokens. A number out of double range becomes null, as it does
+ * once loaded
+ */
+static void json_write_lazy(JsonWriter* w, JsonLazy* lazy)
+{
+	JsonDocument* doc = lazy->doc;
+	const char* buf = (const char *)doc->jp.buf;
+	size_t* index = doc->jp.index;
+	size_t end = doc->close[lazy->open];
+	size_t k;
+
+	if(doc->compact && !doc->overflow) {
+		json_put(w, buf + index[lazy->open], index[end] - index[lazy->open] + 1);
+		return;
+	}
+	for(k = lazy->open; k < end; k++) {
+		const char* p = buf + index[k];
+		const char* q = buf + index[k + 1];
+		while(q > p + 1 && (json_class[(unsigned char)q[-1]] & JSON_SPACE))
+			q--;
+		if(doc->overflow && (*p == '-' || (*p >= '0' && *p <= '9')) &&
+			json_number_overflows((const unsigned char *)p, q - p))
+			json_put(w, "null", 4);
+		else
+			json_put(w, p, q - p);
+	}
+	json_putc(w, buf[index[end]]);
+}
+
+static void json_write(JsonWriter* w, Object* o, size_t depth)
+{
+	int pretty = w->flags & OBJECT_JSON_PRETTY;
+	char number[OBJECT_SCALAR_BUFFER_SIZE];
+
+	if(w->failed)
+		return;
+
+	if(O_FLG(o) & OBJECT_FLAG_LAZY) {
+		if(!(w->flags & (OBJECT_JSON_PRETTY | OBJECT_JSON_ASCII))) {
+			json_write_lazy(w, O_PTVAL(o));
+			return;
+		}
+		if(!jsonLazyLoad(o)) {
+			w->failed = 1;
+			return;
+		}
+	}
+
+	switch(O_TYPE(o)) {
+		case IS_MAP: {
+			Map* map = O_MVAL(o);
+			uint32_t i, left = map->size;
+
+			json_putc(w, '{');
+			if(pretty)
+				json_putc(w, '\n');
+			for(i = 0; i < map->capacity && left; i++) {
+				Bucket* b;
+				for(b = map->buckets[i]; b != NULL; b = b->next) {
+					if(pretty)
+						json_indent(w, depth + 1);
+					json_write_string(w, b->key->value, b->key->length);
+					json_putc(w, ':');
+					if(pretty)
+						json_putc(w, ' ');
+					json_write(w, b->value, depth + 1);
+					if(--left)
+						json_putc(w, ',');
+					if(pretty)
+						json_putc(w, '\n');
+				}
+			}
+			if(pretty)
+				json_indent(w, depth);
+			json_putc(w, '}');
+		}
+		break;
+		case IS_ARRAY: {
+			Array* array = O_AVAL(o);
+			size_t i;
+
+			json_putc(w, '[');
+			if(pretty)
+				json_putc(w, '\n');
+			for(i = 0; i < array->size; i++) {
+				if(pretty)
+					json_indent(w, depth + 1);
+				json_write(w, array->table[i], depth + 1);
+				if(i != array->size - 1)
+					json_putc(w, ',');
+				if(pretty)
+					json_putc(w, '\n');
+			}
+			if(pretty)
+				json_indent(w, depth);
+			json_putc(w, ']');
+		}
+		break;
+		case IS_STRING:
+			json_write_string(w, O_SVAL(o)->value, O_SVAL(o)->length);
+		break;
+		case IS_BYTES:
+			json_write_bytes(w, O_BYVAL(o));
+		break;
+		case IS_DOUBLE: {
+			size_t n;
+			/* JSON has no NaN or Infinity */
+			if(O_DVAL(o) != O_DVAL(o) || O_DVAL(o) - O_DVAL(o) != 0) {
+				json_put(w, "null", 4);
+				break;
+			}
+			/* an integral value needs a fraction to be read back as a Double */
+			n = formatDouble(O_DVAL(o), number);
+			if(strpbrk(number, ".e") == NULL) {
+				memcpy(number + n, ".0", 3);
+				n += 2;
+			}
+			json_put(w, number, n);
+		}
+		break;
+		case IS_LONG:
+		case IS_BOOL:
+		case IS_NULL:
+			json_put(w, number, objectFormatScalar(o, number));
+		break;
+		default:
+			fprintf(get_debug_fp(), "%s(): type %d has no JSON representation\n", __func__,
+				O_TYPE(o));
+			w->failed = 1;
+		break;
+	}
+}
+
+/*
+ * write o and hand the last partial buffer to the sink
+ */
+static int json_write_document(JsonWriter* w, Object* o)
+{
+	json_write(w, o, 0);
+	if(!w->failed && w->pos != w->base && !w->drain(w))
+		w->failed = 1;
+	return !w->failed;
+}
+
+LIBOBJECT_API char* objectToJson(Object* o, int flags, size_t* length)
+{
+	BUG_ON_NULL(o);
+	JsonWriter w;
+
+	json_writer_init(&w, flags, json_drain_grow);
+	json_write(&w, o, 0);
+	json_putc(&w, '\0');
+
+	if(w.failed) {
+		if(w.base != w.chunk)
+			free(w.base);
+		if(length)
+			*length = 0;
+		return NULL;
+	}
+
+	size_t n = w.pos - w.base;
+	char* buffer;
+	if(w.base == w.chunk) {
+		buffer = malloc(n);
+		if(buffer != NULL)
+			memcpy(buffer, w.chunk, n);
+	} else {
+		buffer = realloc(w.base, n);
+		if(buffer == NULL)
+			buffer = w.base;
+	}
+	if(length)
+		*length = buffer ? n - 1 : 0;
+	return buffer;
+}
+
+LIBOBJECT_API size_t objectJsonLength(Object* o, int flags)
+{
+	BUG_ON_NULL(o);
+	JsonWriter w;
+
+	json_writer_init(&w, flags, json_drain_count);
+	json_write(&w, o, 0);
+	return w.failed ? 0 : json_written(&w);
+}
+
+LIBOBJECT_API size_t objectToJsonBuffer(Object* o, int flags, char* buffer, size_t size)
+{
+	BUG_ON_NULL(o);
+	JsonWriter w;
+
+	json_writer_init(&w, flags, json_drain_count);
+	if(buffer != NULL && size > 0) {
+		/* keep the last byte for the NUL */
+		w.base = w.pos = buffer;
+		w.end = buffer + size - 1;
+		w.drain = json_drain_buffer;
+	}
+	json_write(&w, o, 0);
+	if(w.failed)
+		return 0;
+
+	if(buffer != NULL && size > 0) {
+		if(w.base == buffer)
+			*w.pos = '\0';
+		else
+			buffer[size - 1] = '\0';
+	}
+	return json_written(&w);
+}
+
+LIBOBJECT_API int objectToJsonFile(Object* o, int flags, FILE* fp)
+{
+	BUG_ON_NULL(o);
+	BUG_ON_NULL(fp);
+	JsonWriter w;
+
+	json_writer_init(&w, flags, json_drain_file);
+	w.fp = fp;
+	return json_write_document(&w, o);
+}
+
+LIBOBJECT_API int objectToJsonFd(Object* o, int flags, int fd)
+{
+	BUG_ON_NULL(o);
+	JsonWriter w;
+
+	json_writer_init(&w, flags, json_drain_fd);
+	w.fd = fd;
+	return json_write_document(&w, o);
+}
+
+LIBOBJECT_API int objectToJsonCallback(Object* o, int flags, ObjectJsonWriteFunction callback,
+	void* context)
+{
+	BUG_ON_NULL(o);
+	BUG_ON_NULL(callback);
+	JsonWriter w;
+
+	json_writer_init(&w, flags, json_drain_callback);
+	w.write = callback;
+	w.context = context;
+	return json_write_document(&w, o);
+}
@@ -0,0 +1,689 @@
+/*
+ *  Copyright (c) 2015 Ryan McCullagh <me@ryanmccullagh.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * MessagePack encoder and decoder.
+ *
+ * The encoder writes in one pass, checking for room once per value rather
+ * than once per byte. Every
+ * MessagePack container states its element count up front, so the decoder
+ * creates each Array and Map at its final size before decoding what goes
+ * in it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+
+#include "object.h"
+#include "object_private.h"
+
+static size_t msgpack_long_length(long v)
+{
+	if(v >= 0) {
+		if(v < 0x80)
+			return 1;
+		if(v <= 0xff)
+			return 2;
+		if(v <= 0xffff)
+			return 3;
+		if((unsigned long)v <= 0xffffffffUL)
+			return 5;
+		return 9;
+	}
+	if(v >= -32)
+		return 1;
+	if(v >= INT8_MIN)
+		return 2;
+	if(v >= INT16_MIN)
+		return 3;
+	if(v >= INT32_MIN)
+		return 5;
+	return 9;
+}
+
+/*
+ * header size for a str or bin of n bytes, 0 if it is too long
+ */
+static size_t msgpack_raw_length(size_t n, int is_string)
+{
+	if(is_string && n < 32)
+		return 1;
+	if(n <= 0xff)
+		return 2;
+	if(n <= 0xffff)
+		return 3;
+	if(n <= 0xffffffffUL)
+		return 5;
+	return 0;
+}
+
+static size_t msgpack_container_length(size_t n)
+{
+	if(n < 16)
+		return 1;
+	return n <= 0xffff ? 3 : 5;
+}
+
+/*
+ * encoded size of o, 0 if it holds something MessagePack cannot represent
+ */
+static size_t msgpack_length(Object* o)
+{
+	size_t n, k, total;
+
+	if(!objectLoad(o))
+		return 0;
+	switch(O_TYPE(o)) {
+		case IS_NULL:
+		case IS_BOOL:
+			return 1;
+		case IS_LONG:
+			return msgpack_long_length(O_LVAL(o));
+		case IS_DOUBLE:
+			return 9;
+		case IS_STRING:
+		case IS_BYTES:
+			n = msgpack_raw_length(O_SVAL(o)->length, O_TYPE(o) == IS_STRING);
+			return n ? n + O_SVAL(o)->length : 0;
+		case IS_ARRAY: {
+			Array* array = O_AVAL(o);
+			if(array->size > 0xffffffffUL)
+				return 0;
+			total = msgpack_container_length(array->size);
+			for(k = 0; k < array->size; k++) {
+				if((n = msgpack_length(array->table[k])) == 0)
+					return 0;
+				total += n;
+			}
+			return total;
+		}
+		case IS_MAP: {
+			Map* map = O_MVAL(o);
+			uint32_t i, left = map->size;
+			total = msgpack_container_length(map->size);
+			for(i = 0; i < map->capacity && left; i++) {
+				Bucket* b;
+				for(b = map->buckets[i]; b != NULL; b = b->next, left--) {
+					k = msgpack_raw_length(b->key->length, 1);
+					if(k == 0 || (n = msgpack_length(b->value)) == 0)
+						return 0;
+					total += k + b->key->length + n;
+				}
+			}
+			return total;
+		}
+		case IS_PAIR:
+			if((n = msgpack_length(O_PVAL(o)->first)) == 0 ||
+				(k = msgpack_length(O_PVAL(o)->second)) == 0)
+				return 0;
+			return 1 + n + k;
+		default:
+			fprintf(get_debug_fp(), "%s(): type %d has no MessagePack representation\n", __func__, O_TYPE(o));
+			return 0;
+	}
+}
+
+static inline unsigned char* msgpack_put16(unsigned char* p, uint32_t v)
+{
+	p[0] = v >> 8;
+	p[1] = v;
+	return p + 2;
+}
+
+static inline unsigned char* msgpack_put32(unsigned char* p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+	return p + 4;
+}
+
+static inline unsigned char* msgpack_put64(unsigned char* p, uint64_t v)
+{
+	p = msgpack_put32(p, (uint32_t)(v >> 32));
+	return msgpack_put32(p, (uint32_t)v);
+}
+
+static unsigned char* msgpack_put_long(unsigned char* p, long v)
+{
+	switch(msgpack_long_length(v)) {
+		case 1:
+			*p++ = (unsigned char)v;
+			break;
+		case 2:
+			*p++ = v >= 0 ? 0xcc : 0xd0;
+			*p++ = (unsigned char)v;
+			break;
+		case 3:
+			*p++ = v >= 0 ? 0xcd : 0xd1;
+			p = msgpack_put16(p, (uint32_t)v);
+			break;
+		case 5:
+			*p++ = v >= 0 ? 0xce : 0xd2;
+			p = msgpack_put32(p, (uint32_t)v);
+			break;
+		default:
+			*p++ = v >= 0 ? 0xcf : 0xd3;
+			p = msgpack_put64(p, (uint64_t)v);
+			break;
+	}
+	return p;
+}
+
+static unsigned char* msgpack_put_raw(unsigned char* p, const char* value, size_t n, int is_string)
+{
+	switch(msgpack_raw_length(n, is_string)) {
+		case 1:
+			*p++ = 0xa0 | n;
+			break;
+		case 2:
+			*p++ = is_string ? 0xd9 : 0xc4;
+			*p++ = n;
+			break;
+		case 3:
+			*p++ = is_string ? 0xda : 0xc5;
+			p = msgpack_put16(p, n);
+			break;
+		default:
+			*p++ = is_string ? 0xdb : 0xc6;
+			p = msgpack_put32(p, n);
+			break;
+	}
+	memcpy(p, value, n);
+	return p + n;
+}
+
+static unsigned char* msgpack_put_container(unsigned char* p, size_t n, int is_map)
+{
+	if(n < 16) {
+		*p++ = (is_map ? 0x80 : 0x90) | n;
+	} else if(n <= 0xffff) {
+		*p++ = is_map ? 0xde : 0xdc;
+		p = msgpack_put16(p, n);
+	} else {
+		*p++ = is_map ? 0xdf : 0xdd;
+		p = msgpack_put32(p, n);
+	}
+	return p;
+}
+
+typedef struct MsgpackWriter {
+	unsigned char*	base;
+	unsigned char*	p;
+	unsigned char*	end;
+	int		grow;		/* realloc when full, otherwise fail */
+	int		failed;
+	int		unsupported;	/* failed on a type with no encoding */
+} MsgpackWriter;
+
+static int msgpack_grow(MsgpackWriter* w, size_t n)
+{
+	size_t used = w->p - w->base;
+	size_t capacity = w->end - w->base;
+	unsigned char* base;
+
+	if(!w->grow) {
+		w->failed = 1;
+		return 0;
+	}
+	if(capacity == 0)
+		capacity = 256;
+	while(capacity - used < n)
+		capacity *= 2;
+	base = realloc(w->base, capacity);
+	if(base == NULL) {
+		w->failed = 1;
+		return 0;
+	}
+	w->base = base;
+	w->p = base + used;
+	w->end = base + capacity;
+	return 1;
+}
+
+/*
+ * room for n more bytes
+ */
+static inline int msgpack_reserve(MsgpackWriter* w, size_t n)
+{
+	return (size_t)(w->end - w->p) >= n || msgpack_grow(w, n);
+}
+
+static void msgpack_write(MsgpackWriter* w, Object* o)
+{
+	union {
+		double	d;
+		uint64_t u;
+	} bits;
+	size_t k;
+
+	if(w->failed)
+		return;
+	if(!objectLoad(o)) {
+		w->failed = 1;
+		return;
+	}
+
+	switch(O_TYPE(o)) {
+		case IS_NULL:
+			if(msgpack_reserve(w, 1))
+				*w->p++ = 0xc0;
+			break;
+		case IS_BOOL:
+			if(msgpack_reserve(w, 1))
+				*w->p++ = O_BVAL(o) ? 0xc3 : 0xc2;
+			break;
+		case IS_LONG:
+			if(msgpack_reserve(w, msgpack_long_length(O_LVAL(o))))
+				w->p = msgpack_put_long(w->p, O_LVAL(o));
+			break;
+		case IS_DOUBLE:
+			if(msgpack_reserve(w, 9)) {
+				bits.d = O_DVAL(o);
+				*w->p++ = 0xcb;
+				w->p = msgpack_put64(w->p, bits.u);
+			}
+			break;
+		case IS_STRING:
+		case IS_BYTES:
+			k = msgpack_raw_length(O_SVAL(o)->length, O_TYPE(o) == IS_STRING);
+			if(k == 0)
+				w->failed = w->unsupported = 1;
+			else if(msgpack_reserve(w, k + O_SVAL(o)->length))
+				w->p = msgpack_put_raw(w->p, O_SVAL(o)->value, O_SVAL(o)->length, O_TYPE(o) == IS_STRING);
+			break;
+		case IS_ARRAY: {
+			Array* array = O_AVAL(o);
+			if(array->size > 0xffffffffUL) {
+				w->failed = w->unsupported = 1;
+				break;
+			}
+			if(!msgpack_reserve(w, msgpack_container_length(array->size)))
+				break;
+			w->p = msgpack_put_container(w->p, array->size, 0);
+			for(k = 0; k < array->size && !w->failed; k++)
+				msgpack_write(w, array->table[k]);
+		}
+		break;
+		case IS_MAP: {
+			Map* map = O_MVAL(o);
+			uint32_t i, left = map->size;
+			if(!msgpack_reserve(w, msgpack_container_length(map->size)))
+				break;
+			w->p = msgpack_put_container(w->p, map->size, 1);
+			for(i = 0; i < map->capacity && left; i++) {
+				Bucket* b;
+				for(b = map->buckets[i]; b != NULL; b = b->next, left--) {
+					k = msgpack_raw_length(b->key->length, 1);
+					if(k == 0)
+						w->failed = w->unsupported = 1;
+					else if(msgpack_reserve(w, k + b->key->length))
+						w->p = msgpack_put_raw(w->p, b->key->value, b->key->length, 1);
+					msgpack_write(w, b->value);
+					if(w->failed)
+						return;
+				}
+			}
+		}
+		break;
+		case IS_PAIR:
+			if(!msgpack_reserve(w, 1))
+				break;
+			*w->p++ = 0x92;
+			msgpack_write(w, O_PVAL(o)->first);
+			msgpack_write(w, O_PVAL(o)->second);
+			break;
+		default:
+			fprintf(get_debug_fp(), "%s(): type %d has no MessagePack representation\n", __func__, O_TYPE(o));
+			w->failed = w->unsupported = 1;
+			break;
+	}
+}
+
+LIBOBJECT_API size_t objectMsgpackLength(Object* o)
+{
+	BUG_ON_NULL(o);
+	return msgpack_length(o);
+}
+
+/*
+ * A measuring pass would walk the tree twice, and walking it is most of
+ * the cost, so the buffer grows instead
+ */
+LIBOBJECT_API char* objectToMsgpack(Object* o, size_t* length)
+{
+	BUG_ON_NULL(o);
+	MsgpackWriter w;
+
+	memset(&w, 0, sizeof(w));
+	w.grow = 1;
+	msgpack_write(&w, o);
+	if(length != NULL)
+		*length = w.failed ? 0 : (size_t)(w.p - w.base);
+	if(w.failed) {
+		if(!w.unsupported)
+			fprintf(get_debug_fp(), "%s(): out of memory\n", __func__);
+		free(w.base);
+		return NULL;
+	}
+	return (char *)w.base;
+}
+
+LIBOBJECT_API size_t objectToMsgpackBuffer(Object* o, char* buffer, size_t size)
+{
+	BUG_ON_NULL(o);
+	MsgpackWriter w;
+
+	memset(&w, 0, sizeof(w));
+	if(buffer != NULL) {
+		w.base = w.p = (unsigned char *)buffer;
+		w.end = w.base + size;
+	}
+	msgpack_write(&w, o);
+	if(!w.failed)
+		return w.p - w.base;
+	/* too small: measure what it would take */
+	return w.unsupported ? 0 : msgpack_length(o);
+}
+
+typedef struct MsgpackReader {
+	const unsigned char* start;
+	const unsigned char* p;
+	const unsigned char* end;
+	const char*	error;
+	size_t		error_offset;
+} MsgpackReader;
+
+static void* msgpack_fail(MsgpackReader* r, const char* message)
+{
+	if(r->error == NULL) {
+		r->error = message;
+		r->error_offset = r->p - r->start;
+	}
+	return NULL;
+}
+
+/*
+ * the n byte big endian number at p, after checking it is there
+ */
+static inline int msgpack_get(MsgpackReader* r, size_t n, uint64_t* out)
+{
+	uint64_t v = 0;
+	size_t i;
+
+	if((size_t)(r->end - r->p) < n)
+		return 0;
+	for(i = 0; i < n; i++)
+		v = (v << 8) | r->p[i];
+	r->p += n;
+	*out = v;
+	return 1;
+}
+
+/*
+ * read the length of the str that starts at the current byte
+ */
+static int msgpack_string_length(MsgpackReader* r, unsigned char c, uint64_t* n)
+{
+	if((c & 0xe0) == 0xa0) {
+		*n = c & 0x1f;
+		return 1;
+	}
+	switch(c) {
+		case 0xd9: return msgpack_get(r, 1, n);
+		case 0xda: return msgpack_get(r, 2, n);
+		case 0xdb: return msgpack_get(r, 4, n);
+		default: return 0;
+	}
+}
+
+static String* msgpack_string(MsgpackReader* r, uint64_t n)
+{
+	if((uint64_t)(r->end - r->p) < n)
+		return msgpack_fail(r, "truncated input");
+	String* string = newStringInstanceBuffer(n);
+	if(string == NULL)
+		return msgpack_fail(r, "out of memory");
+	memcpy(string->value, r->p, n);
+	r->p += n;
+	return string;
+}
+
+static Object* msgpack_read(MsgpackReader* r, size_t depth);
+
+static Object* msgpack_read_array(MsgpackReader* r, uint64_t n, size_t depth)
+{
+	Object* array;
+	Object* value;
+	uint64_t k;
+
+	/* every element takes at least a byte, so a bad count cannot make us allocate */
+	if(n > (uint64_t)(r->end - r->p))
+		return msgpack_fail(r, "truncated input");
+	array = newArray(n ? n : 1);
+	if(array == NULL)
+		return msgpack_fail(r, "out of memory");
+	for(k = 0; k < n; k++) {
+		value = msgpack_read(r, depth + 1);
+		if(value == NULL) {
+			O_AVAL(array)->size = O_AVAL(array)->nextIndex = k;
+			objectSafeDestroy(array, NULL);
+			return NULL;
+		}
+		O_AVAL(array)->table[k] = value;
+	}
+	O_AVAL(array)->size = n;
+	O_AVAL(array)->nextIndex = n;
+	return array;
+}
+
+static Object* msgpack_read_map(MsgpackReader* r, uint64_t n, size_t depth)
+{
+	Object* map;
+	Object* value;
+	String* key;
+	uint64_t k, length;
+
+	if(n > (uint64_t)(r->end - r->p) / 2)
+		return msgpack_fail(r, "truncated input");
+	if(n + n / 2 + 1 > UINT32_MAX)
+		return msgpack_fail(r, "too many keys");
+	map = newMap((uint32_t)(n + n / 2 + 1));
+	if(map == NULL)
+		return msgpack_fail(r, "out of memory");
+	for(k = 0; k < n; k++) {
+		if(r->p == r->end) {
+			msgpack_fail(r, "truncated input");
+			break;
+		}
+		r->p++;
+		if(!msgpack_string_length(r, r->p[-1], &length)) {
+			r->p--;
+			msgpack_fail(r, "map key is not a string");
+			break;
+		}
+		key = msgpack_string(r, length);
+		if(key == NULL)
+			break;
+		value = msgpack_read(r, depth + 1);
+		if(value == NULL) {
+			stringInstanceFree(key);
+			break;
+		}
+		if(!mapInsertString(map, key, stringHash(key->value, key->length), value)) {
+			stringInstanceFree(key);
+			objectSafeDestroy(value, NULL);
+			msgpack_fail(r, "out of memory");
+			break;
+		}
+	}
+	if(k < n) {
+		objectSafeDestroy(map, NULL);
+		return NULL;
+	}
+	return map;
+}
+
+static Object* msgpack_read(MsgpackReader* r, size_t depth)
+{
+	union {
+		double	d;
+		uint64_t u;
+	} bits;
+	union {
+		float	f;
+		uint32_t u;
+	} bits32;
+	uint64_t n;
+	unsigned char c;
+	Object* value;
+
+	if(depth > OBJECT_MSGPACK_MAX_DEPTH)
+		return msgpack_fail(r, "nesting too deep");
+	if(r->p == r->end)
+		return msgpack_fail(r, "truncated input");
+	c = *r->p++;
+
+	if(c < 0x80)
+		value = newLong(c);
+	else if(c >= 0xe0)
+		value = newLong((signed char)c);
+	else if(c < 0x90)
+		return msgpack_read_map(r, c & 0x0f, depth);
+	else if(c < 0xa0)
+		return msgpack_read_array(r, c & 0x0f, depth);
+	else if(c < 0xc0 || c == 0xd9 || c == 0xda || c == 0xdb) {
+		String* string;
+		if(!msgpack_string_length(r, c, &n))
+			return msgpack_fail(r, "truncated input");
+		string = msgpack_string(r, n);
+		if(string == NULL)
+			return NULL;
+		value = newObject(IS_STRING);
+		if(value == NULL) {
+			stringInstanceFree(string);
+			return msgpack_fail(r, "out of memory");
+		}
+		/* UTF-8 is checked the first time it matters */
+		O_SVAL(value) = string;
+		return value;
+	} else {
+		switch(c) {
+			case 0xc0:
+				value = newNull();
+				break;
+			case 0xc2:
+			case 0xc3:
+				value = newBool(c == 0xc3);
+				break;
+			case 0xc4: case 0xc5: case 0xc6:
+				if(!msgpack_get(r, (size_t)1 << (c - 0xc4), &n))
+					return msgpack_fail(r, "truncated input");
+				if(n > (uint64_t)(r->end - r->p))
+					return msgpack_fail(r, "truncated input");
+				value = newBytes(r->p, n);
+				r->p += n;
+				break;
+			case 0xca:
+				if(!msgpack_get(r, 4, &n))
+					return msgpack_fail(r, "truncated input");
+				bits32.u = (uint32_t)n;
+				value = newDouble(bits32.f);
+				break;
+			case 0xcb:
+				if(!msgpack_get(r, 8, &n))
+					return msgpack_fail(r, "truncated input");
+				bits.u = n;
+				value = newDouble(bits.d);
+				break;
+			case 0xcc: case 0xcd: case 0xce: case 0xcf:
+				if(!msgpack_get(r, (size_t)1 << (c - 0xcc), &n))
+					return msgpack_fail(r, "truncated input");
+				/* like JSON, integers past LONG_MAX become Double */
+				value = n <= LONG_MAX ? newLong((long)n) : newDouble((double)n);
+				break;
+			case 0xd0:
+				if(!msgpack_get(r, 1, &n))
+					return msgpack_fail(r, "truncated input");
+				value = newLong((int8_t)n);
+				break;
+			case 0xd1:
+				if(!msgpack_get(r, 2, &n))
+					return msgpack_fail(r, "truncated input");
+				value = newLong((int16_t)n);
+				break;
+			case 0xd2:
+				if(!msgpack_get(r, 4, &n))
+					return msgpack_fail(r, "truncated input");
+				value = newLong((int32_t)n);
+				break;
+			case 0xd3:
+				if(!msgpack_get(r, 8, &n))
+					return msgpack_fail(r, "truncated input");
+				value = newLong((long)(int64_t)n);
+				break;
+			case 0xdc: case 0xdd:
+				if(!msgpack_get(r, c == 0xdc ? 2 : 4, &n))
+					return msgpack_fail(r, "truncated input");
+				return msgpack_read_array(r, n, depth);
+			case 0xde: case 0xdf:
+				if(!msgpack_get(r, c == 0xde ? 2 : 4, &n))
+					return msgpack_fail(r, "truncated input");
+				return msgpack_read_map(r, n, depth);
+			default:
+				/* 0xc1, extensions */
+				r->p--;
+				return msgpack_fail(r, "unsupported type");
+		}
+	}
+
+	if(value == NULL)
+		return msgpack_fail(r, "out of memory");
+	return value;
+}
+
+LIBOBJECT_API Object* objectFromMsgpack(const char* data, size_t length, size_t* consumed)
+{
+	MsgpackReader r;
+	Object* value;
+
+	if(data == NULL && length != 0) {
+		fprintf(get_debug_fp(), "%s(): NULL input\n", __func__);
+		return NULL;
+	}
+	r.start = r.p = (const unsigned char *)(length ? data : "");
+	r.end = r.start + length;
+	r.error = NULL;
+	r.error_offset = 0;
+
+	value = msgpack_read(&r, 0);
+	if(value != NULL && consumed == NULL && r.p != r.end) {
+		objectSafeDestroy(value, NULL);
+		value = msgpack_fail(&r, "unexpected data after the value");
+	}
+	if(value == NULL) {
+		fprintf(get_debug_fp(), "%s(): %s at offset %zu\n", __func__, r.error, r.error_offset);
+		return NULL;
+	}
+	if(consumed != NULL)
+		*consumed = r.p - r.start;
+	return value;
+}
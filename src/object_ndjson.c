@@ -0,0 +1,619 @@
+/*
+ *  Copyright (c) 2015 Ryan McCullagh <me@ryanmccullagh.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Newline delimited JSON on several cores.
+ *
+ * Input is cut into pieces of about NDJSON_PIECE bytes at line ends and
+ * output into pieces of whole records. The calling thread produces pieces
+ * into a ring, worker threads process them in any order, and the calling
+ * thread consumes them strictly in order, so callbacks see records in
+ * input order and never run concurrently. The ring bounds how far the
+ * workers run ahead, which bounds memory however long the input is. When
+ * the piece it waits for is not taken yet the calling thread processes it
+ * itself, so small inputs never start a worker.
+ *
+ * The workers are not the pool's of object_pool.c: a pool loop returns
+ * only once all of its ranges are done, while here pieces are parsed as
+ * they are read and delivered as they finish, and that overlap is the
+ * point. A worker is started only once a piece is waiting and then lives
+ * for as many pieces of about a megabyte as the call has, so starting it
+ * costs little next to them. There are as many as the pool has threads,
+ * so the two never plan for a different number of cores.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "object.h"
+#include "object_private.h"
+
+#define NDJSON_PIECE		(1 << 20)	/* input bytes per piece */
+#define NDJSON_WRITE_BYTES	(1 << 18)	/* rough output bytes per piece */
+#define NDJSON_MAX_THREADS	64
+
+typedef struct NdjsonPiece {
+	/* reading: a run of whole lines */
+	const char*	text;
+	size_t		length;
+	char*		owned;		/* text read from a file */
+	size_t		offset;		/* of text in the input */
+	size_t		lines;		/* line ends in text */
+	/* parsed records, or the records to write */
+	Object**	records;
+	size_t		nrecords;
+	size_t		records_capacity;
+	/* writing: the formatted lines */
+	char*		out;
+	size_t		out_length;
+	size_t		out_capacity;
+	int		done;
+	int		failed;
+	ObjectJsonError	err;		/* relative to the piece */
+} NdjsonPiece;
+
+typedef struct NdjsonPipeline NdjsonPipeline;
+
+struct NdjsonPipeline {
+	pthread_mutex_t	lock;
+	pthread_cond_t	queued_cond;	/* a piece was queued, or the end */
+	pthread_cond_t	done_cond;	/* a piece was processed */
+	NdjsonPiece*	ring;
+	size_t		window;
+	/* piece counters, each one ahead of the next */
+	size_t		queued;
+	size_t		claimed;
+	size_t		delivered;
+	int		end;		/* nothing more will be queued */
+	void		(*process)(NdjsonPipeline*, NdjsonPiece*);
+	unsigned int	flags;
+	pthread_t	threads[NDJSON_MAX_THREADS];
+	size_t		nthreads;
+	size_t		max_threads;
+};
+
+static void* ndjson_worker(void* arg)
+{
+	NdjsonPipeline* p = arg;
+	NdjsonPiece* piece;
+
+	pthread_mutex_lock(&p->lock);
+	for(;;) {
+		while(p->claimed == p->queued && !p->end)
+			pthread_cond_wait(&p->queued_cond, &p->lock);
+		if(p->claimed == p->queued)
+			break;
+		piece = &p->ring[p->claimed++ % p->window];
+		pthread_mutex_unlock(&p->lock);
+
+		p->process(p, piece);
+
+		pthread_mutex_lock(&p->lock);
+		piece->done = 1;
+		pthread_cond_broadcast(&p->done_cond);
+	}
+	pthread_mutex_unlock(&p->lock);
+	return NULL;
+}
+
+static int ndjson_init(NdjsonPipeline* p, void (*process)(NdjsonPipeline*, NdjsonPiece*),
+	unsigned int flags)
+{
+	memset(p, 0, sizeof(*p));
+	/* the calling thread works too */
+	p->max_threads = poolThreads() - 1;
+	if(p->max_threads > NDJSON_MAX_THREADS)
+		p->max_threads = NDJSON_MAX_THREADS;
+	p->window = 2 * (p->max_threads + 1);
+	p->ring = calloc(p->window, sizeof(NdjsonPiece));
+	if(p->ring == NULL)
+		return 0;
+	p->process = process;
+	p->flags = flags;
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->queued_cond, NULL);
+	pthread_cond_init(&p->done_cond, NULL);
+	return 1;
+}
+
+/*
+ * the slot for the next piece, NULL while the ring is full
+ */
+static NdjsonPiece* ndjson_slot(NdjsonPipeline* p)
+{
+	if(p->queued - p->delivered == p->window)
+		return NULL;
+	return &p->ring[p->queued % p->window];
+}
+
+/*
+ * hand the filled slot to the workers, starting another one while pieces
+ * wait and there are cores left
+ */
+static void ndjson_queue(NdjsonPipeline* p)
+{
+	pthread_mutex_lock(&p->lock);
+	p->ring[p->queued % p->window].done = 0;
+	p->queued++;
+	pthread_cond_signal(&p->queued_cond);
+	if(p->queued - p->claimed > 1 && p->nthreads < p->max_threads &&
+		pthread_create(&p->threads[p->nthreads], NULL, ndjson_worker, p) == 0)
+		p->nthreads++;
+	pthread_mutex_unlock(&p->lock);
+}
+
+/*
+ * the oldest undelivered piece, once it is processed
+ */
+static NdjsonPiece* ndjson_next(NdjsonPipeline* p)
+{
+	NdjsonPiece* piece = &p->ring[p->delivered % p->window];
+
+	pthread_mutex_lock(&p->lock);
+	while(!piece->done) {
+		if(p->claimed == p->delivered) {
+			p->claimed++;
+			pthread_mutex_unlock(&p->lock);
+			p->process(p, piece);
+			pthread_mutex_lock(&p->lock);
+			piece->done = 1;
+			break;
+		}
+		pthread_cond_wait(&p->done_cond, &p->lock);
+	}
+	pthread_mutex_unlock(&p->lock);
+	return piece;
+}
+
+static void ndjson_delivered(NdjsonPipeline* p)
+{
+	pthread_mutex_lock(&p->lock);
+	p->delivered++;
+	pthread_mutex_unlock(&p->lock);
+}
+
+/*
+ * stop the workers once they finish what they hold, then free the ring.
+ * owned says whether the record tables and records belong to the ring
+ */
+static void ndjson_finish(NdjsonPipeline* p, int owned)
+{
+	size_t i, k;
+
+	pthread_mutex_lock(&p->lock);
+	p->end = 1;
+	/* unclaimed pieces are dropped */
+	p->queued = p->claimed;
+	pthread_cond_broadcast(&p->queued_cond);
+	pthread_mutex_unlock(&p->lock);
+	for(i = 0; i < p->nthreads; i++)
+		pthread_join(p->threads[i], NULL);
+
+	for(i = 0; i < p->window; i++) {
+		NdjsonPiece* piece = &p->ring[i];
+		if(owned) {
+			for(k = 0; k < piece->nrecords; k++)
+				objectSafeDestroy(piece->records[k], NULL);
+			free(piece->records);
+		}
+		free(piece->owned);
+		free(piece->out);
+	}
+	free(p->ring);
+	pthread_cond_destroy(&p->done_cond);
+	pthread_cond_destroy(&p->queued_cond);
+	pthread_mutex_destroy(&p->lock);
+}
+
+static int ndjson_push(NdjsonPiece* piece, Object* record)
+{
+	if(piece->nrecords == piece->records_capacity) {
+		size_t n = piece->records_capacity ? 2 * piece->records_capacity : 64;
+		Object** records = realloc(piece->records, n * sizeof(Object*));
+		if(records == NULL)
+			return 0;
+		piece->records = records;
+		piece->records_capacity = n;
+	}
+	piece->records[piece->nrecords++] = record;
+	return 1;
+}
+
+static void ndjson_parse(NdjsonPipeline* p, NdjsonPiece* piece)
+{
+	const char* s = piece->text;
+	const char* end = s + piece->length;
+	const char* nl;
+	const char* e;
+	Object* record;
+
+	piece->nrecords = 0;
+	piece->lines = 0;
+	piece->failed = 0;
+	while(s < end) {
+		nl = memchr(s, '\n', end - s);
+		e = nl ? nl : end;
+		if(e > s && e[-1] == '\r')
+			e--;
+
+		/* blank lines hold no record */
+		const char* t = s;
+		while(t < e && (*t == ' ' || *t == '\t' || *t == '\r'))
+			t++;
+		if(t < e) {
+			record = objectFromJson(s, e - s, p->flags, &piece->err);
+			if(record != NULL && !ndjson_push(piece, record)) {
+				objectSafeDestroy(record, NULL);
+				record = NULL;
+				piece->err.offset = 0;
+				piece->err.column = 1;
+				piece->err.message = "out of memory";
+			}
+			if(record == NULL) {
+				/* a line is one record, so only the line needs fixing up */
+				piece->err.offset += s - piece->text;
+				piece->err.line = piece->lines;
+				piece->failed = 1;
+				return;
+			}
+		}
+		if(nl == NULL)
+			break;
+		piece->lines++;
+		s = nl + 1;
+	}
+}
+
+/*
+ * pass a parsed piece's records on in order. Returns 0 after an error
+ * with err filled in, -1 when the callback stopped and 1 to go on
+ */
+static int ndjson_deliver(NdjsonPiece* piece, size_t* line, size_t* index,
+	ObjectNdjsonFunction callback, void* context, ObjectJsonError* err)
+{
+	size_t k;
+
+	for(k = 0; k < piece->nrecords; k++) {
+		Object* record = piece->records[k];
+		piece->records[k] = NULL;
+		if(!callback(context, record, (*index)++)) {
+			for(k++; k < piece->nrecords; k++)
+				objectSafeDestroy(piece->records[k], NULL);
+			piece->nrecords = 0;
+			return -1;
+		}
+	}
+	piece->nrecords = 0;
+
+	if(piece->failed) {
+		if(err != NULL) {
+			*err = piece->err;
+			err->offset += piece->offset;
+			err->line += *line + 1;
+		}
+		return 0;
+	}
+	*line += piece->lines;
+	return 1;
+}
+
+LIBOBJECT_API int ndjsonReadBuffer(const char* text, size_t length, unsigned int flags,
+	ObjectNdjsonFunction callback, void* context, ObjectJsonError* err)
+{
+	BUG_ON_NULL(callback);
+	NdjsonPipeline p;
+	NdjsonPiece* piece;
+	size_t at = 0;
+	size_t line = 0;
+	size_t index = 0;
+	int status = 1;
+
+	if(text == NULL && length != 0) {
+		fprintf(get_debug_fp(), "%s(): NULL input\n", __func__);
+		return 0;
+	}
+	if(!ndjson_init(&p, ndjson_parse, flags)) {
+		fprintf(get_debug_fp(), "%s(): out of memory\n", __func__);
+		return 0;
+	}
+
+	while(status == 1) {
+		while(at < length && (piece = ndjson_slot(&p)) != NULL) {
+			size_t n = length - at;
+			if(n > NDJSON_PIECE) {
+				const char* nl = memchr(text + at + NDJSON_PIECE, '\n', n - NDJSON_PIECE);
+				if(nl != NULL)
+					n = nl + 1 - (text + at);
+			}
+			piece->text = text + at;
+			piece->length = n;
+			piece->offset = at;
+			at += n;
+			ndjson_queue(&p);
+		}
+		if(p.delivered == p.queued)
+			break;
+		piece = ndjson_next(&p);
+		status = ndjson_deliver(piece, &line, &index, callback, context, err);
+		ndjson_delivered(&p);
+	}
+
+	ndjson_finish(&p, 1);
+	return status != 0;
+}
+
+/*
+ * read the next run of whole lines from fp into a piece. The part of a
+ * line the last read cut off waits in carry
+ */
+typedef struct NdjsonFile {
+	FILE*		fp;
+	char*		carry;
+	size_t		carry_length;
+	size_t		carry_capacity;
+	size_t		offset;
+	int		eof;
+	int		failed;
+} NdjsonFile;
+
+static int ndjson_fill(NdjsonFile* f, NdjsonPiece* piece)
+{
+	size_t capacity = f->carry_length + NDJSON_PIECE;
+	size_t length = f->carry_length;
+	size_t start = length;
+	char* buffer = malloc(capacity);
+	char* p;
+
+	if(buffer == NULL)
+		return 0;
+	if(f->carry_length)
+		memcpy(buffer, f->carry, f->carry_length);
+	for(;;) {
+		length += fread(buffer + length, 1, capacity - length, f->fp);
+		if(length < capacity) {
+			if(ferror(f->fp)) {
+				free(buffer);
+				return 0;
+			}
+			f->eof = 1;
+			f->carry_length = 0;
+			break;
+		}
+		/* cut after the last line end */
+		for(p = buffer + length; p > buffer + start && p[-1] != '\n'; p--)
+			;
+		if(p > buffer + start) {
+			size_t tail = buffer + length - p;
+			if(tail > f->carry_capacity) {
+				char* carry = realloc(f->carry, tail);
+				if(carry == NULL) {
+					free(buffer);
+					return 0;
+				}
+				f->carry = carry;
+				f->carry_capacity = tail;
+			}
+			memcpy(f->carry, p, tail);
+			f->carry_length = tail;
+			length -= tail;
+			break;
+		}
+		/* a line longer than the buffer */
+		start = length;
+		p = realloc(buffer, capacity * 2);
+		if(p == NULL) {
+			free(buffer);
+			return 0;
+		}
+		buffer = p;
+		capacity *= 2;
+	}
+
+	free(piece->owned);
+	piece->owned = buffer;
+	piece->text = buffer;
+	piece->length = length;
+	piece->offset = f->offset;
+	f->offset += length;
+	return 1;
+}
+
+LIBOBJECT_API int ndjsonReadFile(FILE* fp, unsigned int flags, ObjectNdjsonFunction callback,
+	void* context, ObjectJsonError* err)
+{
+	BUG_ON_NULL(fp);
+	BUG_ON_NULL(callback);
+	NdjsonPipeline p;
+	NdjsonPiece* piece;
+	NdjsonFile f;
+	size_t line = 0;
+	size_t index = 0;
+	int status = 1;
+
+	if(!ndjson_init(&p, ndjson_parse, flags)) {
+		fprintf(get_debug_fp(), "%s(): out of memory\n", __func__);
+		return 0;
+	}
+	memset(&f, 0, sizeof(f));
+	f.fp = fp;
+
+	while(status == 1) {
+		while(!f.eof && !f.failed && (piece = ndjson_slot(&p)) != NULL) {
+			if(!ndjson_fill(&f, piece)) {
+				f.failed = 1;
+				break;
+			}
+			ndjson_queue(&p);
+		}
+		if(p.delivered == p.queued) {
+			if(f.failed) {
+				if(err != NULL) {
+					err->offset = f.offset;
+					err->line = line + 1;
+					err->column = 1;
+					err->message = ferror(fp) ? "read error" : "out of memory";
+				}
+				status = 0;
+			}
+			break;
+		}
+		piece = ndjson_next(&p);
+		status = ndjson_deliver(piece, &line, &index, callback, context, err);
+		ndjson_delivered(&p);
+	}
+
+	ndjson_finish(&p, 1);
+	free(f.carry);
+	return status != 0;
+}
+
+typedef struct NdjsonCollect {
+	Object*		array;
+	int		failed;
+} NdjsonCollect;
+
+static int ndjson_collect(void* context, Object* record, size_t index)
+{
+	NdjsonCollect* c = context;
+
+	/* arrayPushEx() returns the index, so compare sizes */
+	arrayPushEx(c->array, record);
+	if(arraySize(c->array) != index + 1) {
+		objectSafeDestroy(record, NULL);
+		c->failed = 1;
+		return 0;
+	}
+	return 1;
+}
+
+LIBOBJECT_API Object* newArrayFromNdjson(const char* text, size_t length, unsigned int flags,
+	ObjectJsonError* err)
+{
+	NdjsonCollect c;
+
+	c.array = newArray(16);
+	c.failed = 0;
+	RETURN_ON_NULL(c.array);
+
+	if(!ndjsonReadBuffer(text, length, flags, ndjson_collect, &c, err) || c.failed) {
+		if(c.failed && err != NULL) {
+			memset(err, 0, sizeof(*err));
+			err->message = "out of memory";
+		}
+		objectSafeDestroy(c.array, NULL);
+		return NULL;
+	}
+	return c.array;
+}
+
+static int ndjson_append(void* context, const char* data, size_t length)
+{
+	NdjsonPiece* piece = context;
+
+	if(piece->out_capacity - piece->out_length < length) {
+		size_t n = piece->out_capacity ? piece->out_capacity : 4096;
+		while(n - piece->out_length < length)
+			n *= 2;
+		char* out = realloc(piece->out, n);
+		if(out == NULL)
+			return 0;
+		piece->out = out;
+		piece->out_capacity = n;
+	}
+	memcpy(piece->out + piece->out_length, data, length);
+	piece->out_length += length;
+	return 1;
+}
+
+static void ndjson_format(NdjsonPipeline* p, NdjsonPiece* piece)
+{
+	size_t k;
+
+	piece->out_length = 0;
+	piece->failed = 0;
+	for(k = 0; k < piece->nrecords; k++) {
+		if(!objectToJsonCallback(piece->records[k], p->flags, ndjson_append, piece) ||
+			!ndjson_append(piece, "\n", 1)) {
+			piece->failed = 1;
+			return;
+		}
+	}
+}
+
+LIBOBJECT_API int ndjsonWrite(Object* array, int flags, ObjectJsonWriteFunction callback,
+	void* context)
+{
+	BUG_ON_NULL(array);
+	BUG_ON_NULL(callback);
+	NdjsonPipeline p;
+	NdjsonPiece* piece;
+	Array* a;
+	size_t at = 0;
+	size_t step;
+	int status = 1;
+
+	if(O_TYPE(array) != IS_ARRAY) {
+		fprintf(get_debug_fp(), "%s(): Object type is not an instance of Array, got %d\n", __func__, O_TYPE(array));
+		return 0;
+	}
+	if(!objectLoad(array))
+		return 0;
+	a = O_AVAL(array);
+	if(!ndjson_init(&p, ndjson_format, flags & ~OBJECT_JSON_PRETTY)) {
+		fprintf(get_debug_fp(), "%s(): out of memory\n", __func__);
+		return 0;
+	}
+
+	/* size pieces from the first record, at least one per thread */
+	step = a->size ? NDJSON_WRITE_BYTES / (objectJsonLength(a->table[0], p.flags) + 1) : 1;
+	if(step > a->size / (p.max_threads + 1))
+		step = a->size / (p.max_threads + 1);
+	if(step == 0)
+		step = 1;
+
+	while(status) {
+		while(at < a->size && (piece = ndjson_slot(&p)) != NULL) {
+			piece->records = a->table + at;
+			piece->nrecords = a->size - at < step ? a->size - at : step;
+			at += piece->nrecords;
+			ndjson_queue(&p);
+		}
+		if(p.delivered == p.queued)
+			break;
+		piece = ndjson_next(&p);
+		status = !piece->failed && (piece->out_length == 0 ||
+			callback(context, piece->out, piece->out_length));
+		ndjson_delivered(&p);
+	}
+
+	/* the records belong to the array */
+	ndjson_finish(&p, 0);
+	return status;
+}
+
+static int ndjson_write_file(void* context, const char* data, size_t length)
+{
+	return fwrite(data, 1, length, context) == length;
+}
+
+LIBOBJECT_API int ndjsonWriteFile(Object* array, int flags, FILE* fp)
+{
+	BUG_ON_NULL(fp);
+	return ndjsonWrite(array, flags, ndjson_write_file, fp);
+}
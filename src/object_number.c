@@ -0,0 +1,971 @@
+/*
+ *  Copyright (c) 2015 Ryan McCullagh <me@ryanmccullagh.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Number formatting and parsing. Doubles are printed with the fewest
+ * digits that read back to the same value, found with Ulf Adams' Ryu
+ * algorithm, and laid out the way ECMAScript's Number.prototype.toString()
+ * does. Integers are printed two digits per division.
+ *
+ * Parsing keeps integers that fit a long as integers. Everything else
+ * tries Clinger's fast path, then the Eisel-Lemire algorithm, and falls
+ * back to an exact big decimal conversion only when more than 19
+ * significant digits leave the result undecided. None of it depends on
+ * the locale.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <float.h>
+
+#include "object.h"
+#include "object_private.h"
+#include "object_number_table.h"
+
+#define NUMBER_MANTISSA_BITS 52
+#define NUMBER_EXPONENT_BITS 11
+#define NUMBER_EXPONENT_BIAS 1023
+
+static const char number_digits[201] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+/*
+ * write the decimal digits of v to out, return how many
+ */
+static size_t number_format_u64(uint64_t v, char* out)
+{
+	char tmp[20];
+	char* p = tmp + sizeof(tmp);
+	size_t n;
+
+	while(v >= 100) {
+		unsigned int r = (unsigned int)(v % 100);
+		v /= 100;
+		p -= 2;
+		memcpy(p, number_digits + 2 * r, 2);
+	}
+	if(v >= 10) {
+		p -= 2;
+		memcpy(p, number_digits + 2 * v, 2);
+	} else {
+		*--p = (char)('0' + v);
+	}
+
+	n = tmp + sizeof(tmp) - p;
+	memcpy(out, p, n);
+	return n;
+}
+
+LIBOBJECT_API size_t formatLong(long value, char* out)
+{
+	if(value < 0) {
+		*out = '-';
+		size_t n = 1 + number_format_u64((uint64_t)0 - (uint64_t)value, out + 1);
+		out[n] = '\0';
+		return n;
+	}
+	size_t n = number_format_u64((uint64_t)value, out);
+	out[n] = '\0';
+	return n;
+}
+
+/*
+ * number_umul128() returns the low and stores the high 64 bits of a * b.
+ * number_mul_shift() returns the upper 64 bits of the 192 bit product
+ * m * mul, shifted right by j - 64
+ */
+#if defined(__SIZEOF_INT128__)
+static inline uint64_t number_umul128(uint64_t a, uint64_t b, uint64_t* high)
+{
+	unsigned __int128 p = (unsigned __int128)a * b;
+	*high = (uint64_t)(p >> 64);
+	return (uint64_t)p;
+}
+
+static inline uint64_t number_mul_shift(uint64_t m, const uint64_t* mul, int32_t j)
+{
+	unsigned __int128 b0 = (unsigned __int128)m * mul[0];
+	unsigned __int128 b2 = (unsigned __int128)m * mul[1];
+	return (uint64_t)(((b0 >> 64) + b2) >> (j - 64));
+}
+#else
+static inline uint64_t number_umul128(uint64_t a, uint64_t b, uint64_t* high)
+{
+	uint64_t a_lo = (uint32_t)a, a_hi = a >> 32;
+	uint64_t b_lo = (uint32_t)b, b_hi = b >> 32;
+	uint64_t b00 = a_lo * b_lo, b01 = a_lo * b_hi;
+	uint64_t b10 = a_hi * b_lo, b11 = a_hi * b_hi;
+	uint64_t mid1 = b10 + (b00 >> 32);
+	uint64_t mid2 = b01 + (uint32_t)mid1;
+
+	*high = b11 + (mid1 >> 32) + (mid2 >> 32);
+	return (mid2 << 32) | (uint32_t)b00;
+}
+
+static inline uint64_t number_mul_shift(uint64_t m, const uint64_t* mul, int32_t j)
+{
+	uint64_t high0, high1, low1, sum;
+	int32_t dist = j - 64;
+
+	number_umul128(m, mul[0], &high0);
+	low1 = number_umul128(m, mul[1], &high1);
+	sum = high0 + low1;
+	if(sum < high0)
+		high1++;
+	return (high1 << (64 - dist)) | (sum >> dist);
+}
+#endif
+
+/* ceil(log2(5^e)), exact for 0 <= e <= 3528 */
+static inline int32_t number_pow5_bits(int32_t e)
+{
+	return (int32_t)(((uint32_t)e * 1217359) >> 19) + 1;
+}
+
+/* floor(log10(2^e)) */
+static inline uint32_t number_log10_pow2(int32_t e)
+{
+	return ((uint32_t)e * 78913) >> 18;
+}
+
+/* floor(log10(5^e)) */
+static inline uint32_t number_log10_pow5(int32_t e)
+{
+	return ((uint32_t)e * 732923) >> 20;
+}
+
+static inline int number_multiple_of_pow5(uint64_t value, uint32_t p)
+{
+	uint32_t count = 0;
+	while(value % 5 == 0) {
+		value /= 5;
+		count++;
+	}
+	return count >= p;
+}
+
+static inline int number_multiple_of_pow2(uint64_t value, uint32_t p)
+{
+	return (value & (((uint64_t)1 << p) - 1)) == 0;
+}
+
+/*
+ * shortest decimal digits and exponent with digits * 10^exponent inside
+ * the rounding interval of a finite, non zero double
+ */
+static void number_shortest(uint64_t mantissa, uint32_t exponent, uint64_t* digits, int32_t* e10_out)
+{
+	int32_t e2;
+	uint64_t m2;
+
+	if(exponent == 0) {
+		e2 = 1 - NUMBER_EXPONENT_BIAS - NUMBER_MANTISSA_BITS - 2;
+		m2 = mantissa;
+	} else {
+		e2 = (int32_t)exponent - NUMBER_EXPONENT_BIAS - NUMBER_MANTISSA_BITS - 2;
+		m2 = ((uint64_t)1 << NUMBER_MANTISSA_BITS) | mantissa;
+	}
+	const int accept_bounds = (m2 & 1) == 0;
+
+	/* the interval is [mv - mm, mv + 2] in units of 2^e2 / 4 */
+	const uint64_t mv = 4 * m2;
+	const uint32_t mm_shift = mantissa != 0 || exponent <= 1;
+
+	uint64_t vr, vp, vm;
+	int32_t e10;
+	int vm_trailing_zeros = 0, vr_trailing_zeros = 0;
+
+	if(e2 >= 0) {
+		const uint32_t q = number_log10_pow2(e2) - (e2 > 3);
+		const int32_t k = NUMBER_POW5_INV_BITCOUNT + number_pow5_bits(q) - 1;
+		const int32_t i = -e2 + (int32_t)q + k;
+
+		e10 = (int32_t)q;
+		vr = number_mul_shift(4 * m2, NUMBER_POW5_INV_SPLIT[q], i);
+		vp = number_mul_shift(4 * m2 + 2, NUMBER_POW5_INV_SPLIT[q], i);
+		vm = number_mul_shift(4 * m2 - 1 - mm_shift, NUMBER_POW5_INV_SPLIT[q], i);
+		if(q <= 21) {
+			/* only then can one of the bounds be a multiple of 5^q */
+			if(mv % 5 == 0)
+				vr_trailing_zeros = number_multiple_of_pow5(mv, q);
+			else if(accept_bounds)
+				vm_trailing_zeros = number_multiple_of_pow5(mv - 1 - mm_shift, q);
+			else
+				vp -= number_multiple_of_pow5(mv + 2, q);
+		}
+	} else {
+		const uint32_t q = number_log10_pow5(-e2) - (-e2 > 1);
+		const int32_t i = -e2 - (int32_t)q;
+		const int32_t k = number_pow5_bits(i) - NUMBER_POW5_BITCOUNT;
+		const int32_t j = (int32_t)q - k;
+
+		e10 = (int32_t)q + e2;
+		vr = number_mul_shift(4 * m2, NUMBER_POW5_SPLIT[i], j);
+		vp = number_mul_shift(4 * m2 + 2, NUMBER_POW5_SPLIT[i], j);
+		vm = number_mul_shift(4 * m2 - 1 - mm_shift, NUMBER_POW5_SPLIT[i], j);
+		if(q <= 1) {
+			vr_trailing_zeros = 1;
+			if(accept_bounds)
+				vm_trailing_zeros = mm_shift == 1;
+			else
+				vp--;
+		} else if(q < 63) {
+			vr_trailing_zeros = number_multiple_of_pow2(mv, q);
+		}
+	}
+
+	int32_t removed = 0;
+	uint8_t last_removed = 0;
+	uint64_t output;
+
+	if(vm_trailing_zeros || vr_trailing_zeros) {
+		/* rare: exact ties need the removed digits tracked */
+		while(vp / 10 > vm / 10) {
+			vm_trailing_zeros &= vm % 10 == 0;
+			vr_trailing_zeros &= last_removed == 0;
+			last_removed = (uint8_t)(vr % 10);
+			vr /= 10;
+			vp /= 10;
+			vm /= 10;
+			removed++;
+		}
+		if(vm_trailing_zeros) {
+			while(vm % 10 == 0) {
+				vr_trailing_zeros &= last_removed == 0;
+				last_removed = (uint8_t)(vr % 10);
+				vr /= 10;
+				vp /= 10;
+				vm /= 10;
+				removed++;
+			}
+		}
+		/* round half to even */
+		if(vr_trailing_zeros && last_removed == 5 && vr % 2 == 0)
+			last_removed = 4;
+		output = vr + ((vr == vm && (!accept_bounds || !vm_trailing_zeros)) || last_removed >= 5);
+	} else {
+		int round_up = 0;
+		if(vp / 100 > vm / 100) {
+			round_up = vr % 100 >= 50;
+			vr /= 100;
+			vp /= 100;
+			vm /= 100;
+			removed += 2;
+		}
+		while(vp / 10 > vm / 10) {
+			round_up = vr % 10 >= 5;
+			vr /= 10;
+			vp /= 10;
+			vm /= 10;
+			removed++;
+		}
+		output = vr + (vr == vm || round_up);
+	}
+
+	*digits = output;
+	*e10_out = e10 + removed;
+}
+
+LIBOBJECT_API size_t formatDouble(double value, char* out)
+{
+	uint64_t bits;
+	char digits[20];
+	char* p = out;
+
+	memcpy(&bits, &value, sizeof(bits));
+	const int negative = (int)(bits >> 63);
+	const uint64_t mantissa = bits & (((uint64_t)1 << NUMBER_MANTISSA_BITS) - 1);
+	const uint32_t exponent = (uint32_t)((bits >> NUMBER_MANTISSA_BITS) &
+		((1u << NUMBER_EXPONENT_BITS) - 1));
+
+	if(exponent == (1u << NUMBER_EXPONENT_BITS) - 1) {
+		const char* text = mantissa ? "NaN" : negative ? "-Infinity" : "Infinity";
+		size_t n = strlen(text);
+		memcpy(out, text, n + 1);
+		return n;
+	}
+	if(negative)
+		*p++ = '-';
+	if(exponent == 0 && mantissa == 0) {
+		*p++ = '0';
+		*p = '\0';
+		return p - out;
+	}
+
+	uint64_t output;
+	int32_t e10;
+	number_shortest(mantissa, exponent, &output, &e10);
+
+	const int32_t k = (int32_t)number_format_u64(output, digits);
+	/* the value is 0.digits * 10^n */
+	const int32_t n = e10 + k;
+
+	if(k <= n && n <= 21) {
+		memcpy(p, digits, k);
+		memset(p + k, '0', n - k);
+		p += n;
+	} else if(0 < n && n <= 21) {
+		memcpy(p, digits, n);
+		p[n] = '.';
+		memcpy(p + n + 1, digits + n, k - n);
+		p += k + 1;
+	} else if(-6 < n && n <= 0) {
+		*p++ = '0';
+		*p++ = '.';
+		memset(p, '0', -n);
+		p += -n;
+		memcpy(p, digits, k);
+		p += k;
+	} else {
+		int32_t e = n - 1;
+		*p++ = digits[0];
+		if(k > 1) {
+			*p++ = '.';
+			memcpy(p, digits + 1, k - 1);
+			p += k - 1;
+		}
+		*p++ = 'e';
+		if(e < 0) {
+			*p++ = '-';
+			e = -e;
+		} else {
+			*p++ = '+';
+		}
+		p += number_format_u64((uint64_t)e, p);
+	}
+
+	*p = '\0';
+	return p - out;
+}
+
+LIBOBJECT_API size_t objectFormatScalar(Object* o, char* out)
+{
+	BUG_ON_NULL(o);
+	BUG_ON_NULL(out);
+
+	switch(O_TYPE(o)) {
+		case IS_NULL:
+			memcpy(out, "null", 5);
+			return 4;
+		case IS_BOOL:
+			if(O_BVAL(o)) {
+				memcpy(out, "true", 5);
+				return 4;
+			}
+			memcpy(out, "false", 6);
+			return 5;
+		case IS_LONG:
+			return formatLong(O_LVAL(o), out);
+		case IS_DOUBLE:
+			return formatDouble(O_DVAL(o), out);
+		default:
+			out[0] = '\0';
+			return 0;
+	}
+}
+
+/*
+ * the pieces of a number found by number_scan(). The digits before and
+ * after the point are kept for the slow path; mantissa holds the first 19
+ * significant ones, so the value is about mantissa * 10^exponent
+ */
+typedef struct NumberScan {
+	const char*	integer;
+	size_t		integer_length;
+	const char*	fraction;
+	size_t		fraction_length;
+	int64_t		explicit_exponent;
+	uint64_t	mantissa;
+	int64_t		exponent;
+	size_t		digits;		/* significant digits */
+	int		truncated;	/* nonzero digits past the 19th */
+	int		negative;
+	int		integral;	/* no point and no exponent */
+	int		special;
+} NumberScan;
+
+#define NUMBER_INFINITY	1
+#define NUMBER_NAN	2
+
+#define NUMBER_MAX_DIGITS 19
+#define NUMBER_EXPONENT_LIMIT 100000	/* far past anything a double holds */
+
+static inline int number_is_digit(char c)
+{
+	return (unsigned char)(c - '0') < 10;
+}
+
+/*
+ * case insensitive match of word at the start of s[0..n)
+ */
+static size_t number_match(const char* s, size_t n, const char* word)
+{
+	size_t k = strlen(word), i;
+
+	if(n < k)
+		return 0;
+	for(i = 0; i < k; i++) {
+		if((s[i] | 0x20) != word[i])
+			return 0;
+	}
+	return k;
+}
+
+/*
+ * digit i of the integer and fraction digits read as one run
+ */
+static inline int number_scan_digit(const NumberScan* ns, size_t i)
+{
+	if(i < ns->integer_length)
+		return ns->integer[i] - '0';
+	return ns->fraction[i - ns->integer_length] - '0';
+}
+
+/*
+ * digits read so far. Kept apart from NumberScan in a local whose address
+ * never escapes, so it stays in registers while the input is read through
+ * a char pointer
+ */
+typedef struct NumberDigits {
+	uint64_t	mantissa;
+	size_t		count;		/* significant digits */
+	size_t		read;		/* digits including leading zeros */
+	size_t		taken;		/* read up to the last digit in mantissa */
+	int		truncated;
+} NumberDigits;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define NUMBER_SWAR 1
+
+static inline int number_eight_are_digits(uint64_t v)
+{
+	return (((v & 0xf0f0f0f0f0f0f0f0ULL) |
+		(((v + 0x0606060606060606ULL) & 0xf0f0f0f0f0f0f0f0ULL) >> 4)) ==
+		0x3333333333333333ULL);
+}
+
+/*
+ * the value of eight ASCII digits, combined pairwise in one register
+ */
+static inline uint64_t number_eight_digits(uint64_t v)
+{
+	v -= 0x3030303030303030ULL;
+	v = (v * 10) + (v >> 8);
+	return (((v & 0x000000ff000000ffULL) * 0x000f424000000064ULL) +
+		(((v >> 16) & 0x000000ff000000ffULL) * 0x0000271000000001ULL)) >> 32;
+}
+#endif
+
+/*
+ * read the run of digits at p, return where it ends
+ */
+static inline const char* number_scan_run(NumberDigits* nd, const char* p, const char* end)
+{
+#ifdef NUMBER_SWAR
+	uint64_t v;
+
+	if(nd->count == 0) {
+		while(p < end && *p == '0') {
+			p++;
+			nd->read++;
+		}
+	}
+	while(end - p >= 8 && nd->count + 8 <= NUMBER_MAX_DIGITS) {
+		memcpy(&v, p, sizeof(v));
+		if(!number_eight_are_digits(v))
+			break;
+		nd->mantissa = nd->mantissa * 100000000 + number_eight_digits(v);
+		nd->count += 8;
+		nd->read += 8;
+		nd->taken = nd->read;
+		p += 8;
+	}
+#endif
+	for(; p < end && number_is_digit(*p); p++) {
+		int digit = *p - '0';
+		nd->read++;
+		if(nd->count == 0 && digit == 0)
+			continue;
+		if(nd->count < NUMBER_MAX_DIGITS) {
+			nd->mantissa = nd->mantissa * 10 + digit;
+			nd->taken = nd->read;
+		} else if(digit) {
+			nd->truncated = 1;
+		}
+		nd->count++;
+	}
+	return p;
+}
+
+/*
+ * [+-] digits [. digits] [e [+-] digits], with digits allowed on either
+ * side of the point, or infinity, inf or nan. Returns the bytes consumed
+ */
+static size_t number_scan(const char* s, size_t n, NumberScan* ns)
+{
+	const char* p = s;
+	const char* end = s + n;
+	NumberDigits nd = { 0, 0, 0, 0, 0 };
+
+	ns->negative = 0;
+	ns->integral = 1;
+	ns->special = 0;
+	ns->explicit_exponent = 0;
+	ns->fraction = NULL;
+	ns->fraction_length = 0;
+
+	if(p < end && (*p == '-' || *p == '+')) {
+		ns->negative = *p == '-';
+		p++;
+	}
+
+	ns->integer = p;
+	p = number_scan_run(&nd, p, end);
+	ns->integer_length = p - ns->integer;
+	if(p < end && *p == '.') {
+		const char* q = number_scan_run(&nd, p + 1, end);
+		ns->fraction = p + 1;
+		ns->fraction_length = q - ns->fraction;
+		if(ns->integer_length || ns->fraction_length) {
+			ns->integral = 0;
+			p = q;
+		}
+	}
+
+	ns->mantissa = nd.mantissa;
+	ns->digits = nd.count;
+	ns->truncated = nd.truncated;
+
+	if(ns->integer_length == 0 && ns->fraction_length == 0) {
+		size_t k;
+		ns->integral = 0;
+		if((k = number_match(p, end - p, "infinity")) || (k = number_match(p, end - p, "inf")))
+			ns->special = NUMBER_INFINITY;
+		else if((k = number_match(p, end - p, "nan")))
+			ns->special = NUMBER_NAN;
+		return k ? (size_t)(p + k - s) : 0;
+	}
+
+	/* an e without digits is not part of the number */
+	if(p < end && (*p | 0x20) == 'e') {
+		const char* q = p + 1;
+		int negative = 0;
+		int64_t e = 0;
+
+		if(q < end && (*q == '+' || *q == '-')) {
+			negative = *q == '-';
+			q++;
+		}
+		if(q < end && number_is_digit(*q)) {
+			while(q < end && number_is_digit(*q)) {
+				if(e < NUMBER_EXPONENT_LIMIT)
+					e = e * 10 + (*q - '0');
+				q++;
+			}
+			ns->explicit_exponent = negative ? -e : e;
+			ns->integral = 0;
+			p = q;
+		}
+	}
+	ns->exponent = ns->explicit_exponent + (int64_t)ns->integer_length - (int64_t)nd.taken;
+
+	return p - s;
+}
+
+static inline int number_clz64(uint64_t x)
+{
+#ifdef __GNUC__
+	return __builtin_clzll(x);
+#else
+	int n = 0;
+	while(!(x & ((uint64_t)1 << 63))) {
+		x <<= 1;
+		n++;
+	}
+	return n;
+#endif
+}
+
+#define NUMBER_INFINITE_POWER	0x7ff
+#define NUMBER_HIDDEN_BIT	((uint64_t)1 << NUMBER_MANTISSA_BITS)
+
+/*
+ * the bits of the double nearest w * 10^q, sign excluded, for w != 0. The
+ * 128 bit approximation of 5^q is always close enough for a w that holds
+ * every digit of the input (Mushtak and Lemire, 2023)
+ */
+static uint64_t number_eisel_lemire(uint64_t w, int64_t q)
+{
+	if(q < NUMBER_POW5_128_MIN)
+		return 0;
+	if(q > NUMBER_POW5_128_MAX)
+		return (uint64_t)NUMBER_INFINITE_POWER << NUMBER_MANTISSA_BITS;
+
+	const int lz = number_clz64(w);
+	const uint64_t* pow5 = NUMBER_POW5_128[q - NUMBER_POW5_128_MIN];
+	uint64_t high, low, high2;
+
+	w <<= lz;
+	low = number_umul128(w, pow5[1], &high);
+	/* only the top 55 bits matter unless the rest could carry into them */
+	if((high & 0x1ff) == 0x1ff) {
+		number_umul128(w, pow5[0], &high2);
+		low += high2;
+		if(high2 > low)
+			high++;
+	}
+
+	const int upper = (int)(high >> 63);
+	const int shift = upper + 64 - NUMBER_MANTISSA_BITS - 3;
+	uint64_t mantissa = high >> shift;
+	/* floor(log2(10^q)) + 63 + the normalization, biased */
+	int32_t power2 = (int32_t)(((217706 * q) >> 16) + 63 + upper - lz + NUMBER_EXPONENT_BIAS);
+
+	if(power2 <= 0) {
+		/* subnormal */
+		if(-power2 + 1 >= 64)
+			return 0;
+		mantissa >>= -power2 + 1;
+		mantissa += mantissa & 1;
+		mantissa >>= 1;
+		/* rounding may carry into the smallest normal */
+		return mantissa;
+	}
+
+	/* exactly halfway between two doubles: round to even */
+	if(low <= 1 && q >= -4 && q <= 23 && (mantissa & 3) == 1 &&
+		(mantissa << shift) == high)
+		mantissa &= ~(uint64_t)1;
+	mantissa += mantissa & 1;
+	mantissa >>= 1;
+	if(mantissa >= NUMBER_HIDDEN_BIT << 1) {
+		mantissa = NUMBER_HIDDEN_BIT;
+		power2++;
+	}
+	mantissa &= ~NUMBER_HIDDEN_BIT;
+	if(power2 >= NUMBER_INFINITE_POWER)
+		return (uint64_t)NUMBER_INFINITE_POWER << NUMBER_MANTISSA_BITS;
+	return mantissa | (uint64_t)power2 << NUMBER_MANTISSA_BITS;
+}
+
+/*
+ * Exact conversion for inputs with more than 19 significant digits, after
+ * Nigel Tao's simple decimal conversion. The value is 0.digits * 10^point
+ * and is scaled by powers of two, which are exact in decimal, until it can
+ * be rounded to 53 bits. 768 digits are enough to decide any double, the
+ * rest only sets truncated.
+ */
+
+#define NUMBER_DECIMAL_DIGITS	768
+#define NUMBER_DECIMAL_PAD	19	/* digits 2^60 can add on the left */
+#define NUMBER_DECIMAL_RANGE	2047
+#define NUMBER_MAX_SHIFT	60
+
+typedef struct NumberDecimal {
+	size_t		count;
+	int32_t		point;
+	int		truncated;
+	unsigned char	digits[NUMBER_DECIMAL_DIGITS + NUMBER_DECIMAL_PAD];
+} NumberDecimal;
+
+static void number_decimal_trim(NumberDecimal* d)
+{
+	while(d->count && d->digits[d->count - 1] == 0)
+		d->count--;
+}
+
+static void number_decimal_from_scan(NumberDecimal* d, const NumberScan* ns)
+{
+	size_t total = ns->integer_length + ns->fraction_length;
+	size_t first = total - ns->digits, i;
+
+	d->count = 0;
+	d->truncated = 0;
+	d->point = (int32_t)(ns->explicit_exponent + (int64_t)ns->integer_length - (int64_t)first);
+	for(i = first; i < total; i++) {
+		int digit = number_scan_digit(ns, i);
+		if(d->count < NUMBER_DECIMAL_DIGITS)
+			d->digits[d->count++] = (unsigned char)digit;
+		else if(digit)
+			d->truncated = 1;
+	}
+	number_decimal_trim(d);
+}
+
+/*
+ * multiply by 2^shift, writing each product digit NUMBER_DECIMAL_PAD
+ * places to the right so the carry has room in front
+ */
+static void number_decimal_left_shift(NumberDecimal* d, unsigned int shift)
+{
+	uint64_t carry = 0;
+	size_t i, start = NUMBER_DECIMAL_PAD, count;
+
+	for(i = d->count; i > 0; i--) {
+		uint64_t v = ((uint64_t)d->digits[i - 1] << shift) + carry;
+		d->digits[i - 1 + NUMBER_DECIMAL_PAD] = (unsigned char)(v % 10);
+		carry = v / 10;
+	}
+	while(carry) {
+		d->digits[--start] = (unsigned char)(carry % 10);
+		carry /= 10;
+	}
+
+	count = d->count + NUMBER_DECIMAL_PAD - start;
+	if(count > NUMBER_DECIMAL_DIGITS) {
+		for(i = NUMBER_DECIMAL_DIGITS; i < count; i++) {
+			if(d->digits[start + i])
+				d->truncated = 1;
+		}
+		count = NUMBER_DECIMAL_DIGITS;
+	}
+	memmove(d->digits, d->digits + start, count);
+	d->point += (int32_t)(NUMBER_DECIMAL_PAD - start);
+	d->count = count;
+	number_decimal_trim(d);
+}
+
+/*
+ * divide by 2^shift, long division from the most significant digit
+ */
+static void number_decimal_right_shift(NumberDecimal* d, unsigned int shift)
+{
+	const uint64_t mask = ((uint64_t)1 << shift) - 1;
+	size_t read = 0, write = 0;
+	uint64_t n = 0;
+
+	while((n >> shift) == 0) {
+		if(read < d->count) {
+			n = n * 10 + d->digits[read++];
+		} else if(n == 0) {
+			return;
+		} else {
+			while((n >> shift) == 0) {
+				n *= 10;
+				read++;
+			}
+			break;
+		}
+	}
+
+	d->point -= (int32_t)read - 1;
+	if(d->point < -NUMBER_DECIMAL_RANGE) {
+		d->count = 0;
+		d->point = 0;
+		d->truncated = 0;
+		return;
+	}
+
+	while(read < d->count) {
+		unsigned char digit = (unsigned char)(n >> shift);
+		n = 10 * (n & mask) + d->digits[read++];
+		d->digits[write++] = digit;
+	}
+	while(n > 0) {
+		unsigned char digit = (unsigned char)(n >> shift);
+		n = 10 * (n & mask);
+		if(write < NUMBER_DECIMAL_DIGITS)
+			d->digits[write++] = digit;
+		else if(digit)
+			d->truncated = 1;
+	}
+	d->count = write;
+	number_decimal_trim(d);
+}
+
+/*
+ * the integer part, rounded half to even on the digits that follow
+ */
+static uint64_t number_decimal_round(const NumberDecimal* d)
+{
+	uint64_t v = 0;
+	int32_t i;
+
+	if(d->count == 0 || d->point < 0)
+		return 0;
+	if(d->point > 18)
+		return UINT64_MAX;
+
+	for(i = 0; i < d->point; i++)
+		v = v * 10 + ((size_t)i < d->count ? d->digits[i] : 0);
+
+	if((size_t)d->point < d->count) {
+		int up = d->digits[d->point] >= 5;
+		if(d->digits[d->point] == 5 && (size_t)d->point + 1 == d->count)
+			up = d->truncated || (d->point > 0 && (d->digits[d->point - 1] & 1));
+		v += up;
+	}
+	return v;
+}
+
+static uint64_t number_decimal_to_bits(NumberDecimal* d)
+{
+	/* shifts that move the point by at least n decimal places */
+	static const unsigned char powers[19] = {
+		0, 3, 6, 9, 13, 16, 19, 23, 26, 29, 33, 36, 39, 43, 46, 49, 53, 56, 59
+	};
+	const uint64_t infinity = (uint64_t)NUMBER_INFINITE_POWER << NUMBER_MANTISSA_BITS;
+	const int32_t minimum = -NUMBER_EXPONENT_BIAS;
+	int32_t exp2 = 0;
+	uint64_t mantissa;
+	unsigned int shift;
+
+	if(d->count == 0 || d->point < -324)
+		return 0;
+	if(d->point >= 310)
+		return infinity;
+
+	while(d->point > 0) {
+		shift = d->point < 19 ? powers[d->point] : NUMBER_MAX_SHIFT;
+		number_decimal_right_shift(d, shift);
+		if(d->count == 0)
+			return 0;
+		exp2 += shift;
+	}
+	/* up into [1/2, 1) */
+	while(d->point <= 0) {
+		if(d->point == 0) {
+			if(d->digits[0] >= 5)
+				break;
+			shift = d->digits[0] < 2 ? 2 : 1;
+		} else {
+			shift = -d->point < 19 ? powers[-d->point] : NUMBER_MAX_SHIFT;
+		}
+		number_decimal_left_shift(d, shift);
+		if(d->point > NUMBER_DECIMAL_RANGE)
+			return infinity;
+		exp2 -= shift;
+	}
+	/* the binary format wants [1, 2) */
+	exp2--;
+	while(minimum + 1 > exp2) {
+		shift = (unsigned int)(minimum + 1 - exp2);
+		if(shift > NUMBER_MAX_SHIFT)
+			shift = NUMBER_MAX_SHIFT;
+		number_decimal_right_shift(d, shift);
+		exp2 += shift;
+	}
+	if(exp2 - minimum >= NUMBER_INFINITE_POWER)
+		return infinity;
+
+	number_decimal_left_shift(d, NUMBER_MANTISSA_BITS + 1);
+	mantissa = number_decimal_round(d);
+	if(mantissa >= NUMBER_HIDDEN_BIT << 1) {
+		number_decimal_right_shift(d, 1);
+		exp2++;
+		mantissa = number_decimal_round(d);
+		if(exp2 - minimum >= NUMBER_INFINITE_POWER)
+			return infinity;
+	}
+
+	int32_t power2 = exp2 - minimum;
+	if(mantissa < NUMBER_HIDDEN_BIT)
+		power2--;
+	return (mantissa & (NUMBER_HIDDEN_BIT - 1)) | (uint64_t)power2 << NUMBER_MANTISSA_BITS;
+}
+
+static double number_scan_to_double(const NumberScan* ns)
+{
+	uint64_t bits;
+	double d;
+
+	if(ns->special == NUMBER_INFINITY) {
+		bits = (uint64_t)NUMBER_INFINITE_POWER << NUMBER_MANTISSA_BITS;
+	} else if(ns->special == NUMBER_NAN) {
+		bits = (uint64_t)NUMBER_INFINITE_POWER << NUMBER_MANTISSA_BITS |
+			(uint64_t)1 << (NUMBER_MANTISSA_BITS - 1);
+	} else if(ns->mantissa == 0) {
+		bits = 0;
+	} else {
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+		/* both operands exact, so one rounding gives the right answer */
+		static const double exact[23] = {
+			1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+			1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+		};
+		if(!ns->truncated && ns->mantissa <= NUMBER_HIDDEN_BIT << 1 &&
+			ns->exponent >= -22 && ns->exponent <= 22) {
+			d = (double)ns->mantissa;
+			d = ns->exponent < 0 ? d / exact[-ns->exponent] : d * exact[ns->exponent];
+			return ns->negative ? -d : d;
+		}
+#endif
+		bits = number_eisel_lemire(ns->mantissa, ns->exponent);
+		/* the dropped digits put the value between w and w + 1 */
+		if(ns->truncated && bits != number_eisel_lemire(ns->mantissa + 1, ns->exponent)) {
+			NumberDecimal decimal;
+			number_decimal_from_scan(&decimal, ns);
+			bits = number_decimal_to_bits(&decimal);
+		}
+	}
+
+	bits |= (uint64_t)ns->negative << 63;
+	memcpy(&d, &bits, sizeof(d));
+	return d;
+}
+
+LIBOBJECT_API size_t parseDouble(const char* s, size_t n, double* out)
+{
+	BUG_ON_NULL(s);
+	BUG_ON_NULL(out);
+
+	NumberScan ns;
+	size_t consumed = number_scan(s, n, &ns);
+
+	*out = consumed ? number_scan_to_double(&ns) : 0.0;
+	return consumed;
+}
+
+LIBOBJECT_API size_t parseNumber(const char* s, size_t n, Object** out)
+{
+	BUG_ON_NULL(s);
+	BUG_ON_NULL(out);
+
+	NumberScan ns;
+	size_t consumed = number_scan(s, n, &ns);
+
+	if(consumed == 0) {
+		*out = NULL;
+		return 0;
+	}
+
+	/* every digit is in the mantissa, "-0" is left to be a Double -0.0 */
+	if(ns.integral && ns.digits <= NUMBER_MAX_DIGITS) {
+		if(!ns.negative && ns.mantissa <= (uint64_t)LONG_MAX) {
+			*out = newLong((long)ns.mantissa);
+			return consumed;
+		}
+		if(ns.negative && ns.mantissa != 0 && ns.mantissa <= (uint64_t)LONG_MAX + 1) {
+			*out = newLong(ns.mantissa == (uint64_t)LONG_MAX + 1 ? LONG_MIN : -(long)ns.mantissa);
+			return consumed;
+		}
+	}
+
+	*out = newDouble(number_scan_to_double(&ns));
+	return consumed;
+}
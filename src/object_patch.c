@@ -0,0 +1,619 @@
+/*
+ *  Copyright (c) 2015 Ryan McCullagh <me@ryanmccullagh.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * JSON Patch (RFC 6902), JSON Merge Patch (RFC 7396) and a diff that
+ * produces the former.
+ *
+ * objectDiff() walks both trees together. Maps are matched by key and
+ * Arrays by position after trimming their common prefix and suffix, so a
+ * single insertion or removal anywhere in an Array is one operation.
+ * Subtrees that only match in part are descended into, so the patch
+ * names the smallest values that changed.
+ *
+ * Both kinds of patch are applied in place: only the containers on the
+ * path to each change are touched, and values are copied out of the patch
+ * so it can be reused. Frozen values cannot be edited, so they are copied
+ * first and the copy is put in their place.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "object.h"
+#include "object_private.h"
+
+/*
+ * Pointers
+ */
+
+/*
+ * a String holding the decoded reference token at path[0..length), with
+ * ~1 read as / and ~0 as ~. NULL if the escape is invalid
+ */
+static String* pointer_token(const char* path, size_t length)
+{
+	String* token = newStringInstanceBuffer(length);
+	size_t i, n = 0;
+
+	if(token == NULL)
+		return NULL;
+	for(i = 0; i < length; i++) {
+		if(path[i] != '~') {
+			token->value[n++] = path[i];
+		} else if(i + 1 < length && (path[i + 1] == '0' || path[i + 1] == '1')) {
+			token->value[n++] = path[++i] == '0' ? '~' : '/';
+		} else {
+			stringInstanceFree(token);
+			return NULL;
+		}
+	}
+	token->value[n] = '\0';
+	token->length = n;
+	return token;
+}
+
+/*
+ * an array index: digits without leading zeros. "-" names the end when
+ * append is set
+ */
+static int pointer_index(String* token, Object* array, int append, size_t* index)
+{
+	size_t i, n = 0;
+
+	if(append && token->length == 1 && token->value[0] == '-') {
+		*index = O_AVAL(array)->size;
+		return 1;
+	}
+	if(token->length == 0 || (token->value[0] == '0' && token->length > 1))
+		return 0;
+	for(i = 0; i < token->length; i++) {
+		if(token->value[i] < '0' || token->value[i] > '9' || n > (SIZE_MAX - 9) / 10)
+			return 0;
+		n = n * 10 + (token->value[i] - '0');
+	}
+	*index = n;
+	return 1;
+}
+
+static Object* pointer_child(Object* o, String* token)
+{
+	size_t index;
+
+	if(!objectLoad(o))
+		return NULL;
+	if(O_TYPE(o) == IS_MAP)
+		return mapSearchHashed(o, token->value, token->length,
+			stringHash(token->value, token->length));
+	if(O_TYPE(o) == IS_ARRAY && pointer_index(token, o, 0, &index) &&
+		index < O_AVAL(o)->size)
+		return O_AVAL(o)->table[index];
+	return NULL;
+}
+
+/*
+ * follow every token of path but the last. Stores the container that
+ * holds the target and the last token, which the caller frees. Returns 0
+ * for the root path "" and for paths that lead nowhere
+ */
+static int pointer_resolve(Object* root, String* path, Object** parent, String** last)
+{
+	const char* p = path->value;
+	const char* end = p + path->length;
+	Object* o = root;
+
+	if(p == end || *p != '/')
+		return 0;
+	for(;;) {
+		const char* next = memchr(p + 1, '/', end - p - 1);
+		String* token = pointer_token(p + 1, (next != NULL ? next : end) - p - 1);
+		if(token == NULL)
+			return 0;
+		if(next == NULL) {
+			*parent = o;
+			*last = token;
+			return objectLoad(o) && (O_TYPE(o) == IS_MAP || O_TYPE(o) == IS_ARRAY);
+		}
+		o = pointer_child(o, token);
+		stringInstanceFree(token);
+		if(o == NULL)
+			return 0;
+		p = next;
+	}
+}
+
+/*
+ * JSON Patch
+ */
+
+typedef struct PatchOperation {
+	const char*	op;
+	String*		path;
+	String*		from;
+	Object*		value;
+} PatchOperation;
+
+static String* patch_string(Object* op, const char* name)
+{
+	Object* o = mapSearchEx(op, name);
+	return o != NULL && O_TYPE(o) == IS_STRING ? O_SVAL(o) : NULL;
+}
+
+/*
+ * the value a path names, NULL if there is none
+ */
+static Object* patch_get(Object* document, String* path)
+{
+	Object* parent = NULL;
+	String* last = NULL;
+	Object* value;
+
+	if(path->length == 0)
+		return document;
+	if(!pointer_resolve(document, path, &parent, &last)) {
+		if(last != NULL)
+			stringInstanceFree(last);
+		return NULL;
+	}
+	value = pointer_child(parent, last);
+	stringInstanceFree(last);
+	return value;
+}
+
+/*
+ * detach the value at path and return it, NULL if there is none
+ */
+static Object* patch_take(Object* document, String* path)
+{
+	Object* parent = NULL;
+	String* last = NULL;
+	Object* value = NULL;
+	size_t index;
+
+	if(pointer_resolve(document, path, &parent, &last)) {
+		if(O_TYPE(parent) == IS_MAP)
+			value = mapTakeHashed(parent, last->value, last->length,
+				stringHash(last->value, last->length));
+		else if(pointer_index(last, parent, 0, &index))
+			value = arrayTakeAt(parent, index);
+	}
+	if(last != NULL)
+		stringInstanceFree(last);
+	return value;
+}
+
+/*
+ * store value at path, taking ownership of it. replace requires the
+ * target to exist, otherwise Map members are added or replaced and Array
+ * elements inserted
+ */
+static int patch_put(Object** document, String* path, Object* value, int replace)
+{
+	Object* parent = NULL;
+	String* last = NULL;
+	size_t index;
+	int ok = 0;
+
+	if(path->length == 0) {
+		objectDestroy(*document);
+		*document = value;
+		return 1;
+	}
+	if(!pointer_resolve(*document, path, &parent, &last)) {
+		if(last != NULL)
+			stringInstanceFree(last);
+		return 0;
+	}
+	if(O_TYPE(parent) == IS_MAP) {
+		uint32_t hash = stringHash(last->value, last->length);
+		/* mapInsertString() owns the key once it succeeds */
+		if((!replace || mapSearchHashed(parent, last->value, last->length, hash) != NULL) &&
+			mapInsertString(parent, last, hash, value))
+			return 1;
+	} else if(pointer_index(last, parent, !replace, &index)) {
+		if(!replace) {
+			ok = arrayInsertAt(parent, index, value);
+		} else if(index < O_AVAL(parent)->size && !(O_FLG(parent) & OBJECT_FLAG_FROZEN)) {
+			objectDestroy(O_AVAL(parent)->table[index]);
+			O_AVAL(parent)->table[index] = value;
+			ok = 1;
+		}
+	}
+	stringInstanceFree(last);
+	return ok;
+}
+
+/*
+ * is a a proper prefix of b, in whole reference tokens
+ */
+static int pointer_is_prefix(String* a, String* b)
+{
+	return a->length < b->length && memcmp(a->value, b->value, a->length) == 0 &&
+		b->value[a->length] == '/';
+}
+
+static const char* patch_apply(Object** document, PatchOperation* op)
+{
+	Object* value;
+
+	if(strcmp(op->op, "test") == 0) {
+		value = patch_get(*document, op->path);
+		if(value == NULL)
+			return "path not found";
+		return objectDeepEquals(value, op->value) ? NULL : "test failed";
+	}
+	if(strcmp(op->op, "remove") == 0) {
+		if(op->path->length == 0)
+			return "cannot remove the root";
+		value = patch_take(*document, op->path);
+		if(value == NULL)
+			return "path not found";
+		objectDestroy(value);
+		return NULL;
+	}
+	if(strcmp(op->op, "add") == 0 || strcmp(op->op, "replace") == 0) {
+		int replace = op->op[0] == 'r';
+		if((value = copyObject(op->value)) == NULL)
+			return "out of memory";
+		if(!patch_put(document, op->path, value, replace)) {
+			objectDestroy(value);
+			return "path not found";
+		}
+		return NULL;
+	}
+	if(strcmp(op->op, "copy") == 0) {
+		value = patch_get(*document, op->from);
+		if(value == NULL)
+			return "from not found";
+		if((value = copyObject(value)) == NULL)
+			return "out of memory";
+		if(!patch_put(document, op->path, value, 0)) {
+			objectDestroy(value);
+			return "path not found";
+		}
+		return NULL;
+	}
+	/* move, which the caller has checked for */
+	if(op->from->length == op->path->length &&
+		memcmp(op->from->value, op->path->value, op->path->length) == 0)
+		return patch_get(*document, op->from) != NULL ? NULL : "from not found";
+	if(op->from->length == 0 || pointer_is_prefix(op->from, op->path))
+		return "cannot move a value into itself";
+	value = patch_take(*document, op->from);
+	if(value == NULL)
+		return "from not found";
+	if(!patch_put(document, op->path, value, 0)) {
+		/* it came out of there, so it goes back */
+		patch_put(document, op->from, value, 0);
+		return "path not found";
+	}
+	return NULL;
+}
+
+static const char* patch_read(Object* o, PatchOperation* op)
+{
+	static const char* const names[] = { "add", "remove", "replace", "move", "copy", "test" };
+	String* name;
+	size_t i;
+
+	if(O_TYPE(o) != IS_MAP)
+		return "operation is not an object";
+	name = patch_string(o, "op");
+	op->path = patch_string(o, "path");
+	op->from = patch_string(o, "from");
+	op->value = mapSearchEx(o, "value");
+	if(name == NULL || op->path == NULL)
+		return "missing op or path";
+	for(i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		if(name->length == strlen(names[i]) && memcmp(name->value, names[i], name->length) == 0)
+			break;
+	}
+	if(i == sizeof(names) / sizeof(names[0]))
+		return "unknown op";
+	op->op = names[i];
+	if((i == 0 || i == 2 || i == 5) && op->value == NULL)
+		return "missing value";
+	if((i == 3 || i == 4) && op->from == NULL)
+		return "missing from";
+	return NULL;
+}
+
+LIBOBJECT_API int objectApplyPatch(Object** document, Object* patch)
+{
+	BUG_ON_NULL(document);
+	BUG_ON_NULL(*document);
+	BUG_ON_NULL(patch);
+	PatchOperation op;
+	const char* error;
+	Object* copy = NULL;
+	Object** target = document;
+	size_t i;
+
+	if(O_TYPE(patch) != IS_ARRAY || !objectLoad(patch)) {
+		fprintf(get_debug_fp(), "%s(): patch is not an Array\n", __func__);
+		return 0;
+	}
+	if(O_FLG(*document) & OBJECT_FLAG_FROZEN) {
+		if((copy = copyObject(*document)) == NULL) {
+			fprintf(get_debug_fp(), "%s(): out of memory\n", __func__);
+			return 0;
+		}
+		target = &copy;
+	}
+	for(i = 0; i < O_AVAL(patch)->size; i++) {
+		error = patch_read(O_AVAL(patch)->table[i], &op);
+		if(error == NULL)
+			error = patch_apply(target, &op);
+		if(error != NULL) {
+			fprintf(get_debug_fp(), "%s(): operation %zu: %s\n", __func__, i, error);
+			objectDestroy(copy);
+			return 0;
+		}
+	}
+	if(copy != NULL) {
+		objectDestroy(*document);
+		*document = copy;
+	}
+	return 1;
+}
+
+/*
+ * JSON Merge Patch
+ */
+
+/*
+ * the result of merging patch into target, which may be NULL. Returns
+ * target itself when it was changed in place, otherwise a new value the
+ * caller puts in its place. NULL on allocation failure
+ */
+static Object* merge_patch(Object* target, Object* patch)
+{
+	Map* map;
+	uint32_t i, left;
+	Bucket* b;
+
+	if(!objectLoad(patch))
+		return NULL;
+	if(O_TYPE(patch) != IS_MAP)
+		return copyObject(patch);
+	if(target == NULL || O_TYPE(target) != IS_MAP || !objectLoad(target))
+		target = newMap(O_MVAL(patch)->size ? O_MVAL(patch)->size : 1);
+	else if(O_FLG(target) & OBJECT_FLAG_FROZEN)
+		target = copyObject(target);
+	if(target == NULL)
+		return NULL;
+
+	map = O_MVAL(patch);
+	for(i = 0, left = map->size; i < map->capacity && left; i++) {
+		for(b = map->buckets[i]; b != NULL; b = b->next, left--) {
+			Object* old;
+			Object* value;
+			String* key;
+
+			if(O_TYPE(b->value) == IS_NULL) {
+				objectDestroy(mapTakeHashed(target, b->key->value, b->key->length, b->hash));
+				continue;
+			}
+			old = mapSearchHashed(target, b->key->value, b->key->length, b->hash);
+			value = merge_patch(old, b->value);
+			if(value == NULL)
+				return NULL;
+			if(value == old)
+				continue;
+			key = newStringInstanceBuffer(b->key->length);
+			if(key == NULL) {
+				objectDestroy(value);
+				return NULL;
+			}
+			memcpy(key->value, b->key->value, b->key->length);
+			if(!mapInsertString(target, key, b->hash, value)) {
+				stringInstanceFree(key);
+				objectDestroy(value);
+				return NULL;
+			}
+		}
+	}
+	return target;
+}
+
+LIBOBJECT_API int objectMergePatch(Object** document, Object* patch)
+{
+	BUG_ON_NULL(document);
+	BUG_ON_NULL(*document);
+	BUG_ON_NULL(patch);
+	Object* result = merge_patch(*document, patch);
+
+	if(result == NULL) {
+		fprintf(get_debug_fp(), "%s(): out of memory\n", __func__);
+		return 0;
+	}
+	if(result != *document) {
+		objectDestroy(*document);
+		*document = result;
+	}
+	return 1;
+}
+
+/*
+ * Diff
+ */
+
+typedef struct PatchDiff {
+	Object*		patch;
+	char*		path;
+	size_t		length;
+	size_t		capacity;
+	int		error;
+} PatchDiff;
+
+/*
+ * append "/" and an escaped reference token to the path, returning the
+ * old length to restore afterwards
+ */
+static size_t diff_push(PatchDiff* d, const char* token, size_t length)
+{
+	size_t mark = d->length;
+	size_t i, need = d->length + 2 * length + 2;
+
+	if(need > d->capacity) {
+		size_t n = d->capacity * 2 > need ? d->capacity * 2 : need;
+		char* path = realloc(d->path, n);
+		if(path == NULL) {
+			d->error = 1;
+			return mark;
+		}
+		d->path = path;
+		d->capacity = n;
+	}
+	d->path[d->length++] = '/';
+	for(i = 0; i < length; i++) {
+		if(token[i] == '~' || token[i] == '/') {
+			d->path[d->length++] = '~';
+			d->path[d->length++] = token[i] == '~' ? '0' : '1';
+		} else {
+			d->path[d->length++] = token[i];
+		}
+	}
+	return mark;
+}
+
+static size_t diff_push_index(PatchDiff* d, size_t index)
+{
+	char text[24];
+	return diff_push(d, text, snprintf(text, sizeof(text), "%zu", index));
+}
+
+/*
+ * add {op, path, value} to the patch, copying value when there is one
+ */
+static void diff_emit(PatchDiff* d, const char* op, Object* value)
+{
+	Object* o;
+
+	if(d->error)
+		return;
+	o = newMap(4);
+	if(o == NULL) {
+		d->error = 1;
+		return;
+	}
+	mapInsertEx(o, "op", newString(op));
+	mapInsertEx(o, "path", newStringFromSequence(d->path ? d->path : "", d->length));
+	if(value != NULL)
+		mapInsertEx(o, "value", copyObject(value));
+	arrayPushEx(d->patch, o);
+}
+
+static void diff_value(PatchDiff* d, Object* from, Object* to);
+
+static void diff_map(PatchDiff* d, Object* from, Object* to)
+{
+	Map* map = O_MVAL(from);
+	uint32_t i, left;
+	Bucket* b;
+	size_t mark;
+
+	for(i = 0, left = map->size; i < map->capacity && left; i++) {
+		for(b = map->buckets[i]; b != NULL; b = b->next, left--) {
+			Object* value = mapSearchHashed(to, b->key->value, b->key->length, b->hash);
+			mark = diff_push(d, b->key->value, b->key->length);
+			if(value == NULL)
+				diff_emit(d, "remove", NULL);
+			else
+				diff_value(d, b->value, value);
+			d->length = mark;
+		}
+	}
+	map = O_MVAL(to);
+	for(i = 0, left = map->size; i < map->capacity && left; i++) {
+		for(b = map->buckets[i]; b != NULL; b = b->next, left--) {
+			if(mapSearchHashed(from, b->key->value, b->key->length, b->hash) != NULL)
+				continue;
+			mark = diff_push(d, b->key->value, b->key->length);
+			diff_emit(d, "add", b->value);
+			d->length = mark;
+		}
+	}
+}
+
+static void diff_array(PatchDiff* d, Object* from, Object* to)
+{
+	Object** a = O_AVAL(from)->table;
+	Object** b = O_AVAL(to)->table;
+	size_t na = O_AVAL(from)->size, nb = O_AVAL(to)->size;
+	size_t start = 0, i, n, mark;
+
+	/* what both share at either end is left alone */
+	while(start < na && start < nb && objectDeepEquals(a[start], b[start]))
+		start++;
+	while(na > start && nb > start && objectDeepEquals(a[na - 1], b[nb - 1])) {
+		na--;
+		nb--;
+	}
+
+	n = na < nb ? na : nb;
+	for(i = start; i < n; i++) {
+		mark = diff_push_index(d, i);
+		diff_value(d, a[i], b[i]);
+		d->length = mark;
+	}
+	mark = diff_push_index(d, n);
+	for(i = n; i < na; i++)
+		diff_emit(d, "remove", NULL);
+	d->length = mark;
+	for(i = n; i < nb; i++) {
+		mark = diff_push_index(d, i);
+		diff_emit(d, "add", b[i]);
+		d->length = mark;
+	}
+}
+
+static void diff_value(PatchDiff* d, Object* from, Object* to)
+{
+	if(d->error || !objectLoad(from) || !objectLoad(to)) {
+		d->error = 1;
+		return;
+	}
+	if(O_TYPE(from) == IS_MAP && O_TYPE(to) == IS_MAP)
+		diff_map(d, from, to);
+	else if(O_TYPE(from) == IS_ARRAY && O_TYPE(to) == IS_ARRAY)
+		diff_array(d, from, to);
+	else if(!objectDeepEquals(from, to))
+		diff_emit(d, "replace", to);
+}
+
+LIBOBJECT_API Object* objectDiff(Object* from, Object* to)
+{
+	BUG_ON_NULL(from);
+	BUG_ON_NULL(to);
+	PatchDiff d;
+
+	memset(&d, 0, sizeof(d));
+	d.patch = newArray(8);
+	if(d.patch == NULL)
+		return NULL;
+	diff_value(&d, from, to);
+	free(d.path);
+	if(d.error) {
+		fprintf(get_debug_fp(), "%s(): out of memory\n", __func__);
+		objectDestroy(d.patch);
+		return NULL;
+	}
+	return d.patch;
+}
@@ -0,0 +1,474 @@
+/*
+ *  Copyright (c) 2015 Ryan McCullagh <me@ryanmccullagh.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Compiled JSONPath queries.
+ *
+ * objectPathCompile() turns an expression into a list of steps once, with
+ * every key's length and hash worked out, so evaluating it only probes
+ * maps and indexes arrays. Results are the Objects inside the tree, never
+ * copies.
+ *
+ *   $		the root
+ *   .name	a member, also ['name'] or ["name"] for any key
+ *   [n]	an array element, counting from the end when negative
+ *   [a:b:c]	a slice, each part optional, as in Python
+ *   .* [*]	every member or element
+ *   ..		before any of the above: apply it at every depth
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+
+#include "object.h"
+#include "object_private.h"
+
+enum {
+	PATH_KEY,
+	PATH_INDEX,
+	PATH_SLICE,
+	PATH_WILDCARD
+};
+
+typedef struct ObjectPathStep {
+	int		type;
+	int		descend;	/* preceded by .. */
+	char*		key;
+	size_t		length;
+	uint32_t	hash;
+	long		index;		/* PATH_INDEX, and start for PATH_SLICE */
+	long		end;
+	long		step;
+	int		has_start;
+	int		has_end;
+} ObjectPathStep;
+
+struct ObjectPath {
+	size_t		nsteps;
+	ObjectPathStep*	steps;
+};
+
+/*
+ * Compiling
+ */
+
+typedef struct PathParser {
+	const char*	start;
+	const char*	p;
+	ObjectPath*	path;
+	size_t		capacity;
+	const char*	error;
+} PathParser;
+
+static int path_fail(PathParser* pp, const char* message)
+{
+	pp->error = message;
+	return 0;
+}
+
+static ObjectPathStep* path_add(PathParser* pp, int type, int descend)
+{
+	ObjectPath* path = pp->path;
+	ObjectPathStep* step;
+
+	if(path->nsteps == pp->capacity) {
+		size_t n = pp->capacity ? pp->capacity * 2 : 4;
+		ObjectPathStep* steps = realloc(path->steps, n * sizeof(ObjectPathStep));
+		if(steps == NULL)
+			return NULL;
+		path->steps = steps;
+		pp->capacity = n;
+	}
+	step = &path->steps[path->nsteps++];
+	memset(step, 0, sizeof(*step));
+	step->type = type;
+	step->descend = descend;
+	return step;
+}
+
+static int path_key(PathParser* pp, const char* key, size_t length, int descend)
+{
+	ObjectPathStep* step = path_add(pp, PATH_KEY, descend);
+	if(step == NULL || (step->key = malloc(length + 1)) == NULL)
+		return path_fail(pp, "out of memory");
+	memcpy(step->key, key, length);
+	step->key[length] = '\0';
+	step->length = length;
+	step->hash = stringHash(step->key, length);
+	return 1;
+}
+
+static void path_space(PathParser* pp)
+{
+	while(*pp->p == ' ' || *pp->p == '\t')
+		pp->p++;
+}
+
+/*
+ * an optional integer, 0 when there is none
+ */
+static int path_integer(PathParser* pp, long* value)
+{
+	const char* p = pp->p;
+	int negative = 0;
+	unsigned long n = 0;
+
+	path_space(pp);
+	p = pp->p;
+	if(*p == '-') {
+		negative = 1;
+		p++;
+	}
+	if(*p < '0' || *p > '9')
+		return 0;
+	for(; *p >= '0' && *p <= '9'; p++) {
+		if(n > ((unsigned long)LONG_MAX - (*p - '0')) / 10)
+			return path_fail(pp, "index out of range");
+		n = n * 10 + (*p - '0');
+	}
+	*value = negative ? -(long)n : (long)n;
+	pp->p = p;
+	path_space(pp);
+	return 1;
+}
+
+/*
+ * a quoted key inside brackets, with \ escaping the next character
+ */
+static int path_quoted(PathParser* pp, int descend)
+{
+	char quote = *pp->p++;
+	const char* p = pp->p;
+	char* key;
+	size_t n = 0;
+	int ok;
+
+	for(; *p != quote; p++) {
+		if(*p == '\0' || (*p == '\\' && *++p == '\0'))
+			return path_fail(pp, "unterminated key");
+		n++;
+	}
+	key = malloc(n + 1);
+	if(key == NULL)
+		return path_fail(pp, "out of memory");
+	for(n = 0, p = pp->p; *p != quote; p++)
+		key[n++] = *p == '\\' ? *++p : *p;
+	pp->p = p + 1;
+	ok = path_key(pp, key, n, descend);
+	free(key);
+	return ok;
+}
+
+static int path_bracket(PathParser* pp, int descend)
+{
+	ObjectPathStep* step;
+	long value = 0;
+	int has_start;
+
+	pp->p++;
+	path_space(pp);
+	if(*pp->p == '\'' || *pp->p == '"') {
+		if(!path_quoted(pp, descend))
+			return 0;
+	} else if(*pp->p == '*') {
+		pp->p++;
+		if(path_add(pp, PATH_WILDCARD, descend) == NULL)
+			return path_fail(pp, "out of memory");
+	} else {
+		has_start = path_integer(pp, &value);
+		if(pp->error != NULL)
+			return 0;
+		if(*pp->p != ':') {
+			if(!has_start)
+				return path_fail(pp, "expected a key, index, slice or *");
+			step = path_add(pp, PATH_INDEX, descend);
+			if(step == NULL)
+				return path_fail(pp, "out of memory");
+			step->index = value;
+		} else {
+			step = path_add(pp, PATH_SLICE, descend);
+			if(step == NULL)
+				return path_fail(pp, "out of memory");
+			step->index = value;
+			step->has_start = has_start;
+			step->step = 1;
+			pp->p++;
+			step->has_end = path_integer(pp, &step->end);
+			if(*pp->p == ':') {
+				pp->p++;
+				if(path_integer(pp, &value))
+					step->step = value;
+			}
+			if(pp->error != NULL)
+				return 0;
+			if(step->step == 0)
+				return path_fail(pp, "slice step cannot be 0");
+		}
+	}
+	path_space(pp);
+	if(*pp->p != ']')
+		return path_fail(pp, "expected ']'");
+	pp->p++;
+	return 1;
+}
+
+static int path_parse(PathParser* pp)
+{
+	if(*pp->p != '$')
+		return path_fail(pp, "expected '$'");
+	pp->p++;
+
+	while(*pp->p != '\0') {
+		int descend = 0;
+		const char* name;
+
+		if(pp->p[0] == '.' && pp->p[1] == '.') {
+			descend = 1;
+			pp->p += 2;
+			if(*pp->p == '[') {
+				if(!path_bracket(pp, 1))
+					return 0;
+				continue;
+			}
+		} else if(*pp->p == '.') {
+			pp->p++;
+		} else if(*pp->p == '[') {
+			if(!path_bracket(pp, 0))
+				return 0;
+			continue;
+		} else {
+			return path_fail(pp, "expected '.' or '['");
+		}
+
+		if(*pp->p == '*') {
+			pp->p++;
+			if(path_add(pp, PATH_WILDCARD, descend) == NULL)
+				return path_fail(pp, "out of memory");
+			continue;
+		}
+		name = pp->p;
+		while(*pp->p != '\0' && *pp->p != '.' && *pp->p != '[')
+			pp->p++;
+		if(pp->p == name)
+			return path_fail(pp, "expected a name");
+		if(!path_key(pp, name, pp->p - name, descend))
+			return 0;
+	}
+	return 1;
+}
+
+LIBOBJECT_API ObjectPath* objectPathCompile(const char* expression)
+{
+	BUG_ON_NULL(expression);
+	PathParser pp;
+
+	memset(&pp, 0, sizeof(pp));
+	pp.start = pp.p = expression;
+	pp.path = calloc(1, sizeof(ObjectPath));
+	if(pp.path == NULL) {
+		fprintf(get_debug_fp(), "%s(): out of memory\n", __func__);
+		return NULL;
+	}
+	if(!path_parse(&pp)) {
+		fprintf(get_debug_fp(), "%s(): %s at offset %zu\n", __func__, pp.error,
+			(size_t)(pp.p - pp.start));
+		objectPathFree(pp.path);
+		return NULL;
+	}
+	return pp.path;
+}
+
+LIBOBJECT_API void objectPathFree(ObjectPath* path)
+{
+	size_t k;
+
+	if(path == NULL)
+		return;
+	for(k = 0; k < path->nsteps; k++)
+		free(path->steps[k].key);
+	free(path->steps);
+	free(path);
+}
+
+/*
+ * Evaluating
+ */
+
+typedef struct PathEval {
+	ObjectPath*	path;
+	Object**	results;
+	size_t		max;
+	size_t		count;
+	int		first;		/* stop at the first match */
+} PathEval;
+
+static int path_eval(PathEval* e, size_t i, Object* o);
+
+/*
+ * apply step i's selector to o, continuing with step i + 1 on each child
+ * it picks. Returns 0 once evaluation should stop
+ */
+static int path_select(PathEval* e, size_t i, Object* o)
+{
+	ObjectPathStep* step = &e->path->steps[i];
+	Array* array;
+	long n, k, start, end;
+
+	if(!objectLoad(o))
+		return 1;
+
+	if(O_TYPE(o) == IS_MAP) {
+		Map* map;
+		uint32_t b, left;
+		Bucket* bucket;
+
+		if(step->type == PATH_KEY) {
+			Object* value = mapSearchHashed(o, step->key, step->length, step->hash);
+			return value == NULL || path_eval(e, i + 1, value);
+		}
+		if(step->type != PATH_WILDCARD)
+			return 1;
+		map = O_MVAL(o);
+		for(b = 0, left = map->size; b < map->capacity && left; b++) {
+			for(bucket = map->buckets[b]; bucket != NULL; bucket = bucket->next, left--) {
+				if(!path_eval(e, i + 1, bucket->value))
+					return 0;
+			}
+		}
+		return 1;
+	}
+	if(O_TYPE(o) != IS_ARRAY || step->type == PATH_KEY)
+		return 1;
+
+	array = O_AVAL(o);
+	n = (long)array->size;
+	switch(step->type) {
+		case PATH_INDEX:
+			k = step->index < 0 ? step->index + n : step->index;
+			return k < 0 || k >= n || path_eval(e, i + 1, array->table[k]);
+		case PATH_WILDCARD:
+			for(k = 0; k < n; k++) {
+				if(!path_eval(e, i + 1, array->table[k]))
+					return 0;
+			}
+			return 1;
+		default:
+			break;
+	}
+
+	/* a slice, clamped the way Python does it */
+	if(step->step > 0) {
+		start = !step->has_start ? 0 : step->index < 0 ? step->index + n : step->index;
+		end = !step->has_end ? n : step->end < 0 ? step->end + n : step->end;
+		if(start < 0)
+			start = 0;
+		if(end > n)
+			end = n;
+		for(k = start; k < end; k += step->step) {
+			if(!path_eval(e, i + 1, array->table[k]))
+				return 0;
+			if(step->step > end - k)
+				break;
+		}
+	} else {
+		start = !step->has_start ? n - 1 : step->index < 0 ? step->index + n : step->index;
+		end = !step->has_end ? -1 : step->end < 0 ? step->end + n : step->end;
+		if(start > n - 1)
+			start = n - 1;
+		if(end < -1)
+			end = -1;
+		for(k = start; k > end; k += step->step) {
+			if(!path_eval(e, i + 1, array->table[k]))
+				return 0;
+			if(-step->step > k - end)
+				break;
+		}
+	}
+	return 1;
+}
+
+/*
+ * match steps i onward against o
+ */
+static int path_eval(PathEval* e, size_t i, Object* o)
+{
+	if(i == e->path->nsteps) {
+		if(e->count < e->max)
+			e->results[e->count] = o;
+		e->count++;
+		return !e->first;
+	}
+	if(!path_select(e, i, o))
+		return 0;
+	if(!e->path->steps[i].descend || !objectLoad(o))
+		return 1;
+
+	/* .. applies the same step below every child */
+	if(O_TYPE(o) == IS_MAP) {
+		Map* map = O_MVAL(o);
+		uint32_t b, left;
+		Bucket* bucket;
+		for(b = 0, left = map->size; b < map->capacity && left; b++) {
+			for(bucket = map->buckets[b]; bucket != NULL; bucket = bucket->next, left--) {
+				if(!path_eval(e, i, bucket->value))
+					return 0;
+			}
+		}
+	} else if(O_TYPE(o) == IS_ARRAY) {
+		Array* array = O_AVAL(o);
+		size_t k;
+		for(k = 0; k < array->size; k++) {
+			if(!path_eval(e, i, array->table[k]))
+				return 0;
+		}
+	}
+	return 1;
+}
+
+LIBOBJECT_API size_t objectPathEval(ObjectPath* path, Object* root, Object** results, size_t max)
+{
+	BUG_ON_NULL(path);
+	BUG_ON_NULL(root);
+	PathEval e;
+
+	e.path = path;
+	e.results = results;
+	e.max = results != NULL ? max : 0;
+	e.count = 0;
+	e.first = 0;
+	path_eval(&e, 0, root);
+	return e.count;
+}
+
+LIBOBJECT_API Object* objectPathGet(ObjectPath* path, Object* root)
+{
+	BUG_ON_NULL(path);
+	BUG_ON_NULL(root);
+	Object* result = NULL;
+	PathEval e;
+
+	e.path = path;
+	e.results = &result;
+	e.max = 1;
+	e.count = 0;
+	e.first = 1;
+	path_eval(&e, 0, root);
+	return result;
+}
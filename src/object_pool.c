@@ -0,0 +1,552 @@
+/*
+ *  Copyright (c) 2015 Ryan McCullagh <me@ryanmccullagh.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A work-stealing pool for loops over Arrays and Maps.
+ *
+ * The pool starts on first use with one worker per CPU but one, since the
+ * calling thread works too. Each of them owns a deque of index ranges. A
+ * thread takes a range, pushes its right half and keeps going with the
+ * left until the range is no longer than the grain, then runs it: ranges
+ * are only split once there is a chance of someone taking the other half.
+ * Owners pop the newest range and thieves take the oldest, the biggest
+ * one left. A caller waiting for its loop runs or steals ranges until the
+ * last of them is done, so loops may nest. The pool serves one outside
+ * caller at a time, and another one that finds it busy runs its loop on
+ * its own.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "object.h"
+#include "object_private.h"
+
+#define POOL_MAX_THREADS	64
+#define POOL_DEQUE_SIZE		64	/* halving a range takes at most one per bit */
+#define POOL_SPLIT		8	/* ranges per thread when the caller gives no grain */
+
+typedef struct PoolJob PoolJob;
+
+struct PoolJob {
+	void		(*run)(PoolJob*, size_t, size_t);
+	size_t		grain;
+	size_t		pending;	/* ranges queued or running */
+	Object*		container;
+	union {
+		ObjectParallelFunction		each;
+		ObjectArrayMapFunction		map;
+		ObjectArrayFilterFunction	filter;
+		ObjectArrayReduceFunction	reduce;
+		void				(*range)(void*, size_t, size_t);
+	} fn;
+	void*		context;
+	void*		out;
+	size_t		chunk;		/* elements per chunk, for arrayReduce() */
+	int		failed;
+};
+
+typedef struct PoolTask {
+	PoolJob*	job;
+	size_t		begin;
+	size_t		end;
+} PoolTask;
+
+typedef struct PoolDeque {
+	pthread_mutex_t	lock;
+	size_t		head;		/* oldest task */
+	size_t		count;
+	PoolTask	tasks[POOL_DEQUE_SIZE];
+} PoolDeque;
+
+static struct {
+	pthread_mutex_t	lock;
+	pthread_cond_t	wake;
+	size_t		active;		/* loops started from outside the pool */
+	pthread_mutex_t	submit;		/* one of them at a time */
+	size_t		nthreads;	/* workers and the caller */
+	PoolDeque	deques[POOL_MAX_THREADS];	/* the caller's is the first */
+	pthread_t	threads[POOL_MAX_THREADS];
+} pool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.wake = PTHREAD_COND_INITIALIZER,
+	.submit = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+static pthread_key_t pool_key;
+
+static int pool_push(PoolDeque* d, PoolJob* job, size_t begin, size_t end)
+{
+	pthread_mutex_lock(&d->lock);
+	if(d->count == POOL_DEQUE_SIZE) {
+		pthread_mutex_unlock(&d->lock);
+		return 0;
+	}
+	PoolTask* t = &d->tasks[(d->head + d->count) % POOL_DEQUE_SIZE];
+	t->job = job;
+	t->begin = begin;
+	t->end = end;
+	/* count is peeked at without the lock */
+	__atomic_store_n(&d->count, d->count + 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&d->lock);
+	return 1;
+}
+
+/*
+ * the newest task for the owner, the oldest for a thief
+ */
+static int pool_take(PoolDeque* d, PoolTask* t, int steal)
+{
+	if(__atomic_load_n(&d->count, __ATOMIC_RELAXED) == 0)
+		return 0;
+	pthread_mutex_lock(&d->lock);
+	if(d->count == 0) {
+		pthread_mutex_unlock(&d->lock);
+		return 0;
+	}
+	if(steal) {
+		*t = d->tasks[d->head];
+		d->head = (d->head + 1) % POOL_DEQUE_SIZE;
+	} else {
+		*t = d->tasks[(d->head + d->count - 1) % POOL_DEQUE_SIZE];
+	}
+	__atomic_store_n(&d->count, d->count - 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&d->lock);
+	return 1;
+}
+
+static void pool_run(PoolDeque* self, PoolTask t)
+{
+	PoolJob* job = t.job;
+
+	while(t.end - t.begin > job->grain) {
+		size_t mid = t.begin + (t.end - t.begin) / 2;
+		/* this task is still pending, so the count cannot reach 0 here */
+		__atomic_add_fetch(&job->pending, 1, __ATOMIC_RELAXED);
+		if(!pool_push(self, job, mid, t.end)) {
+			__atomic_sub_fetch(&job->pending, 1, __ATOMIC_RELAXED);
+			break;
+		}
+		t.end = mid;
+	}
+	job->run(job, t.begin, t.end);
+	__atomic_sub_fetch(&job->pending, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * run one task, ours or someone else's. 0 when there was none
+ */
+static int pool_work(PoolDeque* self)
+{
+	size_t i, start = self - pool.deques;
+	PoolTask t;
+
+	if(pool_take(self, &t, 0)) {
+		pool_run(self, t);
+		return 1;
+	}
+	for(i = 1; i < pool.nthreads; i++) {
+		if(pool_take(&pool.deques[(start + i) % pool.nthreads], &t, 1)) {
+			pool_run(self, t);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void* pool_worker(void* arg)
+{
+	PoolDeque* self = arg;
+
+	pthread_setspecific(pool_key, self);
+	for(;;) {
+		if(__atomic_load_n(&pool.active, __ATOMIC_ACQUIRE) == 0) {
+			pthread_mutex_lock(&pool.lock);
+			while(pool.active == 0)
+				pthread_cond_wait(&pool.wake, &pool.lock);
+			pthread_mutex_unlock(&pool.lock);
+		}
+		if(!pool_work(self))
+			sched_yield();
+	}
+	return NULL;
+}
+
+static void pool_init(void)
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t i;
+
+	if(n < 1)
+		n = 1;
+	if(n > POOL_MAX_THREADS)
+		n = POOL_MAX_THREADS;
+	pthread_key_create(&pool_key, NULL);
+	for(i = 0; i < (size_t)n; i++)
+		pthread_mutex_init(&pool.deques[i].lock, NULL);
+	/* nthreads only grows before any task exists */
+	pool.nthreads = 1;
+	for(i = 1; i < (size_t)n; i++) {
+		if(pthread_create(&pool.threads[i], NULL, pool_worker, &pool.deques[i]) != 0)
+			break;
+		pool.nthreads++;
+	}
+}
+
+/*
+ * call job->run over [0, n) on every thread of the pool and return once
+ * it is done
+ */
+static void pool_parallel(PoolJob* job, size_t n)
+{
+	PoolDeque* self;
+	PoolTask t;
+	int outside;
+
+	if(n == 0)
+		return;
+	pthread_once(&pool_once, pool_init);
+	if(job->grain == 0) {
+		job->grain = n / (POOL_SPLIT * pool.nthreads);
+		if(job->grain == 0)
+			job->grain = 1;
+	}
+	if(pool.nthreads == 1 || n <= job->grain) {
+		job->run(job, 0, n);
+		return;
+	}
+
+	self = pthread_getspecific(pool_key);
+	outside = self == NULL;
+	if(outside) {
+		if(pthread_mutex_trylock(&pool.submit) != 0) {
+			job->run(job, 0, n);
+			return;
+		}
+		self = &pool.deques[0];
+		pthread_setspecific(pool_key, self);
+		pthread_mutex_lock(&pool.lock);
+		__atomic_add_fetch(&pool.active, 1, __ATOMIC_RELEASE);
+		pthread_cond_broadcast(&pool.wake);
+		pthread_mutex_unlock(&pool.lock);
+	}
+
+	job->pending = 1;
+	t.job = job;
+	t.begin = 0;
+	t.end = n;
+	pool_run(self, t);
+	while(__atomic_load_n(&job->pending, __ATOMIC_ACQUIRE) != 0) {
+		if(!pool_work(self))
+			sched_yield();
+	}
+
+	if(outside) {
+		pthread_mutex_lock(&pool.lock);
+		__atomic_sub_fetch(&pool.active, 1, __ATOMIC_RELEASE);
+		pthread_mutex_unlock(&pool.lock);
+		pthread_setspecific(pool_key, NULL);
+		pthread_mutex_unlock(&pool.submit);
+	}
+}
+
+static void pool_job_init(PoolJob* job, void (*run)(PoolJob*, size_t, size_t), Object* container,
+	void* context, size_t grain)
+{
+	memset(job, 0, sizeof(*job));
+	job->run = run;
+	job->container = container;
+	job->context = context;
+	job->grain = grain;
+}
+
+static void parallel_range(PoolJob* job, size_t begin, size_t end)
+{
+	job->fn.range(job->context, begin, end);
+}
+
+void poolParallel(void (*fn)(void*, size_t, size_t), void* context, size_t n, size_t grain)
+{
+	PoolJob job;
+
+	pool_job_init(&job, parallel_range, NULL, context, grain);
+	job.fn.range = fn;
+	pool_parallel(&job, n);
+}
+
+size_t poolThreads(void)
+{
+	pthread_once(&pool_once, pool_init);
+	return pool.nthreads;
+}
+
+static void for_each_array(PoolJob* job, size_t begin, size_t end)
+{
+	Object** table = O_AVAL(job->container)->table;
+	size_t i;
+
+	for(i = begin; i < end; i++)
+		job->fn.each(job->context, i, NULL, table[i]);
+}
+
+static void for_each_map(PoolJob* job, size_t begin, size_t end)
+{
+	Bucket** buckets = O_MVAL(job->container)->buckets;
+	size_t i;
+
+	for(i = begin; i < end; i++) {
+		Bucket* b;
+		for(b = buckets[i]; b != NULL; b = b->next)
+			job->fn.each(job->context, i, b->key->value, b->value);
+	}
+}
+
+LIBOBJECT_API int objectParallelForEach(Object* container, ObjectParallelFunction fn, void* context,
+	size_t grain)
+{
+	BUG_ON_NULL(container);
+	BUG_ON_NULL(fn);
+	PoolJob job;
+
+	if(O_TYPE(container) != IS_ARRAY && O_TYPE(container) != IS_MAP) {
+		fprintf(get_debug_fp(), "%s(): Object is not an Array or a Map\n", __func__);
+		return 0;
+	}
+	if(!objectLoad(container))
+		return 0;
+	if(O_TYPE(container) == IS_ARRAY) {
+		pool_job_init(&job, for_each_array, container, context, grain);
+		job.fn.each = fn;
+		pool_parallel(&job, O_AVAL(container)->size);
+	} else {
+		pool_job_init(&job, for_each_map, container, context, grain);
+		job.fn.each = fn;
+		pool_parallel(&job, O_MVAL(container)->capacity);
+	}
+	return 1;
+}
+
+static int array_check(Object* array, const char* func)
+{
+	if(O_TYPE(array) != IS_ARRAY) {
+		fprintf(get_debug_fp(), "%s(): Object is not an Array\n", func);
+		return 0;
+	}
+	return objectLoad(array);
+}
+
+/*
+ * every range writes its own slots of the result table
+ */
+static void array_map(PoolJob* job, size_t begin, size_t end)
+{
+	Object** table = O_AVAL(job->container)->table;
+	Object** out = job->out;
+	size_t i;
+
+	for(i = begin; i < end; i++) {
+		if(__atomic_load_n(&job->failed, __ATOMIC_RELAXED))
+			return;
+		if((out[i] = job->fn.map(job->context, i, table[i])) == NULL)
+			__atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+	}
+}
+
+LIBOBJECT_API Object* arrayMap(Object* array, ObjectArrayMapFunction fn, void* context, size_t grain)
+{
+	BUG_ON_NULL(array);
+	BUG_ON_NULL(fn);
+	PoolJob job;
+	Object* result;
+	size_t i, n;
+
+	if(!array_check(array, __func__))
+		return NULL;
+	n = O_AVAL(array)->size;
+	result = newArray(n ? n : 1);
+	if(result == NULL)
+		return NULL;
+	/* the table starts zeroed, so a failed map knows what to free */
+	pool_job_init(&job, array_map, array, context, grain);
+	job.fn.map = fn;
+	job.out = O_AVAL(result)->table;
+	pool_parallel(&job, n);
+	if(job.failed) {
+		for(i = 0; i < n; i++)
+			objectDestroy(O_AVAL(result)->table[i]);
+		free(O_AVAL(result)->table);
+		free(O_AVAL(result));
+		free(result);
+		return NULL;
+	}
+	O_AVAL(result)->size = n;
+	O_AVAL(result)->nextIndex = n;
+	return result;
+}
+
+static void array_filter(PoolJob* job, size_t begin, size_t end)
+{
+	Object** table = O_AVAL(job->container)->table;
+	unsigned char* keep = job->out;
+	size_t i;
+
+	for(i = begin; i < end; i++)
+		keep[i] = job->fn.filter(job->context, i, table[i]) != 0;
+}
+
+LIBOBJECT_API Object* arrayFilter(Object* array, ObjectArrayFilterFunction fn, void* context,
+	size_t grain)
+{
+	BUG_ON_NULL(array);
+	BUG_ON_NULL(fn);
+	PoolJob job;
+	Object* result;
+	unsigned char* keep;
+	size_t i, k, n;
+
+	if(!array_check(array, __func__))
+		return NULL;
+	n = O_AVAL(array)->size;
+	keep = malloc(n ? n : 1);
+	if(keep == NULL) {
+		fprintf(get_debug_fp(), "%s(): out of memory\n", __func__);
+		return NULL;
+	}
+	pool_job_init(&job, array_filter, array, context, grain);
+	job.fn.filter = fn;
+	job.out = keep;
+	pool_parallel(&job, n);
+
+	for(i = k = 0; i < n; i++)
+		k += keep[i];
+	result = newArray(k ? k : 1);
+	if(result == NULL) {
+		free(keep);
+		return NULL;
+	}
+	/*
+	 * retaining happens here, on one thread: an unfrozen element may be
+	 * in the array more than once and its count is not atomic
+	 */
+	for(i = k = 0; i < n; i++) {
+		if(keep[i])
+			O_AVAL(result)->table[k++] = objectRetain(O_AVAL(array)->table[i]);
+	}
+	O_AVAL(result)->size = k;
+	O_AVAL(result)->nextIndex = k;
+	free(keep);
+	return result;
+}
+
+/*
+ * a chunk's fold, or its only element when owned is 0
+ */
+typedef struct ReduceSlot {
+	Object*		value;
+	int		owned;
+} ReduceSlot;
+
+static int reduce_step(ObjectArrayReduceFunction fn, void* context, ReduceSlot* acc, Object* value)
+{
+	Object* next = fn(context, acc->value, value);
+
+	if(acc->owned)
+		objectDestroy(acc->value);
+	acc->value = next;
+	acc->owned = 1;
+	return next != NULL;
+}
+
+/*
+ * ranges here are chunk numbers, so the chunks and the order they are
+ * combined in do not depend on who ran what
+ */
+static void array_reduce(PoolJob* job, size_t begin, size_t end)
+{
+	Array* array = O_AVAL(job->container);
+	ReduceSlot* slots = job->out;
+	size_t chunk, i, last;
+
+	for(chunk = begin; chunk < end; chunk++) {
+		ReduceSlot* acc = &slots[chunk];
+		i = chunk * job->chunk;
+		last = i + job->chunk < array->size ? i + job->chunk : array->size;
+		acc->value = array->table[i];
+		acc->owned = 0;
+		for(i++; i < last; i++) {
+			if(__atomic_load_n(&job->failed, __ATOMIC_RELAXED) ||
+				!reduce_step(job->fn.reduce, job->context, acc, array->table[i])) {
+				__atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+				return;
+			}
+		}
+	}
+}
+
+LIBOBJECT_API Object* arrayReduce(Object* array, ObjectArrayReduceFunction fn, void* context,
+	size_t grain)
+{
+	BUG_ON_NULL(array);
+	BUG_ON_NULL(fn);
+	PoolJob job;
+	ReduceSlot* slots;
+	ReduceSlot acc;
+	size_t i, n, nchunks;
+	int ok;
+
+	if(!array_check(array, __func__))
+		return NULL;
+	n = O_AVAL(array)->size;
+	if(n == 0)
+		return NULL;
+	pthread_once(&pool_once, pool_init);
+	pool_job_init(&job, array_reduce, array, context, 1);
+	job.fn.reduce = fn;
+	job.chunk = grain ? grain : n / (POOL_SPLIT * pool.nthreads);
+	if(job.chunk == 0)
+		job.chunk = 1;
+	nchunks = (n + job.chunk - 1) / job.chunk;
+	slots = calloc(nchunks, sizeof(ReduceSlot));
+	if(slots == NULL) {
+		fprintf(get_debug_fp(), "%s(): out of memory\n", __func__);
+		return NULL;
+	}
+	job.out = slots;
+	pool_parallel(&job, nchunks);
+
+	/* then the chunks, left to right, so fn only needs to be associative */
+	ok = !job.failed;
+	acc = slots[0];
+	for(i = 1; i < nchunks; i++) {
+		if(ok)
+			ok = reduce_step(fn, context, &acc, slots[i].value);
+		if(slots[i].owned)
+			objectDestroy(slots[i].value);
+	}
+	free(slots);
+	if(!ok) {
+		if(acc.owned)
+			objectDestroy(acc.value);
+		return NULL;
+	}
+	return acc.owned ? acc.value : objectRetain(acc.value);
+}
@@ -0,0 +1,153 @@
+/*
+ *  Copyright (c) 2015 Ryan McCullagh <me@ryanmccullagh.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __OBJECT_PRIVATE_H
+#define __OBJECT_PRIVATE_H
+
+/*
+ * Constructors and helpers shared between the library's translation units.
+ * None of these are exported from the shared object.
+ */
+
+#include "object.h"
+
+#if defined(__GNUC__) && __GNUC__ >= 4
+#define LIBOBJECT_INTERNAL __attribute__((__visibility__("hidden")))
+#else
+#define LIBOBJECT_INTERNAL
+#endif
+
+extern LIBOBJECT_INTERNAL FILE*   get_debug_fp(void);
+
+#define RETURN_ON_NULL(o) do { \
+	if(o == NULL) { \
+		fprintf(get_debug_fp(), "%s():%s:%d caught a NULL pointer\n", __FILE__, \
+			__FUNCTION__, __LINE__); \
+		return NULL; \
+	} \
+} \
+while(0)
+
+#define BUG_ON_NULL(o) do { \
+	if(o == NULL) { \
+		fprintf(get_debug_fp(), "%s:%s:%d caught a NULL pointer!\n", __FILE__, \
+			__FUNCTION__, __LINE__); \
+		exit(EXIT_FAILURE); \
+	} \
+} \
+while(0)
+
+extern LIBOBJECT_INTERNAL Object* newObject(ObjectType);
+/*
+ * a String with room for n bytes and a terminating NUL in the same block
+ */
+extern LIBOBJECT_INTERNAL String* newStringInstanceBuffer(size_t);
+extern LIBOBJECT_INTERNAL void    stringInstanceFree(String*);
+/*
+ * the hash objectHash() uses for the bytes of a String, Bytes or key,
+ * cached in the String
+ */
+extern LIBOBJECT_INTERNAL uint64_t stringInstanceHash(String*);
+/*
+ * insert without copying, taking ownership of key and value. hash must be
+ * stringHash() of the key. A value already stored under the key is
+ * destroyed and replaced, and the new key is freed
+ */
+extern LIBOBJECT_INTERNAL int     mapInsertString(Object*, String*, uint32_t, Object*);
+/*
+ * mapSearchEx() for a key of known length and stringHash()
+ */
+extern LIBOBJECT_INTERNAL Object* mapSearchHashed(Object*, const char*, size_t, uint32_t);
+/*
+ * unlink a key and return its value without destroying it, NULL if absent
+ */
+extern LIBOBJECT_INTERNAL Object* mapTakeHashed(Object*, const char*, size_t, uint32_t);
+/*
+ * insert value before index, or append when index is the size, taking
+ * ownership. 0 if index is out of range or the table cannot grow
+ */
+extern LIBOBJECT_INTERNAL int     arrayInsertAt(Object*, size_t, Object*);
+/*
+ * remove the element at index and return it without destroying it
+ */
+extern LIBOBJECT_INTERNAL Object* arrayTakeAt(Object*, size_t);
+/*
+ * objectCanonicalize() for a node whose children are already canonical
+ */
+extern LIBOBJECT_INTERNAL Object* canonIntern(ObjectCanonTable*, Object*);
+/*
+ * call fn(context, begin, end) over ranges covering [0, n) on the pool of
+ * object_pool.c, about grain long or picked from n for 0, and return once
+ * all are done. poolThreads() counts the threads, the caller included
+ */
+extern LIBOBJECT_INTERNAL void    poolParallel(void (*)(void*, size_t, size_t), void*, size_t, size_t);
+extern LIBOBJECT_INTERNAL size_t  poolThreads(void);
+/*
+ * heap owned by o itself, not counting its children or malloc overhead
+ */
+extern LIBOBJECT_INTERNAL size_t  objectFootprint(Object*);
+/*
+ * objectDestroy() returning the objectFootprint() of everything it freed
+ */
+extern LIBOBJECT_INTERNAL size_t  objectDestroyCounted(Object*);
+
+/*
+ * Object flags. A LAZY Array or Map comes from objectFromJson() with
+ * OBJECT_JSON_LAZY and has not built its children yet: value.pointerValue
+ * is the parser's record of it instead of an Array or Map. Anything that
+ * reads the container must call objectLoad() first
+ */
+#define OBJECT_FLAG_LAZY	0x1
+/*
+ * set by objectFreeze(). A FROZEN object and everything under it never
+ * changes again: it is fully loaded, its lazily cached facts are filled
+ * in, its reference count is only touched atomically and every mutator
+ * refuses it, so threads can read it without locks
+ */
+#define OBJECT_FLAG_FROZEN	0x2
+
+extern LIBOBJECT_INTERNAL int     jsonLazyLoad(Object*);
+extern LIBOBJECT_INTERNAL Object* jsonLazyCopy(Object*);
+extern LIBOBJECT_INTERNAL void    jsonLazyFree(Object*);
+
+/*
+ * build the children of a lazy container in place, 0 if that failed
+ */
+#define objectLoad(o) (!(O_FLG(o) & OBJECT_FLAG_LAZY) || jsonLazyLoad(o))
+
+/*
+ * Epoch based reclamation for lock-free readers. Readers bracket their
+ * use of shared memory with epochEnter(), which is 0 when out of memory,
+ * and epochExit(), which is 0 outside a section; sections nest. Writers
+ * unlink memory first and then epochRetire() it onto a list they protect
+ * themselves. epochReclaim() releases what no reader can reach any more
+ * and returns how many are left, epochReclaimAll() releases everything
+ * once there are no readers
+ */
+typedef struct EpochRetired {
+	void		(*release)(void*);
+	void*		pointer;
+	uint64_t	epoch;
+	struct EpochRetired* next;
+} EpochRetired;
+
+extern LIBOBJECT_INTERNAL int     epochEnter(void);
+extern LIBOBJECT_INTERNAL int     epochExit(void);
+extern LIBOBJECT_INTERNAL void    epochRetire(EpochRetired**, void (*)(void*), void*);
+extern LIBOBJECT_INTERNAL size_t  epochReclaim(EpochRetired**);
+extern LIBOBJECT_INTERNAL void    epochReclaimAll(EpochRetired**);
+
+#endif /* __OBJECT_PRIVATE_H */
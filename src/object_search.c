@@ -0,0 +1,444 @@
+/*
+ *  Copyright (c) 2015 Ryan McCullagh <me@ryanmccullagh.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Substring search. The common case is a SIMD filter on the first and
+ * last byte of the needle (Mula), which rejects most positions 16 at a
+ * time. When candidate verification costs more than the text scanned so
+ * far the search switches to the Crochemore-Perrin two-way algorithm,
+ * which is linear in the worst case. Multi pattern search uses an
+ * Aho-Corasick automaton over a compressed byte alphabet.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "object.h"
+#include "object_simd.h"
+
+#define SEARCH_MAX(a, b) ((a) > (b) ? (a) : (b))
+
+/*
+ * reverse views let one two-way implementation find the last match: the
+ * last occurrence is the first occurrence of the reversed needle in the
+ * reversed haystack
+ */
+#define HAY(i) (reverse ? h[hn - 1 - (i)] : h[i])
+#define NEEDLE(i) (reverse ? n[l - 1 - (i)] : n[i])
+
+static size_t twoway_search(const unsigned char* h, size_t hn,
+	const unsigned char* n, size_t l, int reverse)
+{
+	size_t i, ip, jp, k, p, ms, p0, mem, mem0;
+	size_t shift[256];
+	unsigned char present[256];
+	size_t pos = 0;
+
+	memset(present, 0, sizeof(present));
+	for(i = 0; i < l; i++) {
+		present[NEEDLE(i)] = 1;
+		shift[NEEDLE(i)] = i + 1;
+	}
+
+	/* maximal suffix under < */
+	ip = (size_t)-1; jp = 0; k = p = 1;
+	while(jp + k < l) {
+		if(NEEDLE(ip + k) == NEEDLE(jp + k)) {
+			if(k == p) {
+				jp += p;
+				k = 1;
+			} else {
+				k++;
+			}
+		} else if(NEEDLE(ip + k) > NEEDLE(jp + k)) {
+			jp += k;
+			k = 1;
+			p = jp - ip;
+		} else {
+			ip = jp++;
+			k = p = 1;
+		}
+	}
+	ms = ip;
+	p0 = p;
+
+	/* and under > */
+	ip = (size_t)-1; jp = 0; k = p = 1;
+	while(jp + k < l) {
+		if(NEEDLE(ip + k) == NEEDLE(jp + k)) {
+			if(k == p) {
+				jp += p;
+				k = 1;
+			} else {
+				k++;
+			}
+		} else if(NEEDLE(ip + k) < NEEDLE(jp + k)) {
+			jp += k;
+			k = 1;
+			p = jp - ip;
+		} else {
+			ip = jp++;
+			k = p = 1;
+		}
+	}
+	if(ip + 1 > ms + 1)
+		ms = ip;
+	else
+		p = p0;
+
+	/* periodic needle? */
+	int periodic = 1;
+	for(i = 0; i < ms + 1; i++) {
+		if(NEEDLE(i) != NEEDLE(i + p)) {
+			periodic = 0;
+			break;
+		}
+	}
+	if(!periodic) {
+		mem0 = 0;
+		p = SEARCH_MAX(ms, l - ms - 1) + 1;
+	} else {
+		mem0 = l - p;
+	}
+	mem = 0;
+
+	for(;;) {
+		if(hn - pos < l)
+			return STRING_NPOS;
+
+		unsigned char last = HAY(pos + l - 1);
+		if(present[last]) {
+			k = l - shift[last];
+			if(k) {
+				if(k < mem)
+					k = mem;
+				pos += k;
+				mem = 0;
+				continue;
+			}
+		} else {
+			pos += l;
+			mem = 0;
+			continue;
+		}
+
+		for(k = SEARCH_MAX(ms + 1, mem); k < l && NEEDLE(k) == HAY(pos + k); k++);
+		if(k < l) {
+			pos += k - ms;
+			mem = 0;
+			continue;
+		}
+		for(k = ms + 1; k > mem && NEEDLE(k - 1) == HAY(pos + k - 1); k--);
+		if(k <= mem)
+			return reverse ? hn - pos - l : pos;
+		pos += p;
+		mem = mem0;
+	}
+}
+
+#undef HAY
+#undef NEEDLE
+
+/*
+ * return the offset of the first occurrence of the m byte needle in the n
+ * byte haystack, or STRING_NPOS
+ */
+LIBOBJECT_API size_t byteSearch(const char* haystack, size_t n, const char* needle, size_t m)
+{
+	const unsigned char* h = (const unsigned char *)haystack;
+	const unsigned char* s = (const unsigned char *)needle;
+	size_t i = 0;
+
+	if(m == 0)
+		return 0;
+	if(m > n)
+		return STRING_NPOS;
+	if(m == 1) {
+		const void* p = memchr(h, s[0], n);
+		return p ? (size_t)((const unsigned char *)p - h) : STRING_NPOS;
+	}
+
+#ifdef OBJECT_SIMD_X86
+	const __m128i first = _mm_set1_epi8((char)s[0]);
+	const __m128i last = _mm_set1_epi8((char)s[m - 1]);
+	size_t verified = 0;
+
+	for(; i + m - 1 + 16 <= n; i += 16) {
+		__m128i block_first = _mm_loadu_si128((const __m128i *)(h + i));
+		__m128i block_last = _mm_loadu_si128((const __m128i *)(h + i + m - 1));
+		uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_and_si128(
+			_mm_cmpeq_epi8(block_first, first), _mm_cmpeq_epi8(block_last, last)));
+		while(mask != 0) {
+			size_t bit = (size_t)object_ctz32(mask);
+			if(memcmp(h + i + bit + 1, s + 1, m - 2) == 0)
+				return i + bit;
+			verified += m;
+			mask &= mask - 1;
+		}
+		/* adversarial input, fall back to the linear algorithm */
+		if(verified > 4 * i + 1024) {
+			size_t pos = twoway_search(h + i, n - i, s, m, 0);
+			return pos == STRING_NPOS ? pos : i + pos;
+		}
+	}
+#endif
+	if(n - i < m)
+		return STRING_NPOS;
+	if(n - i >= 64) {
+		size_t pos = twoway_search(h + i, n - i, s, m, 0);
+		return pos == STRING_NPOS ? pos : i + pos;
+	}
+	for(; i + m <= n; i++) {
+		if(h[i] == s[0] && memcmp(h + i, s, m) == 0)
+			return i;
+	}
+	return STRING_NPOS;
+}
+
+/*
+ * return the offset of the last occurrence of the needle, or STRING_NPOS
+ */
+LIBOBJECT_API size_t byteSearchLast(const char* haystack, size_t n, const char* needle, size_t m)
+{
+	const unsigned char* h = (const unsigned char *)haystack;
+	const unsigned char* s = (const unsigned char *)needle;
+
+	if(m == 0)
+		return n;
+	if(m > n)
+		return STRING_NPOS;
+
+	/* candidates start at [0, end) */
+	size_t end = n - m + 1;
+
+#ifdef OBJECT_SIMD_X86
+	const __m128i first = _mm_set1_epi8((char)s[0]);
+	const __m128i last = _mm_set1_epi8((char)s[m - 1]);
+	size_t verified = 0;
+	size_t scanned = 0;
+
+	while(end >= 16) {
+		size_t i = end - 16;
+		__m128i block_first = _mm_loadu_si128((const __m128i *)(h + i));
+		__m128i block_last = _mm_loadu_si128((const __m128i *)(h + i + m - 1));
+		uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_and_si128(
+			_mm_cmpeq_epi8(block_first, first), _mm_cmpeq_epi8(block_last, last)));
+		while(mask != 0) {
+			size_t bit = 31 - (size_t)__builtin_clz(mask);
+			if(memcmp(h + i + bit, s, m) == 0)
+				return i + bit;
+			verified += m;
+			mask &= ~(1u << bit);
+		}
+		end = i;
+		scanned += 16;
+		if(verified > 4 * scanned + 1024)
+			return twoway_search(h, end + m - 1, s, m, 1);
+	}
+#endif
+	if(end >= 64)
+		return twoway_search(h, end + m - 1, s, m, 1);
+	while(end > 0) {
+		end--;
+		if(h[end] == s[0] && memcmp(h + end, s, m) == 0)
+			return end;
+	}
+	return STRING_NPOS;
+}
+
+/*
+ * Aho-Corasick automaton. Bytes that occur in no pattern share class 0,
+ * so the transition table is states x classes rather than states x 256.
+ * Every transition is precomputed (a DFA), scanning costs one table load
+ * per input byte.
+ */
+struct StringMatcher {
+	unsigned char	classes[256];
+	size_t		class_count;
+	size_t		state_count;
+	uint32_t*	next;		/* state_count * class_count */
+	int32_t*	output;		/* pattern ending at this state, or -1 */
+	uint32_t*	output_link;	/* next state on the suffix chain with output */
+	size_t*		lengths;	/* pattern lengths */
+	size_t		pattern_count;
+};
+
+#define MATCHER_NO_LINK ((uint32_t)-1)
+
+static String* matcher_pattern(Object* patterns, size_t i)
+{
+	Object* o = arrayGetEx(patterns, i);
+	if(o == NULL || (O_TYPE(o) != IS_STRING && O_TYPE(o) != IS_BYTES))
+		return NULL;
+	return O_SVAL(o);
+}
+
+/*
+ * build a matcher from an Array of Strings. Pattern i is reported with
+ * index i. return NULL if an element is not a String or is empty
+ */
+LIBOBJECT_API StringMatcher* stringMatcherNew(Object* patterns)
+{
+	size_t count = arraySize(patterns);
+	size_t i, j, c;
+	size_t max_states = 1;
+
+	StringMatcher* matcher = calloc(1, sizeof(StringMatcher));
+	if(!matcher)
+		return NULL;
+
+	for(i = 0; i < count; i++) {
+		String* p = matcher_pattern(patterns, i);
+		if(p == NULL || p->length == 0) {
+			free(matcher);
+			return NULL;
+		}
+		max_states += p->length;
+		for(j = 0; j < p->length; j++)
+			matcher->classes[(unsigned char)p->value[j]] = 1;
+	}
+	matcher->class_count = 1;
+	for(c = 0; c < 256; c++) {
+		if(matcher->classes[c])
+			matcher->classes[c] = (unsigned char)matcher->class_count++;
+	}
+
+	size_t width = matcher->class_count;
+	matcher->next = calloc(max_states * width, sizeof(uint32_t));
+	matcher->output = malloc(max_states * sizeof(int32_t));
+	matcher->output_link = malloc(max_states * sizeof(uint32_t));
+	matcher->lengths = malloc((count ? count : 1) * sizeof(size_t));
+	uint32_t* fail = malloc(max_states * sizeof(uint32_t));
+	uint32_t* queue = malloc(max_states * sizeof(uint32_t));
+	if(!matcher->next || !matcher->output || !matcher->output_link ||
+		!matcher->lengths || !fail || !queue) {
+		free(fail);
+		free(queue);
+		stringMatcherFree(matcher);
+		return NULL;
+	}
+	matcher->pattern_count = count;
+
+	/* trie, 0 in next[] means "no edge" since the root is never a child */
+	matcher->state_count = 1;
+	matcher->output[0] = -1;
+	for(i = 0; i < count; i++) {
+		String* p = matcher_pattern(patterns, i);
+		uint32_t state = 0;
+		for(j = 0; j < p->length; j++) {
+			size_t cls = matcher->classes[(unsigned char)p->value[j]];
+			uint32_t* edge = &matcher->next[state * width + cls];
+			if(*edge == 0) {
+				*edge = (uint32_t)matcher->state_count;
+				matcher->output[matcher->state_count] = -1;
+				matcher->state_count++;
+			}
+			state = *edge;
+		}
+		/* keep the first of duplicate patterns */
+		if(matcher->output[state] < 0)
+			matcher->output[state] = (int32_t)i;
+		matcher->lengths[i] = p->length;
+	}
+
+	/* breadth first: failure links, then fill in missing edges */
+	size_t head = 0, tail = 0;
+	fail[0] = 0;
+	matcher->output_link[0] = MATCHER_NO_LINK;
+	for(c = 0; c < width; c++) {
+		uint32_t child = matcher->next[c];
+		if(child != 0) {
+			fail[child] = 0;
+			matcher->output_link[child] = MATCHER_NO_LINK;
+			queue[tail++] = child;
+		}
+	}
+	while(head < tail) {
+		uint32_t state = queue[head++];
+		for(c = 0; c < width; c++) {
+			uint32_t* edge = &matcher->next[state * width + c];
+			uint32_t target = matcher->next[fail[state] * width + c];
+			if(*edge == 0) {
+				*edge = target;
+				continue;
+			}
+			uint32_t child = *edge;
+			fail[child] = target;
+			matcher->output_link[child] = matcher->output[target] >= 0 ?
+				target : matcher->output_link[target];
+			queue[tail++] = child;
+		}
+	}
+
+	free(fail);
+	free(queue);
+	return matcher;
+}
+
+LIBOBJECT_API void stringMatcherFree(StringMatcher* matcher)
+{
+	if(matcher == NULL)
+		return;
+	free(matcher->next);
+	free(matcher->output);
+	free(matcher->output_link);
+	free(matcher->lengths);
+	free(matcher);
+}
+
+/*
+ * scan n bytes once and report every occurrence of every pattern,
+ * overlapping ones included, in order of their end offset. callback gets
+ * the pattern index and the byte offset where the match starts, and stops
+ * the scan by returning 0. return the number of matches reported
+ */
+LIBOBJECT_API size_t stringMatcherScanBytes(StringMatcher* matcher, const char* text, size_t n,
+	StringMatchFunction callback, void* context)
+{
+	const unsigned char* p = (const unsigned char *)text;
+	const uint32_t* next = matcher->next;
+	const unsigned char* classes = matcher->classes;
+	size_t width = matcher->class_count;
+	uint32_t state = 0;
+	size_t found = 0;
+	size_t i;
+
+	for(i = 0; i < n; i++) {
+		state = next[state * width + classes[p[i]]];
+		uint32_t s = matcher->output[state] >= 0 ? state : matcher->output_link[state];
+		while(s != MATCHER_NO_LINK) {
+			size_t pattern = (size_t)matcher->output[s];
+			found++;
+			if(callback && !callback(context, pattern, i + 1 - matcher->lengths[pattern]))
+				return found;
+			s = matcher->output_link[s];
+		}
+	}
+	return found;
+}
+
+LIBOBJECT_API size_t stringMatcherScan(StringMatcher* matcher, Object* text,
+	StringMatchFunction callback, void* context)
+{
+	if(matcher == NULL || text == NULL)
+		return 0;
+	if(O_TYPE(text) != IS_STRING && O_TYPE(text) != IS_BYTES)
+		return 0;
+	return stringMatcherScanBytes(matcher, O_SVAL(text)->value, O_SVAL(text)->length,
+		callback, context);
+}
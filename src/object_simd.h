@@ -0,0 +1,61 @@
+/*
+ *  Copyright (c) 2015 Ryan McCullagh <me@ryanmccullagh.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __OBJECT_SIMD_H
+#define __OBJECT_SIMD_H
+
+/*
+ * Internal helpers for the vectorized kernels. SSE2 is part of the x86-64
+ * baseline and is used unconditionally when the compiler targets it. Wider
+ * instruction sets are compiled per function with OBJECT_TARGET() and
+ * selected at run time, so a default build still uses them when the CPU
+ * has them.
+ */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define OBJECT_SIMD_X86 1
+#include <immintrin.h>
+
+#define OBJECT_TARGET(t) __attribute__((target(t)))
+
+static inline int object_cpu_has_ssse3(void)
+{
+	static int cached = -1;
+	if(cached < 0)
+		cached = __builtin_cpu_supports("ssse3") ? 1 : 0;
+	return cached;
+}
+
+static inline int object_cpu_has_avx2(void)
+{
+	static int cached = -1;
+	if(cached < 0)
+		cached = __builtin_cpu_supports("avx2") ? 1 : 0;
+	return cached;
+}
+
+static inline int object_ctz32(uint32_t x)
+{
+	return __builtin_ctz(x);
+}
+
+static inline int object_ctz64(uint64_t x)
+{
+	return __builtin_ctzll(x);
+}
+#endif
+
+#endif /* __OBJECT_SIMD_H */
@@ -0,0 +1,739 @@
+/*
+ *  Copyright (c) 2015 Ryan McCullagh <me@ryanmccullagh.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Snapshots: an Object tree laid out so it can be used straight from a
+ * read-only mapping.
+ *
+ * Every value is a 16 byte slot holding its type and either the value
+ * itself (Null, Bool, Long, Double) or the file offset of a node. Nodes
+ * are 8 byte aligned and only refer to each other by offset, so the file
+ * means the same wherever it is mapped and every process mapping it shares
+ * the page cache. Children are written before their parents, so the
+ * writer streams and never seeks back except to fill in the header.
+ *
+ *   String, Bytes	length, hash, flags, bytes, NUL
+ *   Array		count, slots
+ *   Pair		two slots
+ *   Map		count, bucket count, entries (key offset and value
+ *			slot), then an open addressing table of hash and
+ *			entry number, at most half full
+ *
+ * Integers are stored in the byte order of the machine that wrote the
+ * file, which readers check.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "object.h"
+#include "object_private.h"
+
+#define SNAPSHOT_MAGIC		"LOBJSNAP"
+#define SNAPSHOT_VERSION	1
+#define SNAPSHOT_BYTE_ORDER	0x01020304
+
+typedef struct SnapshotSlot {
+	uint32_t	type;
+	uint32_t	reserved;
+	uint64_t	value;		/* the bits of a scalar, or a node offset */
+} SnapshotSlot;
+
+typedef struct SnapshotHeader {
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	byte_order;
+	uint64_t	size;		/* of the whole snapshot */
+	SnapshotSlot	root;
+} SnapshotHeader;
+
+typedef struct SnapshotString {
+	uint64_t	length;
+	uint32_t	hash;		/* stringHash() of the bytes */
+	uint32_t	flags;		/* STRING_FLAG_UTF8 and friends */
+	/* the bytes and a NUL follow */
+} SnapshotString;
+
+typedef struct SnapshotEntry {
+	uint64_t	key;		/* offset of a SnapshotString */
+	SnapshotSlot	value;
+} SnapshotEntry;
+
+typedef struct SnapshotBucket {
+	uint32_t	hash;
+	uint32_t	entry;		/* entry number plus one, 0 when empty */
+} SnapshotBucket;
+
+typedef struct SnapshotMap {
+	uint64_t	count;
+	uint64_t	nbuckets;	/* a power of two */
+	/* count entries and nbuckets buckets follow */
+} SnapshotMap;
+
+struct ObjectSnapshot {
+	const unsigned char* base;
+	size_t		size;
+};
+
+/*
+ * Writing
+ */
+
+#define SNAPSHOT_BUFFER	(1 << 16)
+
+/*
+ * map keys already written, so records sharing a shape share their key
+ * nodes. Only the first SNAPSHOT_KEYS distinct keys are remembered
+ */
+#define SNAPSHOT_KEYS	(1 << 12)
+
+typedef struct SnapshotKey {
+	String*		key;
+	uint32_t	hash;
+	uint64_t	offset;
+} SnapshotKey;
+
+typedef struct SnapshotWriter {
+	int		fd;
+	uint64_t	offset;		/* of the next byte */
+	size_t		used;
+	int		failed;
+	size_t		nkeys;
+	SnapshotKey	keys[2 * SNAPSHOT_KEYS];
+	char		buffer[SNAPSHOT_BUFFER];
+} SnapshotWriter;
+
+static int snapshot_flush(SnapshotWriter* w)
+{
+	const char* p = w->buffer;
+	const char* end = w->buffer + w->used;
+
+	while(p < end) {
+		ssize_t n = write(w->fd, p, end - p);
+		if(n < 0) {
+			if(errno == EINTR)
+				continue;
+			w->failed = 1;
+			return 0;
+		}
+		p += n;
+	}
+	w->used = 0;
+	return 1;
+}
+
+static void snapshot_put(SnapshotWriter* w, const void* data, size_t n)
+{
+	const char* p = data;
+
+	w->offset += n;
+	while(n > 0 && !w->failed) {
+		size_t k = SNAPSHOT_BUFFER - w->used;
+		if(k > n)
+			k = n;
+		memcpy(w->buffer + w->used, p, k);
+		w->used += k;
+		p += k;
+		n -= k;
+		if(w->used == SNAPSHOT_BUFFER)
+			snapshot_flush(w);
+	}
+}
+
+static void snapshot_align(SnapshotWriter* w)
+{
+	static const char zero[8];
+	if(w->offset & 7)
+		snapshot_put(w, zero, 8 - (w->offset & 7));
+}
+
+/*
+ * write a String node and return its offset
+ */
+static uint64_t snapshot_write_string(SnapshotWriter* w, String* string, uint32_t hash)
+{
+	SnapshotString node;
+	uint64_t offset;
+
+	snapshot_align(w);
+	offset = w->offset;
+	node.length = string->length;
+	node.hash = hash;
+	node.flags = string->flags & (STRING_FLAG_UTF8 | STRING_FLAG_ASCII);
+	snapshot_put(w, &node, sizeof(node));
+	snapshot_put(w, string->value, string->length);
+	snapshot_put(w, "", 1);
+	return offset;
+}
+
+static uint64_t snapshot_write_key(SnapshotWriter* w, String* key, uint32_t hash)
+{
+	size_t at = hash & (2 * SNAPSHOT_KEYS - 1);
+	SnapshotKey* slot;
+
+	for(; (slot = &w->keys[at])->key != NULL; at = (at + 1) & (2 * SNAPSHOT_KEYS - 1)) {
+		if(slot->hash == hash && slot->key->length == key->length &&
+			memcmp(slot->key->value, key->value, key->length) == 0)
+			return slot->offset;
+	}
+	if(w->nkeys == SNAPSHOT_KEYS)
+		return snapshot_write_string(w, key, hash);
+	w->nkeys++;
+	slot->key = key;
+	slot->hash = hash;
+	slot->offset = snapshot_write_string(w, key, hash);
+	return slot->offset;
+}
+
+static uint64_t snapshot_next_power(uint64_t n)
+{
+	uint64_t p = 1;
+	while(p < n)
+		p <<= 1;
+	return p;
+}
+
+/*
+ * fill in slot for o, first writing whatever nodes it needs
+ */
+static int snapshot_write(SnapshotWriter* w, Object* o, SnapshotSlot* slot)
+{
+	uint64_t k;
+
+	memset(slot, 0, sizeof(*slot));
+	slot->type = O_TYPE(o);
+	if(!objectLoad(o))
+		return 0;
+
+	switch(O_TYPE(o)) {
+		case IS_NULL:
+			return 1;
+		case IS_BOOL:
+			slot->value = O_BVAL(o) != 0;
+			return 1;
+		case IS_LONG:
+			slot->value = (uint64_t)O_LVAL(o);
+			return 1;
+		case IS_DOUBLE:
+			memcpy(&slot->value, &O_DVAL(o), sizeof(double));
+			return 1;
+		case IS_STRING:
+		case IS_BYTES:
+			slot->value = snapshot_write_string(w, O_SVAL(o),
+				stringHash(O_SVAL(o)->value, O_SVAL(o)->length));
+			return !w->failed;
+		case IS_PAIR: {
+			SnapshotSlot pair[2];
+			if(!snapshot_write(w, O_PVAL(o)->first, &pair[0]) ||
+				!snapshot_write(w, O_PVAL(o)->second, &pair[1]))
+				return 0;
+			snapshot_align(w);
+			slot->value = w->offset;
+			snapshot_put(w, pair, sizeof(pair));
+			return !w->failed;
+		}
+		case IS_ARRAY: {
+			Array* array = O_AVAL(o);
+			uint64_t count = array->size;
+			SnapshotSlot* slots = malloc((count ? count : 1) * sizeof(SnapshotSlot));
+			if(slots == NULL)
+				return 0;
+			for(k = 0; k < count; k++) {
+				if(!snapshot_write(w, array->table[k], &slots[k])) {
+					free(slots);
+					return 0;
+				}
+			}
+			snapshot_align(w);
+			slot->value = w->offset;
+			snapshot_put(w, &count, sizeof(count));
+			snapshot_put(w, slots, count * sizeof(SnapshotSlot));
+			free(slots);
+			return !w->failed;
+		}
+		case IS_MAP: {
+			Map* map = O_MVAL(o);
+			SnapshotMap node;
+			SnapshotEntry* entries;
+			SnapshotBucket* buckets;
+			uint32_t i, left = map->size;
+
+			node.count = map->size;
+			node.nbuckets = snapshot_next_power(2 * node.count);
+			entries = malloc((node.count ? node.count : 1) * sizeof(SnapshotEntry));
+			buckets = calloc(node.nbuckets, sizeof(SnapshotBucket));
+			if(entries == NULL || buckets == NULL) {
+				free(entries);
+				free(buckets);
+				return 0;
+			}
+			k = 0;
+			for(i = 0; i < map->capacity && left; i++) {
+				Bucket* b;
+				for(b = map->buckets[i]; b != NULL; b = b->next, left--, k++) {
+					uint64_t at = b->hash & (node.nbuckets - 1);
+					while(buckets[at].entry != 0)
+						at = (at + 1) & (node.nbuckets - 1);
+					buckets[at].hash = b->hash;
+					buckets[at].entry = (uint32_t)(k + 1);
+					entries[k].key = snapshot_write_key(w, b->key, b->hash);
+					if(!snapshot_write(w, b->value, &entries[k].value)) {
+						free(entries);
+						free(buckets);
+						return 0;
+					}
+				}
+			}
+			snapshot_align(w);
+			slot->value = w->offset;
+			snapshot_put(w, &node, sizeof(node));
+			snapshot_put(w, entries, node.count * sizeof(SnapshotEntry));
+			snapshot_put(w, buckets, node.nbuckets * sizeof(SnapshotBucket));
+			free(entries);
+			free(buckets);
+			return !w->failed;
+		}
+		default:
+			fprintf(get_debug_fp(), "%s(): type %d cannot be stored in a snapshot\n", __func__, O_TYPE(o));
+			return 0;
+	}
+}
+
+LIBOBJECT_API int objectSnapshotWrite(Object* o, int fd)
+{
+	BUG_ON_NULL(o);
+	SnapshotWriter* w = malloc(sizeof(SnapshotWriter));
+	SnapshotHeader header;
+	off_t start;
+	int ok;
+
+	if(w == NULL) {
+		fprintf(get_debug_fp(), "%s(): out of memory\n", __func__);
+		return 0;
+	}
+	start = lseek(fd, 0, SEEK_CUR);
+	if(start < 0) {
+		fprintf(get_debug_fp(), "%s(): the file must be seekable\n", __func__);
+		free(w);
+		return 0;
+	}
+
+	memset(&header, 0, sizeof(header));
+	w->fd = fd;
+	w->offset = 0;
+	w->used = 0;
+	w->failed = 0;
+	w->nkeys = 0;
+	memset(w->keys, 0, sizeof(w->keys));
+	/* a placeholder until the root and size are known */
+	snapshot_put(w, &header, sizeof(header));
+
+	ok = snapshot_write(w, o, &header.root);
+	snapshot_align(w);
+	ok = ok && snapshot_flush(w);
+	if(ok) {
+		memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+		header.version = SNAPSHOT_VERSION;
+		header.byte_order = SNAPSHOT_BYTE_ORDER;
+		header.size = w->offset;
+		ok = pwrite(fd, &header, sizeof(header), start) == (ssize_t)sizeof(header);
+	}
+	if(!ok && w->failed)
+		fprintf(get_debug_fp(), "%s(): write failed: %s\n", __func__, strerror(errno));
+
+	free(w);
+	return ok;
+}
+
+/*
+ * Reading. Offsets come from the file, so each one is checked against the
+ * mapping before it is followed
+ */
+
+static const void* snapshot_node(ObjectSnapshot* s, uint64_t offset, uint64_t size)
+{
+	if(offset < sizeof(SnapshotHeader) || (offset & 7) || offset > s->size ||
+		size > s->size - offset)
+		return NULL;
+	return s->base + offset;
+}
+
+static const SnapshotSlot* snapshot_slot(ObjectSnapshot* s, ObjectSnapshotRef ref)
+{
+	if(ref == offsetof(SnapshotHeader, root))
+		return (const SnapshotSlot *)(s->base + ref);
+	return snapshot_node(s, ref, sizeof(SnapshotSlot));
+}
+
+static const SnapshotString* snapshot_string_node(ObjectSnapshot* s, uint64_t offset)
+{
+	const SnapshotString* node = snapshot_node(s, offset, sizeof(SnapshotString));
+	if(node == NULL || node->length >= s->size - offset - sizeof(SnapshotString))
+		return NULL;
+	return node;
+}
+
+static const SnapshotMap* snapshot_map_node(ObjectSnapshot* s, const SnapshotSlot* slot)
+{
+	const SnapshotMap* node;
+
+	if(slot == NULL || slot->type != IS_MAP ||
+		(node = snapshot_node(s, slot->value, sizeof(SnapshotMap))) == NULL)
+		return NULL;
+	if(node->nbuckets == 0 || (node->nbuckets & (node->nbuckets - 1)) ||
+		node->count > node->nbuckets ||
+		node->nbuckets > (s->size - slot->value) / sizeof(SnapshotBucket) ||
+		snapshot_node(s, slot->value, sizeof(SnapshotMap) + node->count * sizeof(SnapshotEntry) +
+			node->nbuckets * sizeof(SnapshotBucket)) == NULL)
+		return NULL;
+	return node;
+}
+
+LIBOBJECT_API ObjectSnapshot* objectSnapshotOpen(const char* path)
+{
+	BUG_ON_NULL(path);
+	ObjectSnapshot* s;
+	const SnapshotHeader* header;
+	struct stat st;
+	void* base;
+	int fd = open(path, O_RDONLY);
+
+	if(fd < 0) {
+		fprintf(get_debug_fp(), "%s(): %s: %s\n", __func__, path, strerror(errno));
+		return NULL;
+	}
+	if(fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(SnapshotHeader)) {
+		fprintf(get_debug_fp(), "%s(): %s is not a snapshot\n", __func__, path);
+		close(fd);
+		return NULL;
+	}
+	/* shared, so every process maps the same page cache copy */
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(base == MAP_FAILED) {
+		fprintf(get_debug_fp(), "%s(): mmap: %s\n", __func__, strerror(errno));
+		return NULL;
+	}
+
+	header = base;
+	if(memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 ||
+		header->version != SNAPSHOT_VERSION || header->byte_order != SNAPSHOT_BYTE_ORDER ||
+		header->size != (uint64_t)st.st_size) {
+		fprintf(get_debug_fp(), "%s(): %s is not a snapshot this build can read\n", __func__, path);
+		munmap(base, st.st_size);
+		return NULL;
+	}
+
+	s = malloc(sizeof(ObjectSnapshot));
+	if(s == NULL) {
+		munmap(base, st.st_size);
+		return NULL;
+	}
+	s->base = base;
+	s->size = st.st_size;
+	return s;
+}
+
+LIBOBJECT_API void objectSnapshotClose(ObjectSnapshot* s)
+{
+	if(s == NULL)
+		return;
+	munmap((void *)s->base, s->size);
+	free(s);
+}
+
+LIBOBJECT_API ObjectSnapshotRef snapshotRoot(ObjectSnapshot* s)
+{
+	BUG_ON_NULL(s);
+	return offsetof(SnapshotHeader, root);
+}
+
+LIBOBJECT_API int snapshotType(ObjectSnapshot* s, ObjectSnapshotRef ref)
+{
+	BUG_ON_NULL(s);
+	const SnapshotSlot* slot = snapshot_slot(s, ref);
+	return slot ? (int)slot->type : -1;
+}
+
+LIBOBJECT_API long snapshotLong(ObjectSnapshot* s, ObjectSnapshotRef ref)
+{
+	BUG_ON_NULL(s);
+	const SnapshotSlot* slot = snapshot_slot(s, ref);
+	double d;
+
+	if(slot == NULL)
+		return 0;
+	switch(slot->type) {
+		case IS_BOOL:
+		case IS_LONG:
+			return (long)slot->value;
+		case IS_DOUBLE:
+			memcpy(&d, &slot->value, sizeof(d));
+			return (long)d;
+		default:
+			return 0;
+	}
+}
+
+LIBOBJECT_API double snapshotDouble(ObjectSnapshot* s, ObjectSnapshotRef ref)
+{
+	BUG_ON_NULL(s);
+	const SnapshotSlot* slot = snapshot_slot(s, ref);
+	double d;
+
+	if(slot == NULL)
+		return 0.0;
+	switch(slot->type) {
+		case IS_BOOL:
+		case IS_LONG:
+			return (double)(long)slot->value;
+		case IS_DOUBLE:
+			memcpy(&d, &slot->value, sizeof(d));
+			return d;
+		default:
+			return 0.0;
+	}
+}
+
+LIBOBJECT_API const char* snapshotString(ObjectSnapshot* s, ObjectSnapshotRef ref, size_t* length)
+{
+	BUG_ON_NULL(s);
+	const SnapshotSlot* slot = snapshot_slot(s, ref);
+	const SnapshotString* node;
+
+	if(slot == NULL || (slot->type != IS_STRING && slot->type != IS_BYTES) ||
+		(node = snapshot_string_node(s, slot->value)) == NULL)
+		return NULL;
+	if(length != NULL)
+		*length = node->length;
+	return (const char *)(node + 1);
+}
+
+LIBOBJECT_API size_t snapshotSize(ObjectSnapshot* s, ObjectSnapshotRef ref)
+{
+	BUG_ON_NULL(s);
+	const SnapshotSlot* slot = snapshot_slot(s, ref);
+	const uint64_t* count;
+
+	if(slot == NULL)
+		return 0;
+	switch(slot->type) {
+		case IS_ARRAY:
+		case IS_MAP:
+			count = snapshot_node(s, slot->value, sizeof(uint64_t));
+			return count ? *count : 0;
+		case IS_PAIR:
+			return 2;
+		default:
+			return 0;
+	}
+}
+
+LIBOBJECT_API ObjectSnapshotRef snapshotArrayGet(ObjectSnapshot* s, ObjectSnapshotRef ref, size_t index)
+{
+	BUG_ON_NULL(s);
+	const SnapshotSlot* slot = snapshot_slot(s, ref);
+	const uint64_t* count;
+
+	if(slot == NULL)
+		return 0;
+	if(slot->type == IS_PAIR)
+		return index < 2 && snapshot_node(s, slot->value, 2 * sizeof(SnapshotSlot)) ?
+			slot->value + index * sizeof(SnapshotSlot) : 0;
+	if(slot->type != IS_ARRAY || (count = snapshot_node(s, slot->value, sizeof(uint64_t))) == NULL ||
+		index >= *count)
+		return 0;
+	return slot->value + sizeof(uint64_t) + index * sizeof(SnapshotSlot);
+}
+
+LIBOBJECT_API ObjectSnapshotRef snapshotMapSearch(ObjectSnapshot* s, ObjectSnapshotRef ref,
+	const char* key, size_t length)
+{
+	BUG_ON_NULL(s);
+	BUG_ON_NULL(key);
+	const SnapshotSlot* slot = snapshot_slot(s, ref);
+	const SnapshotMap* map = snapshot_map_node(s, slot);
+	const SnapshotEntry* entries;
+	const SnapshotBucket* buckets;
+	uint32_t hash;
+	uint64_t at, probes;
+
+	if(map == NULL)
+		return 0;
+	entries = (const SnapshotEntry *)(map + 1);
+	buckets = (const SnapshotBucket *)(entries + map->count);
+	hash = stringHash(key, length);
+
+	at = hash & (map->nbuckets - 1);
+	for(probes = 0; probes < map->nbuckets && buckets[at].entry != 0; probes++) {
+		if(buckets[at].hash == hash && buckets[at].entry <= map->count) {
+			const SnapshotEntry* entry = &entries[buckets[at].entry - 1];
+			const SnapshotString* name = snapshot_string_node(s, entry->key);
+			if(name != NULL && name->length == length && memcmp(name + 1, key, length) == 0)
+				return (const unsigned char *)&entry->value - s->base;
+		}
+		at = (at + 1) & (map->nbuckets - 1);
+	}
+	return 0;
+}
+
+LIBOBJECT_API const char* snapshotMapKey(ObjectSnapshot* s, ObjectSnapshotRef ref, size_t index,
+	size_t* length)
+{
+	BUG_ON_NULL(s);
+	const SnapshotMap* map = snapshot_map_node(s, snapshot_slot(s, ref));
+	const SnapshotString* name;
+
+	if(map == NULL || index >= map->count ||
+		(name = snapshot_string_node(s, ((const SnapshotEntry *)(map + 1))[index].key)) == NULL)
+		return NULL;
+	if(length != NULL)
+		*length = name->length;
+	return (const char *)(name + 1);
+}
+
+LIBOBJECT_API ObjectSnapshotRef snapshotMapValue(ObjectSnapshot* s, ObjectSnapshotRef ref, size_t index)
+{
+	BUG_ON_NULL(s);
+	const SnapshotMap* map = snapshot_map_node(s, snapshot_slot(s, ref));
+
+	if(map == NULL || index >= map->count)
+		return 0;
+	return (const unsigned char *)&((const SnapshotEntry *)(map + 1))[index].value - s->base;
+}
+
+static String* snapshot_copy_string(ObjectSnapshot* s, uint64_t offset, uint32_t* hash)
+{
+	const SnapshotString* node = snapshot_string_node(s, offset);
+	String* string;
+
+	if(node == NULL || (string = newStringInstanceBuffer(node->length)) == NULL)
+		return NULL;
+	memcpy(string->value, node + 1, node->length);
+	string->flags |= node->flags & (STRING_FLAG_UTF8 | STRING_FLAG_ASCII);
+	if(hash != NULL)
+		*hash = node->hash;
+	return string;
+}
+
+/*
+ * copy the value at ref, whose node must start below limit. The writer puts
+ * children before their parent, so requiring that of every node rules out
+ * cycles in a damaged file
+ */
+static Object* snapshot_copy(ObjectSnapshot* s, ObjectSnapshotRef ref, uint64_t limit)
+{
+	const SnapshotSlot* slot = snapshot_slot(s, ref);
+	Object* o = NULL;
+	double d;
+	size_t k, n;
+
+	if(slot == NULL)
+		return NULL;
+	if(slot->type >= IS_STRING && slot->value >= limit)
+		return NULL;
+	switch(slot->type) {
+		case IS_NULL:
+			return newNull();
+		case IS_BOOL:
+			return newBool(slot->value != 0);
+		case IS_LONG:
+			return newLong((long)slot->value);
+		case IS_DOUBLE:
+			memcpy(&d, &slot->value, sizeof(d));
+			return newDouble(d);
+		case IS_STRING:
+		case IS_BYTES: {
+			String* string = snapshot_copy_string(s, slot->value, NULL);
+			if(string == NULL || (o = newObject(slot->type)) == NULL) {
+				if(string != NULL)
+					stringInstanceFree(string);
+				return NULL;
+			}
+			O_SVAL(o) = string;
+			return o;
+		}
+		case IS_PAIR: {
+			Object* first = snapshot_copy(s, snapshotArrayGet(s, ref, 0), slot->value);
+			Object* second = first ? snapshot_copy(s, snapshotArrayGet(s, ref, 1), slot->value) : NULL;
+			/* newPair() stores copies */
+			if(second != NULL)
+				o = newPair(first, second);
+			if(first != NULL)
+				objectSafeDestroy(first, NULL);
+			if(second != NULL)
+				objectSafeDestroy(second, NULL);
+			return o;
+		}
+		case IS_ARRAY:
+			n = snapshotSize(s, ref);
+			if(n > s->size / sizeof(SnapshotSlot) ||
+				snapshot_node(s, slot->value, sizeof(uint64_t) + n * sizeof(SnapshotSlot)) == NULL ||
+				(o = newArray(n ? n : 1)) == NULL)
+				return NULL;
+			for(k = 0; k < n; k++) {
+				Object* value = snapshot_copy(s, snapshotArrayGet(s, ref, k), slot->value);
+				if(value == NULL) {
+					objectSafeDestroy(o, NULL);
+					return NULL;
+				}
+				O_AVAL(o)->table[k] = value;
+				O_AVAL(o)->size = O_AVAL(o)->nextIndex = k + 1;
+			}
+			return o;
+		case IS_MAP: {
+			const SnapshotMap* map = snapshot_map_node(s, slot);
+			const SnapshotEntry* entries;
+			if(map == NULL || map->count > UINT32_MAX / 2)
+				return NULL;
+			entries = (const SnapshotEntry *)(map + 1);
+			o = newMap((uint32_t)(map->count + map->count / 2 + 1));
+			if(o == NULL)
+				return NULL;
+			for(k = 0; k < map->count; k++) {
+				uint32_t hash;
+				String* key = snapshot_copy_string(s, entries[k].key, &hash);
+				Object* value = key ? snapshot_copy(s,
+					(const unsigned char *)&entries[k].value - s->base, slot->value) : NULL;
+				if(value == NULL || !mapInsertString(o, key, hash, value)) {
+					if(key != NULL)
+						stringInstanceFree(key);
+					if(value != NULL)
+						objectSafeDestroy(value, NULL);
+					objectSafeDestroy(o, NULL);
+					return NULL;
+				}
+			}
+			return o;
+		}
+		default:
+			return NULL;
+	}
+}
+
+LIBOBJECT_API Object* snapshotToObject(ObjectSnapshot* s, ObjectSnapshotRef ref)
+{
+	BUG_ON_NULL(s);
+	return snapshot_copy(s, ref, s->size);
+}
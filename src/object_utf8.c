@@ -0,0 +1,414 @@
+/*
+ *  Copyright (c) 2015 Ryan McCullagh <me@ryanmccullagh.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * UTF-8 kernels used by String: validation, code point counting and case
+ * folding. They work on (pointer, length) pairs and never allocate.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "object.h"
+#include "object_simd.h"
+
+static int utf8_validate_scalar(const unsigned char* s, size_t n)
+{
+	size_t i = 0;
+	while(i < n) {
+		unsigned char c = s[i];
+		if(c < 0x80) {
+			i++;
+			continue;
+		}
+		if(c < 0xc2) {
+			return 0;
+		} else if(c < 0xe0) {
+			if(i + 1 >= n || (s[i + 1] & 0xc0) != 0x80)
+				return 0;
+			i += 2;
+		} else if(c < 0xf0) {
+			if(i + 2 >= n || (s[i + 1] & 0xc0) != 0x80 || (s[i + 2] & 0xc0) != 0x80)
+				return 0;
+			if(c == 0xe0 && s[i + 1] < 0xa0)
+				return 0;
+			if(c == 0xed && s[i + 1] > 0x9f)
+				return 0;
+			i += 3;
+		} else if(c < 0xf5) {
+			if(i + 3 >= n || (s[i + 1] & 0xc0) != 0x80 || (s[i + 2] & 0xc0) != 0x80 ||
+				(s[i + 3] & 0xc0) != 0x80)
+				return 0;
+			if(c == 0xf0 && s[i + 1] < 0x90)
+				return 0;
+			if(c == 0xf4 && s[i + 1] > 0x8f)
+				return 0;
+			i += 4;
+		} else {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+#ifdef OBJECT_SIMD_X86
+/*
+ * Keiser and Lemire, "Validating UTF-8 In Less Than One Instruction Per
+ * Byte". Every error is a property of a pair of adjacent bytes, looked up
+ * by the high and low nibble of the first byte and the high nibble of the
+ * second. The three lookups are ANDed so a bit survives only when all
+ * three agree. Runs of continuation bytes are checked against the lead
+ * bytes two and three positions back.
+ */
+#define UTF8_TOO_SHORT		(1 << 0)
+#define UTF8_TOO_LONG		(1 << 1)
+#define UTF8_OVERLONG_3		(1 << 2)
+#define UTF8_TOO_LARGE		(1 << 3)
+#define UTF8_SURROGATE		(1 << 4)
+#define UTF8_OVERLONG_2		(1 << 5)
+#define UTF8_TOO_LARGE_1000	(1 << 6)
+#define UTF8_OVERLONG_4		(1 << 6)
+#define UTF8_TWO_CONTS		(1 << 7)
+#define UTF8_CARRY		(UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+
+OBJECT_TARGET("ssse3")
+static inline __m128i utf8_check_block(__m128i input, __m128i previous)
+{
+	const __m128i nibble = _mm_set1_epi8(0x0f);
+	const __m128i byte_1_high_table = _mm_setr_epi8(
+		UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+		UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+		UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+		UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+		UTF8_TOO_SHORT,
+		UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+		UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4);
+	const __m128i byte_1_low_table = _mm_setr_epi8(
+		UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4,
+		UTF8_CARRY | UTF8_OVERLONG_2,
+		UTF8_CARRY,
+		UTF8_CARRY,
+		UTF8_CARRY | UTF8_TOO_LARGE,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000);
+	const __m128i byte_2_high_table = _mm_setr_epi8(
+		UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+		UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+		(char)(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 |
+			UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4),
+		(char)(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 |
+			UTF8_TOO_LARGE),
+		(char)(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE |
+			UTF8_TOO_LARGE),
+		(char)(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE |
+			UTF8_TOO_LARGE),
+		UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT);
+
+	__m128i prev1 = _mm_alignr_epi8(input, previous, 15);
+	__m128i byte_1_high = _mm_shuffle_epi8(byte_1_high_table,
+		_mm_and_si128(_mm_srli_epi16(prev1, 4), nibble));
+	__m128i byte_1_low = _mm_shuffle_epi8(byte_1_low_table, _mm_and_si128(prev1, nibble));
+	__m128i byte_2_high = _mm_shuffle_epi8(byte_2_high_table,
+		_mm_and_si128(_mm_srli_epi16(input, 4), nibble));
+	__m128i special = _mm_and_si128(_mm_and_si128(byte_1_high, byte_1_low), byte_2_high);
+
+	__m128i prev2 = _mm_alignr_epi8(input, previous, 14);
+	__m128i prev3 = _mm_alignr_epi8(input, previous, 13);
+	__m128i is_third_byte = _mm_subs_epu8(prev2, _mm_set1_epi8((char)(0xe0 - 0x80)));
+	__m128i is_fourth_byte = _mm_subs_epu8(prev3, _mm_set1_epi8((char)(0xf0 - 0x80)));
+	__m128i must23_80 = _mm_and_si128(_mm_or_si128(is_third_byte, is_fourth_byte),
+		_mm_set1_epi8((char)0x80));
+	return _mm_xor_si128(must23_80, special);
+}
+
+/*
+ * non zero where the block ends inside a multi byte sequence
+ */
+static inline __m128i utf8_incomplete(__m128i input)
+{
+	const __m128i max_value = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, (char)(0xf0 - 1), (char)(0xe0 - 1), (char)(0xc0 - 1));
+	return _mm_subs_epu8(input, max_value);
+}
+
+OBJECT_TARGET("ssse3")
+static int utf8_validate_ssse3(const unsigned char* s, size_t n)
+{
+	__m128i error = _mm_setzero_si128();
+	__m128i previous = _mm_setzero_si128();
+	__m128i incomplete = _mm_setzero_si128();
+	size_t i = 0;
+
+	for(; i + 16 <= n; i += 16) {
+		__m128i input = _mm_loadu_si128((const __m128i *)(s + i));
+		if(_mm_movemask_epi8(input) == 0) {
+			error = _mm_or_si128(error, incomplete);
+		} else {
+			error = _mm_or_si128(error, utf8_check_block(input, previous));
+			incomplete = utf8_incomplete(input);
+		}
+		previous = input;
+	}
+	if(i < n) {
+		unsigned char tail[16] = { 0 };
+		memcpy(tail, s + i, n - i);
+		__m128i input = _mm_loadu_si128((const __m128i *)tail);
+		error = _mm_or_si128(error, utf8_check_block(input, previous));
+		incomplete = utf8_incomplete(input);
+	}
+	error = _mm_or_si128(error, incomplete);
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) == 0xffff;
+}
+#endif
+
+/*
+ * return 1 if the n bytes at s are well formed UTF-8 (no overlong forms,
+ * surrogates or code points above U+10FFFF), 0 otherwise
+ */
+LIBOBJECT_API int utf8Validate(const char* s, size_t n)
+{
+	const unsigned char* p = (const unsigned char *)s;
+	size_t i = 0;
+#ifdef OBJECT_SIMD_X86
+	if(n >= 32 && object_cpu_has_ssse3())
+		return utf8_validate_ssse3(p, n);
+	for(; i + 16 <= n; i += 16) {
+		if(_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(p + i))) != 0)
+			break;
+	}
+#endif
+	return utf8_validate_scalar(p + i, n - i);
+}
+
+/*
+ * count the bytes that start a code point, i.e. everything but
+ * continuation bytes. For valid UTF-8 that is the number of code points
+ */
+LIBOBJECT_API size_t utf8CodePointCount(const char* s, size_t n)
+{
+	const unsigned char* p = (const unsigned char *)s;
+	size_t count = 0;
+	size_t i = 0;
+#ifdef OBJECT_SIMD_X86
+	const __m128i threshold = _mm_set1_epi8(-65);
+	for(; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+		/* continuation bytes are 0x80 - 0xbf, i.e. -128 to -65 signed */
+		count += (size_t)__builtin_popcount(_mm_movemask_epi8(_mm_cmpgt_epi8(v, threshold)));
+	}
+#endif
+	for(; i < n; i++) {
+		if((p[i] & 0xc0) != 0x80)
+			count++;
+	}
+	return count;
+}
+
+/*
+ * return the byte offset of the code point that is count code points
+ * after offset, or n if the string ends first
+ */
+LIBOBJECT_API size_t utf8Advance(const char* s, size_t n, size_t offset, size_t count)
+{
+	const unsigned char* p = (const unsigned char *)s;
+	while(offset < n) {
+		if((p[offset] & 0xc0) != 0x80) {
+			if(count == 0)
+				return offset;
+			count--;
+		}
+		offset++;
+	}
+	return n;
+}
+
+static uint32_t utf8_decode(const unsigned char* s, size_t n, size_t* width)
+{
+	unsigned char c = s[0];
+	if(c < 0x80 || n < 2) {
+		*width = 1;
+		return c;
+	}
+	if(c < 0xe0) {
+		*width = 2;
+		return ((uint32_t)(c & 0x1f) << 6) | (s[1] & 0x3f);
+	}
+	if(c < 0xf0 || n < 4) {
+		if(n < 3) {
+			*width = 1;
+			return c;
+		}
+		*width = 3;
+		return ((uint32_t)(c & 0x0f) << 12) | ((uint32_t)(s[1] & 0x3f) << 6) | (s[2] & 0x3f);
+	}
+	*width = 4;
+	return ((uint32_t)(c & 0x07) << 18) | ((uint32_t)(s[1] & 0x3f) << 12) |
+		((uint32_t)(s[2] & 0x3f) << 6) | (s[3] & 0x3f);
+}
+
+static size_t utf8_encode(uint32_t cp, unsigned char* out)
+{
+	if(cp < 0x80) {
+		out[0] = (unsigned char)cp;
+		return 1;
+	}
+	if(cp < 0x800) {
+		out[0] = (unsigned char)(0xc0 | (cp >> 6));
+		out[1] = (unsigned char)(0x80 | (cp & 0x3f));
+		return 2;
+	}
+	if(cp < 0x10000) {
+		out[0] = (unsigned char)(0xe0 | (cp >> 12));
+		out[1] = (unsigned char)(0x80 | ((cp >> 6) & 0x3f));
+		out[2] = (unsigned char)(0x80 | (cp & 0x3f));
+		return 3;
+	}
+	out[0] = (unsigned char)(0xf0 | (cp >> 18));
+	out[1] = (unsigned char)(0x80 | ((cp >> 12) & 0x3f));
+	out[2] = (unsigned char)(0x80 | ((cp >> 6) & 0x3f));
+	out[3] = (unsigned char)(0x80 | (cp & 0x3f));
+	return 4;
+}
+
+/*
+ * Simple case folding (Unicode CaseFolding.txt status C and S) for the
+ * Latin, Greek, Cyrillic and Armenian blocks and the fullwidth forms.
+ * Every mapping here encodes to at most as many bytes as its source.
+ */
+static uint32_t utf8_fold(uint32_t cp)
+{
+	if(cp < 0x80)
+		return (cp >= 'A' && cp <= 'Z') ? cp + 32 : cp;
+	if(cp < 0x100) {
+		if(cp == 0xb5)
+			return 0x3bc;
+		if((cp >= 0xc0 && cp <= 0xde) && cp != 0xd7)
+			return cp + 32;
+		return cp;
+	}
+	if(cp < 0x180) {
+		if(cp == 0x130 || cp == 0x131 || cp == 0x138 || cp == 0x149)
+			return cp;
+		if(cp == 0x178)
+			return 0xff;
+		if(cp == 0x17f)
+			return 's';
+		if((cp >= 0x139 && cp <= 0x148) || (cp >= 0x179 && cp <= 0x17e))
+			return (cp & 1) ? cp + 1 : cp;
+		return (cp & 1) ? cp : cp + 1;
+	}
+	if(cp >= 0x370 && cp < 0x400) {
+		if(cp == 0x386)
+			return 0x3ac;
+		if(cp >= 0x388 && cp <= 0x38a)
+			return cp + 37;
+		if(cp == 0x38c)
+			return 0x3cc;
+		if(cp == 0x38e || cp == 0x38f)
+			return cp + 63;
+		if(cp >= 0x391 && cp <= 0x3ab && cp != 0x3a2)
+			return cp + 32;
+		if(cp == 0x3c2)
+			return 0x3c3;
+		return cp;
+	}
+	if(cp >= 0x400 && cp < 0x530) {
+		if(cp < 0x410)
+			return cp + 80;
+		if(cp < 0x430)
+			return cp + 32;
+		if((cp >= 0x460 && cp <= 0x481) || (cp >= 0x48a && cp <= 0x4bf) ||
+			(cp >= 0x4d0 && cp <= 0x52f))
+			return (cp & 1) ? cp : cp + 1;
+		if(cp == 0x4c0)
+			return 0x4cf;
+		if(cp >= 0x4c1 && cp <= 0x4ce)
+			return (cp & 1) ? cp + 1 : cp;
+		return cp;
+	}
+	if(cp >= 0x531 && cp <= 0x556)
+		return cp + 48;
+	if(cp >= 0x1e00 && cp <= 0x1e95)
+		return (cp & 1) ? cp : cp + 1;
+	if(cp >= 0x1ea0 && cp <= 0x1eff)
+		return (cp & 1) ? cp : cp + 1;
+	if(cp >= 0xff21 && cp <= 0xff3a)
+		return cp + 32;
+	return cp;
+}
+
+/*
+ * write the case folded form of the n bytes at s to out, which must hold n
+ * bytes. Folding never lengthens the input, invalid sequences are copied
+ * through unchanged. return the number of bytes written
+ */
+LIBOBJECT_API size_t utf8CaseFold(const char* s, size_t n, char* out)
+{
+	const unsigned char* p = (const unsigned char *)s;
+	unsigned char* o = (unsigned char *)out;
+	size_t i = 0;
+	size_t w = 0;
+
+	while(i < n) {
+#ifdef OBJECT_SIMD_X86
+		/* fold runs of ASCII 16 bytes at a time */
+		while(i + 16 <= n) {
+			__m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+			if(_mm_movemask_epi8(v) != 0)
+				break;
+			__m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)),
+				_mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1)));
+			v = _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+			_mm_storeu_si128((__m128i *)(o + w), v);
+			i += 16;
+			w += 16;
+		}
+		if(i >= n)
+			break;
+#endif
+		if(p[i] < 0x80) {
+			o[w++] = (p[i] >= 'A' && p[i] <= 'Z') ? p[i] + 32 : p[i];
+			i++;
+			continue;
+		}
+		size_t width;
+		uint32_t cp = utf8_decode(p + i, n - i, &width);
+		if(width == 1 || !utf8_validate_scalar(p + i, width)) {
+			o[w++] = p[i++];
+			continue;
+		}
+		if(cp == 0xdf || cp == 0x1e9e) {
+			/* sharp s folds to "ss" */
+			o[w++] = 's';
+			o[w++] = 's';
+		} else {
+			w += utf8_encode(utf8_fold(cp), o + w);
+		}
+		i += width;
+	}
+	return w;
+}
@@ -0,0 +1,201 @@
+/*
+ * ObjectCell against a rwlock and a mutex guarding objectRetain(), for
+ * readers of a root that a writer keeps replacing.
+ *
+ *   cellBench [readers] [publications]
+ *
+ * First the cost of an empty read section on one thread, then readers
+ * doing lookups in a 10000 entry Map while the writer publishes a new one
+ * every 10 ms. Not part of make check.
+ */
+
+#include <stdio.h>
+#include <object.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#define MAX_READERS 64
+#define ENTRIES 10000
+#define EMPTY_SECTIONS 20000000L
+
+enum { USE_CELL, USE_RWLOCK, USE_RETAIN };
+
+static const char* names[] = { "cell", "rwlock", "mutex+retain" };
+
+static ObjectCell* cell;
+static Object* root;
+static pthread_rwlock_t rwlock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static int mode;
+static volatile int stop;
+
+/* one cache line each */
+static struct {
+	long	lookups;
+	char	pad[64 - sizeof(long)];
+} counts[MAX_READERS];
+
+static double now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static Object* table(long version)
+{
+	Object* map = newMap(2 * ENTRIES);
+	char key[32];
+	long i;
+
+	for(i = 0; i < ENTRIES; i++) {
+		snprintf(key, sizeof(key), "10.0.%ld.%ld", i / 256, i % 256);
+		mapInsertEx(map, key, newLong(version + i));
+	}
+	return map;
+}
+
+static void* reader(void* arg)
+{
+	long id = (long)arg, n = 0, i;
+	char key[32];
+	Object* o;
+
+	while(!stop) {
+		i = n++ % ENTRIES;
+		snprintf(key, sizeof(key), "10.0.%ld.%ld", i / 256, i % 256);
+		switch(mode) {
+			case USE_CELL:
+				o = cellAcquire(cell);
+				mapSearchEx(o, key);
+				cellRelease(cell);
+			break;
+			case USE_RWLOCK:
+				pthread_rwlock_rdlock(&rwlock);
+				mapSearchEx(root, key);
+				pthread_rwlock_unlock(&rwlock);
+			break;
+			default:
+				pthread_mutex_lock(&mutex);
+				o = objectRetain(root);
+				pthread_mutex_unlock(&mutex);
+				mapSearchEx(o, key);
+				objectDestroy(o);
+			break;
+		}
+	}
+	counts[id].lookups = n;
+	return NULL;
+}
+
+static void publish(Object* next)
+{
+	Object* old;
+
+	switch(mode) {
+		case USE_CELL:
+			cellPublish(cell, next);
+		break;
+		case USE_RWLOCK:
+			objectFreeze(next);
+			pthread_rwlock_wrlock(&rwlock);
+			old = root;
+			root = next;
+			pthread_rwlock_unlock(&rwlock);
+			objectDestroy(old);
+		break;
+		default:
+			objectFreeze(next);
+			pthread_mutex_lock(&mutex);
+			old = root;
+			root = next;
+			pthread_mutex_unlock(&mutex);
+			objectDestroy(old);
+		break;
+	}
+}
+
+static void contended(long readers, long publications)
+{
+	struct timespec pause = { 0, 10000000 };
+	pthread_t threads[MAX_READERS];
+	long i, total = 0;
+	double t;
+
+	if(mode == USE_CELL)
+		cell = newObjectCell(table(0));
+	else
+		root = objectFreeze(table(0));
+	stop = 0;
+
+	t = now();
+	for(i = 0; i < readers; i++)
+		pthread_create(&threads[i], NULL, reader, (void*)i);
+	for(i = 1; i <= publications; i++) {
+		publish(table(i));
+		nanosleep(&pause, NULL);
+	}
+	stop = 1;
+	for(i = 0; i < readers; i++) {
+		pthread_join(threads[i], NULL);
+		total += counts[i].lookups;
+	}
+	t = now() - t;
+
+	printf("%-14s %2ld readers: %6.2f M lookups/s\n", names[mode], readers, total / t / 1e6);
+	if(mode == USE_CELL)
+		cellFree(cell);
+	else
+		objectDestroy(root);
+}
+
+static void uncontended(void)
+{
+	ObjectCell* empty = newObjectCell(newMap(4));
+	Object* frozen = objectFreeze(newMap(4));
+	Object* volatile sink;
+	double t[4];
+	long i;
+
+	t[0] = now();
+	for(i = 0; i < EMPTY_SECTIONS; i++) {
+		sink = cellAcquire(empty);
+		cellRelease(empty);
+	}
+	t[1] = now();
+	for(i = 0; i < EMPTY_SECTIONS; i++) {
+		pthread_rwlock_rdlock(&rwlock);
+		sink = frozen;
+		pthread_rwlock_unlock(&rwlock);
+	}
+	t[2] = now();
+	for(i = 0; i < EMPTY_SECTIONS; i++) {
+		pthread_mutex_lock(&mutex);
+		sink = objectRetain(frozen);
+		pthread_mutex_unlock(&mutex);
+		objectDestroy(sink);
+	}
+	t[3] = now();
+	(void)sink;
+
+	for(i = 0; i < 3; i++)
+		printf("%-14s empty section: %5.1f ns\n", names[i], (t[i + 1] - t[i]) / EMPTY_SECTIONS * 1e9);
+	cellFree(empty);
+	objectDestroy(frozen);
+}
+
+int main(int argc, char** argv)
+{
+	long readers = argc > 1 ? atol(argv[1]) : 8;
+	long publications = argc > 2 ? atol(argv[2]) : 100;
+
+	if(readers < 1 || readers > MAX_READERS) {
+		fprintf(stderr, "readers must be 1 to %d\n", MAX_READERS);
+		return 1;
+	}
+	uncontended();
+	for(mode = USE_CELL; mode <= USE_RETAIN; mode++)
+		contended(readers, publications);
+	return 0;
+}
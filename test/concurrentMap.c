@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <object.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "test_common.h"
+
+#define THREADS 4
+#define KEYS 5000
+
+static ObjectConcurrentMap* shared;
+
+static void test_concurrentMap(void)
+{
+	ObjectConcurrentMap* map = newConcurrentMap(1);
+	Object* value;
+	char key[32];
+	long i;
+
+	expect(concurrentMapSize(map) == 0);
+	expect(concurrentMapSearch(map, "missing") == NULL);
+	expect(concurrentMapInsert(map, "a", newLong(1)));
+	expect(concurrentMapInsert(map, "b", newString("two")));
+
+	value = concurrentMapSearch(map, "a");
+	expect(O_LVAL(value) == 1 && objectIsFrozen(value));
+
+	/* replacing leaves the old value with whoever still holds it */
+	expect(concurrentMapInsert(map, "a", newLong(3)));
+	expect(concurrentMapSize(map) == 2);
+	expect(O_LVAL(value) == 1);
+	objectDestroy(value);
+	value = concurrentMapSearch(map, "a");
+	expect(O_LVAL(value) == 3);
+	objectDestroy(value);
+
+	expect(concurrentMapDelete(map, "b"));
+	expect(!concurrentMapDelete(map, "b"));
+	expect(concurrentMapSearch(map, "b") == NULL);
+	expect(concurrentMapSize(map) == 1);
+
+	/* growing keeps every member */
+	for(i = 0; i < 10000; i++) {
+		snprintf(key, sizeof(key), "key%ld", i);
+		expect(concurrentMapInsert(map, key, newLong(i)));
+	}
+	expect(concurrentMapSize(map) == 10001);
+	for(i = 0; i < 10000; i += 7) {
+		snprintf(key, sizeof(key), "key%ld", i);
+		value = concurrentMapSearch(map, key);
+		expect(value != NULL && O_LVAL(value) == i);
+		objectDestroy(value);
+	}
+
+	Object* copy = concurrentMapToMap(map);
+	expect(mapSize(copy) == 10001);
+	expect(O_LVAL(mapSearchEx(copy, "key9999")) == 9999);
+	objectDestroy(copy);
+	concurrentMapFree(map);
+}
+
+/*
+ * each thread owns the keys i with i % THREADS == id and churns them while
+ * reading everyone's
+ */
+static void* worker(void* arg)
+{
+	long id = (long)arg, ok = 1, i, round;
+	char key[32];
+
+	for(round = 0; round < 3; round++) {
+		for(i = id; i < KEYS; i += THREADS) {
+			snprintf(key, sizeof(key), "k%ld", i);
+			ok &= concurrentMapInsert(shared, key, newLong(i * 10 + round));
+			if(i % 3 == 0)
+				ok &= concurrentMapDelete(shared, key);
+		}
+		for(i = 0; i < KEYS; i++) {
+			snprintf(key, sizeof(key), "k%ld", i);
+			Object* value = concurrentMapSearch(shared, key);
+			if(value != NULL) {
+				ok &= O_LVAL(value) / 10 == i;
+				objectDestroy(value);
+			}
+		}
+	}
+	return (void*)ok;
+}
+
+static void test_concurrentMapThreads(void)
+{
+	pthread_t threads[THREADS];
+	void* ok;
+	char key[32];
+	long i, present = 0;
+
+	shared = newConcurrentMap(1);
+	for(i = 0; i < THREADS; i++)
+		pthread_create(&threads[i], NULL, worker, (void*)i);
+	for(i = 0; i < THREADS; i++) {
+		pthread_join(threads[i], &ok);
+		expect(ok != NULL);
+	}
+	for(i = 0; i < KEYS; i++) {
+		snprintf(key, sizeof(key), "k%ld", i);
+		Object* value = concurrentMapSearch(shared, key);
+		if(i % 3 == 0) {
+			expect(value == NULL);
+		} else {
+			expect(value != NULL && O_LVAL(value) == i * 10 + 2);
+			present++;
+		}
+		objectDestroy(value);
+	}
+	expect(concurrentMapSize(shared) == present);
+	concurrentMapFree(shared);
+}
+
+int main(void)
+{
+	test_concurrentMap();
+	test_concurrentMapThreads();
+	return 0;
+}
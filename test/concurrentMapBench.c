@@ -0,0 +1,120 @@
+/*
+ * ObjectConcurrentMap against a Map behind a rwlock, under a mix of
+ * searches and inserts over 100000 keys, half of them present at the start.
+ *
+ *   concurrentMapBench [threads] [write percent] [ops per thread]
+ *
+ * Runs with 1, 2, 4 and so on up to threads threads. Not part of make
+ * check.
+ */
+
+#include <stdio.h>
+#include <object.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#define MAX_THREADS 64
+#define KEYS 100000
+
+static ObjectConcurrentMap* cmap;
+static Object* map;
+static pthread_rwlock_t rwlock = PTHREAD_RWLOCK_INITIALIZER;
+static int use_rwlock;
+static int writes;
+static long ops;
+static char keys[KEYS][16];
+
+static double now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void* worker(void* arg)
+{
+	unsigned int seed = (unsigned int)(long)arg * 2654435761u + 1;
+	long i;
+
+	for(i = 0; i < ops; i++) {
+		seed = seed * 1103515245 + 12345;
+		const char* key = keys[(seed >> 8) % KEYS];
+		int write = (long)((seed >> 4) % 100) < writes;
+
+		if(!use_rwlock) {
+			if(write)
+				concurrentMapInsert(cmap, key, newLong(i));
+			else
+				objectDestroy(concurrentMapSearch(cmap, key));
+		} else if(write) {
+			pthread_rwlock_wrlock(&rwlock);
+			Object* value = mapSearchEx(map, key);
+			if(value != NULL)
+				O_LVAL(value) = i;
+			else
+				mapInsertEx(map, key, newLong(i));
+			pthread_rwlock_unlock(&rwlock);
+		} else {
+			pthread_rwlock_rdlock(&rwlock);
+			mapSearchEx(map, key);
+			pthread_rwlock_unlock(&rwlock);
+		}
+	}
+	return NULL;
+}
+
+static double run(long nthreads)
+{
+	pthread_t threads[MAX_THREADS];
+	long i;
+	double t;
+
+	cmap = newConcurrentMap(1);
+	map = newMap(1);
+	for(i = 0; i < KEYS; i += 2) {
+		concurrentMapInsert(cmap, keys[i], newLong(i));
+		mapInsertEx(map, keys[i], newLong(i));
+	}
+
+	t = now();
+	for(i = 0; i < nthreads; i++)
+		pthread_create(&threads[i], NULL, worker, (void*)i);
+	for(i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+	t = now() - t;
+
+	concurrentMapFree(cmap);
+	objectDestroy(map);
+	return nthreads * ops / t / 1e6;
+}
+
+int main(int argc, char** argv)
+{
+	long nthreads = argc > 1 ? atol(argv[1]) : 16;
+	long n, i;
+
+	writes = argc > 2 ? atoi(argv[2]) : 5;
+	ops = argc > 3 ? atol(argv[3]) : 400000;
+	if(nthreads < 1 || nthreads > MAX_THREADS || writes < 0 || writes > 100 || ops < 1) {
+		fprintf(stderr, "usage: %s [threads 1-%d] [write percent] [ops per thread]\n",
+			argv[0], MAX_THREADS);
+		return 1;
+	}
+	for(i = 0; i < KEYS; i++)
+		snprintf(keys[i], sizeof(keys[i]), "k%ld", i);
+
+	printf("%d%% writes, %ld ops per thread, M ops/s\n", writes, ops);
+	printf("threads  concurrent  rwlock Map\n");
+	for(n = 1; ; n = n * 2 < nthreads ? n * 2 : nthreads) {
+		double concurrent, locked;
+		use_rwlock = 0;
+		concurrent = run(n);
+		use_rwlock = 1;
+		locked = run(n);
+		printf("%7ld  %10.2f  %10.2f\n", n, concurrent, locked);
+		if(n == nthreads)
+			break;
+	}
+	return 0;
+}
@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <object.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test_common.h"
+
+#define DEPTH 200000
+#define WIDE 20000
+
+static Object* json(const char* text)
+{
+	return objectFromJson(text, strlen(text), 0, NULL);
+}
+
+static void test_copyObject(void)
+{
+	Object* a = json("{\"a\": 1, \"b\": [true, null, \"x\", 2.5], \"c\": {\"d\": {}}}");
+	Object* seven = newLong(7);
+	Object* pair = newPair(a, seven);
+	Object* copy;
+	char* text;
+	char* copied;
+
+	copy = copyObject(a);
+	expect(copy != a && objectDeepEquals(a, copy));
+	/* members come out in the same order */
+	text = objectToJson(a, 0, NULL);
+	copied = objectToJson(copy, 0, NULL);
+	expect(str_equal(text, copied));
+	free(text);
+	free(copied);
+	objectDestroy(copy);
+
+	copy = copyObject(pair);
+	expect(objectDeepEquals(O_PVAL(copy)->first, a));
+	expect(O_LVAL(O_PVAL(copy)->second) == 7);
+	objectDestroy(copy);
+	objectDestroy(seven);
+	objectDestroy(pair);
+	objectDestroy(a);
+}
+
+/*
+ * far deeper than a recursive walk would survive
+ */
+static void test_copyObjectDeep(void)
+{
+	Object* root = newLong(42);
+	Object* copy;
+	Object* o;
+	long i;
+
+	for(i = 0; i < DEPTH; i++) {
+		Object* outer = i % 2 ? newArray(1) : newMap(2);
+		if(i % 2)
+			arrayPushEx(outer, root);
+		else
+			mapInsertEx(outer, "next", root);
+		root = outer;
+	}
+
+	copy = copyObject(root);
+	expect(copy != NULL);
+	for(o = copy, i = 0; i < DEPTH; i++)
+		o = O_TYPE(o) == IS_ARRAY ? arrayGetEx(o, 0) : mapSearchEx(o, "next");
+	expect(O_TYPE(o) == IS_LONG && O_LVAL(o) == 42);
+
+	objectDestroy(copy);
+	objectDestroy(root);
+}
+
+/*
+ * wide enough for the pool to take the children
+ */
+static void test_copyObjectWide(void)
+{
+	Object* root = newArray(WIDE);
+	Object* map = newMap(WIDE);
+	Object* copy;
+	char key[32];
+	long i;
+
+	for(i = 0; i < WIDE; i++) {
+		Object* item = newMap(4);
+		snprintf(key, sizeof(key), "k%ld", i);
+		mapInsertEx(item, "id", newLong(i));
+		mapInsertEx(item, "name", newString(key));
+		arrayPushEx(root, item);
+		mapInsertEx(map, key, newLong(i));
+	}
+	arrayPushEx(root, map);
+
+	copy = copyObject(root);
+	expect(arraySize(copy) == WIDE + 1);
+	expect(objectDeepEquals(root, copy));
+	expect(mapSize(arrayGetEx(copy, WIDE)) == WIDE);
+	expect(O_LVAL(mapSearchEx(arrayGetEx(copy, WIDE), "k12345")) == 12345);
+	objectDestroy(copy);
+
+	/* shared subtrees are let go of once, whichever thread gets there last */
+	objectFreeze(map);
+	copy = newArray(WIDE);
+	for(i = 0; i < WIDE; i++)
+		arrayPushEx(copy, objectRetain(map));
+	objectDestroy(copy);
+	expect(O_REFCNT(map) == 1);
+	objectDestroy(root);
+}
+
+int main(void)
+{
+	test_copyObject();
+	test_copyObjectDeep();
+	test_copyObjectWide();
+	return 0;
+}
@@ -0,0 +1,299 @@
+#include <stdio.h>
+#include <object.h>
+#include <stdlib.h>
+
+#include "test_common.h"
+
+/*
+ * hands the text to the reader step bytes at a time, each chunk in its own
+ * allocation so reads past the current one are caught
+ */
+typedef struct Feeder {
+	const char*	text;
+	size_t		length;
+	size_t		at;
+	size_t		step;
+	char*		chunk;
+} Feeder;
+
+static void feeder_init(Feeder* f, const char* text, size_t step)
+{
+	f->text = text;
+	f->length = strlen(text);
+	f->at = 0;
+	f->step = step ? step : f->length;
+	f->chunk = NULL;
+}
+
+static void feed(ObjectJsonReader* r, Feeder* f)
+{
+	size_t n = f->length - f->at < f->step ? f->length - f->at : f->step;
+
+	free(f->chunk);
+	f->chunk = NULL;
+	if(n == 0) {
+		jsonReaderFinish(r);
+		return;
+	}
+	f->chunk = malloc(n);
+	memcpy(f->chunk, f->text + f->at, n);
+	expect(jsonReaderFeed(r, f->chunk, n));
+	f->at += n;
+}
+
+static ObjectJsonEvent next(ObjectJsonReader* r, Feeder* f)
+{
+	ObjectJsonEvent event;
+	while((event = jsonReaderNext(r)) == OBJECT_JSON_NEED_MORE)
+		feed(r, f);
+	return event;
+}
+
+static Object* value(ObjectJsonReader* r, Feeder* f)
+{
+	Object* o;
+	while(jsonReaderValue(r, &o) == OBJECT_JSON_NEED_MORE)
+		feed(r, f);
+	return o;
+}
+
+static void skip(ObjectJsonReader* r, Feeder* f)
+{
+	ObjectJsonEvent event;
+	while((event = jsonReaderSkip(r)) == OBJECT_JSON_NEED_MORE)
+		feed(r, f);
+	expect(event == OBJECT_JSON_VALUE);
+}
+
+/*
+ * every event in one string: brackets as themselves, k<key>; for keys,
+ * s<text>; for strings, v for other values, E at the end and ! on error
+ */
+static char* trace(const char* text, size_t step, unsigned int flags)
+{
+	ObjectJsonReader* r = newJsonReader(flags);
+	char* out = malloc(4096);
+	size_t n = 0;
+	const char* s;
+	size_t length;
+	ObjectJsonEvent event;
+	Feeder f;
+
+	feeder_init(&f, text, step);
+	do {
+		event = next(r, &f);
+		switch(event) {
+			case OBJECT_JSON_START_MAP: out[n++] = '{'; break;
+			case OBJECT_JSON_END_MAP: out[n++] = '}'; break;
+			case OBJECT_JSON_START_ARRAY: out[n++] = '['; break;
+			case OBJECT_JSON_END_ARRAY: out[n++] = ']'; break;
+			case OBJECT_JSON_KEY:
+			case OBJECT_JSON_VALUE:
+				s = jsonReaderString(r, &length);
+				if(s == NULL) {
+					out[n++] = 'v';
+					break;
+				}
+				out[n++] = event == OBJECT_JSON_KEY ? 'k' : 's';
+				memcpy(out + n, s, length);
+				n += length;
+				out[n++] = ';';
+				break;
+			case OBJECT_JSON_END: out[n++] = 'E'; break;
+			default: out[n++] = '!'; break;
+		}
+	} while(event != OBJECT_JSON_END && event != OBJECT_JSON_ERROR);
+	out[n] = '\0';
+
+	free(f.chunk);
+	jsonReaderFree(r);
+	return out;
+}
+
+static const char document[] =
+	"{\"name\": \"caf\\u00e9 \\\"x\\\"\", \"tags\": [\"a\", \"\xc3\xa9\", []],\n"
+	" \"n\": -12.5e3, \"ok\": true, \"none\": null, \"big\": 123456789012345678901,\n"
+	" \"nested\": {\"k\": [{}, {\"\": 0}], \"s\": \"\\ud83d\\ude00\"}}";
+
+static void test_jsonReaderEvents(void)
+{
+	static const char expected[] =
+		"{kname;scaf\xc3\xa9 \"x\";ktags;[sa;s\xc3\xa9;[]]kn;vkok;vknone;vkbig;v"
+		"knested;{kk;[{}{k;v}]ks;s\xf0\x9f\x98\x80;}}E";
+	size_t step;
+
+	for(step = 0; step <= sizeof(document); step++) {
+		char* events = trace(document, step, 0);
+		expect(str_equal(events, expected));
+		free(events);
+	}
+}
+
+static void test_jsonReaderValue(void)
+{
+	Object* whole = objectFromJson(document, strlen(document), 0, NULL);
+	char* json = objectToJson(whole, 0, NULL);
+	size_t step;
+
+	for(step = 0; step <= sizeof(document); step++) {
+		ObjectJsonReader* r = newJsonReader(0);
+		Feeder f;
+
+		feeder_init(&f, document, step);
+		expect(next(r, &f) == OBJECT_JSON_START_MAP);
+		Object* o = value(r, &f);
+		expect(o != NULL);
+		char* text = objectToJson(o, 0, NULL);
+		expect(str_equal(text, json));
+		expect(next(r, &f) == OBJECT_JSON_END);
+
+		free(text);
+		objectDestroy(o);
+		free(f.chunk);
+		jsonReaderFree(r);
+	}
+
+	free(json);
+	objectDestroy(whole);
+}
+
+/*
+ * read one member, skip the others without building them
+ */
+static void test_jsonReaderFilter(void)
+{
+	static const char text[] =
+		"{\"skip\": {\"deep\": [1, 2, {\"x\": \"]}\\\"\"}]}, \"keep\": [1, \"a\\\"b\"],"
+		" \"n\": 5, \"s\": \"}\", \"after\": {}}";
+	size_t step;
+
+	for(step = 0; step <= sizeof(text); step++) {
+		ObjectJsonReader* r = newJsonReader(0);
+		Object* kept = NULL;
+		const char* key;
+		size_t length;
+		Feeder f;
+
+		feeder_init(&f, text, step);
+		expect(next(r, &f) == OBJECT_JSON_START_MAP);
+		while(next(r, &f) == OBJECT_JSON_KEY) {
+			/* the text is not NUL terminated */
+			key = jsonReaderString(r, &length);
+			if(length == 4 && memcmp(key, "keep", 4) == 0)
+				kept = value(r, &f);
+			else
+				skip(r, &f);
+			expect(jsonReaderDepth(r) == 1);
+		}
+		expect(jsonReaderDepth(r) == 0);
+		expect(next(r, &f) == OBJECT_JSON_END);
+
+		expect(kept != NULL);
+		char* json = objectToJson(kept, 0, NULL);
+		expect(str_equal(json, "[1,\"a\\\"b\"]"));
+		free(json);
+		objectDestroy(kept);
+		free(f.chunk);
+		jsonReaderFree(r);
+	}
+}
+
+static void test_jsonReaderSkipContainer(void)
+{
+	ObjectJsonReader* r = newJsonReader(0);
+	Object* o;
+	Feeder f;
+
+	feeder_init(&f, "[[1, [2]], {\"a\": [3]}, 4]", 3);
+	expect(next(r, &f) == OBJECT_JSON_START_ARRAY);
+	expect(next(r, &f) == OBJECT_JSON_START_ARRAY);
+	skip(r, &f);
+	expect(next(r, &f) == OBJECT_JSON_START_MAP);
+	expect(next(r, &f) == OBJECT_JSON_KEY);
+	expect(next(r, &f) == OBJECT_JSON_START_ARRAY);
+	/* leaving a value half read finishes it */
+	expect(jsonReaderValue(r, &o) == OBJECT_JSON_NEED_MORE);
+	expect(next(r, &f) == OBJECT_JSON_END_MAP);
+	expect(next(r, &f) == OBJECT_JSON_VALUE);
+	expect(next(r, &f) == OBJECT_JSON_END_ARRAY);
+	expect(next(r, &f) == OBJECT_JSON_END);
+
+	free(f.chunk);
+	jsonReaderFree(r);
+}
+
+static void expect_error(const char* text, size_t step, const char* message, size_t line, size_t column)
+{
+	ObjectJsonReader* r = newJsonReader(0);
+	ObjectJsonError err;
+	Feeder f;
+
+	feeder_init(&f, text, step);
+	while(next(r, &f) != OBJECT_JSON_ERROR)
+		;
+	expect(jsonReaderError(r, &err));
+	expect(str_equal(err.message, message));
+	expect(err.line == line);
+	expect(err.column == column);
+
+	free(f.chunk);
+	jsonReaderFree(r);
+}
+
+static void test_jsonReaderErrors(void)
+{
+	size_t step;
+
+	for(step = 0; step < 4; step++) {
+		expect_error("{\"a\": 1,\n  \"b\" 2}", step, "expected ':'", 2, 7);
+		expect_error("[1, 2", step, "unexpected end of input", 1, 6);
+		expect_error("[\"abc", step, "unterminated string", 1, 2);
+		expect_error("[tru]", step, "invalid literal", 1, 2);
+		expect_error("[1.]", step, "invalid number", 1, 2);
+		expect_error("[\"\\q\"]", step, "invalid escape", 1, 3);
+		expect_error("{\"a\": 1]", step, "expected ',' or '}'", 1, 8);
+		expect_error("[1,]", step, "expected a value", 1, 4);
+		expect_error("{1: 2}", step, "expected a string key", 1, 2);
+		expect_error("1 2", step, "unexpected data after the document", 1, 3);
+		expect_error(" ", step, "empty document", 1, 2);
+	}
+
+	ObjectJsonReader* r = newJsonReader(0);
+	expect(!jsonReaderError(r, NULL));
+	expect(jsonReaderFeed(r, "[1]", 3));
+	expect(!jsonReaderFeed(r, "[2]", 3));
+	expect(jsonReaderNext(r) == OBJECT_JSON_START_ARRAY);
+	expect(jsonReaderNext(r) == OBJECT_JSON_VALUE);
+	expect(jsonReaderNext(r) == OBJECT_JSON_END_ARRAY);
+	expect(jsonReaderNext(r) == OBJECT_JSON_NEED_MORE);
+	jsonReaderFinish(r);
+	expect(jsonReaderNext(r) == OBJECT_JSON_END);
+	jsonReaderFree(r);
+}
+
+static void test_jsonReaderMultiple(void)
+{
+	static const char text[] = "{\"a\": 1}\n[2]\n\"three\"\n4\n";
+	size_t step;
+
+	for(step = 0; step <= sizeof(text); step++) {
+		char* events = trace(text, step, OBJECT_JSON_MULTIPLE);
+		expect(str_equal(events, "{ka;v}[v]sthree;vE"));
+		free(events);
+	}
+
+	char* events = trace("", 0, OBJECT_JSON_MULTIPLE);
+	expect(str_equal(events, "E"));
+	free(events);
+}
+
+int main(void)
+{
+	test_jsonReaderEvents();
+	test_jsonReaderValue();
+	test_jsonReaderFilter();
+	test_jsonReaderSkipContainer();
+	test_jsonReaderErrors();
+	test_jsonReaderMultiple();
+	return 0;
+}
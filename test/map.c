@@ -19,8 +19,33 @@ static void test_map(void)
 
 }
 
+static void test_mapDelete(void)
+{
+	Object* map = newMap(2);
+	char key[16];
+	size_t i;
+
+	/* a small table keeps many keys per chain */
+	for(i = 0; i < 64; i++) {
+		snprintf(key, sizeof(key), "k%zu", i);
+		mapInsertEx(map, key, newLong(i));
+	}
+	for(i = 0; i < 64; i += 2) {
+		snprintf(key, sizeof(key), "k%zu", i);
+		mapDelete(map, key);
+	}
+	expect(mapSize(map) == 32);
+	for(i = 0; i < 64; i++) {
+		snprintf(key, sizeof(key), "k%zu", i);
+		Object* value = mapSearchEx(map, key);
+		expect(i % 2 ? value != NULL && O_LVAL(value) == (long)i : value == NULL);
+	}
+	objectDestroy(map);
+}
+
 int main(void)
 {
 
 	test_map();
+	test_mapDelete();
 }
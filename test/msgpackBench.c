@@ -0,0 +1,180 @@
+/*
+ * MessagePack against JSON, encoding and decoding the same tree.
+ *
+ *   msgpackBench [numbers|strings|FILE.json] [records] [runs]
+ *
+ * numbers and strings generate an array of records of that kind, a file
+ * is read as JSON instead. Each step is timed runs times and the best run
+ * is printed. Not part of make check.
+ */
+
+#include <stdio.h>
+#include <object.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static unsigned long seed = 12345;
+
+static unsigned long next_random(void)
+{
+	seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+	return seed >> 33;
+}
+
+static double uniform(void)
+{
+	return (double)next_random() / (double)(1UL << 31);
+}
+
+static double now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/*
+ * {"x": 134.36, "y": 819850095, "z": [0.80, 0.06, 0.11, 0.76]}
+ */
+static Object* number_record(long i)
+{
+	Object* record = newMap(4);
+	Object* z = newArray(4);
+	int k;
+	(void)i;
+
+	mapInsertEx(record, "x", newDouble(uniform() * 1000));
+	mapInsertEx(record, "y", newLong((long)next_random() - (1L << 30)));
+	for(k = 0; k < 4; k++)
+		arrayPushEx(z, newDouble(uniform()));
+	mapInsertEx(record, "z", z);
+	return record;
+}
+
+/*
+ * {"id": 0, "name": "user0", "score": 23.79, "tags": ["a", "bb", "ccc"],
+ *  "active": true, "bio": "lorem ipsum ..."}
+ */
+static Object* string_record(long i)
+{
+	Object* record = newMap(8);
+	Object* tags = newArray(3);
+	char name[32];
+
+	snprintf(name, sizeof(name), "user%ld", i);
+	mapInsertEx(record, "id", newLong(i));
+	mapInsertEx(record, "name", newString(name));
+	mapInsertEx(record, "score", newDouble(uniform() * 100));
+	arrayPushEx(tags, newString("a"));
+	arrayPushEx(tags, newString("bb"));
+	arrayPushEx(tags, newString("ccc"));
+	mapInsertEx(record, "tags", tags);
+	mapInsertEx(record, "active", newBool(i % 2 == 0));
+	mapInsertEx(record, "bio", newString("lorem ipsum dolor sit amet lorem ipsum dolor sit amet "
+		"lorem ipsum dolor sit amet "));
+	return record;
+}
+
+static Object* generate(Object* (*record)(long), long n)
+{
+	Object* array = newArray(n);
+	long i;
+
+	for(i = 0; i < n; i++)
+		arrayPushEx(array, record(i));
+	return array;
+}
+
+static Object* load(const char* path)
+{
+	FILE* fp = fopen(path, "rb");
+	ObjectJsonError err;
+	Object* doc;
+	char* text;
+	long n;
+
+	if(fp == NULL) {
+		perror(path);
+		return NULL;
+	}
+	fseek(fp, 0, SEEK_END);
+	n = ftell(fp);
+	rewind(fp);
+	text = malloc(n ? n : 1);
+	if(text == NULL || fread(text, 1, n, fp) != (size_t)n) {
+		fprintf(stderr, "%s: read failed\n", path);
+		fclose(fp);
+		free(text);
+		return NULL;
+	}
+	fclose(fp);
+	doc = objectFromJson(text, n, 0, &err);
+	if(doc == NULL)
+		fprintf(stderr, "%s:%zu:%zu: %s\n", path, err.line, err.column, err.message);
+	free(text);
+	return doc;
+}
+
+int main(int argc, char** argv)
+{
+	const char* input = argc > 1 ? argv[1] : "numbers";
+	long records = argc > 2 ? atol(argv[2]) : 300000;
+	int runs = argc > 3 ? atoi(argv[3]) : 5;
+	double best[4] = { 1e9, 1e9, 1e9, 1e9 };
+	size_t json_length = 0, msgpack_length = 0;
+	Object* doc;
+	double t;
+	int run;
+
+	if(strcmp(input, "numbers") == 0)
+		doc = generate(number_record, records);
+	else if(strcmp(input, "strings") == 0)
+		doc = generate(string_record, records);
+	else
+		doc = load(input);
+	if(doc == NULL)
+		return 1;
+
+	for(run = 0; run < runs; run++) {
+		Object* back;
+		char* json;
+		char* msgpack;
+
+		t = now();
+		json = objectToJson(doc, 0, &json_length);
+		t = now() - t;
+		best[0] = t < best[0] ? t : best[0];
+
+		t = now();
+		back = objectFromJson(json, json_length, 0, NULL);
+		t = now() - t;
+		best[1] = t < best[1] ? t : best[1];
+		objectDestroy(back);
+
+		t = now();
+		msgpack = objectToMsgpack(doc, &msgpack_length);
+		t = now() - t;
+		best[2] = t < best[2] ? t : best[2];
+
+		t = now();
+		back = objectFromMsgpack(msgpack, msgpack_length, NULL);
+		t = now() - t;
+		best[3] = t < best[3] ? t : best[3];
+		if(back == NULL) {
+			fprintf(stderr, "objectFromMsgpack() failed\n");
+			return 1;
+		}
+		objectDestroy(back);
+
+		free(json);
+		free(msgpack);
+	}
+
+	printf("json    %10zu bytes: encode %7.1f ms, decode %7.1f ms\n",
+		json_length, best[0] * 1e3, best[1] * 1e3);
+	printf("msgpack %10zu bytes: encode %7.1f ms, decode %7.1f ms\n",
+		msgpack_length, best[2] * 1e3, best[3] * 1e3);
+	objectDestroy(doc);
+	return 0;
+}
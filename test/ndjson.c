@@ -0,0 +1,210 @@
+#include <stdio.h>
+#include <object.h>
+#include <stdlib.h>
+
+#include "test_common.h"
+
+typedef struct Records {
+	size_t		count;
+	size_t		stop;		/* stop after this many, 0 for never */
+	long		sum;
+	int		ordered;
+} Records;
+
+/*
+ * the records are {"i": n} with n counting up from 0
+ */
+static int check_record(void* context, Object* record, size_t index)
+{
+	Records* r = context;
+	Object* i = mapSearchEx(record, "i");
+
+	if(i == NULL || O_LVAL(i) != (long)index)
+		r->ordered = 0;
+	r->sum += i ? O_LVAL(i) : 0;
+	r->count++;
+	objectDestroy(record);
+	return r->stop == 0 || r->count < r->stop;
+}
+
+/*
+ * n records, more than one piece's worth once n is large
+ */
+static char* records_text(size_t n, size_t* length)
+{
+	char* text = malloc(n * 24 + 1);
+	size_t at = 0, i;
+
+	for(i = 0; i < n; i++)
+		at += sprintf(text + at, i % 7 == 3 ? "{\"i\": %zu}\r\n\n" : "{\"i\":%zu}\n", i);
+	*length = at;
+	return text;
+}
+
+static void test_ndjsonReadBuffer(void)
+{
+	static const char text[] = "{\"i\": 0}\n\n  \n{\"i\": 1}\r\n{\"i\": 2}";
+	Records r = {0, 0, 0, 1};
+	ObjectJsonError err;
+
+	expect(ndjsonReadBuffer(text, strlen(text), 0, check_record, &r, &err));
+	expect(r.count == 3 && r.ordered);
+
+	r.count = 0;
+	expect(ndjsonReadBuffer("", 0, 0, check_record, &r, &err));
+	expect(r.count == 0);
+
+	size_t length, n = 200000;
+	char* big = records_text(n, &length);
+	r.count = 0;
+	r.sum = 0;
+	expect(ndjsonReadBuffer(big, length, 0, check_record, &r, &err));
+	expect(r.count == n && r.ordered);
+	expect(r.sum == (long)(n * (n - 1) / 2));
+
+	/* stopping early */
+	r.count = 0;
+	r.stop = 1000;
+	expect(ndjsonReadBuffer(big, length, 0, check_record, &r, &err));
+	expect(r.count == 1000 && r.ordered);
+	free(big);
+}
+
+static void test_ndjsonReadErrors(void)
+{
+	Records r = {0, 0, 0, 1};
+	ObjectJsonError err;
+
+	expect(!ndjsonReadBuffer("{\"i\": 0}\n\n{\"i\": 1,}\n{\"i\": 2}\n", 29, 0, check_record, &r, &err));
+	expect(r.count == 1);
+	expect(err.line == 3);
+	expect(err.column == 9);
+	expect(err.offset == 18);
+	expect(str_equal(err.message, "expected a string key"));
+
+	/* deep into a large input, past several pieces */
+	size_t length, n = 200000;
+	char* big = records_text(n, &length);
+	char* bad = strstr(big, "{\"i\":150000}");
+	bad[1] = 'x';
+
+	r.count = 0;
+	expect(!ndjsonReadBuffer(big, length, 0, check_record, &r, &err));
+	expect(r.count == 150000 && r.ordered);
+	expect(err.offset == (size_t)(bad + 1 - big));
+	/* one line each, and a blank line after each i % 7 == 3 */
+	expect(err.line == 150000 + (150000 + 3) / 7 + 1);
+	expect(err.column == 2);
+	free(big);
+
+	expect(newArrayFromNdjson("1\n2\n[\n", 6, 0, &err) == NULL);
+	expect(err.line == 3);
+}
+
+static void test_newArrayFromNdjson(void)
+{
+	static const char text[] = "1\n\"two\"\n[3]\n{\"four\": 4}\n";
+	Object* array = newArrayFromNdjson(text, strlen(text), 0, NULL);
+	expect(array != NULL);
+	expect(arraySize(array) == 4);
+	char* json = objectToJson(array, 0, NULL);
+	expect(str_equal(json, "[1,\"two\",[3],{\"four\":4}]"));
+	free(json);
+	objectDestroy(array);
+}
+
+static void test_ndjsonReadFile(void)
+{
+	Records r = {0, 0, 0, 1};
+	ObjectJsonError err;
+	size_t length, n = 200000;
+	char* big = records_text(n, &length);
+	FILE* fp = tmpfile();
+
+	expect(fp != NULL);
+	/* a line longer than a piece */
+	char* string = malloc(3 << 20);
+	memset(string, 'a', 3 << 20);
+	fputs("{\"i\": 0, \"long\": \"", fp);
+	fwrite(string, 1, 3 << 20, fp);
+	fputs("\"}\n", fp);
+	free(string);
+	fwrite(strchr(big, '\n') + 1, 1, length - (strchr(big, '\n') + 1 - big), fp);
+	rewind(fp);
+
+	expect(ndjsonReadFile(fp, 0, check_record, &r, &err));
+	expect(r.count == n && r.ordered);
+	fclose(fp);
+	free(big);
+}
+
+typedef struct Output {
+	char*		text;
+	size_t		length;
+	size_t		capacity;
+} Output;
+
+static int append(void* context, const char* data, size_t length)
+{
+	Output* o = context;
+	while(o->length + length > o->capacity) {
+		o->capacity = o->capacity ? 2 * o->capacity : 4096;
+		o->text = realloc(o->text, o->capacity);
+	}
+	memcpy(o->text + o->length, data, length);
+	o->length += length;
+	return 1;
+}
+
+static void test_ndjsonWrite(void)
+{
+	Object* array = newArray(16);
+	Output out = {NULL, 0, 0};
+	Output expected = {NULL, 0, 0};
+	size_t i;
+
+	for(i = 0; i < 100000; i++) {
+		Object* map = newMap(4);
+		mapInsertEx(map, "i", newLong(i));
+		mapInsertEx(map, "s", newString("x\ny"));
+		arrayPushEx(array, map);
+	}
+	for(i = 0; i < 100000; i++) {
+		expect(objectToJsonCallback(O_AVAL(array)->table[i], 0, append, &expected));
+		append(&expected, "\n", 1);
+	}
+
+	expect(ndjsonWrite(array, OBJECT_JSON_PRETTY, append, &out));
+	expect(out.length == expected.length);
+	expect(memcmp(out.text, expected.text, out.length) == 0);
+
+	/* and back */
+	Records r = {0, 0, 0, 1};
+	expect(ndjsonReadBuffer(out.text, out.length, 0, check_record, &r, NULL));
+	expect(r.count == 100000 && r.ordered);
+
+	/* JSON has no functions */
+	arrayPushEx(array, newFunction((void *)test_ndjsonWrite));
+	out.length = 0;
+	expect(!ndjsonWrite(array, 0, append, &out));
+
+	out.length = 0;
+	Object* empty = newArray(1);
+	expect(ndjsonWrite(empty, 0, append, &out));
+	expect(out.length == 0);
+
+	objectDestroy(empty);
+	objectDestroy(array);
+	free(out.text);
+	free(expected.text);
+}
+
+int main(void)
+{
+	test_ndjsonReadBuffer();
+	test_ndjsonReadErrors();
+	test_newArrayFromNdjson();
+	test_ndjsonReadFile();
+	test_ndjsonWrite();
+	return 0;
+}
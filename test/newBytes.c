@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <object.h>
+#include <stdlib.h>
+
+#include "test_common.h"
+
+static void test_newBytes(void)
+{
+	const char payload[] = { 'a', '\0', 'b', '\0' };
+
+	Object* value = newBytes(payload, sizeof(payload));
+	Object* copy = copyObject(value);
+
+	expect(O_TYPE(copy) == IS_BYTES);
+	expect(bytesLength(copy) == 4);
+	expect(memcmp(O_BYVAL(copy)->value, payload, 4) == 0);
+	expect(objectValueCompare(value, copy));
+
+	Object* shorter = newBytes(payload, 3);
+	expect(!objectValueCompare(value, shorter));
+	expect(objectValueIsLessThan(shorter, value));
+
+	Object* array = newArray(2);
+	arrayPush(array, value);
+	size_t length = 0;
+	char* json = objectToJson(array, 0, &length);
+	expect(str_equal(json, "[\"YQBiAA==\"]"));
+	free(json);
+
+	objectDestroy(array);
+	objectDestroy(shorter);
+	objectDestroy(copy);
+	objectDestroy(value);
+}
+
+static void test_base64(void)
+{
+	const char* vectors[][2] = {
+		{ "", "" }, { "f", "Zg==" }, { "fo", "Zm8=" }, { "foo", "Zm9v" },
+		{ "foob", "Zm9vYg==" }, { "fooba", "Zm9vYmE=" }, { "foobar", "Zm9vYmFy" }
+	};
+	size_t i;
+	for(i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+		Object* bytes = newBytes(vectors[i][0], strlen(vectors[i][0]));
+		Object* encoded = bytesToBase64(bytes);
+		expect(str_equal(O_SVAL(encoded)->value, vectors[i][1]));
+		Object* decoded = newBytesFromBase64(O_SVAL(encoded)->value, O_SVAL(encoded)->length);
+		expect(objectValueCompare(bytes, decoded));
+		objectDestroy(decoded);
+		objectDestroy(encoded);
+		objectDestroy(bytes);
+	}
+
+	expect(newBytesFromBase64("Zm9v!", 5) == NULL);
+	expect(newBytesFromBase64("Z", 1) == NULL);
+	expect(newBytesFromBase64("Zg=", 3) == NULL);
+
+	/* long enough inputs go through the vector paths */
+	unsigned char data[1000];
+	char text[1400];
+	unsigned char back[1000];
+	size_t n;
+	srand(7);
+	for(i = 0; i < sizeof(data); i++)
+		data[i] = (unsigned char)rand();
+	for(n = 0; n <= sizeof(data); n += 37) {
+		size_t length = base64Encode(data, n, text);
+		size_t decoded = 0;
+		expect(length == base64EncodedLength(n));
+		expect(base64Decode(text, length, back, &decoded));
+		expect(decoded == n);
+		expect(memcmp(back, data, n) == 0);
+	}
+	n = base64Encode(data, 300, text);
+	text[200] = '*';
+	expect(!base64Decode(text, n, back, &n));
+}
+
+static void test_hex(void)
+{
+	unsigned char data[256];
+	char text[512];
+	unsigned char back[256];
+	size_t i;
+	for(i = 0; i < sizeof(data); i++)
+		data[i] = (unsigned char)i;
+
+	expect(hexEncode(data, sizeof(data), text) == 512);
+	expect(memcmp(text, "000102", 6) == 0);
+	expect(memcmp(text + 500, "fafbfcfdfeff", 12) == 0);
+
+	size_t decoded = 0;
+	expect(hexDecode(text, 512, back, &decoded));
+	expect(decoded == 256);
+	expect(memcmp(back, data, 256) == 0);
+
+	Object* upper = newBytesFromHex("DEADbeef", 8);
+	Object* hex = bytesToHex(upper);
+	expect(str_equal(O_SVAL(hex)->value, "deadbeef"));
+	objectDestroy(hex);
+	objectDestroy(upper);
+
+	text[100] = 'g';
+	expect(!hexDecode(text, 512, back, &decoded));
+	expect(newBytesFromHex("abc", 3) == NULL);
+}
+
+int main(void)
+{
+
+	test_newBytes();
+	test_base64();
+	test_hex();
+}
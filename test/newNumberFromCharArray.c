@@ -9,9 +9,15 @@ static void test_newNumberFromCharArray(void)
 
 	Object* value = newNumberFromCharArray("777");
 
-	expect((O_DVAL(value)) == 777);
+	expect(O_TYPE(value) == IS_LONG);
+	expect((O_LVAL(value)) == 777);
 	
 	objectDestroy(value);
+
+	value = newNumberFromCharArray(" 7.5");
+	expect(O_TYPE(value) == IS_DOUBLE);
+	expect((O_DVAL(value)) == 7.5);
+	objectDestroy(value);
 }
 
 int main(void)
@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <object.h>
+#include <stdlib.h>
+
+#include "test_common.h"
+
+static int released = 0;
+
+static void release(void* context, const char* value, size_t length)
+{
+	expect(context == &released);
+	expect(length == 4);
+	expect(memcmp(value, "Ryan", 4) == 0);
+	released++;
+}
+
+static void test_newStringExternal(void)
+{
+	/* the external bytes are not NUL terminated */
+	const char buffer[] = { 'R', 'y', 'a', 'n', 'X' };
+
+	Object* value = newStringExternal(buffer, 4, release, &released);
+	Object* owned = newString("Ryan");
+
+	expect(O_SVAL(value)->length == 4);
+	expect(O_SVAL(value)->value == buffer);
+	expect(objectValueCompare(value, owned));
+
+	Object* copy = copyObject(value);
+	expect(O_SVAL(copy)->value != buffer);
+	expect(str_equal(O_SVAL(copy)->value, "Ryan"));
+
+	Object* map = newMap(2);
+	mapInsert(map, "name", value);
+	size_t length = 0;
+	char* json = objectToJson(map, 0, &length);
+	expect(str_equal(json, "{\"name\":\"Ryan\"}"));
+	free(json);
+
+	objectDestroy(map);
+	objectDestroy(copy);
+	objectDestroy(owned);
+	expect(released == 0);
+	objectDestroy(value);
+	expect(released == 1);
+}
+
+static void test_newStringStatic(void)
+{
+	Object* value = newStringStatic("libobject", 3);
+	Object* copy = copyObject(value);
+
+	expect(O_SVAL(copy)->length == 3);
+	expect(memcmp(O_SVAL(copy)->value, "lib", 3) == 0);
+
+	objectDestroy(copy);
+	objectDestroy(value);
+}
+
+int main(void)
+{
+
+	test_newStringExternal();
+	test_newStringStatic();
+}
@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <object.h>
+#include <stdlib.h>
+
+#include "test_common.h"
+
+static void test_newStringUtf8Checked(void)
+{
+	const char* valid = "caf\xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80";
+	const char* invalid[] = {
+		"\xc0\xaf",		/* overlong */
+		"\xed\xa0\x80",		/* surrogate */
+		"\xf4\x90\x80\x80",	/* above U+10FFFF */
+		"abc\xe2\x82",		/* truncated */
+		"\x80",			/* stray continuation */
+	};
+	size_t i;
+
+	Object* value = newStringUtf8Checked(valid, strlen(valid));
+	expect(value != NULL);
+	expect(O_SVAL(value)->flags & STRING_FLAG_UTF8);
+	expect(stringCodePointLength(value) == 8);
+	objectDestroy(value);
+
+	for(i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+		expect(newStringUtf8Checked(invalid[i], strlen(invalid[i])) == NULL);
+		expect(!utf8Validate(invalid[i], strlen(invalid[i])));
+	}
+
+	/* trusted callers skip validation */
+	value = newStringEx(invalid[0], 2, 0);
+	expect(value != NULL);
+	expect(!stringIsValidUtf8(value));
+	objectDestroy(value);
+
+	/* long inputs take the vector path, errors at every position */
+	char buffer[200];
+	for(i = 0; i < sizeof(buffer); i += 2) {
+		buffer[i] = '\xc3';
+		buffer[i + 1] = '\xa9';
+	}
+	expect(utf8Validate(buffer, sizeof(buffer)));
+	for(i = 0; i < sizeof(buffer); i++) {
+		char saved = buffer[i];
+		buffer[i] = '\xff';
+		expect(!utf8Validate(buffer, sizeof(buffer)));
+		buffer[i] = saved;
+	}
+	expect(!utf8Validate(buffer, sizeof(buffer) - 1));
+}
+
+static void test_stringCodePointSubstr(void)
+{
+	/* long enough to build the sparse index */
+	char buffer[3 * 500];
+	size_t i;
+	for(i = 0; i < 500; i++)
+		memcpy(buffer + 3 * i, i % 2 ? "\xe2\x82\xac" : "abc", 3);
+
+	Object* value = newStringFromSequence(buffer, sizeof(buffer));
+	/* every "abc" plus euro sign pair is 4 code points */
+	expect(stringCodePointLength(value) == 1000);
+
+	Object* sub = stringCodePointSubstr(value, 401, 4);
+	expect(O_SVAL(sub)->length == 6);
+	expect(memcmp(O_SVAL(sub)->value, "bc\xe2\x82\xac" "a", 6) == 0);
+	expect(O_SVAL(value)->index != NULL);
+	objectDestroy(sub);
+
+	sub = stringCodePointSubstr(value, 998, 10);
+	expect(stringCodePointLength(sub) == 2);
+	objectDestroy(sub);
+
+	expect(stringCodePointSubstr(value, 1001, 1) == NULL);
+	objectDestroy(value);
+}
+
+static void test_stringCaseFold(void)
+{
+	Object* value = newString("Hello WORLD, \xc3\x84pfel \xce\xa3\xce\xb9\xcf\x82 \xd0\x9f\xd1\x80\xd0\xb8 Stra\xc3\x9f" "e ABCDEFGHIJKLMNOPQRSTUVWXYZ");
+	Object* folded = stringCaseFold(value);
+
+	expect(str_equal(O_SVAL(folded)->value, "hello world, \xc3\xa4pfel \xcf\x83\xce\xb9\xcf\x83 \xd0\xbf\xd1\x80\xd0\xb8 strasse abcdefghijklmnopqrstuvwxyz"));
+
+	objectDestroy(folded);
+	objectDestroy(value);
+}
+
+int main(void)
+{
+
+	test_newStringUtf8Checked();
+	test_stringCodePointSubstr();
+	test_stringCaseFold();
+}
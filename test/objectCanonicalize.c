@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <object.h>
+#include <stdlib.h>
+
+#include "test_common.h"
+
+static const char doc[] =
+	"[{\"name\": \"a\", \"address\": {\"city\": \"X\", \"zip\": \"1\"}, \"tags\": [\"t\", \"u\"]},"
+	" {\"name\": \"b\", \"address\": {\"zip\": \"1\", \"city\": \"X\"}, \"tags\": [\"t\", \"u\"]},"
+	" {\"name\": \"a\", \"address\": {\"city\": \"Y\", \"zip\": \"1\"}, \"tags\": [\"u\", \"t\"]},"
+	" -0.0, 0.0, 0.0, true, true, null]";
+
+static Object* element(Object* o, size_t i, const char* key)
+{
+	Object* value = arrayGetEx(o, i);
+	return key ? mapSearchEx(value, key) : value;
+}
+
+static void check(Object* o)
+{
+	Object* expected = objectFromJson(doc, strlen(doc), 0, NULL);
+
+	/* the same value as before, with repeats shared */
+	expect(objectDeepEquals(o, expected));
+	expect(element(o, 0, "address") == element(o, 1, "address"));
+	expect(element(o, 0, "tags") == element(o, 1, "tags"));
+	expect(element(o, 0, "name") == element(o, 2, "name"));
+	expect(element(o, 0, "address") != element(o, 2, "address"));
+	expect(element(o, 0, "tags") != element(o, 2, "tags"));
+	expect(mapSearchEx(element(o, 0, "address"), "zip") == mapSearchEx(element(o, 2, "address"), "zip"));
+	expect(element(o, 3, NULL) != element(o, 4, NULL));
+	expect(element(o, 4, NULL) == element(o, 5, NULL));
+	expect(element(o, 6, NULL) == element(o, 7, NULL));
+	objectDestroy(expected);
+}
+
+static void test_objectCanonicalize(void)
+{
+	ObjectCanonTable* table = objectCanonTableNew();
+	ObjectCanonStats stats;
+	Object* o = objectCanonicalize(objectFromJson(doc, strlen(doc), 0, NULL), table);
+
+	check(o);
+
+	objectCanonTableStats(table, &stats);
+	expect(stats.shared > 0 && stats.bytes_saved > 0);
+	expect(stats.objects + stats.shared == stats.lookups);
+
+	/* a second document shares with the first, even after the table goes */
+	Object* again = objectCanonicalize(objectFromJson(doc, strlen(doc), 0, NULL), table);
+	expect(again == o);
+	objectDestroy(again);
+	objectCanonTableFree(table);
+	check(o);
+
+	/* shared nodes survive being dropped by one of their holders */
+	Object* address = objectRetain(element(o, 0, "address"));
+	objectDestroy(o);
+	expect(str_equal(O_SVAL(mapSearchEx(address, "city"))->value, "X"));
+	objectDestroy(address);
+}
+
+static void test_objectFromJsonCanonical(void)
+{
+	ObjectCanonTable* table = objectCanonTableNew();
+	ObjectCanonStats stats;
+	ObjectJsonError error;
+	Object* o = objectFromJsonCanonical(doc, strlen(doc), OBJECT_JSON_LAZY, table, NULL);
+	size_t i;
+
+	check(o);
+	objectCanonTableStats(table, &stats);
+	expect(stats.shared > 0);
+
+	/* repeated records come out as one instance */
+	Object* records = newArray(1);
+	for(i = 0; i < 1000; i++) {
+		const char* text = "{\"kind\": \"event\", \"tags\": [\"a\", \"b\"], \"at\": {\"x\": 1, \"y\": 2}}";
+		arrayPushEx(records, objectFromJsonCanonical(text, strlen(text), 0, table, NULL));
+	}
+	expect(arrayGetEx(records, 0) == arrayGetEx(records, 999));
+	objectCanonTableStats(table, &stats);
+	expect(stats.bytes_saved > 999 * sizeof(Object));
+
+	expect(objectFromJsonCanonical("[1, [2, 3", 9, 0, table, &error) == NULL);
+	expect(error.offset == 9);
+
+	objectCanonTableFree(table);
+	objectDestroy(records);
+	objectDestroy(o);
+}
+
+int main(void)
+{
+	test_objectCanonicalize();
+	test_objectFromJsonCanonical();
+	return 0;
+}
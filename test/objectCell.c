@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <object.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "test_common.h"
+
+#define READERS 4
+#define VERSIONS 500
+
+static Object* routes(long version)
+{
+	Object* o = newMap(8);
+	Object* hops = newArray(4);
+	long i;
+
+	for(i = 0; i < 4; i++)
+		arrayPushEx(hops, newLong(version * 10 + i));
+	mapInsertEx(o, "version", newLong(version));
+	mapInsertEx(o, "hops", hops);
+	return o;
+}
+
+static ObjectCell* cell;
+static volatile int done;
+
+static void* reader(void* arg)
+{
+	long last = 0, ok = 1;
+	(void)arg;
+
+	while(!__atomic_load_n(&done, __ATOMIC_ACQUIRE)) {
+		Object* o = cellAcquire(cell);
+		long version = O_LVAL(mapSearchEx(o, "version"));
+		Object* hops = mapSearchEx(o, "hops");
+		/* a root never changes under a reader, and never goes back */
+		ok &= version >= last;
+		ok &= O_LVAL(arrayGetEx(hops, 3)) == version * 10 + 3;
+		ok &= objectIsFrozen(o);
+		last = version;
+		cellRelease(cell);
+	}
+	return (void*)ok;
+}
+
+static void test_objectCell(void)
+{
+	ObjectCell* c = newObjectCell(routes(1));
+	Object* first;
+	Object* kept;
+
+	first = cellAcquire(c);
+	expect(O_LVAL(mapSearchEx(first, "version")) == 1);
+	expect(objectIsFrozen(first));
+	expect(mapInsertEx(first, "x", NULL) == 0);
+
+	/* the old root stays usable for the section that read it */
+	kept = objectRetain(first);
+	expect(cellPublish(c, routes(2)));
+	expect(cellAcquire(c) != first);
+	expect(O_LVAL(mapSearchEx(cellAcquire(c), "version")) == 2);
+	cellRelease(c);
+	cellRelease(c);
+	expect(O_LVAL(arrayGetEx(mapSearchEx(first, "hops"), 0)) == 10);
+	cellRelease(c);
+
+	/* then the cell lets go of it, and only the retained reference is left */
+	cellSynchronize(c);
+	expect(O_REFCNT(kept) == 1);
+	objectDestroy(kept);
+
+	/* publishing the current root again leaves it in place */
+	first = cellAcquire(c);
+	cellRelease(c);
+	expect(cellPublish(c, first));
+	cellSynchronize(c);
+	expect(cellAcquire(c) == first && O_REFCNT(first) == 1);
+	expect(O_LVAL(mapSearchEx(first, "version")) == 2);
+	cellRelease(c);
+
+	expect(cellPublish(c, routes(3)));
+	cellFree(c);
+}
+
+static void test_objectCellThreads(void)
+{
+	pthread_t threads[READERS];
+	void* ok;
+	long i;
+
+	cell = newObjectCell(routes(1));
+	for(i = 0; i < READERS; i++)
+		pthread_create(&threads[i], NULL, reader, NULL);
+	for(i = 2; i <= VERSIONS; i++)
+		expect(cellPublish(cell, routes(i)));
+	cellSynchronize(cell);
+	__atomic_store_n(&done, 1, __ATOMIC_RELEASE);
+	for(i = 0; i < READERS; i++) {
+		pthread_join(threads[i], &ok);
+		expect(ok != NULL);
+	}
+	expect(O_LVAL(mapSearchEx(cellAcquire(cell), "version")) == VERSIONS);
+	cellRelease(cell);
+	cellFree(cell);
+}
+
+int main(void)
+{
+	test_objectCell();
+	test_objectCellThreads();
+	return 0;
+}
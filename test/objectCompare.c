@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <object.h>
+#include <stdlib.h>
+#include <limits.h>
+
+#include "test_common.h"
+
+static Object* json(const char* text)
+{
+	return objectFromJson(text, strlen(text), 0, NULL);
+}
+
+static int sign(int n)
+{
+	return n < 0 ? -1 : n > 0;
+}
+
+static void test_objectCompare(void)
+{
+	/* in ascending order */
+	Object* values[] = {
+		newNull(),
+		newBool(0),
+		newBool(1),
+		newDouble(-1.0 / 0.0),
+		newLong(LONG_MIN),
+		newDouble(-1.5),
+		newLong(-1),
+		newDouble(-0.5),
+		newLong(0),
+		newDouble(0.5),
+		newLong(1),
+		newDouble(1.0),
+		newLong(9007199254740993L),
+		newDouble(9007199254740994.0),
+		newLong(LONG_MAX),
+		newDouble(1e19),
+		newDouble(0.0 / 0.0),
+		newString(""),
+		newStringFromSequence("a\0b", 3),
+		newStringFromSequence("a\0c", 3),
+		newString("ab"),
+		newBytes("", 0),
+		newBytes("\x00", 1),
+		json("[]"),
+		json("[1]"),
+		json("[1, 2]"),
+		json("[2]"),
+		json("{}"),
+		json("{\"a\": 1}"),
+		json("{\"a\": 1, \"b\": 0}"),
+		json("{\"a\": 2}"),
+		json("{\"b\": 0}"),
+		newFunction((void *)test_objectCompare),
+	};
+	size_t n = sizeof(values) / sizeof(values[0]), i, j;
+
+	for(i = 0; i < n; i++) {
+		for(j = 0; j < n; j++) {
+			int expected = i < j ? -1 : i > j;
+			expect(sign(objectCompare(values[i], values[j])) == expected);
+		}
+	}
+
+	/* maps compare by sorted keys, whatever their insertion order */
+	Object* a = json("{\"x\": [1, {\"y\": null}], \"b\": true, \"m\": \"s\"}");
+	Object* b = json("{\"m\": \"s\", \"x\": [1, {\"y\": null}], \"b\": true}");
+	expect(objectCompare(a, b) == 0 && objectDeepEquals(a, b));
+	objectDestroy(b);
+	b = json("{\"m\": \"s\", \"x\": [1, {\"y\": false}], \"b\": true}");
+	expect(objectCompare(a, b) < 0 && objectCompare(b, a) > 0);
+	objectDestroy(a);
+	objectDestroy(b);
+
+	/* large maps sort their entries on the heap */
+	a = newMap(8);
+	b = newMap(64);
+	for(i = 0; i < 40; i++) {
+		char key[8];
+		snprintf(key, sizeof(key), "k%zu", i);
+		mapInsertEx(a, key, newLong(i));
+		snprintf(key, sizeof(key), "k%zu", 39 - i);
+		mapInsertEx(b, key, newLong(39 - i));
+	}
+	expect(objectCompare(a, b) == 0);
+	mapInsertEx(b, "k99", newLong(99));
+	expect(objectCompare(a, b) < 0);
+	objectDestroy(a);
+	objectDestroy(b);
+
+	for(i = 0; i < n; i++)
+		objectDestroy(values[i]);
+}
+
+static void test_arraySort(void)
+{
+	Object* array = json("[3, \"b\", null, [2], 1.5, {\"a\": 1}, \"a\", -2, true, [1, 9], 1]");
+	char* text;
+	size_t i;
+
+	arraySort(array);
+	text = objectToJson(array, 0, NULL);
+	expect(str_equal(text, "[null,true,-2,1,1.5,3,\"a\",\"b\",[1,9],[2],{\"a\":1}]"));
+	free(text);
+
+	for(i = 1; i < arraySize(array); i++)
+		expect(objectCompare(arrayGetEx(array, i - 1), arrayGetEx(array, i)) < 0);
+
+	Object* key = newLong(1);
+	expect(arrayLowerBound(array, key) == 3);
+	objectDestroy(key);
+	key = newDouble(1.0);
+	expect(arrayLowerBound(array, key) == 4);
+	objectDestroy(key);
+	key = newString("c");
+	expect(arrayLowerBound(array, key) == 8);
+	objectDestroy(key);
+	key = newPointer(NULL);
+	expect(arrayLowerBound(array, key) == arraySize(array));
+	objectDestroy(key);
+	key = newNull();
+	expect(arrayLowerBound(array, key) == 0);
+	objectDestroy(key);
+	objectDestroy(array);
+}
+
+int main(void)
+{
+	test_objectCompare();
+	test_arraySort();
+	return 0;
+}
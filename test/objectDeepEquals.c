@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <object.h>
+#include <stdlib.h>
+
+#include "test_common.h"
+
+static Object* json(const char* text, int flags)
+{
+	return objectFromJson(text, strlen(text), flags, NULL);
+}
+
+static int same(Object* a, Object* b)
+{
+	return objectDeepEquals(a, b) && objectDeepEquals(b, a) && objectHash(a) == objectHash(b);
+}
+
+static void test_objectDeepEquals(void)
+{
+	Object* a = json("{\"a\": 1, \"b\": [true, null, \"x\", 2.5], \"c\": {\"d\": {}}}", 0);
+	Object* b = newMap(64);
+	Object* list = newArray(1);
+	Object* copy;
+	size_t i;
+
+	/* the same entries inserted in another order into another capacity */
+	mapInsertEx(b, "c", json("{\"d\": {}}", 0));
+	arrayPushEx(list, newBool(5));
+	arrayPushEx(list, newNull());
+	arrayPushEx(list, newString("x"));
+	arrayPushEx(list, newDouble(2.5));
+	mapInsertEx(b, "b", list);
+	mapInsertEx(b, "a", newLong(1));
+	expect(same(a, b));
+
+	copy = copyObject(a);
+	expect(same(a, copy));
+	objectDestroy(copy);
+
+	/* any change to a leaf is seen */
+	O_DVAL(arrayGetEx(list, 3)) = 2.25;
+	expect(!objectDeepEquals(a, b) && objectHash(a) != objectHash(b));
+	O_DVAL(arrayGetEx(list, 3)) = 2.5;
+	mapInsertEx(b, "e", newNull());
+	expect(!objectDeepEquals(a, b) && !objectDeepEquals(b, a));
+	mapDelete(b, "e");
+	expect(same(a, b));
+	arrayPushEx(list, newNull());
+	expect(!objectDeepEquals(a, b));
+
+	/* a lazy document equals a full parse */
+	copy = json("{\"c\": {\"d\": {}}, \"b\": [true, null, \"x\", 2.5], \"a\": 1}", OBJECT_JSON_LAZY);
+	expect(same(a, copy));
+	objectDestroy(copy);
+
+	/* keys in a different order hash the same */
+	for(i = 0; i < 2; i++) {
+		Object* x = json(i ? "[{\"k\": 1, \"l\": 2}]" : "[{\"k\": 2, \"l\": 1}]", 0);
+		Object* y = json("[{\"l\": 1, \"k\": 2}]", 0);
+		expect(objectDeepEquals(x, y) == !i);
+		expect((objectHash(x) == objectHash(y)) == !i);
+		objectDestroy(x);
+		objectDestroy(y);
+	}
+
+	objectDestroy(a);
+	objectDestroy(b);
+}
+
+static void test_objectDeepEqualsScalars(void)
+{
+	Object* values[] = {
+		newLong(1), newDouble(1.0), newString("ab"), newBytes("ab", 2), newBool(0), newNull(),
+	};
+	size_t n = sizeof(values) / sizeof(values[0]), i, j;
+
+	/* no two types are equal, even with the same value */
+	for(i = 0; i < n; i++) {
+		for(j = 0; j < n; j++)
+			expect(objectDeepEquals(values[i], values[j]) == (i == j));
+	}
+
+	Object* zero = newDouble(0.0);
+	Object* negative = newDouble(-0.0);
+	expect(same(zero, negative));
+	objectDestroy(zero);
+	objectDestroy(negative);
+
+	/* cached string hashes are kept by copies */
+	Object* s = newString("ab");
+	expect(objectHash(s) == objectHash(values[2]));
+	Object* t = copyObject(s);
+	expect(same(s, t));
+	objectDestroy(s);
+	s = newStringStatic("ab", 2);
+	expect(objectHash(s) == objectHash(t));
+	objectDestroy(s);
+	objectDestroy(t);
+
+	expect(objectValueCompare(values[4], values[4]));
+	for(i = 0; i < n; i++)
+		objectDestroy(values[i]);
+}
+
+int main(void)
+{
+	test_objectDeepEquals();
+	test_objectDeepEqualsScalars();
+	return 0;
+}
@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <object.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "test_common.h"
+
+#define THREADS 4
+#define TREES 200
+
+static Object* records(long n)
+{
+	Object* o = newArray(n);
+	char name[32];
+	long i;
+
+	for(i = 0; i < n; i++) {
+		Object* record = newMap(4);
+		snprintf(name, sizeof(name), "record %ld", i);
+		mapInsertEx(record, "id", newLong(i));
+		mapInsertEx(record, "name", newString(name));
+		arrayPushEx(o, record);
+	}
+	return o;
+}
+
+static void* producer(void* arg)
+{
+	long i;
+	(void)arg;
+
+	for(i = 0; i < TREES; i++)
+		objectDestroyAsync(records(50));
+	return NULL;
+}
+
+static void test_objectDestroyAsync(void)
+{
+	ObjectAsyncStats stats;
+	pthread_t threads[THREADS];
+	Object* shared;
+	long i;
+
+	objectDestroyAsync(records(2000));
+	objectDestroyAsyncDrain();
+	objectDestroyAsyncStats(&stats);
+	expect(stats.queued == 0 && stats.pending_bytes == 0);
+	expect(stats.reclaimed == 1);
+	expect(stats.reclaimed_bytes > 2000 * 3 * sizeof(Object));
+
+	/* small trees and references that are not the last never queue */
+	objectDestroyAsync(newLong(1));
+	shared = objectFreeze(records(100));
+	objectRetain(shared);
+	objectDestroyAsync(shared);
+	expect(O_REFCNT(shared) == 1);
+	objectDestroyAsync(shared);
+	objectDestroyAsyncDrain();
+	objectDestroyAsyncStats(&stats);
+	expect(stats.reclaimed == 2);
+
+	/* over the limit the caller does the work */
+	objectDestroyAsyncLimit(1);
+	objectDestroyAsync(records(2000));
+	objectDestroyAsyncStats(&stats);
+	expect(stats.overflowed == 1 && stats.reclaimed == 2);
+
+	/* a limit of 0 destroys in place without counting an overflow */
+	objectDestroyAsyncLimit(0);
+	objectDestroyAsync(records(2000));
+	objectDestroyAsyncStats(&stats);
+	expect(stats.overflowed == 1 && stats.reclaimed == 2 && stats.queued == 0);
+	objectDestroyAsyncLimit((size_t)64 << 20);
+
+	for(i = 0; i < THREADS; i++)
+		pthread_create(&threads[i], NULL, producer, NULL);
+	for(i = 0; i < THREADS; i++)
+		pthread_join(threads[i], NULL);
+	objectDestroyAsyncDrain();
+	objectDestroyAsyncStats(&stats);
+	expect(stats.reclaimed + stats.overflowed == 3 + THREADS * TREES);
+	expect(stats.queued == 0 && stats.pending_bytes == 0);
+}
+
+int main(void)
+{
+	test_objectDestroyAsync();
+	return 0;
+}
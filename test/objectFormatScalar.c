@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <object.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <math.h>
+
+#include "test_common.h"
+
+static int formats_as(double value, const char* text)
+{
+	char buffer[OBJECT_SCALAR_BUFFER_SIZE];
+	size_t n = formatDouble(value, buffer);
+	return n == strlen(text) && str_equal(buffer, text);
+}
+
+static void test_formatDouble(void)
+{
+	expect(formats_as(0.1, "0.1"));
+	expect(formats_as(0.3, "0.3"));
+	expect(formats_as(1.5, "1.5"));
+	expect(formats_as(-2.0, "-2"));
+	expect(formats_as(0.0, "0"));
+	expect(formats_as(-0.0, "-0"));
+	expect(formats_as(123456.789, "123456.789"));
+	expect(formats_as(1e20, "100000000000000000000"));
+	expect(formats_as(1e21, "1e+21"));
+	expect(formats_as(0.000001, "0.000001"));
+	expect(formats_as(1e-7, "1e-7"));
+	expect(formats_as(5e-324, "5e-324"));
+	expect(formats_as(1.7976931348623157e308, "1.7976931348623157e+308"));
+	expect(formats_as(2.2250738585072014e-308, "2.2250738585072014e-308"));
+	/* 17 digits where %.15G loses the value */
+	expect(formats_as(0.1 + 0.2, "0.30000000000000004"));
+	expect(formats_as(9007199254740993.0, "9007199254740992"));
+	expect(formats_as(NAN, "NaN"));
+	expect(formats_as(-INFINITY, "-Infinity"));
+}
+
+static void test_formatLong(void)
+{
+	char buffer[OBJECT_SCALAR_BUFFER_SIZE];
+
+	expect(formatLong(0, buffer) == 1 && str_equal(buffer, "0"));
+	expect(formatLong(7, buffer) == 1 && str_equal(buffer, "7"));
+	expect(formatLong(-10, buffer) == 3 && str_equal(buffer, "-10"));
+	expect(formatLong(1234567, buffer) == 7 && str_equal(buffer, "1234567"));
+	formatLong(LONG_MAX, buffer);
+	char expected[OBJECT_SCALAR_BUFFER_SIZE];
+	snprintf(expected, sizeof(expected), "%ld", LONG_MAX);
+	expect(str_equal(buffer, expected));
+	formatLong(LONG_MIN, buffer);
+	snprintf(expected, sizeof(expected), "%ld", LONG_MIN);
+	expect(str_equal(buffer, expected));
+}
+
+static void test_objectFormatScalar(void)
+{
+	char buffer[OBJECT_SCALAR_BUFFER_SIZE];
+	Object* values[] = { newNull(), newBool(1), newBool(0), newLong(-42), newDouble(2.5) };
+	const char* texts[] = { "null", "true", "false", "-42", "2.5" };
+	size_t i;
+
+	for(i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+		expect(objectFormatScalar(values[i], buffer) == strlen(texts[i]));
+		expect(str_equal(buffer, texts[i]));
+
+		char* text = objectToString(values[i]);
+		expect(str_equal(text, texts[i]));
+		free(text);
+		objectDestroy(values[i]);
+	}
+
+	Object* s = newString("x");
+	expect(objectFormatScalar(s, buffer) == 0);
+	objectDestroy(s);
+}
+
+static void test_objectToJsonNumbers(void)
+{
+	Object* list = newArray(4);
+	size_t length;
+
+	arrayPushEx(list, newDouble(0.1));
+	arrayPushEx(list, newDouble(1e300));
+	arrayPushEx(list, newDouble(NAN));
+	arrayPushEx(list, newLong(LONG_MIN));
+
+	char* text = objectToJson(list, 0, &length);
+	expect(text != NULL);
+	expect(strstr(text, "[0.1,1e+300,null,-") == text);
+	free(text);
+	objectDestroy(list);
+}
+
+int main(void)
+{
+	test_formatDouble();
+	test_formatLong();
+	test_objectFormatScalar();
+	test_objectToJsonNumbers();
+	return 0;
+}
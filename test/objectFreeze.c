@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <object.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "test_common.h"
+
+#define THREADS 8
+
+static const char config[] =
+	"{\"name\": \"service\", \"limits\": {\"rps\": 100, \"burst\": 2.5},"
+	" \"hosts\": [\"a.example\", \"b.example\", \"\\u00e9t\\u00e9\"],"
+	" \"flags\": [true, false, null]}";
+
+static Object* json(const char* text)
+{
+	return objectFromJson(text, strlen(text), 0, NULL);
+}
+
+static void* reader(void* arg)
+{
+	Object* shared = arg;
+	Object* hosts;
+	long ok = 1;
+	int i;
+
+	for(i = 0; i < 2000; i++) {
+		Object* o = objectRetain(shared);
+		hosts = mapSearchEx(o, "hosts");
+		ok &= O_LVAL(mapSearchEx(mapSearchEx(o, "limits"), "rps")) == 100;
+		ok &= stringCodePointLength(arrayGetEx(hosts, 2)) == 3;
+		ok &= objectHash(o) == objectHash(shared);
+		char* text = objectToJson(o, 0, NULL);
+		ok &= text != NULL;
+		free(text);
+		objectDestroy(o);
+	}
+	return (void*)ok;
+}
+
+static void test_objectFreeze(void)
+{
+	Object* o = objectFromJson(config, strlen(config), OBJECT_JSON_LAZY, NULL);
+	Object* hosts;
+	Object* value = newLong(1);
+
+	expect(!objectIsFrozen(o));
+	expect(objectFreeze(o) == o);
+	expect(objectIsFrozen(o));
+	hosts = mapSearchEx(o, "hosts");
+	expect(objectIsFrozen(hosts) && objectIsFrozen(arrayGetEx(hosts, 0)));
+
+	/* every mutator refuses a frozen object */
+	expect(mapInsert(o, "extra", value) == 0);
+	expect(mapInsertEx(o, "extra", value) == 0);
+	expect(arrayPush(hosts, value) == 0);
+	expect(arrayPushEx(hosts, value) == 0);
+	mapDelete(o, "name");
+	arraySort(hosts);
+	expect(mapSize(o) == 4 && arraySize(hosts) == 3);
+	expect(str_equal(O_SVAL(arrayGetEx(hosts, 0))->value, "a.example"));
+	objectDestroy(value);
+
+	/* patches put an edited copy in place of a frozen document */
+	Object* doc = objectRetain(o);
+	Object* patch = json("{\"name\": null, \"limits\": {\"rps\": 5}}");
+	expect(objectMergePatch(&doc, patch));
+	expect(doc != o && !objectIsFrozen(doc) && mapSize(doc) == 3);
+	expect(O_LVAL(mapSearchEx(mapSearchEx(doc, "limits"), "rps")) == 5);
+	objectDestroy(patch);
+	patch = json("[{\"op\": \"remove\", \"path\": \"/hosts/0\"}]");
+	objectDestroy(doc);
+	doc = objectRetain(o);
+	expect(objectApplyPatch(&doc, patch));
+	expect(doc != o && arraySize(mapSearchEx(doc, "hosts")) == 2);
+	objectDestroy(doc);
+	objectDestroy(patch);
+	expect(mapSize(o) == 4 && arraySize(hosts) == 3);
+	expect(O_LVAL(mapSearchEx(mapSearchEx(o, "limits"), "rps")) == 100);
+
+	/* a copy can be edited again */
+	Object* copy = copyObject(o);
+	expect(!objectIsFrozen(copy) && !objectIsFrozen(mapSearchEx(copy, "hosts")));
+	expect(mapInsertEx(copy, "extra", newNull()) != 0);
+	expect(arrayPushEx(mapSearchEx(copy, "hosts"), newNull()) != 0);
+	expect(mapSize(copy) == 5);
+	objectDestroy(copy);
+
+	objectDestroy(o);
+}
+
+static void test_objectFreezeDeep(void)
+{
+	Object* root = newArray(1);
+	Object* inner = root;
+	Object* value = newNull();
+	long i;
+
+	/* far deeper than the C stack would allow a level per call */
+	for(i = 0; i < 200000; i++) {
+		Object* next = i % 2 ? newArray(1) : newMap(1);
+		if(O_TYPE(inner) == IS_ARRAY)
+			arrayPushEx(inner, next);
+		else
+			mapInsertEx(inner, "k", next);
+		inner = next;
+	}
+	arrayPushEx(inner, newString("leaf"));
+
+	expect(objectFreeze(root) == root);
+	expect(objectIsFrozen(inner) && objectIsFrozen(arrayGetEx(inner, 0)));
+	expect(arrayPushEx(inner, value) == 0);
+	objectDestroy(value);
+	objectDestroy(root);
+}
+
+static void test_objectFreezeThreads(void)
+{
+	Object* o = objectFreeze(json(config));
+	pthread_t threads[THREADS];
+	void* ok;
+	int i;
+
+	for(i = 0; i < THREADS; i++)
+		pthread_create(&threads[i], NULL, reader, o);
+	for(i = 0; i < THREADS; i++) {
+		pthread_join(threads[i], &ok);
+		expect(ok != NULL);
+	}
+
+	/* the last holder frees it, whichever thread that is */
+	Object* limits = objectRetain(mapSearchEx(o, "limits"));
+	objectDestroy(o);
+	expect(O_DVAL(mapSearchEx(limits, "burst")) == 2.5);
+	objectDestroy(limits);
+}
+
+int main(void)
+{
+	test_objectFreeze();
+	test_objectFreezeDeep();
+	test_objectFreezeThreads();
+	return 0;
+}
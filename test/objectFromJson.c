@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <object.h>
+#include <stdlib.h>
+#include <limits.h>
+
+#include "test_common.h"
+
+static Object* parse(const char* text)
+{
+	return objectFromJson(text, strlen(text), 0, NULL);
+}
+
+static void test_objectFromJson(void)
+{
+	const char* text = "{\"name\": \"libobject\", \"tags\": [\"c\", \"json\"],"
+		" \"version\": 3, \"ratio\": 0.5, \"stable\": true, \"parent\": null}";
+	Object* o = parse(text);
+
+	expect(o != NULL);
+	expect(O_TYPE(o) == IS_MAP);
+	expect(mapSize(o) == 6);
+	expect(str_equal(O_SVAL(mapSearchEx(o, "name"))->value, "libobject"));
+	expect(O_LVAL(mapSearchEx(o, "version")) == 3);
+	expect(O_DVAL(mapSearchEx(o, "ratio")) == 0.5);
+	expect(O_TYPE(mapSearchEx(o, "stable")) == IS_BOOL);
+	expect(O_TYPE(mapSearchEx(o, "parent")) == IS_NULL);
+
+	Object* tags = mapSearchEx(o, "tags");
+	expect(O_TYPE(tags) == IS_ARRAY);
+	expect(arraySize(tags) == 2);
+	expect(str_equal(O_SVAL(arrayGetEx(tags, 1))->value, "json"));
+
+	objectDestroy(o);
+}
+
+static void test_objectFromJsonScalars(void)
+{
+	Object* o = parse("[0, -12, 9223372036854775807, -9223372036854775808,"
+		" 9223372036854775808, 1e3, -2.5E-1, \"\"]");
+
+	expect(o != NULL);
+	expect(arraySize(o) == 8);
+	expect(O_TYPE(arrayGetEx(o, 0)) == IS_LONG && O_LVAL(arrayGetEx(o, 0)) == 0);
+	expect(O_LVAL(arrayGetEx(o, 1)) == -12);
+	expect(O_LVAL(arrayGetEx(o, 2)) == LONG_MAX);
+	expect(O_LVAL(arrayGetEx(o, 3)) == LONG_MIN);
+	/* out of range integers fall back to Double */
+	expect(O_TYPE(arrayGetEx(o, 4)) == IS_DOUBLE);
+	expect(O_DVAL(arrayGetEx(o, 5)) == 1000.0);
+	expect(O_DVAL(arrayGetEx(o, 6)) == -0.25);
+	expect(O_SVAL(arrayGetEx(o, 7))->length == 0);
+	objectDestroy(o);
+
+	o = parse("  42 ");
+	expect(o != NULL && O_LVAL(o) == 42);
+	objectDestroy(o);
+}
+
+static void test_objectFromJsonStrings(void)
+{
+	Object* o = parse("[\"a\\\"b\\\\c\\/\\n\", \"\\u00e9\\u20ac\", \"\\ud83d\\ude00\", \"x\\u0000y\"]");
+
+	expect(o != NULL);
+	expect(str_equal(O_SVAL(arrayGetEx(o, 0))->value, "a\"b\\c/\n"));
+	expect(str_equal(O_SVAL(arrayGetEx(o, 1))->value, "\xc3\xa9\xe2\x82\xac"));
+	expect(str_equal(O_SVAL(arrayGetEx(o, 2))->value, "\xf0\x9f\x98\x80"));
+	expect(O_SVAL(arrayGetEx(o, 3))->length == 3);
+	expect(O_SVAL(arrayGetEx(o, 3))->value[1] == '\0');
+	objectDestroy(o);
+
+	/* escaped quotes across the 64 byte blocks of the structural scan */
+	char text[200];
+	memset(text, ' ', sizeof(text));
+	text[0] = '[';
+	text[60] = '"';
+	memcpy(text + 61, "\\\\\\\"", 4);
+	text[65] = '"';
+	memcpy(text + 66, ",\"]\"]", 5);
+	o = objectFromJson(text, 71, 0, NULL);
+	expect(o != NULL);
+	expect(arraySize(o) == 2);
+	expect(str_equal(O_SVAL(arrayGetEx(o, 0))->value, "\\\""));
+	expect(str_equal(O_SVAL(arrayGetEx(o, 1))->value, "]"));
+	objectDestroy(o);
+}
+
+static void test_objectFromJsonDuplicateKeys(void)
+{
+	Object* o = parse("{\"a\": [1], \"b\": 2, \"a\": 3}");
+
+	expect(o != NULL);
+	expect(mapSize(o) == 2);
+	expect(O_LVAL(mapSearchEx(o, "a")) == 3);
+	objectDestroy(o);
+}
+
+static void test_objectFromJsonErrors(void)
+{
+	ObjectJsonError err;
+
+	expect(objectFromJson("{\"a\": 1,\n \"b\" 2}", 16, 0, &err) == NULL);
+	expect(err.offset == 14);
+	expect(err.line == 2);
+	expect(err.column == 6);
+	expect(str_equal(err.message, "expected ':'"));
+
+	expect(objectFromJson("", 0, 0, &err) == NULL);
+	expect(objectFromJson("[1,]", 4, 0, &err) == NULL);
+	expect(err.offset == 3);
+	expect(objectFromJson("[1 2]", 5, 0, &err) == NULL);
+	expect(objectFromJson("01", 2, 0, &err) == NULL);
+	expect(objectFromJson("truex", 5, 0, &err) == NULL);
+	expect(objectFromJson("\"abc", 4, 0, &err) == NULL);
+	expect(objectFromJson("\"a\tb\"", 5, 0, &err) == NULL);
+	expect(objectFromJson("\"\\ud800\"", 8, 0, &err) == NULL);
+	expect(objectFromJson("\"\\x\"", 4, 0, &err) == NULL);
+	expect(objectFromJson("{} {}", 5, 0, &err) == NULL);
+	expect(err.offset == 3);
+
+	/* invalid UTF-8 is rejected unless the caller vouches for it */
+	expect(objectFromJson("\"\xc3\x28\"", 4, 0, &err) == NULL);
+	Object* o = objectFromJson("\"\xc3\x28\"", 4, OBJECT_JSON_NO_UTF8_CHECK, &err);
+	expect(o != NULL);
+	objectDestroy(o);
+}
+
+static void test_objectFromJsonDepth(void)
+{
+	size_t depth = OBJECT_JSON_MAX_DEPTH + 1;
+	char* text = malloc(depth * 2);
+	ObjectJsonError err;
+
+	memset(text, '[', depth);
+	memset(text + depth, ']', depth);
+	expect(objectFromJson(text, depth * 2, 0, &err) == NULL);
+	expect(str_equal(err.message, "nesting too deep"));
+
+	Object* o = objectFromJson(text + 1, (depth - 1) * 2, 0, &err);
+	expect(o != NULL);
+	objectDestroy(o);
+	free(text);
+}
+
+/*
+ * Doubles come back as Doubles, integral ones included
+ */
+static void test_objectFromJsonRoundTrip(void)
+{
+	static const double values[] = { 2.0, -2.0, 1e15, 0.5, 1e21 };
+	static const char* texts[] = { "[2.0]", "[-2.0]", "[1000000000000000.0]", "[0.5]", "[1e+21]" };
+	size_t i;
+
+	for(i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+		Object* original = newArray(1);
+		Object* parsed;
+		char* text;
+
+		arrayPushEx(original, newDouble(values[i]));
+		text = objectToJson(original, 0, NULL);
+		expect(str_equal(text, texts[i]));
+		parsed = parse(text);
+		expect(O_TYPE(arrayGetEx(parsed, 0)) == IS_DOUBLE);
+		expect(objectDeepEquals(original, parsed));
+		free(text);
+		objectDestroy(parsed);
+		objectDestroy(original);
+	}
+}
+
+int main(void)
+{
+	test_objectFromJson();
+	test_objectFromJsonScalars();
+	test_objectFromJsonStrings();
+	test_objectFromJsonDuplicateKeys();
+	test_objectFromJsonErrors();
+	test_objectFromJsonDepth();
+	test_objectFromJsonRoundTrip();
+	return 0;
+}
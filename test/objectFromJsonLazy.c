@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <object.h>
+#include <stdlib.h>
+
+#include "test_common.h"
+
+static const char doc[] =
+	"{\"name\": \"caf\\u00e9\",\n"
+	"  \"list\": [1, -2, 3.25, true, null, [], {}],\n"
+	"  \"nested\": {\"a\": {\"b\": [\"c\", {\"d\": 1e3}]}}}";
+
+static Object* lazy(const char* text)
+{
+	return objectFromJson(text, strlen(text), OBJECT_JSON_LAZY, NULL);
+}
+
+static void test_objectFromJsonLazy(void)
+{
+	Object* o = lazy(doc);
+	Object* eager = objectFromJson(doc, strlen(doc), 0, NULL);
+	char* text;
+	char* expected;
+
+	expect(o != NULL && O_TYPE(o) == IS_MAP);
+	expect(str_equal(O_SVAL(mapSearchEx(o, "name"))->value, "caf\xc3\xa9"));
+
+	Object* list = mapSearchEx(o, "list");
+	expect(O_TYPE(list) == IS_ARRAY && arraySize(list) == 7);
+	expect(O_LVAL(arrayGetEx(list, 1)) == -2);
+	expect(O_DVAL(arrayGetEx(list, 2)) == 3.25);
+	expect(arraySize(arrayGetEx(list, 5)) == 0);
+	expect(mapSize(arrayGetEx(list, 6)) == 0);
+	expect(arrayGetEx(list, 7) == NULL);
+
+	/* untouched containers are copied from the source, less white space */
+	text = objectToJson(mapSearchEx(o, "nested"), 0, NULL);
+	expect(str_equal(text, "{\"a\":{\"b\":[\"c\",{\"d\":1e3}]}}"));
+	free(text);
+
+	/* loading everything gives what a full parse does */
+	text = objectToJson(o, OBJECT_JSON_PRETTY, NULL);
+	expected = objectToJson(eager, OBJECT_JSON_PRETTY, NULL);
+	expect(str_equal(text, expected));
+	free(text);
+	free(expected);
+
+	objectDestroy(o);
+	objectDestroy(eager);
+}
+
+static void test_objectFromJsonLazyEdit(void)
+{
+	Object* o = lazy("[{\"a\": [1, 2]}, {\"b\": 2}]");
+	Object* copy = copyObject(o);
+	Object* first = arrayGetEx(o, 0);
+	char* text;
+
+	/* the copy loads separately and sees none of the edits */
+	mapInsertEx(first, "c", newLong(3));
+	mapDelete(first, "a");
+	arrayPushEx(o, newString("x"));
+	text = objectToJson(o, 0, NULL);
+	expect(str_equal(text, "[{\"c\":3},{\"b\":2},\"x\"]"));
+	free(text);
+	objectDestroy(o);
+
+	text = objectToJson(copy, 0, NULL);
+	expect(str_equal(text, "[{\"a\":[1,2]},{\"b\":2}]"));
+	free(text);
+	expect(O_LVAL(arrayGetEx(mapSearchEx(arrayGetEx(copy, 0), "a"), 1)) == 2);
+	objectDestroy(copy);
+
+	/* destroyed without ever being read */
+	objectDestroy(lazy("{\"a\": {\"b\": [1]}}"));
+
+	/* scalar documents are not deferred */
+	o = lazy(" \"str\" ");
+	expect(O_TYPE(o) == IS_STRING && str_equal(O_SVAL(o)->value, "str"));
+	objectDestroy(o);
+}
+
+/*
+ * numbers past the double range are null whether or not the node was loaded
+ */
+static void test_objectFromJsonLazyOverflow(void)
+{
+	/* numbers in range keep their spelling until loaded */
+	static const char* cases[][3] = {
+		{ "[1e+3020,{\"a\":[-1e400,2,1e308]}]",
+			"[null,{\"a\":[null,2,1e308]}]", "[null,{\"a\":[null,2,1e+308]}]" },
+		{ "[1e+3020, {\"a\": [-1e400, 2, 1e308]}]",
+			"[null,{\"a\":[null,2,1e308]}]", "[null,{\"a\":[null,2,1e+308]}]" },
+		{ "[2, {\"a\": [-1e400, 1e+3020]}]",
+			"[2,{\"a\":[null,null]}]", "[2,{\"a\":[null,null]}]" },
+	};
+	size_t i;
+
+	for(i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		Object* o = lazy(cases[i][0]);
+		Object* eager = objectFromJson(cases[i][0], strlen(cases[i][0]), 0, NULL);
+		char* text = objectToJson(o, 0, NULL);
+		char* expected = objectToJson(eager, 0, NULL);
+
+		expect(str_equal(text, cases[i][1]));
+		expect(str_equal(expected, cases[i][2]));
+		free(text);
+		free(expected);
+		objectDestroy(o);
+		objectDestroy(eager);
+	}
+}
+
+static void test_objectFromJsonLazyErrors(void)
+{
+	static const char* bad[] = {
+		"{\"a\": [1, 2}", "[1, \"\\x\"]", "{\"a\" 1}", "[1] 2", "[\"\xff\"]", "{\"a\": tru}", "[",
+	};
+	size_t i;
+
+	/* the whole text is checked up front, with the same errors */
+	for(i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+		ObjectJsonError e1, e2;
+		expect(objectFromJson(bad[i], strlen(bad[i]), 0, &e1) == NULL);
+		expect(objectFromJson(bad[i], strlen(bad[i]), OBJECT_JSON_LAZY, &e2) == NULL);
+		expect(str_equal(e1.message, e2.message) && e1.offset == e2.offset);
+	}
+}
+
+int main(void)
+{
+	test_objectFromJsonLazy();
+	test_objectFromJsonLazyEdit();
+	test_objectFromJsonLazyOverflow();
+	test_objectFromJsonLazyErrors();
+	return 0;
+}
@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <object.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "test_common.h"
+
+#define ELEMENTS 100000
+#define CALLERS 4
+
+static Object* numbers(long n)
+{
+	Object* o = newArray(n);
+	long i;
+
+	for(i = 0; i < n; i++)
+		arrayPushEx(o, newLong(i));
+	return o;
+}
+
+static void sum(void* context, size_t index, const char* key, Object* value)
+{
+	(void)key;
+	/* every element lands exactly once, at its own index */
+	if(O_LVAL(value) == (long)index)
+		__atomic_add_fetch((long*)context, O_LVAL(value), __ATOMIC_RELAXED);
+}
+
+static void sum_map(void* context, size_t index, const char* key, Object* value)
+{
+	(void)index;
+	if(atol(key + 1) == O_LVAL(value))
+		__atomic_add_fetch((long*)context, O_LVAL(value), __ATOMIC_RELAXED);
+}
+
+static void sum_nested(void* context, size_t index, const char* key, Object* value)
+{
+	(void)index;
+	(void)key;
+	objectParallelForEach(value, sum, context, 16);
+}
+
+static Object* square(void* context, size_t index, Object* value)
+{
+	(void)context;
+	(void)index;
+	return newLong(O_LVAL(value) * O_LVAL(value));
+}
+
+static Object* fail_at(void* context, size_t index, Object* value)
+{
+	if(index == *(size_t*)context)
+		return NULL;
+	return newLong(O_LVAL(value));
+}
+
+static int even(void* context, size_t index, Object* value)
+{
+	(void)context;
+	(void)index;
+	return O_LVAL(value) % 2 == 0;
+}
+
+static Object* add(void* context, Object* left, Object* right)
+{
+	(void)context;
+	return newLong(O_LVAL(left) + O_LVAL(right));
+}
+
+static Object* concat(void* context, Object* left, Object* right)
+{
+	char buf[256];
+	(void)context;
+	snprintf(buf, sizeof(buf), "%s%s", O_SVAL(left)->value, O_SVAL(right)->value);
+	return newString(buf);
+}
+
+static void test_objectParallelForEach(void)
+{
+	Object* array = numbers(ELEMENTS);
+	Object* map = newMap(64);
+	Object* nested = newArray(8);
+	long total = 0, i;
+	char key[32];
+
+	expect(objectParallelForEach(array, sum, &total, 0));
+	expect(total == (long)ELEMENTS * (ELEMENTS - 1) / 2);
+	total = 0;
+	expect(objectParallelForEach(array, sum, &total, 1));
+	expect(total == (long)ELEMENTS * (ELEMENTS - 1) / 2);
+
+	for(i = 0; i < 5000; i++) {
+		snprintf(key, sizeof(key), "k%ld", i);
+		mapInsertEx(map, key, newLong(i));
+	}
+	total = 0;
+	expect(objectParallelForEach(map, sum_map, &total, 0));
+	expect(total == 5000L * 4999 / 2);
+
+	for(i = 0; i < 8; i++)
+		arrayPushEx(nested, numbers(1000));
+	total = 0;
+	expect(objectParallelForEach(nested, sum_nested, &total, 1));
+	expect(total == 8 * 1000L * 999 / 2);
+
+	objectDestroy(nested);
+	nested = newArray(1);
+	total = 0;
+	expect(objectParallelForEach(nested, sum, &total, 0) && total == 0);
+	objectDestroy(map);
+	map = newLong(1);
+	expect(!objectParallelForEach(map, sum, &total, 0));
+
+	objectDestroy(array);
+	objectDestroy(map);
+	objectDestroy(nested);
+}
+
+static void test_arrayMapFilterReduce(void)
+{
+	Object* array = numbers(ELEMENTS);
+	Object* words = newArray(8);
+	Object* result;
+	size_t at = 777;
+	long i, ok = 1;
+
+	result = arrayMap(array, square, NULL, 0);
+	expect(arraySize(result) == ELEMENTS);
+	for(i = 0; i < ELEMENTS; i++)
+		ok &= O_LVAL(arrayGetEx(result, i)) == i * i;
+	expect(ok);
+	objectDestroy(result);
+	expect(arrayMap(array, fail_at, &at, 10) == NULL);
+
+	result = arrayFilter(array, even, NULL, 0);
+	expect(arraySize(result) == ELEMENTS / 2);
+	for(i = 0; i < ELEMENTS / 2; i++)
+		ok &= arrayGetEx(result, i) == arrayGetEx(array, 2 * i);
+	expect(ok);
+	objectDestroy(result);
+
+	result = arrayReduce(array, add, NULL, 0);
+	expect(O_LVAL(result) == (long)ELEMENTS * (ELEMENTS - 1) / 2);
+	objectDestroy(result);
+	result = arrayReduce(array, add, NULL, 3);
+	expect(O_LVAL(result) == (long)ELEMENTS * (ELEMENTS - 1) / 2);
+	objectDestroy(result);
+
+	/* folded in order, whatever the chunks */
+	for(i = 0; i < 26; i++) {
+		char letter[2] = { (char)('a' + i), 0 };
+		arrayPushEx(words, newString(letter));
+	}
+	for(i = 1; i <= 27; i++) {
+		result = arrayReduce(words, concat, NULL, i);
+		expect(str_equal(O_SVAL(result)->value, "abcdefghijklmnopqrstuvwxyz"));
+		objectDestroy(result);
+	}
+
+	objectDestroy(words);
+	words = newArray(1);
+	expect(arrayReduce(words, add, NULL, 0) == NULL);
+	arrayPushEx(words, newLong(5));
+	result = arrayReduce(words, add, NULL, 0);
+	expect(result == arrayGetEx(words, 0) && O_REFCNT(result) == 2);
+	objectDestroy(result);
+	objectDestroy(words);
+	objectDestroy(array);
+}
+
+static int first_even(void* context, size_t index, Object* value)
+{
+	(void)context;
+	(void)index;
+	return O_LVAL(arrayGetEx(value, 0)) % 2 == 0;
+}
+
+static void test_objectParallelLazy(void)
+{
+	const char* json = "[[0],[1],[2],[3],[4],[5],[6],[7],[8],[9]]";
+	Object* doc = objectFromJson(json, strlen(json), OBJECT_JSON_LAZY, NULL);
+	Object* result = arrayFilter(doc, first_even, NULL, 1);
+
+	expect(arraySize(result) == 5);
+	expect(O_LVAL(arrayGetEx(arrayGetEx(result, 4), 0)) == 8);
+	objectDestroy(result);
+	objectDestroy(doc);
+}
+
+static void* caller(void* arg)
+{
+	Object* array = arg;
+	Object* result = arrayReduce(array, add, NULL, 0);
+	long ok = O_LVAL(result) == (long)ELEMENTS * (ELEMENTS - 1) / 2;
+
+	objectDestroy(result);
+	return (void*)ok;
+}
+
+static void test_objectParallelCallers(void)
+{
+	Object* array = numbers(ELEMENTS);
+	pthread_t threads[CALLERS];
+	void* ok;
+	long i;
+
+	objectFreeze(array);
+	for(i = 0; i < CALLERS; i++)
+		pthread_create(&threads[i], NULL, caller, array);
+	for(i = 0; i < CALLERS; i++) {
+		pthread_join(threads[i], &ok);
+		expect(ok != NULL);
+	}
+	objectDestroy(array);
+}
+
+int main(void)
+{
+	test_objectParallelForEach();
+	test_arrayMapFilterReduce();
+	test_objectParallelLazy();
+	test_objectParallelCallers();
+	return 0;
+}
@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <object.h>
+#include <stdlib.h>
+
+#include "test_common.h"
+
+static Object* json(const char* text)
+{
+	return objectFromJson(text, strlen(text), 0, NULL);
+}
+
+/*
+ * apply patch to document and compare the result with expected, or expect
+ * the patch to fail when expected is NULL
+ */
+static int patched(const char* document, const char* patch, const char* expected)
+{
+	Object* o = json(document);
+	Object* p = json(patch);
+	int ok = objectApplyPatch(&o, p);
+
+	if(expected == NULL) {
+		ok = !ok;
+	} else {
+		Object* e = json(expected);
+		ok = ok && objectDeepEquals(o, e);
+		objectDestroy(e);
+	}
+	objectDestroy(o);
+	objectDestroy(p);
+	return ok;
+}
+
+static int merged(const char* document, const char* patch, const char* expected)
+{
+	Object* o = json(document);
+	Object* p = json(patch);
+	Object* e = json(expected);
+	int ok = objectMergePatch(&o, p) && objectDeepEquals(o, e);
+
+	objectDestroy(o);
+	objectDestroy(p);
+	objectDestroy(e);
+	return ok;
+}
+
+static void test_objectApplyPatch(void)
+{
+	/* from RFC 6902 appendix A */
+	expect(patched("{\"foo\":\"bar\"}",
+		"[{\"op\":\"add\",\"path\":\"/baz\",\"value\":\"qux\"}]",
+		"{\"foo\":\"bar\",\"baz\":\"qux\"}"));
+	expect(patched("{\"foo\":[\"bar\",\"baz\"]}",
+		"[{\"op\":\"add\",\"path\":\"/foo/1\",\"value\":\"qux\"}]",
+		"{\"foo\":[\"bar\",\"qux\",\"baz\"]}"));
+	expect(patched("{\"foo\":[\"bar\",\"qux\",\"baz\"]}",
+		"[{\"op\":\"remove\",\"path\":\"/foo/1\"}]",
+		"{\"foo\":[\"bar\",\"baz\"]}"));
+	expect(patched("{\"foo\":[\"bar\"]}",
+		"[{\"op\":\"add\",\"path\":\"/foo/-\",\"value\":[\"abc\",\"def\"]}]",
+		"{\"foo\":[\"bar\",[\"abc\",\"def\"]]}"));
+	expect(patched("{\"foo\":{\"bar\":\"baz\",\"waldo\":\"fred\"},\"qux\":{\"corge\":\"grault\"}}",
+		"[{\"op\":\"move\",\"from\":\"/foo/waldo\",\"path\":\"/qux/thud\"},"
+		"{\"op\":\"remove\",\"path\":\"/foo\"},{\"op\":\"remove\",\"path\":\"/qux/corge\"}]",
+		"{\"qux\":{\"thud\":\"fred\"}}"));
+	expect(patched("{\"foo\":[\"all\",\"grass\",\"cows\",\"eat\"]}",
+		"[{\"op\":\"move\",\"from\":\"/foo/1\",\"path\":\"/foo/3\"}]",
+		"{\"foo\":[\"all\",\"cows\",\"eat\",\"grass\"]}"));
+	expect(patched("{\"/\":1,\"m~n\":8}",
+		"[{\"op\":\"test\",\"path\":\"/m~0n\",\"value\":8},"
+		"{\"op\":\"replace\",\"path\":\"/~1\",\"value\":[null]},{\"op\":\"remove\",\"path\":\"/m~0n\"}]",
+		"{\"/\":[null]}"));
+	expect(patched("[1,{\"a\":2}]",
+		"[{\"op\":\"copy\",\"from\":\"/1\",\"path\":\"/0\"},{\"op\":\"replace\",\"path\":\"/0/a\",\"value\":3}]",
+		"[{\"a\":3},1,{\"a\":2}]"));
+	expect(patched("{\"a\":1}", "[{\"op\":\"replace\",\"path\":\"\",\"value\":[2]}]", "[2]"));
+	expect(patched("[]", "[]", "[]"));
+
+	/* errors */
+	expect(patched("{\"baz\":\"qux\"}", "[{\"op\":\"add\",\"path\":\"/baz/bat\",\"value\":\"qux\"}]", NULL));
+	expect(patched("{\"foo\":\"bar\"}", "[{\"op\":\"test\",\"path\":\"/foo\",\"value\":1}]", NULL));
+	expect(patched("[1]", "[{\"op\":\"add\",\"path\":\"/2\",\"value\":2}]", NULL));
+	expect(patched("[1]", "[{\"op\":\"add\",\"path\":\"/01\",\"value\":2}]", NULL));
+	expect(patched("[1]", "[{\"op\":\"replace\",\"path\":\"/-\",\"value\":2}]", NULL));
+	expect(patched("{}", "[{\"op\":\"replace\",\"path\":\"/a\",\"value\":2}]", NULL));
+	expect(patched("{}", "[{\"op\":\"remove\",\"path\":\"/a\"}]", NULL));
+	expect(patched("{\"a\":{}}", "[{\"op\":\"move\",\"from\":\"/a\",\"path\":\"/a/b\"}]", NULL));
+	expect(patched("{\"a\":1}", "[{\"op\":\"move\",\"from\":\"/a\",\"path\":\"/x/y\"}]", NULL));
+	expect(patched("{}", "[{\"op\":\"frob\",\"path\":\"\"}]", NULL));
+	expect(patched("{}", "[{\"op\":\"add\",\"path\":\"/a\"}]", NULL));
+	expect(patched("{}", "[{\"op\":\"add\",\"path\":\"/~2\",\"value\":1}]", NULL));
+	expect(patched("{}", "{}", NULL));
+
+	/* a failed move puts the value back */
+	expect(patched("{\"a\":1}",
+		"[{\"op\":\"add\",\"path\":\"/b\",\"value\":2},{\"op\":\"move\",\"from\":\"/a\",\"path\":\"/x/y\"}]",
+		NULL));
+	Object* o = json("{\"a\":1}");
+	Object* p = json("[{\"op\":\"move\",\"from\":\"/a\",\"path\":\"/x/y\"}]");
+	expect(!objectApplyPatch(&o, p));
+	expect(O_LVAL(mapSearchEx(o, "a")) == 1);
+	objectDestroy(o);
+	objectDestroy(p);
+}
+
+static void test_objectMergePatch(void)
+{
+	/* from RFC 7396 */
+	expect(merged("{\"title\":\"Goodbye!\",\"author\":{\"givenName\":\"John\",\"familyName\":\"Doe\"},"
+		"\"tags\":[\"example\",\"sample\"],\"content\":\"This will be unchanged\"}",
+		"{\"title\":\"Hello!\",\"phoneNumber\":\"+01-123-456-7890\",\"author\":{\"familyName\":null},"
+		"\"tags\":[\"example\"]}",
+		"{\"title\":\"Hello!\",\"author\":{\"givenName\":\"John\"},\"tags\":[\"example\"],"
+		"\"content\":\"This will be unchanged\",\"phoneNumber\":\"+01-123-456-7890\"}"));
+	expect(merged("{\"a\":\"b\"}", "{\"a\":\"c\"}", "{\"a\":\"c\"}"));
+	expect(merged("{\"a\":\"b\"}", "{\"b\":\"c\"}", "{\"a\":\"b\",\"b\":\"c\"}"));
+	expect(merged("{\"a\":\"b\"}", "{\"a\":null}", "{}"));
+	expect(merged("{\"a\":\"b\",\"b\":\"c\"}", "{\"a\":null}", "{\"b\":\"c\"}"));
+	expect(merged("{\"a\":[\"b\"]}", "{\"a\":\"c\"}", "{\"a\":\"c\"}"));
+	expect(merged("{\"a\":\"c\"}", "{\"a\":[\"b\"]}", "{\"a\":[\"b\"]}"));
+	expect(merged("{\"a\":{\"b\":\"c\"}}", "{\"a\":{\"b\":\"d\",\"c\":null}}", "{\"a\":{\"b\":\"d\"}}"));
+	expect(merged("{\"a\":[{\"b\":\"c\"}]}", "{\"a\":[1]}", "{\"a\":[1]}"));
+	expect(merged("[\"a\",\"b\"]", "[\"c\",\"d\"]", "[\"c\",\"d\"]"));
+	expect(merged("{\"a\":\"b\"}", "[\"c\"]", "[\"c\"]"));
+	expect(merged("{\"a\":\"foo\"}", "null", "null"));
+	expect(merged("{\"e\":null}", "{\"a\":1}", "{\"e\":null,\"a\":1}"));
+	expect(merged("[1,2]", "{\"a\":\"b\",\"c\":null}", "{\"a\":\"b\"}"));
+	expect(merged("{}", "{\"a\":{\"bb\":{\"ccc\":null}}}", "{\"a\":{\"bb\":{}}}"));
+
+	/* members the patch does not name are left where they are */
+	Object* o = json("{\"keep\":{\"x\":1},\"edit\":{\"y\":2}}");
+	Object* keep = mapSearchEx(o, "keep");
+	Object* edit = mapSearchEx(o, "edit");
+	Object* p = json("{\"edit\":{\"z\":3}}");
+	expect(objectMergePatch(&o, p));
+	expect(mapSearchEx(o, "keep") == keep && mapSearchEx(o, "edit") == edit);
+	expect(mapSize(edit) == 2);
+	objectDestroy(o);
+	objectDestroy(p);
+}
+
+static void test_objectDiff(void)
+{
+	static const char* pairs[][2] = {
+		{ "{\"a\":1,\"b\":[1,2,3],\"c\":{\"d\":\"e\"}}", "{\"a\":1,\"b\":[1,3],\"c\":{\"d\":\"f\",\"g\":null}}" },
+		{ "[1,2,3,4,5]", "[1,2,9,3,4,5]" },
+		{ "[1,2,3,4,5]", "[0]" },
+		{ "[]", "[[],{}]" },
+		{ "{\"a/b\":1,\"~\":2}", "{\"a/b\":2}" },
+		{ "{\"a\":1}", "[1]" },
+		{ "1", "1.0" },
+		{ "{\"x\":[{\"a\":1},{\"b\":2}]}", "{\"x\":[{\"a\":1,\"c\":0},{\"b\":3}]}" },
+	};
+	size_t i;
+
+	for(i = 0; i < sizeof(pairs) / sizeof(pairs[0]); i++) {
+		Object* from = json(pairs[i][0]);
+		Object* to = json(pairs[i][1]);
+		Object* patch = objectDiff(from, to);
+		expect(patch != NULL);
+		expect(objectApplyPatch(&from, patch));
+		expect(objectDeepEquals(from, to));
+		objectDestroy(from);
+		objectDestroy(to);
+		objectDestroy(patch);
+	}
+
+	/* the smallest change is named */
+	Object* from = json("{\"big\":[1,2,3,4,5,6,7,8],\"n\":{\"m\":1}}");
+	Object* to = json("{\"big\":[1,2,3,4,0,5,6,7,8],\"n\":{\"m\":2}}");
+	Object* patch = objectDiff(from, to);
+	char* text = objectToJson(patch, 0, NULL);
+	expect(arraySize(patch) == 2);
+	expect(strstr(text, "\"path\":\"/big/4\"") != NULL && strstr(text, "\"path\":\"/n/m\"") != NULL);
+	free(text);
+	objectDestroy(patch);
+
+	patch = objectDiff(from, from);
+	expect(arraySize(patch) == 0);
+	objectDestroy(patch);
+	objectDestroy(from);
+	objectDestroy(to);
+}
+
+int main(void)
+{
+	test_objectApplyPatch();
+	test_objectMergePatch();
+	test_objectDiff();
+	return 0;
+}
@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <object.h>
+#include <stdlib.h>
+
+#include "test_common.h"
+
+static const char doc[] =
+	"{\"store\": {\"items\": [{\"name\": \"a\", \"price\": 1},"
+	" {\"name\": \"b\", \"price\": 2}, {\"name\": \"c\", \"price\": 3},"
+	" {\"name\": \"d\", \"price\": 4, \"extra\": {\"price\": 5}}],"
+	" \"odd key\": true}}";
+
+static size_t eval(Object* o, const char* expression, Object** results, size_t max)
+{
+	ObjectPath* path = objectPathCompile(expression);
+	size_t n;
+
+	expect(path != NULL);
+	n = objectPathEval(path, o, results, max);
+	objectPathFree(path);
+	return n;
+}
+
+/*
+ * the prices an expression selects, in order, as "1,2,"
+ */
+static int prices(Object* o, const char* expression, const char* expected)
+{
+	Object* results[16];
+	char text[64] = "";
+	size_t n = eval(o, expression, results, 16), i;
+
+	for(i = 0; i < n; i++)
+		snprintf(text + strlen(text), sizeof(text) - strlen(text), "%ld,", O_LVAL(results[i]));
+	return str_equal(text, expected);
+}
+
+static void test_objectPath(void)
+{
+	Object* o = objectFromJson(doc, strlen(doc), 0, NULL);
+	Object* items = mapSearchEx(mapSearchEx(o, "store"), "items");
+	Object* results[8];
+	ObjectPath* path;
+
+	expect(prices(o, "$.store.items[*].price", "1,2,3,4,"));
+	expect(prices(o, "$['store'][\"items\"][1].price", "2,"));
+	expect(prices(o, "$.store.items[-1].price", "4,"));
+	expect(prices(o, "$.store.items[1:3].price", "2,3,"));
+	expect(prices(o, "$.store.items[::2].price", "1,3,"));
+	expect(prices(o, "$.store.items[::-1].price", "4,3,2,1,"));
+	expect(prices(o, "$.store.items[-2:].price", "3,4,"));
+	expect(prices(o, "$.store.items[ 5 : 0 : -2 ].price", "4,2,"));
+	expect(prices(o, "$.store.items[9].price", ""));
+	expect(prices(o, "$.store.items[3].extra.price", "5,"));
+
+	/* recursive descent visits a node before what is under it */
+	expect(prices(o, "$..price", "1,2,3,4,5,"));
+	expect(prices(o, "$.store..items[0].price", "1,"));
+	expect(eval(o, "$..[0]", results, 8) == 1 && results[0] == arrayGetEx(items, 0));
+	expect(eval(o, "$.store.*", NULL, 0) == 2);
+	expect(eval(o, "$['odd key']", NULL, 0) == 0);
+	expect(eval(o, "$.store['odd key']", results, 1) == 1 && O_TYPE(results[0]) == IS_BOOL);
+
+	/* results beyond max are counted but not stored */
+	results[2] = NULL;
+	expect(eval(o, "$..name", results, 2) == 4 && results[2] == NULL);
+	expect(eval(o, "$", results, 1) == 1 && results[0] == o);
+
+	path = objectPathCompile("$.store.items[*].name");
+	expect(objectPathGet(path, o) == mapSearchEx(arrayGetEx(items, 0), "name"));
+	expect(objectPathGet(path, items) == NULL);
+	objectPathFree(path);
+	objectDestroy(o);
+}
+
+static void test_objectPathLazy(void)
+{
+	Object* o = objectFromJson(doc, strlen(doc), OBJECT_JSON_LAZY, NULL);
+
+	expect(prices(o, "$.store.items[*].price", "1,2,3,4,"));
+	expect(prices(o, "$..extra..price", "5,"));
+	objectDestroy(o);
+}
+
+static void test_objectPathErrors(void)
+{
+	static const char* bad[] = {
+		"", "store", "$.", "$..", "$[", "$[1", "$['a]", "$[a]", "$[::0]", "$x", "$[1:2:]x",
+		"$[99999999999999999999]",
+	};
+	size_t i;
+
+	for(i = 0; i < sizeof(bad) / sizeof(bad[0]); i++)
+		expect(objectPathCompile(bad[i]) == NULL);
+}
+
+int main(void)
+{
+	test_objectPath();
+	test_objectPathLazy();
+	test_objectPathErrors();
+	return 0;
+}
@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <object.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "test_common.h"
+
+static char path[] = "/tmp/objectSnapshotXXXXXX";
+
+static int write_snapshot(Object* o)
+{
+	int fd = open(path, O_WRONLY | O_TRUNC);
+	int ok;
+
+	expect(fd >= 0);
+	ok = objectSnapshotWrite(o, fd);
+	close(fd);
+	return ok;
+}
+
+static void test_objectSnapshot(void)
+{
+	static const char json[] =
+		"{\"name\": \"caf\xc3\xa9\", \"list\": [1, -2, 3.25, true, null, [], {}],"
+		" \"nested\": {\"a\": {\"b\": [\"c\"]}}}";
+	Object* doc = objectFromJson(json, strlen(json), 0, NULL);
+	ObjectSnapshot* s;
+	ObjectSnapshotRef root, list, ref;
+	size_t length, i;
+	char key[16];
+
+	Object* first = newLong(7);
+	Object* second = newBytes("\x00\x01", 2);
+	mapInsertEx(doc, "pair", newPair(first, second));
+	objectDestroy(first);
+	objectDestroy(second);
+	for(i = 0; i < 100; i++) {
+		snprintf(key, sizeof(key), "k%zu", i);
+		mapInsertEx(doc, key, newLong(i));
+	}
+	expect(write_snapshot(doc));
+
+	s = objectSnapshotOpen(path);
+	expect(s != NULL);
+	root = snapshotRoot(s);
+	expect(snapshotType(s, root) == IS_MAP);
+	expect(snapshotSize(s, root) == 104);
+
+	ref = snapshotMapSearch(s, root, "name", 4);
+	expect(snapshotType(s, ref) == IS_STRING);
+	expect(str_equal(snapshotString(s, ref, &length), "caf\xc3\xa9") && length == 5);
+
+	list = snapshotMapSearch(s, root, "list", 4);
+	expect(snapshotType(s, list) == IS_ARRAY && snapshotSize(s, list) == 7);
+	expect(snapshotLong(s, snapshotArrayGet(s, list, 1)) == -2);
+	expect(snapshotDouble(s, snapshotArrayGet(s, list, 2)) == 3.25);
+	expect(snapshotType(s, snapshotArrayGet(s, list, 3)) == IS_BOOL);
+	expect(snapshotLong(s, snapshotArrayGet(s, list, 3)) == 1);
+	expect(snapshotType(s, snapshotArrayGet(s, list, 4)) == IS_NULL);
+	expect(snapshotSize(s, snapshotArrayGet(s, list, 6)) == 0);
+	expect(snapshotArrayGet(s, list, 7) == 0);
+	expect(snapshotType(s, 0) == -1);
+
+	for(i = 0; i < 100; i++) {
+		snprintf(key, sizeof(key), "k%zu", i);
+		expect(snapshotLong(s, snapshotMapSearch(s, root, key, strlen(key))) == (long)i);
+	}
+	expect(snapshotMapSearch(s, root, "k100", 4) == 0);
+	expect(snapshotMapSearch(s, root, "nam", 3) == 0);
+	expect(snapshotMapSearch(s, list, "name", 4) == 0);
+
+	ref = snapshotMapSearch(s, root, "nested", 6);
+	ref = snapshotMapSearch(s, snapshotMapSearch(s, ref, "a", 1), "b", 1);
+	expect(str_equal(snapshotString(s, snapshotArrayGet(s, ref, 0), NULL), "c"));
+
+	ref = snapshotMapSearch(s, root, "pair", 4);
+	expect(snapshotType(s, ref) == IS_PAIR && snapshotSize(s, ref) == 2);
+	expect(snapshotLong(s, snapshotArrayGet(s, ref, 0)) == 7);
+	expect(snapshotType(s, snapshotArrayGet(s, ref, 1)) == IS_BYTES);
+
+	/* every key found by iteration leads back to its value */
+	for(i = 0; i < snapshotSize(s, root); i++) {
+		const char* name = snapshotMapKey(s, root, i, &length);
+		expect(snapshotMapSearch(s, root, name, length) == snapshotMapValue(s, root, i));
+	}
+
+	Object* back = snapshotToObject(s, root);
+	expect(back != NULL);
+	expect(objectJsonLength(back, 0) == objectJsonLength(doc, 0));
+	expect(str_equal(O_SVAL(mapSearchEx(back, "name"))->value, "caf\xc3\xa9"));
+	expect(O_LVAL(mapSearchEx(back, "k42")) == 42);
+	char* text = objectToJson(mapSearchEx(back, "list"), 0, NULL);
+	expect(str_equal(text, "[1,-2,3.25,true,null,[],{}]"));
+	free(text);
+	objectDestroy(back);
+
+	objectSnapshotClose(s);
+	objectDestroy(doc);
+}
+
+static void test_objectSnapshotErrors(void)
+{
+	Object* array = newArray(2);
+	ObjectSnapshot* s;
+	int fd;
+
+	arrayPushEx(array, newLong(1));
+	arrayPushEx(array, newFunction((void *)test_objectSnapshotErrors));
+	expect(!write_snapshot(array));
+	expect(objectSnapshotOpen(path) == NULL);
+	objectDestroy(array);
+
+	/* a truncated file is rejected */
+	array = newArray(1);
+	arrayPushEx(array, newString("abc"));
+	expect(write_snapshot(array));
+	expect(truncate(path, 40) == 0);
+	expect(objectSnapshotOpen(path) == NULL);
+	objectDestroy(array);
+
+	char junk[64];
+	memset(junk, 'x', sizeof(junk));
+	fd = open(path, O_WRONLY | O_TRUNC);
+	expect(write(fd, junk, sizeof(junk)) == sizeof(junk));
+	close(fd);
+	expect(objectSnapshotOpen(path) == NULL);
+
+	/* a scalar root */
+	array = newLong(-5);
+	expect(write_snapshot(array));
+	s = objectSnapshotOpen(path);
+	expect(s != NULL && snapshotLong(s, snapshotRoot(s)) == -5);
+	expect(snapshotSize(s, snapshotRoot(s)) == 0);
+	objectSnapshotClose(s);
+	objectDestroy(array);
+
+	expect(objectSnapshotOpen("/nonexistent/snapshot") == NULL);
+}
+
+int main(void)
+{
+	int fd = mkstemp(path);
+
+	expect(fd >= 0);
+	close(fd);
+	test_objectSnapshot();
+	test_objectSnapshotErrors();
+	unlink(path);
+	return 0;
+}
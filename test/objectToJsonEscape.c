@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <object.h>
+#include <stdlib.h>
+
+#include "test_common.h"
+
+static char* serialize(const char* value, size_t length, int flags)
+{
+	Object* s = newStringFromSequence(value, length);
+	char* text = objectToJson(s, flags, NULL);
+	expect(objectJsonLength(s, flags) == strlen(text));
+	objectDestroy(s);
+	return text;
+}
+
+static void expect_json(const char* value, int flags, const char* json)
+{
+	char* text = serialize(value, strlen(value), flags);
+	expect(str_equal(text, json));
+	free(text);
+}
+
+static void test_objectToJsonEscape(void)
+{
+	expect_json("plain", 0, "\"plain\"");
+	expect_json("a\"b\\c/d", 0, "\"a\\\"b\\\\c/d\"");
+	expect_json("\b\f\n\r\t", 0, "\"\\b\\f\\n\\r\\t\"");
+	expect_json("\x01\x1f\x7f", 0, "\"\\u0001\\u001f\x7f\"");
+
+	char* text = serialize("x\0y", 3, 0);
+	expect(str_equal(text, "\"x\\u0000y\""));
+	free(text);
+
+	/* UTF-8 passes through unless asked for ASCII */
+	expect_json("\xc3\xa9\xe2\x82\xac", 0, "\"\xc3\xa9\xe2\x82\xac\"");
+	expect_json("\xc3\xa9\xe2\x82\xac", OBJECT_JSON_ASCII, "\"\\u00e9\\u20ac\"");
+	expect_json("\xf0\x9f\x98\x80", OBJECT_JSON_ASCII, "\"\\ud83d\\ude00\"");
+	expect_json("a\xc3(\xed\xa0\x80", OBJECT_JSON_ASCII,
+		"\"a\\ufffd(\\ufffd\\ufffd\\ufffd\"");
+}
+
+static void test_objectToJsonEscapeKeys(void)
+{
+	Object* map = newMap(2);
+
+	mapInsertEx(map, "new\nline", newLong(1));
+	char* text = objectToJson(map, 0, NULL);
+	expect(str_equal(text, "{\"new\\nline\":1}"));
+	free(text);
+	objectDestroy(map);
+}
+
+/*
+ * long strings with a byte to escape at every offset, so each one lands
+ * inside, between and after the vector blocks
+ */
+static void test_objectToJsonEscapeRoundTrip(void)
+{
+	static const char special[] = "\"\\\n\x01\xc3\xa9";
+	char value[200];
+	size_t i, k;
+	int flags;
+
+	for(flags = 0; flags <= OBJECT_JSON_ASCII; flags += OBJECT_JSON_ASCII) {
+		for(i = 0; i < sizeof(value) - 2; i++) {
+			for(k = 0; k < sizeof(special) - 1; k++) {
+				size_t length = i + 2;
+				memset(value, 'a', length);
+				if(special[k] == '\xc3')
+					memcpy(value + i, "\xc3\xa9", 2);
+				else if(special[k] == '\xa9')
+					continue;
+				else
+					value[i] = special[k];
+
+				char* text = serialize(value, length, flags);
+				Object* o = objectFromJson(text, strlen(text), 0, NULL);
+				expect(o != NULL);
+				expect(O_SVAL(o)->length == length);
+				expect(memcmp(O_SVAL(o)->value, value, length) == 0);
+				if(flags & OBJECT_JSON_ASCII) {
+					const char* p;
+					for(p = text; *p; p++)
+						expect((unsigned char)*p < 0x80);
+				}
+				objectDestroy(o);
+				free(text);
+			}
+		}
+	}
+}
+
+int main(void)
+{
+	test_objectToJsonEscape();
+	test_objectToJsonEscapeKeys();
+	test_objectToJsonEscapeRoundTrip();
+	return 0;
+}
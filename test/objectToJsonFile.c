@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <object.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "test_common.h"
+
+typedef struct Collected {
+	char*	value;
+	size_t	length;
+	size_t	calls;
+} Collected;
+
+static int collect(void* context, const char* data, size_t length)
+{
+	Collected* c = context;
+	c->value = realloc(c->value, c->length + length + 1);
+	memcpy(c->value + c->length, data, length);
+	c->length += length;
+	c->value[c->length] = '\0';
+	c->calls++;
+	return 1;
+}
+
+static int refuse(void* context, const char* data, size_t length)
+{
+	(void)context; (void)data; (void)length;
+	return 0;
+}
+
+/*
+ * large enough that every sink drains more than once
+ */
+static Object* sample(void)
+{
+	Object* root = newMap(4);
+	Object* list = newArray(4);
+	size_t i;
+
+	for(i = 0; i < 2000; i++) {
+		if(i % 3 == 0)
+			arrayPushEx(list, newLong((long)i * 1000003));
+		else if(i % 3 == 1)
+			arrayPushEx(list, newString("a string long enough to matter"));
+		else
+			arrayPushEx(list, newBytes("\x00\x01\x02\xff", 4));
+	}
+	mapInsertEx(root, "list", list);
+	mapInsertEx(root, "ratio", newDouble(0.25));
+	mapInsertEx(root, "ok", newBool(1));
+	mapInsertEx(root, "nothing", newNull());
+	return root;
+}
+
+static char* slurp(FILE* fp, size_t* length)
+{
+	long n;
+	fseek(fp, 0, SEEK_END);
+	n = ftell(fp);
+	rewind(fp);
+	char* text = malloc(n + 1);
+	expect(fread(text, 1, n, fp) == (size_t)n);
+	text[n] = '\0';
+	*length = n;
+	return text;
+}
+
+static void test_objectToJsonPretty(void)
+{
+	Object* map = newMap(2);
+	Object* list = newArray(2);
+	size_t length;
+
+	arrayPushEx(list, newLong(1));
+	mapInsertEx(map, "a", list);
+
+	char* text = objectToJson(map, OBJECT_JSON_PRETTY, &length);
+	expect(str_equal(text, "{\n  \"a\": [\n    1\n  ]\n}"));
+	expect(objectJsonLength(map, OBJECT_JSON_PRETTY) == length);
+	free(text);
+	objectDestroy(map);
+}
+
+static void test_objectToJsonSinks(void)
+{
+	int flags;
+
+	for(flags = 0; flags <= OBJECT_JSON_PRETTY; flags++) {
+		Object* o = sample();
+		size_t length, n;
+		char* text = objectToJson(o, flags, &length);
+
+		expect(text != NULL);
+		expect(length == strlen(text));
+		expect(length > 4 * 4096);
+		expect(objectJsonLength(o, flags) == length);
+
+		/* exact fit */
+		char* buffer = malloc(length + 1);
+		expect(objectToJsonBuffer(o, flags, buffer, length + 1) == length);
+		expect(str_equal(buffer, text));
+
+		/* truncated like snprintf */
+		expect(objectToJsonBuffer(o, flags, buffer, 100) == length);
+		expect(strlen(buffer) == 99);
+		expect(memcmp(buffer, text, 99) == 0);
+		expect(objectToJsonBuffer(o, flags, NULL, 0) == length);
+		free(buffer);
+
+		Collected c = { NULL, 0, 0 };
+		expect(objectToJsonCallback(o, flags, collect, &c));
+		expect(c.length == length);
+		expect(c.calls > 1);
+		expect(str_equal(c.value, text));
+		free(c.value);
+		expect(!objectToJsonCallback(o, flags, refuse, NULL));
+
+		FILE* fp = tmpfile();
+		expect(objectToJsonFile(o, flags, fp));
+		char* written = slurp(fp, &n);
+		expect(n == length && str_equal(written, text));
+		free(written);
+		fclose(fp);
+
+		fp = tmpfile();
+		expect(objectToJsonFd(o, flags, fileno(fp)));
+		written = slurp(fp, &n);
+		expect(n == length && str_equal(written, text));
+		free(written);
+		fclose(fp);
+
+		free(text);
+		objectDestroy(o);
+	}
+}
+
+static void test_objectToJsonUnsupported(void)
+{
+	Object* list = newArray(2);
+	size_t length = 1;
+	char buffer[16];
+
+	arrayPushEx(list, newPointer(list));
+	expect(objectToJson(list, 0, &length) == NULL);
+	expect(length == 0);
+	expect(objectJsonLength(list, 0) == 0);
+	expect(objectToJsonBuffer(list, 0, buffer, sizeof(buffer)) == 0);
+	objectDestroy(list);
+}
+
+int main(void)
+{
+	test_objectToJsonPretty();
+	test_objectToJsonSinks();
+	test_objectToJsonUnsupported();
+	return 0;
+}
@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <object.h>
+#include <stdlib.h>
+#include <limits.h>
+
+#include "test_common.h"
+
+static void expect_bytes(Object* o, const char* bytes, size_t n)
+{
+	size_t length;
+	char* data = objectToMsgpack(o, &length);
+
+	expect(data != NULL);
+	expect(length == n);
+	expect(objectMsgpackLength(o) == n);
+	expect(memcmp(data, bytes, n) == 0);
+	free(data);
+	objectDestroy(o);
+}
+
+static void test_objectToMsgpack(void)
+{
+	expect_bytes(newNull(), "\xc0", 1);
+	expect_bytes(newBool(1), "\xc3", 1);
+	expect_bytes(newBool(0), "\xc2", 1);
+	expect_bytes(newLong(0), "\x00", 1);
+	expect_bytes(newLong(127), "\x7f", 1);
+	expect_bytes(newLong(128), "\xcc\x80", 2);
+	expect_bytes(newLong(256), "\xcd\x01\x00", 3);
+	expect_bytes(newLong(65536), "\xce\x00\x01\x00\x00", 5);
+	expect_bytes(newLong(-1), "\xff", 1);
+	expect_bytes(newLong(-32), "\xe0", 1);
+	expect_bytes(newLong(-33), "\xd0\xdf", 2);
+	expect_bytes(newLong(-129), "\xd1\xff\x7f", 3);
+	expect_bytes(newLong(LONG_MIN), "\xd3\x80\x00\x00\x00\x00\x00\x00\x00", 9);
+	expect_bytes(newDouble(1.5), "\xcb\x3f\xf8\x00\x00\x00\x00\x00\x00", 9);
+	expect_bytes(newString("abc"), "\xa3" "abc", 4);
+	expect_bytes(newBytes("\x00\x01", 2), "\xc4\x02\x00\x01", 4);
+
+	/* newPair() copies its members */
+	Object* first = newLong(1);
+	Object* second = newNull();
+	expect_bytes(newPair(first, second), "\x92\x01\xc0", 3);
+	objectDestroy(first);
+	objectDestroy(second);
+
+	/* mapInsertEx() does not, the map owns the array */
+	Object* map = newMap(4);
+	mapInsertEx(map, "k", newArray(1));
+	expect_bytes(map, "\x81\xa1k\x90", 4);
+
+	char text[33];
+	memset(text, 'x', 32);
+	text[32] = '\0';
+	size_t length;
+	Object* string = newString(text);
+	char* data = objectToMsgpack(string, &length);
+	expect(length == 34 && memcmp(data, "\xd9\x20", 2) == 0);
+	free(data);
+	objectDestroy(string);
+
+	Object* array = newArray(16);
+	size_t i;
+	for(i = 0; i < 16; i++)
+		arrayPushEx(array, newLong(i));
+	data = objectToMsgpack(array, &length);
+	expect(length == 19 && memcmp(data, "\xdc\x00\x10\x00\x01", 5) == 0);
+	free(data);
+	objectDestroy(array);
+}
+
+static void test_objectToMsgpackErrors(void)
+{
+	Object* array = newArray(2);
+	char buffer[4];
+
+	arrayPushEx(array, newLong(1));
+	expect(objectToMsgpackBuffer(array, buffer, 1) == 2);
+	expect(objectToMsgpackBuffer(array, buffer, sizeof(buffer)) == 2);
+	expect(memcmp(buffer, "\x91\x01", 2) == 0);
+
+	arrayPushEx(array, newFunction((void *)test_objectToMsgpackErrors));
+	expect(objectMsgpackLength(array) == 0);
+	expect(objectToMsgpack(array, NULL) == NULL);
+	objectDestroy(array);
+}
+
+static void test_objectFromMsgpack(void)
+{
+	static const char json[] =
+		"{\"name\": \"caf\xc3\xa9\", \"list\": [1, -2, 3.25, true, null, [], {}],"
+		" \"big\": 4294967296, \"nested\": {\"a\": {\"b\": [\"c\"]}}}";
+	Object* doc = objectFromJson(json, strlen(json), 0, NULL);
+	size_t length, consumed;
+	char* data = objectToMsgpack(doc, &length);
+	Object* back = objectFromMsgpack(data, length, NULL);
+
+	/* map order may differ, so compare sizes and then members */
+	expect(back != NULL);
+	expect(objectJsonLength(back, 0) == objectJsonLength(doc, 0));
+	expect(str_equal(O_SVAL(mapSearchEx(back, "name"))->value, "caf\xc3\xa9"));
+	expect(O_LVAL(mapSearchEx(back, "big")) == 4294967296L);
+	Object* list = mapSearchEx(back, "list");
+	char* text = objectToJson(list, 0, NULL);
+	expect(str_equal(text, "[1,-2,3.25,true,null,[],{}]"));
+	free(text);
+	text = objectToJson(mapSearchEx(back, "nested"), 0, NULL);
+	expect(str_equal(text, "{\"a\":{\"b\":[\"c\"]}}"));
+	free(text);
+	objectDestroy(back);
+
+	/* trailing data is an error unless asked for the length */
+	data = realloc(data, length + 1);
+	data[length] = '\xc0';
+	expect(objectFromMsgpack(data, length + 1, NULL) == NULL);
+	back = objectFromMsgpack(data, length + 1, &consumed);
+	expect(back != NULL && consumed == length);
+	objectDestroy(back);
+
+	/* every truncation fails cleanly */
+	for(consumed = 0; consumed < length; consumed++)
+		expect(objectFromMsgpack(data, consumed, NULL) == NULL);
+	free(data);
+	objectDestroy(doc);
+
+	back = objectFromMsgpack("\xcf\xff\xff\xff\xff\xff\xff\xff\xff", 9, NULL);
+	expect(O_TYPE(back) == IS_DOUBLE && O_DVAL(back) == 18446744073709551615.0);
+	objectDestroy(back);
+	back = objectFromMsgpack("\xca\x3f\xc0\x00\x00", 5, NULL);
+	expect(O_TYPE(back) == IS_DOUBLE && O_DVAL(back) == 1.5);
+	objectDestroy(back);
+	back = objectFromMsgpack("\xc5\x00\x02\xff\x00", 5, NULL);
+	expect(O_TYPE(back) == IS_BYTES && O_BYVAL(back)->length == 2);
+	objectDestroy(back);
+
+	expect(objectFromMsgpack("\xd4\x01\x00", 3, NULL) == NULL);
+	expect(objectFromMsgpack("\x81\x01\x02", 3, NULL) == NULL);
+	expect(objectFromMsgpack("\xdd\xff\xff\xff\xff\x00", 6, NULL) == NULL);
+	expect(objectFromMsgpack("\xc1", 1, NULL) == NULL);
+	expect(objectFromMsgpack("", 0, NULL) == NULL);
+}
+
+int main(void)
+{
+	test_objectToMsgpack();
+	test_objectToMsgpackErrors();
+	test_objectFromMsgpack();
+	return 0;
+}
@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <object.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <math.h>
+
+#include "test_common.h"
+
+static double parse(const char* text, size_t expected)
+{
+	double d;
+	expect(parseDouble(text, strlen(text), &d) == expected);
+	return d;
+}
+
+static void test_parseNumberIntegers(void)
+{
+	Object* o;
+
+	expect(parseNumber("42", 2, &o) == 2);
+	expect(O_TYPE(o) == IS_LONG && O_LVAL(o) == 42);
+	objectDestroy(o);
+
+	/* stays exact above 2^53 */
+	expect(parseNumber("9007199254740993", 16, &o) == 16);
+	expect(O_TYPE(o) == IS_LONG && O_LVAL(o) == 9007199254740993L);
+	objectDestroy(o);
+
+	expect(parseNumber("-9223372036854775808", 20, &o) == 20);
+	expect(O_TYPE(o) == IS_LONG && O_LVAL(o) == LONG_MIN);
+	objectDestroy(o);
+
+	expect(parseNumber("+0000000000000000000000012", 26, &o) == 26);
+	expect(O_TYPE(o) == IS_LONG && O_LVAL(o) == 12);
+	objectDestroy(o);
+
+	/* overflow falls back to Double */
+	expect(parseNumber("9223372036854775808", 19, &o) == 19);
+	expect(O_TYPE(o) == IS_DOUBLE && O_DVAL(o) == 9223372036854775808.0);
+	objectDestroy(o);
+
+	expect(parseNumber("12.0", 4, &o) == 4);
+	expect(O_TYPE(o) == IS_DOUBLE && O_DVAL(o) == 12.0);
+	objectDestroy(o);
+
+	/* keeps its sign, so it is not a Long */
+	expect(parseNumber("-0", 2, &o) == 2);
+	expect(O_TYPE(o) == IS_DOUBLE && O_DVAL(o) == 0.0 && signbit(O_DVAL(o)));
+	objectDestroy(o);
+
+	expect(parseNumber("0", 1, &o) == 1);
+	expect(O_TYPE(o) == IS_LONG && O_LVAL(o) == 0);
+	objectDestroy(o);
+
+	expect(parseNumber("x", 1, &o) == 0);
+	expect(o == NULL);
+}
+
+static void test_parseNumberLength(void)
+{
+	Object* o;
+
+	/* reads no further than the length, and stops at the first non number byte */
+	expect(parseNumber("12345", 3, &o) == 3);
+	expect(O_LVAL(o) == 123);
+	objectDestroy(o);
+
+	expect(parseNumber("2.5e3,", 6, &o) == 5);
+	expect(O_DVAL(o) == 2500.0);
+	objectDestroy(o);
+
+	expect(parse("1e", 1) == 1.0);
+	expect(parse("1e+x", 1) == 1.0);
+	expect(parse("5.", 2) == 5.0);
+	expect(parse(".5", 2) == 0.5);
+	expect(parse(".", 0) == 0.0);
+	expect(parse("-", 0) == 0.0);
+}
+
+static void test_parseDouble(void)
+{
+	expect(parse("0.1", 3) == 0.1);
+	expect(parse("-2.5E-3", 7) == -2.5e-3);
+	expect(parse("1.7976931348623157e308", 22) == 1.7976931348623157e308);
+	expect(parse("2.2250738585072014e-308", 23) == 2.2250738585072014e-308);
+	expect(parse("4.9406564584124654e-324", 23) == 4.9406564584124654e-324);
+	expect(parse("1e-400", 6) == 0.0);
+
+	double inf = parse("1e400", 5);
+	expect(inf > 1.7976931348623157e308);
+	expect(parse("-Infinity", 9) == -inf);
+	expect(parse("inf", 3) == inf);
+	double nan = parse("NaN", 3);
+	expect(nan != nan);
+
+	/* halfway between 2^53 and 2^53 + 2 rounds to even, one digit past it up */
+	expect(parse("9007199254740993.0", 18) == 9007199254740992.0);
+	expect(parse("9007199254740993.00000000000000000000001", 40) == 9007199254740994.0);
+
+	/* more digits than the fast path holds */
+	expect(parse("0.1000000000000000055511151231257827021181583404541015625", 57) == 0.1);
+
+	/* exactly half the smallest subnormal rounds to even, a digit more rounds up */
+	static const char half[] =
+		"2.47032822920623272088284396434110686182529901307162382212792841"
+		"2503377536351043759326499181808179961898982823477228588654633283"
+		"5517796989819938739800539093906315035659515570226392290858392449"
+		"1051844359318028499365361525003193704576782492193656236698636584"
+		"8075700158576926990370631192827955855133292783433840935197801553"
+		"1246597263579574622766465272827220056374006485499977096599470454"
+		"0208281662262378573934507363390079677619305775067401763246736009"
+		"6895134053553745851666113422376667860416215968046191446729184030"
+		"0530057530849048765391711386591646239524912623653881879636239373"
+		"2804238910186723484976682350898633885879256283027559956575244555"
+		"0725518931369083625477918694866799496832404970582102851318545139"
+		"6213837722826145437693412532098591327667236328125";
+	char text[sizeof(half) + 8];
+	snprintf(text, sizeof(text), "%se-324", half);
+	expect(parse(text, strlen(text)) == 0.0);
+	snprintf(text, sizeof(text), "%s1e-324", half);
+	expect(parse(text, strlen(text)) == 4.9406564584124654e-324);
+}
+
+int main(void)
+{
+	test_parseNumberIntegers();
+	test_parseNumberLength();
+	test_parseDouble();
+	return 0;
+}
@@ -13,6 +13,9 @@ static void test_stringCat(void)
 	Object* full = stringCat(first, last);
 
 	expect(O_SVAL(full)->length == 14);
+	/* one block, like every other owned String */
+	expect(O_SVAL(full)->value == (char *)(O_SVAL(full) + 1));
+	expect(str_equal(O_SVAL(full)->value, "Ryan McCullagh"));
  
 	fprintf(stdout, "%s\n", O_SVAL(full)->value);
 
@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <object.h>
+#include <stdlib.h>
+
+#include "test_common.h"
+
+static void test_stringIndexOf(void)
+{
+	Object* haystack = newString("the quick brown fox jumps over the lazy dog, the end");
+	Object* the = newString("the");
+	Object* cat = newString("cat");
+	Object* dog = newString("dog");
+
+	expect(stringIndexOf(haystack, the) == 0);
+	expect(stringLastIndexOf(haystack, the) == 45);
+	expect(stringIndexOf(haystack, dog) == 40);
+	expect(stringIndexOf(haystack, cat) == STRING_NPOS);
+	expect(stringContains(haystack, dog));
+	expect(!stringContains(haystack, cat));
+	expect(stringCount(haystack, the) == 3);
+
+	objectDestroy(dog);
+	objectDestroy(cat);
+	objectDestroy(the);
+	objectDestroy(haystack);
+}
+
+static void test_stringIndexOfAdversarial(void)
+{
+	/* a^n b needle in a^m text defeats the first/last byte filter */
+	char text[5000];
+	char needle[100];
+	memset(text, 'a', sizeof(text));
+	memset(needle, 'a', sizeof(needle));
+	needle[sizeof(needle) - 1] = 'b';
+	text[4000] = 'b';
+
+	expect(byteSearch(text, sizeof(text), needle, sizeof(needle)) == 4000 - 99);
+	expect(byteSearchLast(text, sizeof(text), needle, sizeof(needle)) == 4000 - 99);
+	text[4000] = 'a';
+	expect(byteSearch(text, sizeof(text), needle, sizeof(needle)) == STRING_NPOS);
+	expect(byteSearchLast(text, sizeof(text), needle, sizeof(needle)) == STRING_NPOS);
+
+	/* embedded NUL bytes are searched like any other byte */
+	expect(byteSearch("ab\0cd\0ef", 8, "\0e", 2) == 5);
+}
+
+static void test_stringReplaceAll(void)
+{
+	Object* value = newString("a-b-c--d");
+	Object* dash = newString("-");
+	Object* arrow = newString("=>");
+	Object* empty = newString("");
+
+	Object* replaced = stringReplaceAll(value, dash, arrow);
+	expect(str_equal(O_SVAL(replaced)->value, "a=>b=>c=>=>d"));
+	objectDestroy(replaced);
+
+	replaced = stringReplaceAll(value, dash, empty);
+	expect(str_equal(O_SVAL(replaced)->value, "abcd"));
+	expect(O_SVAL(replaced)->length == 4);
+	objectDestroy(replaced);
+
+	objectDestroy(empty);
+	objectDestroy(arrow);
+	objectDestroy(dash);
+	objectDestroy(value);
+}
+
+static int collect(void* context, size_t pattern, size_t offset)
+{
+	size_t* found = context;
+	found[2 * found[0] + 1] = pattern;
+	found[2 * found[0] + 2] = offset;
+	found[0]++;
+	return 1;
+}
+
+static int first(void* context, size_t pattern, size_t offset)
+{
+	(void)pattern;
+	*(size_t*)context = offset;
+	return 0;
+}
+
+static void test_stringMatcher(void)
+{
+	Object* patterns = newArray(4);
+	Object* text = newString("ushers");
+	const char* words[] = { "he", "she", "his", "hers" };
+	size_t i;
+	for(i = 0; i < 4; i++) {
+		Object* word = newString(words[i]);
+		arrayPush(patterns, word);
+		objectDestroy(word);
+	}
+
+	StringMatcher* matcher = stringMatcherNew(patterns);
+	size_t found[16] = { 0 };
+	expect(stringMatcherScan(matcher, text, collect, found) == 3);
+	/* she@1, he@2, hers@2 */
+	expect(found[1] == 1 && found[2] == 1);
+	expect(found[3] == 0 && found[4] == 2);
+	expect(found[5] == 3 && found[6] == 2);
+	expect(stringMatcherScan(matcher, text, first, found) == 1);
+	expect(found[0] == 1);
+
+	stringMatcherFree(matcher);
+	objectDestroy(text);
+	objectDestroy(patterns);
+}
+
+int main(void)
+{
+
+	test_stringIndexOf();
+	test_stringIndexOfAdversarial();
+	test_stringReplaceAll();
+	test_stringMatcher();
+}